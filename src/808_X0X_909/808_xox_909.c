@@ -29,6 +29,8 @@
 #include "model.h"
 #include "controller.h"
 #include "ut3k_view.h"
+#include "ut3k_config.h"
+#include "ut3k_session.h"
 
 
 /** 808/909 drum machine
@@ -42,6 +44,11 @@
 #define EVENT_LOOP_DURATION_TIME_DEFAULT 10
 #define CONFIG_SOUND_LIST_KEY "sound_list"
 
+// steps are played this far behind the sequencer's timeline so the
+// mixer starts them on the exact frame, whenever in the 128th the loop
+// gets to them.  Covers the loop waking late and the controller's time.
+#define SEQUENCER_LOOKAHEAD_USEC 30000
+
 static uint32_t clock_iterations = 0, clock_overruns = 0; // count of iterations through event loop
 static struct model *model = NULL;
 static struct ut3k_view *view = NULL;
@@ -51,6 +58,7 @@ static struct controller *controller = NULL;
 void sig_cleanup_and_exit(int signum) {
   printf("caught sig %d.  Cleaning up and exiting.  Stats: %u clock ticks (%u overruns)\n",
 	 signum, clock_iterations, clock_overruns);
+  print_input_latency(view);
   ut3k_remove_all_samples();
   free_controller(controller);
   free_model(model);
@@ -72,7 +80,9 @@ static suseconds_t bpm_128th_to_useconds(int bpm) {
 }
 
 static void run_mvc(config_t *cfg, char ***sample_keys) {
-  struct timeval tval_controller_start, tval_controller_end, tval_controller_time, tval_fixed_loop_time, tval_sleep_time;
+  struct timeval tval_fixed_loop_time;
+  struct timespec now, wakeup;
+  uint64_t tick_ns, now_ns;
   int loop_time_ms;
   int bpm = 120;
 
@@ -95,6 +105,9 @@ static void run_mvc(config_t *cfg, char ***sample_keys) {
     return;
   }
 
+  // cabinet settings from ultratroninator.config
+  load_ut3k_config(cfg);
+
   view = create_alphanum_ut3k_view();
   if (view == NULL) {
     printf("error creating game view\n");
@@ -111,10 +124,14 @@ static void run_mvc(config_t *cfg, char ***sample_keys) {
   register_control_panel_listener(view, controller_callback_control_panel, controller);
 
   // init and hack:
-  // start with a sleep since the view does a read from the ht16k33
-  tval_sleep_time.tv_sec = 0;
-  tval_sleep_time.tv_usec = tval_fixed_loop_time.tv_usec;
-  
+  // start with a sleep since the view does a read from the ht16k33.
+  // After that each tick is at a fixed time on the sequencer's
+  // timeline, a 128th after the last, rather than a 128th after the
+  // previous tick finished: no drift, and jitter only in when a tick
+  // runs, not in when its steps play.
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  tick_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec + tval_fixed_loop_time.tv_usec * 1000ULL;
+
   signal(SIGINT, sig_cleanup_and_exit);
   signal(SIGTERM, sig_cleanup_and_exit);
 
@@ -122,36 +139,37 @@ static void run_mvc(config_t *cfg, char ***sample_keys) {
   while (1) {
     // do the usleep first, otherwise the game launch is delayed by way too long
 
-    if (tval_sleep_time.tv_sec == 0) {
-      // sleep for the fixed loop time minus the time for the controller
-      usleep(tval_sleep_time.tv_usec);
+    if (ut3k_session_is_replay()) {
+      // replaying a recorded session: run as fast as the model allows
     }
     else {
-       // this really shouldn't happen... loop takes <8 ms
-      clock_overruns++;
-      printf("controller took %ld.%06ld; this is longer than event loop of %ld.%06ld seconds\n", tval_controller_time.tv_sec, tval_controller_time.tv_usec, tval_fixed_loop_time.tv_sec, tval_fixed_loop_time.tv_usec);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      now_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+      if (now_ns > tick_ns + SEQUENCER_LOOKAHEAD_USEC * 1000ULL) {
+        // this really shouldn't happen... loop takes <8 ms.  Too late
+        // for the lookahead to cover: pick the timeline up from now.
+        clock_overruns++;
+        printf("tick %llu.%06llu late; more than the %d usec lookahead\n",
+               (unsigned long long) (now_ns - tick_ns) / 1000000000, (unsigned long long) (now_ns - tick_ns) / 1000 % 1000000,
+               SEQUENCER_LOOKAHEAD_USEC);
+        tick_ns = now_ns;
+      }
+      else if (now_ns < tick_ns) {
+        wakeup.tv_sec = tick_ns / 1000000000;
+        wakeup.tv_nsec = tick_ns % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+      }
     }
 
-    // should this function even exist or just rely on callback?
-    // could instead just make this a loop around update_view?
-    gettimeofday(&tval_controller_start, NULL);
-
-    bpm = controller_update(controller, clock_iterations);
+    bpm = controller_update(controller, clock_iterations, tick_ns + SEQUENCER_LOOKAHEAD_USEC * 1000ULL);
     tval_fixed_loop_time.tv_usec = bpm_128th_to_useconds(bpm);
 
     ut3k_pa_mainloop_iterate();
 
-    gettimeofday(&tval_controller_end, NULL);
-    // tval_controller_time is duration of controller_update
-    // tval_fixed_loop_time - tval_controller_time ==> time to sleep between iterations
-    timersub(&tval_controller_end, &tval_controller_start, &tval_controller_time);
-    timersub(&tval_fixed_loop_time, &tval_controller_time, &tval_sleep_time);
-
-
+    tick_ns += tval_fixed_loop_time.tv_usec * 1000ULL;
     clock_iterations++;
 
-    //printf("controller time: %ld.%06ld  sleep time avail: %ld.06%ld\n", tval_controller_time.tv_sec,tval_controller_time.tv_usec, tval_sleep_time.tv_sec,tval_sleep_time.tv_usec);
-
   }
 
 
@@ -247,7 +265,8 @@ int main(int argc, char **argv, char **envp) {
 
   cfg = (config_t*)malloc(sizeof(config_t));
 
-  srand(time(NULL));
+  // a replayed session brings its own seed
+  srand(ut3k_session_init(time(NULL)));
 
   config_init(cfg);
 
@@ -276,7 +295,9 @@ int main(int argc, char **argv, char **envp) {
   ut3k_new_audio_context();
  
   /* load audio specified from config */
+  ut3k_begin_sample_loading("808_xox_909");
   sample_keys = load_audio_from_config(cfg, games_directory);
+  ut3k_finish_sample_loading();
 
 
   /* everything setup, run the mvc in a loop --
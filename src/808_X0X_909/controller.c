@@ -30,6 +30,11 @@ struct controller {
 };
 
 
+// BPM goes from 50 to 240: a quick spin covers it in about a turn
+static const struct encoder_acceleration bpm_acceleration =
+  { .slow_detent_usec = 120000, .fast_detent_usec = 15000, .max_multiplier = 10 };
+
+
 /* start off with accurate front panel state */
 static void initialize_model_from_control_panel(struct controller *this, const struct control_panel *control_panel);
 
@@ -42,6 +47,7 @@ struct controller* create_controller(struct model *model, struct ut3k_view *view
   this->model = model;
   this->view = view;
 
+  set_encoder_acceleration(view, GREEN_ROTARY_ENCODER, &bpm_acceleration);
   initialize_model_from_control_panel(this, get_control_panel(view));
 
   return this;
@@ -54,16 +60,17 @@ void free_controller(struct controller *this) {
 
 /** controller_update:
  * do the thing and also return the current BPM to the caller.
- * This is expected to be called once every 128th note.
+ * This is expected to be called once every 128th note, with the time
+ * (CLOCK_MONOTONIC) that note should be heard.
  */
-int controller_update(struct controller *this, uint32_t clock) {
-  clocktick_model(this->model);
+int controller_update(struct controller *this, uint32_t clock, uint64_t step_ns) {
+  clocktick_model(this->model, step_ns);
 
   if (clock & 0b1) {
     update_controls(this->view, clock);
   }
 
-  update_displays(this->view, get_display_strategy(this->model), clock);
+  commit_ut3k_view(this->view, get_ut3k_display(this->model), clock);
 
   return get_bpm(this->model);
 }
@@ -93,8 +100,8 @@ void controller_callback_control_panel(const struct control_panel *control_panel
   const struct selector *blue_selector = get_blue_selector(control_panel);
 
 
-  if (green_rotary->encoder_delta != 0) {
-    change_bpm(this->model, green_rotary->encoder_delta);
+  if (green_rotary->accelerated_delta != 0) {
+    change_bpm(this->model, green_rotary->accelerated_delta);
   }
 
   // blue selector to change which sample is played
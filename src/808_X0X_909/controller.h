@@ -32,7 +32,7 @@ struct controller* create_controller(struct model*, struct ut3k_view*);
 void free_controller(struct controller *this);
 
 
-int controller_update(struct controller *this, uint32_t clock);
+int controller_update(struct controller *this, uint32_t clock, uint64_t step_ns);
 
 void controller_initialize_control_panel(struct control_panel *control_panel, void *userdata);
 void controller_callback_control_panel(const struct control_panel *control_panel, void *userdata);
@@ -26,6 +26,7 @@
 #include <ctype.h>
 
 #include "model.h"
+#include "ut3k_levels.h"
 #include "ut3k_pulseaudio.h"
 
 #define STEPS_IN_SEQUENCE 16
@@ -53,7 +54,7 @@ struct triggered_instrument {
 };
 
 struct model {
-  struct display_strategy *display_strategy;
+  struct ut3k_display ut3k_display;
 
   // allow for 16 instruments, packed into a 2 byte structure for each 16th note.
   // Each element of the array is a step in the sequence.
@@ -81,8 +82,10 @@ struct model {
 
 
 
-static struct display_strategy* create_display_strategy(struct model *this);
-static void free_display_strategy(struct display_strategy *display_strategy); 
+static void init_display(struct model *this);
+static void update_instrument_display(struct model *this);
+static void update_leds_display(struct model *this);
+static void update_meter_display(struct model *this);
 static int is_triggerable_step(uint8_t step, shuffle_t shuffle);
 
 
@@ -94,7 +97,6 @@ struct model* create_model(char ***sample_keys) {
   struct model* this = (struct model*)malloc(sizeof(struct model));
   *this = (struct model const)
     {
-     .display_strategy = create_display_strategy(this),
      .sequence = { 0 },
      .current_step = 0,
      .current_triggered_instrument_index = 0,
@@ -130,33 +132,37 @@ struct model* create_model(char ***sample_keys) {
   this->triggered_instruments[15].instrument->sample_name = NULL;
   this->triggered_instruments[15].instrument->display_name = "ACNT";
 
+  init_display(this);
 
   return this;
 }
 
 
 void free_model(struct model *this) {
-  free_display_strategy(this->display_strategy);
   return free(this);
 }
 
 
 
 
-void clocktick_model(struct model *this) {
+/** clocktick_model
+ *
+ * advance a 128th.  Instruments on the step play at step_ns, scheduled
+ * ahead with the mixer so they land on the beat.
+ */
+void clocktick_model(struct model *this, uint64_t step_ns) {
   int triggers_at_step;
 
   if (++this->current_step > 127) {
     this->current_step = 0;
   }
 
-  if (this->run_state == SEQUENCE_STOP) {
-    return;
-  }
+  // the step LED moves (or the stopped LED beats)
+  update_leds_display(this);
 
   // are we on a triggerable step?
   // if so, check what instruments should play on this step.
-  if (is_triggerable_step(this->current_step, this->shuffle)) {
+  if (this->run_state == SEQUENCE_RUN && is_triggerable_step(this->current_step, this->shuffle)) {
     // drop current_step down to a sixteenth note
     //triggers_at_step = this->sequence[step_map[this->current_step >> 3]];
     triggers_at_step = this->sequence[this->current_step >> 3];
@@ -166,11 +172,15 @@ void clocktick_model(struct model *this) {
       if ((triggers_at_step & (1 << triggered_instrument))) {
 	printf("playing instrument %d on step %d:\n", triggered_instrument+1, this->current_step >> 3);
 	if (this->triggered_instruments[triggered_instrument].instrument->sample_name != NULL) {
-	  ut3k_play_sample(this->triggered_instruments[triggered_instrument].instrument->sample_name);
+	  ut3k_play_sample_at(this->triggered_instruments[triggered_instrument].instrument->sample_name,
+			      ut3k_get_default_volume(), step_ns);
 	}
       }
     }
   }
+
+  // after the triggers so a hit shows on the tick it plays
+  update_meter_display(this);
 }
 
 
@@ -182,12 +192,14 @@ void toggle_run_state(struct model *this) {
   else {
     this->run_state = SEQUENCE_STOP;
   }
+  update_leds_display(this);
 }
 
 
 void set_bpm(struct model *this, int bpm) {
   if (bpm >= 50 && bpm <= 240) {
     this->bpm = bpm;
+    set_display_integer(&this->ut3k_display.displays[0], this->bpm);
   }
 }
 
@@ -197,13 +209,17 @@ int get_bpm(struct model *this) {
 }
 
 void change_bpm(struct model *this, int amount) {
-  this->bpm += amount;
-  if (this->bpm > 240) {
-    this->bpm = 240;
+  // in int: an accelerated spin would wrap the uint8_t
+  int bpm = this->bpm + amount;
+
+  if (bpm > 240) {
+    bpm = 240;
   }
-  else if (this->bpm < 50) {
-    this->bpm = 50;
+  else if (bpm < 50) {
+    bpm = 50;
   }
+  this->bpm = bpm;
+  set_display_integer(&this->ut3k_display.displays[0], this->bpm);
 }
 
 
@@ -219,6 +235,7 @@ void change_instrument(struct model *this, int amount) {
     this->current_triggered_instrument_index = 15;
   }
 
+  update_instrument_display(this);
 }
 
 
@@ -232,6 +249,7 @@ void change_instrument_sample(struct model *this, int sample_num) {
   // this is a completely horrid data structure
   this->triggered_instruments[this->current_triggered_instrument_index].instrument->sample_name = this->sample_keys[this->current_triggered_instrument_index][sample_num];
   this->triggered_instruments[this->current_triggered_instrument_index].instrument->display_name = this->sample_keys[this->current_triggered_instrument_index][sample_num];
+  update_instrument_display(this);
 }
 
 void toggle_current_triggered_instrument_at_step(struct model *this, int step) {
@@ -240,6 +258,7 @@ void toggle_current_triggered_instrument_at_step(struct model *this, int step) {
   int trigger_bitmask =
     this->triggered_instruments[this->current_triggered_instrument_index].trigger_bitmask;
   this->sequence[step] = this->sequence[step] ^ trigger_bitmask;
+  update_leds_display(this);
 
   printf("setting instr %s at step %d: 0x%X\n",
 	 this->triggered_instruments[this->current_triggered_instrument_index].instrument->sample_name,
@@ -249,10 +268,12 @@ void toggle_current_triggered_instrument_at_step(struct model *this, int step) {
 
 void set_trigger_at_step(struct model *this, int trigger_idx, int step) {
   this->sequence[step] |= STEP_NUM_TO_TRIGGER_BITMASK(trigger_idx);
+  update_leds_display(this);
 }
 
 void clear_trigger_at_step(struct model *this, int trigger_idx, int step) {
   this->sequence[step] &= (~ STEP_NUM_TO_TRIGGER_BITMASK(trigger_idx) );
+  update_leds_display(this);
 }
 
 
@@ -262,64 +283,72 @@ void set_shuffle(struct model *this, shuffle_t shuffle) {
 }
 
 
-// implements f_get_display for the red display
-display_type_t get_red_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
-  struct model *this = (struct model*) display_strategy->userdata;
+struct ut3k_display* get_ut3k_display(struct model *this) {
+  return &this->ut3k_display;
+}
 
-  //(*value).display_int = ...
 
-  (*value).display_string = "3";
-  *brightness = HT16K33_BRIGHTNESS_12;
-  *blink = HT16K33_BLINK_OFF;
-  return string_display;
-}
 
-// implements f_get_display for the blue display
-display_type_t get_blue_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
-  struct model *this = (struct model*) display_strategy->userdata;
+/* static ----------------------------------------------------------- */
 
-  (*value).display_string = this->triggered_instruments[this->current_triggered_instrument_index].instrument->display_name;
-  *blink = HT16K33_BLINK_OFF;
-  *brightness = HT16K33_BRIGHTNESS_12;
 
-  return string_display;
+/** init_display
+ *
+ * red shows a constant, green the bpm, blue the current instrument and
+ * the LEDs the sequence.  After this the displays only change along
+ * with the model.
+ */
+static void init_display(struct model *this) {
+  reset_ut3k_display(&this->ut3k_display);
+
+  for (int i = 0; i < 3; ++i) {
+    set_display_brightness(&this->ut3k_display.displays[i], HT16K33_BRIGHTNESS_12);
+  }
+  set_display_brightness(&this->ut3k_display.leds, HT16K33_BRIGHTNESS_12);
+
+  set_display_integer(&this->ut3k_display.displays[0], this->bpm);
+  set_display_string(&this->ut3k_display.displays[2], "3");
+  update_instrument_display(this);
+  update_leds_display(this);
 }
 
-// implements f_get_display for the green display
-display_type_t get_green_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
-  struct model *this = (struct model*) display_strategy->userdata;
 
-  (*value).display_int = this->bpm;
-  *blink = HT16K33_BLINK_OFF;
-  *brightness = HT16K33_BRIGHTNESS_12;
+static void update_instrument_display(struct model *this) {
+  set_display_string(&this->ut3k_display.displays[1], this->triggered_instruments[this->current_triggered_instrument_index].instrument->display_name);
 
-  return integer_display;
+  // the LEDs show the triggers of the current instrument
+  update_leds_display(this);
 }
 
 
-
 static const uint8_t green_led_offset = 16;
 static const uint8_t blue_led_offset = 8;
 
-// implements f_get_display for the leds display
-display_type_t get_leds_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
-  struct model *this = (struct model*) display_strategy->userdata;
+/** update_leds_display
+ *
+ * green and blue LEDs: the current step and the triggers for the
+ * current instrument.  The red LEDs are the VU meter.  set_*_leds
+ * only dirty the display on a change, which for the step LED is once
+ * every 16th note.
+ */
+static void update_leds_display(struct model *this) {
+  uint32_t leds;
 
   if (this->run_state == SEQUENCE_RUN) {
     // light one LED to show where the current step is in the 16 step sequence
     if (this->current_step < 64) {
       // start on the green display for steps 1 - 8
-      (*value).display_int = led_map[(this->current_step >> 3)] << green_led_offset;
+      leds = led_map[(this->current_step >> 3)] << green_led_offset;
     }
     else {
       // then move to blue display for steps 9 - 16
-      (*value).display_int = led_map[((this->current_step >> 3) - 8)] << blue_led_offset;
+      leds = led_map[((this->current_step >> 3) - 8)] << blue_led_offset;
     }
   }
   else {
     // we're stopped - keep the first LED going to the beat at the first
     // green LED
-    (*value).display_int = (this->current_step & 0b10000) ?
+    leds = (this->current_step & 0b10000) ?
       led_map[0] << green_led_offset : 0;
   }
 
@@ -328,63 +357,30 @@ display_type_t get_leds_display(struct display_strategy *display_strategy, displ
   // show the triggers for the current instrument
   for (int step = 0; step < 8; ++step) {
     if ((this->sequence[step] & trigger_bitmask)) {
-      (*value).display_int = (*value).display_int ^ (1 << (step_map[step] + green_led_offset));
+      leds = leds ^ (1 << (step_map[step] + green_led_offset));
     }
   }
   for (int step = 8; step < STEPS_IN_SEQUENCE; ++step) {
     if ((this->sequence[step] & trigger_bitmask)) {
-      (*value).display_int = (*value).display_int ^ (1 << step_map[step]);
+      leds = leds ^ (1 << step_map[step]);
       // no blue led offset since the steps are 8-15 here
     }
   }
 
-  // for the red LEDs:
-  /*
-  for (int step = 0; step < 8; ++step) {
-    if ((this->sequence[step] & trigger_bitmask)) {
-      (*value).display_int = (*value).display_int | (1 << step);
-    }
-  }
-  */
-
-  *blink = HT16K33_BLINK_OFF;
-  *brightness = HT16K33_BRIGHTNESS_12;
-
-  return integer_display;
+  set_green_leds(&this->ut3k_display.leds, (leds >> green_led_offset) & 0xFF);
+  set_blue_leds(&this->ut3k_display.leds, (leds >> blue_led_offset) & 0xFF);
 }
 
 
+/** update_meter_display
+ *
+ * red LEDs: master level of everything playing, with the peak.
+ */
+static void update_meter_display(struct model *this) {
+  struct ut3k_level level;
 
-struct display_strategy* get_display_strategy(struct model *this) {
-  return this->display_strategy;
-}
-
-
-
-/* static ----------------------------------------------------------- */
-
-
-static struct display_strategy* create_display_strategy(struct model *this) {
-  struct display_strategy *display_strategy;
-  display_strategy = (struct display_strategy*)malloc(sizeof(struct display_strategy));
-  display_strategy->userdata = (void*)this;
-  display_strategy->get_green_display = get_green_display;
-  display_strategy->green_blink = HT16K33_BLINK_OFF;
-  display_strategy->green_brightness = HT16K33_BRIGHTNESS_12;
-  display_strategy->get_blue_display = get_blue_display;
-  display_strategy->blue_blink = HT16K33_BLINK_OFF;
-  display_strategy->blue_brightness = HT16K33_BRIGHTNESS_12;
-  display_strategy->get_red_display = get_red_display;
-  display_strategy->red_blink = HT16K33_BLINK_OFF;
-  display_strategy->red_brightness = HT16K33_BRIGHTNESS_12;
-  display_strategy->get_leds_display = get_leds_display;
-  display_strategy->leds_blink = HT16K33_BLINK_OFF;
-  display_strategy->leds_brightness = HT16K33_BRIGHTNESS_12;
-  return display_strategy;
-}
-
-static void free_display_strategy(struct display_strategy *display_strategy) {
-  free(display_strategy);
+  ut3k_get_master_level(&level);
+  set_leds_bar_graph(&this->ut3k_display.leds, LEDS_RED, level.rms, level.peak);
 }
 
 
@@ -25,7 +25,7 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#include "display_strategy.h"
+#include "ut3k_view.h"
 
 struct model;
 
@@ -38,7 +38,7 @@ void free_model(struct model*);
 // Supported model methods
 
 void set_next_step(struct model*, uint8_t step);
-void clocktick_model(struct model*);
+void clocktick_model(struct model*, uint64_t step_ns);
 void toggle_run_state(struct model *this);
 void set_bpm(struct model *this, int bpm);
 int get_bpm(struct model *this);
@@ -61,6 +61,8 @@ typedef enum {
 void set_shuffle(struct model *this, shuffle_t shuffle);
 
 
-struct display_strategy* get_display_strategy(struct model *this);
+// retained display: kept up to date as the model changes, commit it
+// every tick
+struct ut3k_display* get_ut3k_display(struct model *this);
 
 #endif
@@ -80,23 +80,21 @@ void controller_battle_callback_control_panel(const struct control_panel *contro
   struct controller_battle *this = (struct controller_battle*) userdata;
   const struct joystick *joystick = get_joystick(control_panel);
   const struct rotary_encoder *blue_rotary_encoder = get_blue_rotary_encoder(control_panel);
+  int moves = joystick->repeat;
+  int dx = joystick_direction_x(joystick->direction);
+  int dy = joystick_direction_y(joystick->direction);
 
   if (joystick->state_count == 0 && joystick->direction != JOY_CENTERED) {
-    switch (joystick->direction) {
-    case JOY_LEFT:
-      battle_move_player_x(this->model, 1);
-      break;
-    case JOY_RIGHT:
-      battle_move_player_x(this->model, -1);
-      break;
-    case JOY_UP:
-      battle_move_player_y(this->model, 1);
-      break;
-    case JOY_DOWN:
-      battle_move_player_y(this->model, -1);
-      break;
-    default:
-      break;
+    ++moves;
+  }
+
+  // sights move opposite the stick left / right; diagonals do both
+  for (int move = 0; move < moves; ++move) {
+    if (dx != 0) {
+      battle_move_player_x(this->model, -dx);
+    }
+    if (dy != 0) {
+      battle_move_player_y(this->model, dy);
     }
   }
 
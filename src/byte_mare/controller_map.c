@@ -89,6 +89,10 @@ void controller_map_callback_control_panel(const struct control_panel *control_p
   if (joystick->state_count == 0 && joystick->direction != JOY_CENTERED) {
     map_move_cursor(this->model, joystick->direction);
   }
+  // held: keep going at the auto-repeat rate
+  for (int repeat = 0; repeat < joystick->repeat; ++repeat) {
+    map_move_cursor(this->model, joystick->direction);
+  }
 
   // any button depressed starts the game
   if ((green_button->button_state == 1 && green_button->state_count == 0) ||
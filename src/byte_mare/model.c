@@ -170,28 +170,28 @@ const struct player* get_player(struct model *this) {
 }
 
 void map_move_cursor(struct model *this, enum direction direction) {
+  int dx = joystick_direction_x(direction);
+  int dy = joystick_direction_y(direction);
+
   if (this->game_state == GAME_PLAY_MAP) {
-    switch (direction) {
-    case JOY_UP:
+    // diagonals move both ways at once
+    if (dy > 0) {
       this->player.cursor_quadrant.y =
         this->player.cursor_quadrant.y == quadrant_max_y ?
         quadrant_max_y : this->player.cursor_quadrant.y + 1;
-      break;
-    case JOY_DOWN:
+    }
+    else if (dy < 0) {
       this->player.cursor_quadrant.y =
         this->player.cursor_quadrant.y == 0 ? 0 : this->player.cursor_quadrant.y - 1;
-      break;
-    case JOY_LEFT:
+    }
+    if (dx < 0) {
       this->player.cursor_quadrant.x =
         this->player.cursor_quadrant.x == 0 ? 0 : this->player.cursor_quadrant.x - 1;
-      break;
-    case JOY_RIGHT:
+    }
+    else if (dx > 0) {
       this->player.cursor_quadrant.x =
         this->player.cursor_quadrant.x == quadrant_max_x ?
         quadrant_max_x : this->player.cursor_quadrant.x + 1;
-      break;
-    default:
-      break;
     }
   }
 
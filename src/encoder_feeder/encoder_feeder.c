@@ -0,0 +1,182 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uinput.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "encoder_feeder.h"
+
+
+#define ENCODERS 3
+
+static const char *encoder_names[ENCODERS] = { "green", "blue", "red" };
+
+
+static int create_encoder(const char *color, char *event_device, size_t size);
+static int turn_encoder(int fd, int detents, int detent_msec);
+static int emit(int fd, uint16_t type, uint16_t code, int32_t value);
+static void sleep_msec(int msec);
+
+
+
+int main(int argc, char **argv) {
+  char event_devices[ENCODERS][300], line[128], encoder;
+  int fds[ENCODERS];
+  int detent_msec = argc > 1 ? atoi(argv[1]) : DEFAULT_DETENT_MSEC;
+  int amount;
+
+  for (int i = 0; i < ENCODERS; ++i) {
+    if ((fds[i] = create_encoder(encoder_names[i], event_devices[i], sizeof(event_devices[i]))) == -1) {
+      return 1;
+    }
+  }
+
+  printf("hardware = { encoder_devices = [ \"%s\", \"%s\", \"%s\" ]; };\n",
+         event_devices[0], event_devices[1], event_devices[2]);
+  fflush(stdout);
+
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    if (sscanf(line, " %c %d", &encoder, &amount) != 2) {
+      continue;
+    }
+    switch (encoder) {
+    case 'g':
+      turn_encoder(fds[0], amount, detent_msec);
+      break;
+    case 'b':
+      turn_encoder(fds[1], amount, detent_msec);
+      break;
+    case 'r':
+      turn_encoder(fds[2], amount, detent_msec);
+      break;
+    case 'p':
+      sleep_msec(amount);
+      break;
+    default:
+      fprintf(stderr, "don't know %c, want g, b, r or p\n", encoder);
+      break;
+    }
+  }
+
+  for (int i = 0; i < ENCODERS; ++i) {
+    ioctl(fds[i], UI_DEV_DESTROY);
+    close(fds[i]);
+  }
+  return 0;
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+/** create_encoder
+ *
+ * a device sending REL_X, as the rotary-encoder driver does with
+ * relative_axis.  Fills in its /dev/input/eventN.  Returns the uinput
+ * fd, or -1.
+ */
+static int create_encoder(const char *color, char *event_device, size_t size) {
+  struct uinput_setup setup;
+  char sysname[32], sys_dirname[128];
+  struct dirent *entry;
+  DIR *dir;
+  int fd;
+
+  if ((fd = open(UINPUT_DEVICE, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+    fprintf(stderr, "can't open %s: %s\n", UINPUT_DEVICE, strerror(errno));
+    return -1;
+  }
+
+  memset(&setup, 0, sizeof(setup));
+  setup.id.bustype = BUS_VIRTUAL;
+  snprintf(setup.name, sizeof(setup.name), "%s%s", DEVICE_NAME_PREFIX, color);
+
+  if (ioctl(fd, UI_SET_EVBIT, EV_REL) == -1 ||
+      ioctl(fd, UI_SET_RELBIT, REL_X) == -1 ||
+      ioctl(fd, UI_DEV_SETUP, &setup) == -1 ||
+      ioctl(fd, UI_DEV_CREATE) == -1) {
+    fprintf(stderr, "can't create the %s encoder: %s\n", color, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  // inputN under sys holds the eventN the game opens
+  event_device[0] = '\0';
+  if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) >= 0) {
+    snprintf(sys_dirname, sizeof(sys_dirname), "%s%s", SYS_INPUT_DIRNAME, sysname);
+    if ((dir = opendir(sys_dirname)) != NULL) {
+      while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "event", 5) == 0) {
+          snprintf(event_device, size, "/dev/input/%s", entry->d_name);
+          break;
+        }
+      }
+      closedir(dir);
+    }
+  }
+  if (event_device[0] == '\0') {
+    fprintf(stderr, "can't find the event device for the %s encoder\n", color);
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+// a count and a report per detent, as the driver sends them
+static int turn_encoder(int fd, int detents, int detent_msec) {
+  for (int i = 0; i < abs(detents); ++i) {
+    if (emit(fd, EV_REL, REL_X, detents > 0 ? 1 : -1) != 0 ||
+        emit(fd, EV_SYN, SYN_REPORT, 0) != 0) {
+      fprintf(stderr, "can't write to the encoder: %s\n", strerror(errno));
+      return -1;
+    }
+    sleep_msec(detent_msec);
+  }
+  return 0;
+}
+
+
+static int emit(int fd, uint16_t type, uint16_t code, int32_t value) {
+  struct input_event event;
+
+  memset(&event, 0, sizeof(event));
+  event.type = type;
+  event.code = code;
+  event.value = value;
+
+  return write(fd, &event, sizeof(event)) == sizeof(event) ? 0 : -1;
+}
+
+
+static void sleep_msec(int msec) {
+  struct timespec delay = { msec / 1000, (msec % 1000) * 1000000L };
+
+  while (nanosleep(&delay, &delay) == -1 && errno == EINTR) {
+  }
+}
@@ -0,0 +1,47 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+
+/* encoder_feeder.h
+ *
+ * ut3k_encoder_feeder: three uinput devices standing in for the
+ * kernel's rotary-encoder devices (see ut3k_encoder_evdev.h), for
+ * running and testing the evdev encoder backend without the cabinet.
+ *
+ *   ut3k_encoder_feeder [detent_msec]
+ *
+ * Needs write access to /dev/uinput (modprobe uinput, then root or the
+ * input group).  Prints the event devices it made as an encoder_devices
+ * line for ultratroninator.config, then turns the encoders as told on
+ * stdin, one command a line:
+ *   <g|b|r> <detents>   turn green, blue or red, negative for counter
+ *                       clockwise, a detent every detent_msec (5)
+ *   p <msec>            pause
+ * Sweep the red knob back and forth with, say:
+ *   while :; do echo "r 10"; echo "r -10"; echo "p 500"; done | ut3k_encoder_feeder
+ * and watch the game's player move, or the session recording.
+ */
+
+#ifndef ENCODER_FEEDER_H
+#define ENCODER_FEEDER_H
+
+#define UINPUT_DEVICE "/dev/uinput"
+#define SYS_INPUT_DIRNAME "/sys/devices/virtual/input/"
+#define DEVICE_NAME_PREFIX "ut3k encoder "
+#define DEFAULT_DETENT_MSEC 5
+
+#endif
@@ -28,6 +28,8 @@
 #include "model.h"
 #include "controller.h"
 #include "ut3k_view.h"
+#include "ut3k_config.h"
+#include "ut3k_session.h"
 #include "hex_inv_ader.h"
 
 /** hex invaders
@@ -67,6 +69,7 @@ static struct controller *controller = NULL;
 void sig_cleanup_and_exit(int signum) {
   printf("caught sig %d.  Cleaning up and exiting.  Stats: %u clock ticks (%u overruns)\n",
 	 signum, clock_iterations, clock_overruns);
+  print_input_latency(view);
   ut3k_remove_all_samples();
   free_controller(controller);
   free_model(model);
@@ -98,6 +101,9 @@ static void run_mvc(config_t *cfg) {
     return;
   }
 
+  // cabinet settings from ultratroninator.config
+  load_ut3k_config(cfg);
+
   view = create_alphanum_ut3k_view();
   if (view == NULL) {
     printf("error creating game view\n");
@@ -124,7 +130,10 @@ static void run_mvc(config_t *cfg) {
   while (1) {
     // do the usleep first, otherwise the game launch is delayed by way too long
 
-    if (tval_sleep_time.tv_sec == 0) {
+    if (ut3k_session_is_replay()) {
+      // replaying a recorded session: run as fast as the model allows
+    }
+    else if (tval_sleep_time.tv_sec == 0) {
       // sleep for the fixed loop time minus the time for the controller
       usleep(tval_sleep_time.tv_usec);
     }
@@ -213,7 +222,8 @@ int main(int argc, char **argv, char **envp) {
 
   cfg = (config_t*)malloc(sizeof(config_t));
 
-  srand(time(NULL));
+  // a replayed session brings its own seed
+  srand(ut3k_session_init(time(NULL)));
 
   config_init(cfg);
 
@@ -242,7 +252,9 @@ int main(int argc, char **argv, char **envp) {
   ut3k_new_audio_context();
  
   /* load audio specified from config */
+  ut3k_begin_sample_loading("hex_invaders");
   load_audio_from_config(cfg, games_directory);
+  ut3k_finish_sample_loading();
 
 
   /* everything setup, run the mvc in a loop --
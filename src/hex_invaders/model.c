@@ -26,6 +26,7 @@
 
 #include "hex_inv_ader.h"
 #include "model.h"
+#include "ut3k_levels.h"
 #include "ut3k_pulseaudio.h"
 
 
@@ -856,6 +857,8 @@ static const int32_t attract_leds[] =
 display_type_t get_leds_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
   struct model *this = (struct model*) display_strategy->userdata;
   uint8_t shield = this->player.shield;
+  struct ut3k_level level;
+  uint8_t meter;
   // flash the increase in shield if we're levelling up and increasing shield
   if (this->game_state == GAME_LEVEL_UP && shield != 0xFF && this->messaging.clockticks % 2) {
     shield = shield >> 1;
@@ -871,7 +874,10 @@ display_type_t get_leds_display(struct display_strategy *display_strategy, displ
     (*value).display_int = ~attract_leds[i];
   }
   else {
-    (*value).display_int = 0;
+    // VU meter across all three rows for the game over sound
+    ut3k_get_master_level(&level);
+    meter = leds_bar_graph(level.rms, level.peak);
+    (*value).display_int = (meter << 16) | (meter << 8) | meter;
   }
 
   *blink = HT16K33_BLINK_OFF;
@@ -33,6 +33,7 @@ struct game_controller {
   controller_state_t controller_state;
   uint32_t state_clock;
   int shutdown_requesting;
+  uint32_t input_cursor;  // for read_input_events
 };
 
 
@@ -47,6 +48,7 @@ struct game_controller* create_game_controller(struct game_model *model, struct
   this->controller_state = FULL_INTRO;
   this->state_clock = state_clock_default;
   this->shutdown_requesting = 0;
+  this->input_cursor = 0;
 
   update_full_intro(this->model);
   return this;
@@ -100,7 +102,8 @@ void controller_callback_control_panel(const struct control_panel *control_panel
   const struct button *blue_button = get_blue_button(control_panel);
   const struct button *red_button = get_red_button(control_panel);
   const struct rotary_encoder *red_rotary_encoder = get_red_rotary_encoder(control_panel);
-  const struct rotary_encoder *blue_rotary_encoder = get_blue_rotary_encoder(control_panel);
+  struct panel_input_event events[INPUT_EVENT_RING_SIZE];
+  int num_events;
 	 
   // three finger salute: hold down green, blue, and red button last
   if (green_button->button_state == 1 &&
@@ -123,27 +126,29 @@ void controller_callback_control_panel(const struct control_panel *control_panel
   }
 
 
-  // hey, a game is picked!
-  // allow either of red encoder|red button to pick executable,
-  // so long as the green or blue button is NOT pressed
-  if ((red_rotary_encoder->button.button_state == 1 &&
-       red_rotary_encoder->button.state_count == 0) ||
-      (red_button->button_state == 1 &&
-       red_button->state_count == 0 &&
-       this->shutdown_requesting == 0)) {
-    this->game_exec_to_launch = get_current_executable(this->model);
-  }
+  num_events = read_input_events(control_panel, &this->input_cursor, events, INPUT_EVENT_RING_SIZE);
+  for (int event = 0; event < num_events; ++event) {
+    if (events[event].type != INPUT_PRESS) {
+      continue;
+    }
 
+    // hey, a game is picked!
+    // allow either of red encoder|red button to pick executable,
+    // so long as the green or blue button is NOT pressed
+    if (events[event].input == INPUT_RED_ENCODER_BUTTON ||
+        (events[event].input == INPUT_RED_BUTTON && this->shutdown_requesting == 0)) {
+      this->game_exec_to_launch = get_current_executable(this->model);
+    }
 
-  if (blue_rotary_encoder->button.button_state == 1 &&
-      blue_rotary_encoder->button.state_count == 0) {
-    uint32_t sink_list[16];
-    int num_sinks;
+    if (events[event].input == INPUT_BLUE_ENCODER_BUTTON) {
+      uint32_t sink_list[16];
+      int num_sinks;
 
-    ut3k_get_sink_list(sink_list, &num_sinks);
-    printf("sinks: got %d\n", num_sinks);
-    for (int i = 0; i< num_sinks; ++i) {
-      printf("  sink %d\n", sink_list[i]);
+      ut3k_get_sink_list(sink_list, &num_sinks);
+      printf("sinks: got %d\n", num_sinks);
+      for (int i = 0; i< num_sinks; ++i) {
+        printf("  sink %d\n", sink_list[i]);
+      }
     }
   }
 
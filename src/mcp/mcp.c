@@ -32,6 +32,8 @@
 #include "game_model.h"
 #include "game_controller.h"
 #include "ut3k_view.h"
+#include "ut3k_config.h"
+#include "ut3k_session.h"
 
 
 /** Master Control Program
@@ -52,8 +54,6 @@
 #define EVENT_LOOP_DURATION_TIME_DEFAULT 35
 #define CONFIG_SOUND_LIST_KEY "sound_list"
 
-static const char *gpio_devfile = "/dev/gpiochip0";
-static const int gpio_reset_button_bcm = 23;
 
 // gpio data
 static int gpio_fd = -1; // set to an invalid fd
@@ -122,6 +122,7 @@ static struct game_controller *controller = NULL;
 
 void sig_cleanup_and_exit(int signum) {
   printf("caught sig %d.  Cleaning up and exiting.\n", signum);
+  print_input_latency(view);
   ut3k_remove_all_samples();
   free_game_controller(controller);
   free_game_model(model);
@@ -155,6 +156,9 @@ static char* run_mvc(config_t *cfg) {
     return NULL;
   }
 
+  // cabinet settings from ultratroninator.config
+  load_ut3k_config(cfg);
+
   view = create_alphanum_ut3k_view();
   if (view == NULL) {
     printf("error creating game view\n");
@@ -185,7 +189,10 @@ static char* run_mvc(config_t *cfg) {
   while (executable == NULL) {
     // do the usleep first, otherwise the game launch is delayed by way too long
 
-    if (tval_sleep_time.tv_sec == 0) {
+    if (ut3k_session_is_replay()) {
+      // replaying a recorded session: run as fast as the model allows
+    }
+    else if (tval_sleep_time.tv_sec == 0) {
       // sleep for the fixed loop time minus the time for the controller
       usleep(tval_sleep_time.tv_usec);
     }
@@ -276,7 +283,8 @@ int main(int argc, char **argv, char **envp) {
 
   cfg = (config_t*)malloc(sizeof(config_t));
 
-  srand(time(NULL));
+  // a replayed session brings its own seed
+  srand(ut3k_session_init(time(NULL)));
 
   config_init(cfg);
 
@@ -305,16 +313,19 @@ int main(int argc, char **argv, char **envp) {
   ut3k_new_audio_context();
  
   /* load audio specified from config */
+  ut3k_begin_sample_loading("mcp");
   load_audio_from_config(cfg, games_directory);
+  ut3k_finish_sample_loading();
 
 
-  // setup the gpio pin for reading
-  gpio_fd = open(gpio_devfile, O_RDONLY);
+  // setup the gpio pin for reading: where it is depends on the cabinet
+  load_ut3k_config(cfg);
+  gpio_fd = open(get_ut3k_config()->hardware.gpio_chip, O_RDONLY);
   if (gpio_fd == -1) {
     printf("can't open gpio devfile, %s\n", strerror(errno));
   }
 
-  gpio_request.lineoffsets[0] = gpio_reset_button_bcm;
+  gpio_request.lineoffsets[0] = get_ut3k_config()->hardware.reset_button_line;
   gpio_request.lines = 1;
   gpio_request.flags = GPIOHANDLE_REQUEST_INPUT | GPIOHANDLE_REQUEST_BIAS_PULL_UP;
   
@@ -57,7 +57,7 @@ void controller_update(struct controller *this, uint32_t clock) {
     update_controls(this->view, clock);
   }
 
-  update_displays(this->view, get_display_strategy(this->model), clock);
+  commit_ut3k_view(this->view, get_ut3k_display(this->model), clock);
 }
 
 
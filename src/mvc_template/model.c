@@ -30,7 +30,7 @@
 
 
 struct model {
-  struct display_strategy *display_strategy;
+  struct ut3k_display ut3k_display;
 };
 
 
@@ -40,13 +40,12 @@ struct model {
  */
 struct model* create_model() {
   struct model* this = (struct model*)malloc(sizeof(struct model));
-  this->display_strategy = create_display_strategy(this);
+  init_display(&this->ut3k_display);
   return this;
 }
 
 
 void free_model(struct model *this) {
-  free_display_strategy(this->display_strategy);
   return free(this);
 }
 
@@ -57,8 +56,8 @@ void free_model(struct model *this) {
 
 
 
-struct display_strategy* get_display_strategy(struct model *this) {
-  return this->display_strategy;
+struct ut3k_display* get_ut3k_display(struct model *this) {
+  return &this->ut3k_display;
 }
 
 
@@ -25,7 +25,7 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#include "display_strategy.h"
+#include "ut3k_view.h"
 
 struct model;
 
@@ -40,10 +40,10 @@ void free_model(struct model*);
 
 
 
-// accessors here- but these may be decoupled via the display_strategy
+// accessors here
 
 
-// critical to implement
-struct display_strategy* get_display_strategy(struct model *this);
+// critical to implement: the retained display the controller commits
+struct ut3k_display* get_ut3k_display(struct model *this);
 
 #endif
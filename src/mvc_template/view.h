@@ -16,9 +16,8 @@
 #ifndef VIEW_H
 #define VIEW_H
 
-#include "display_strategy.h"
+#include "ut3k_view.h"
 
-struct display_strategy* create_display_strategy(void*);
-void free_display_strategy(struct display_strategy *display_strategy);
+void init_display(struct ut3k_display *ut3k_display);
 
 #endif
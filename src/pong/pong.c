@@ -30,6 +30,8 @@
 #include "view.h"
 #include "controller.h"
 #include "ut3k_view.h"
+#include "ut3k_config.h"
+#include "ut3k_session.h"
 #include "ut3k_pulseaudio.h"
 
 
@@ -60,6 +62,7 @@ void sig_cleanup_and_exit(int signum) {
   printf("caught sig %d.  Cleaning up and exiting.  Stats: %u clock ticks (%u overruns); total controller time %ld.%06ld\n",
 	 signum, clock_iterations, clock_overruns,
          tval_total_controller_time.tv_sec, tval_total_controller_time.tv_usec);
+  print_input_latency(ut3k_view);
   ut3k_remove_all_samples();
   free_controller(controller);
   free_pong_view(view);
@@ -92,6 +95,9 @@ static void run_mvc(config_t *cfg) {
     return;
   }
 
+  // cabinet settings from ultratroninator.config
+  load_ut3k_config(cfg);
+
   ut3k_view = create_alphanum_ut3k_view();
   if (ut3k_view == NULL) {
     printf("error creating game ut3k_view\n");
@@ -121,7 +127,10 @@ static void run_mvc(config_t *cfg) {
   while (1) {
     // do the usleep first, otherwise the game launch is delayed by way too long
 
-    if (tval_sleep_time.tv_sec == 0) {
+    if (ut3k_session_is_replay()) {
+      // replaying a recorded session: run as fast as the model allows
+    }
+    else if (tval_sleep_time.tv_sec == 0) {
       // sleep for the fixed loop time minus the time for the controller
       usleep(tval_sleep_time.tv_usec);
     }
@@ -209,7 +218,8 @@ int main(int argc, char **argv, char **envp) {
 
   cfg = (config_t*)malloc(sizeof(config_t));
 
-  srand(time(NULL));
+  // a replayed session brings its own seed
+  srand(ut3k_session_init(time(NULL)));
 
   config_init(cfg);
 
@@ -238,7 +248,9 @@ int main(int argc, char **argv, char **envp) {
   ut3k_new_audio_context();
  
   /* load audio specified from config */
+  ut3k_begin_sample_loading("pong");
   load_audio_from_config(cfg, games_directory);
+  ut3k_finish_sample_loading();
 
 
   /* everything setup, run the mvc in a loop --
@@ -0,0 +1,147 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <libconfig.h>
+
+#include "sample_bank.h"
+#include "ut3k_sample_bank.h"
+
+
+static int pack_config(struct ut3k_sample_bank_writer *writer, const char *config_directory, const char *config_filename);
+static int pack_setting(struct ut3k_sample_bank_writer *writer, const config_setting_t *setting);
+static int is_sample(const char *name);
+static int has_suffix(const char *name, const char *suffix);
+
+
+
+int main(int argc, char **argv) {
+  char *games_directory, config_directory[256], samples_directory[256], bank_filename[512], config_filename[512];
+  struct ut3k_sample_bank_writer *writer;
+  struct dirent *entry;
+  DIR *dir;
+  int failures = 0, count;
+
+  if (! (games_directory = getenv(GAMES_LOCAL_ENV_VAR)) ) {
+    games_directory = DEFAULT_GAMES_BASEDIR;
+  }
+  snprintf(config_directory, sizeof(config_directory), "%s%s", games_directory, CONFIG_DIRNAME);
+  snprintf(samples_directory, sizeof(samples_directory), "%s%s", games_directory, SAMPLE_DIRNAME);
+  snprintf(bank_filename, sizeof(bank_filename), "%s%s", samples_directory, UT3K_BANK_FILENAME);
+
+  if ((writer = new_ut3k_sample_bank_writer(bank_filename, samples_directory)) == NULL) {
+    return 1;
+  }
+
+  if (argc > 1) {
+    for (int i = 1; i < argc; ++i) {
+      failures += pack_config(writer, config_directory, argv[i]);
+    }
+  }
+  else if ((dir = opendir(config_directory)) != NULL) {
+    while ((entry = readdir(dir)) != NULL) {
+      if (has_suffix(entry->d_name, CONFIG_SUFFIX)) {
+        snprintf(config_filename, sizeof(config_filename), "%s%s", config_directory, entry->d_name);
+        failures += pack_config(writer, config_directory, config_filename);
+      }
+    }
+    closedir(dir);
+  }
+  else {
+    fprintf(stderr, "can't read config directory %s\n", config_directory);
+    ++failures;
+  }
+
+  if ((count = finish_ut3k_sample_bank_writer(writer)) < 0) {
+    return 1;
+  }
+
+  printf("packed %d samples into %s, %d failures\n", count, bank_filename, failures);
+  return failures ? 1 : 0;
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+/** pack_config
+ *
+ * add every sample named anywhere in a config, includes and all.
+ * Returns the count of samples that couldn't be added.
+ */
+static int pack_config(struct ut3k_sample_bank_writer *writer, const char *config_directory, const char *config_filename) {
+  config_t cfg;
+  int failures;
+
+  config_init(&cfg);
+  config_set_include_dir(&cfg, config_directory);
+
+  printf("packing samples from %s\n", config_filename);
+  if (! config_read_file(&cfg, config_filename)) {
+    fprintf(stderr, "%s:%d - %s\n", config_error_file(&cfg) ? config_error_file(&cfg) : config_filename,
+            config_error_line(&cfg), config_error_text(&cfg));
+    config_destroy(&cfg);
+    return 1;
+  }
+
+  failures = pack_setting(writer, config_root_setting(&cfg));
+  config_destroy(&cfg);
+
+  return failures;
+}
+
+
+static int pack_setting(struct ut3k_sample_bank_writer *writer, const config_setting_t *setting) {
+  const char *name;
+  int failures = 0;
+
+  switch (config_setting_type(setting)) {
+  case CONFIG_TYPE_STRING:
+    name = config_setting_get_string(setting);
+    if (is_sample(name) && ut3k_sample_bank_add(writer, name) != 0) {
+      ++failures;
+    }
+    break;
+  case CONFIG_TYPE_GROUP:
+  case CONFIG_TYPE_ARRAY:
+  case CONFIG_TYPE_LIST:
+    for (int i = 0; i < config_setting_length(setting); ++i) {
+      failures += pack_setting(writer, config_setting_get_elem(setting, i));
+    }
+    break;
+  default:
+    break;
+  }
+
+  return failures;
+}
+
+
+static int is_sample(const char *name) {
+  return name != NULL && has_suffix(name, SAMPLE_SUFFIX);
+}
+
+
+static int has_suffix(const char *name, const char *suffix) {
+  size_t length = strlen(name), suffix_length = strlen(suffix);
+
+  return length > suffix_length && strcasecmp(name + length - suffix_length, suffix) == 0;
+}
@@ -0,0 +1,39 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/* sample_bank.h
+ *
+ * ut3k_sample_bank: pack every sample the game configs name into the
+ * sample bank the games map at start (see ut3k_sample_bank.h).
+ *
+ *   ut3k_sample_bank [config ...]
+ *
+ * With no configs given, every .config in the games' etc directory.
+ * Run it again after adding or changing samples.
+ */
+
+#ifndef SAMPLE_BANK_H
+#define SAMPLE_BANK_H
+
+#define GAMES_LOCAL_ENV_VAR "GAMES_LOCAL"
+#define DEFAULT_GAMES_BASEDIR "/usr/local/games/ultratroninator_3000"
+#define CONFIG_DIRNAME "/etc/"
+#define CONFIG_SUFFIX ".config"
+#define SAMPLE_DIRNAME "/samples/"
+#define SAMPLE_SUFFIX ".wav"
+
+#endif
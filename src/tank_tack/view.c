@@ -16,10 +16,16 @@
 #include <stdlib.h>
 #include "view.h"
 
+// radar ghosting: the sweep fades through the dither levels
+#define RADAR_DITHER_DEPTH 3
+#define RADAR_DITHER_FRAME_USEC 10000
+#define RADAR_GHOST_LEVEL 1
+
 struct radarsweep {
   int state;
   int timer;
   int delay;
+  struct ut3k_dither *dither;
 };
 
 struct led_lightshow {
@@ -34,18 +40,22 @@ struct view {
   struct ut3k_display ut3k_display;
   struct radarsweep radarsweep;
   struct led_lightshow leds;
+  struct ut3k_dither dither;
 };
 
 static void f_radarsweep0(struct display *display, uint32_t clock);
 static void f_radarsweep1(struct display *display, uint32_t clock);
 static void f_radarsweep2(struct display *display, uint32_t clock);
 static void f_ledlightshow(struct display *display, uint32_t clock);
+static void radar_segments(struct radarsweep *radarsweep, struct display *display, int display_index, int digit, uint16_t segments, uint8_t level);
 
 
 struct view* create_pong_view(struct ut3k_view *ut3k_view) {
   struct view *this = (struct view*)malloc(sizeof(struct view));
   this->ut3k_view = ut3k_view;
   reset_ut3k_display(&this->ut3k_display);
+  init_ut3k_dither(&this->dither, RADAR_DITHER_DEPTH, RADAR_DITHER_FRAME_USEC);
+  this->radarsweep.dither = &this->dither;
 
   return this;
 }
@@ -59,6 +69,11 @@ void free_pong_view(struct view *this) {
 
 
 void set_attract(struct view *this, void *scroller, f_animator animation) {
+  // dither levels stick: don't leave the radar's ghosting on the text
+  for (int display = 0; display < 3; ++display) {
+    set_dither_display_level(&this->dither, display, this->dither.depth);
+  }
+
   this->ut3k_display.displays[0].f_animate = animation;
   this->ut3k_display.displays[0].userdata = scroller;
 }
@@ -96,7 +111,7 @@ void set_radarview(struct view *this) {
 
 
 void render_display(struct view *this, uint32_t clock) {
-  commit_ut3k_display(this->ut3k_view, &this->ut3k_display, clock);
+  commit_ut3k_view_dithered(this->ut3k_view, &this->ut3k_display, &this->dither, clock);
   // wipe after render
   clear_ut3k_display(&this->ut3k_display);
 
@@ -114,38 +129,26 @@ void render_display(struct view *this, uint32_t clock) {
 
 
 // radar sweep for green display
-// radar sweep appears to rotate around the display, also
-// give a slight fading phosphor effect.  not really, but trying.
+// radar sweep appears to rotate around the display, leaving a dim
+// phosphor ghost of the previous position behind it.
 static void f_radarsweep0(struct display *display, uint32_t clock) {
   struct radarsweep *radarsweep = (struct radarsweep*) display->userdata;
+  uint8_t full = radarsweep->dither->depth;
 
   switch (radarsweep->state) {
   case 0:
-    display->display_value.display_glyph[2] |= (SEG_F | SEG_E);
-    // ghost effects on previous state:
-    if (radarsweep->timer == radarsweep->delay - 2 ||
-        radarsweep->timer == radarsweep->delay - 5 ||
-        radarsweep->timer == radarsweep->delay - 9) {
-      display->display_value.display_glyph[0] |= (SEG_H | SEG_N);
-    }
+    radar_segments(radarsweep, display, 0, 2, SEG_F | SEG_E, full);
+    radar_segments(radarsweep, display, 0, 0, SEG_H | SEG_N, RADAR_GHOST_LEVEL);
     break;
   case 7:
-    display->display_value.display_glyph[0] |= (SEG_H | SEG_N);
+    radar_segments(radarsweep, display, 0, 0, SEG_H | SEG_N, full);
     break;
   case 2:
-    if (radarsweep->timer == radarsweep->delay - 2 ||
-        radarsweep->timer == radarsweep->delay - 5 ||
-        radarsweep->timer == radarsweep->delay - 9) {
-      display->display_value.display_glyph[3] |= (SEG_L | SEG_K);
-    }
+    radar_segments(radarsweep, display, 0, 3, SEG_L | SEG_K, RADAR_GHOST_LEVEL);
     break;
   case 1:
-    display->display_value.display_glyph[3] |= (SEG_L | SEG_K);
-    if (radarsweep->timer == radarsweep->delay - 2 ||
-        radarsweep->timer == radarsweep->delay - 5 ||
-        radarsweep->timer == radarsweep->delay - 9) {
-      display->display_value.display_glyph[2] |= (SEG_F | SEG_E);
-    }
+    radar_segments(radarsweep, display, 0, 3, SEG_L | SEG_K, full);
+    radar_segments(radarsweep, display, 0, 2, SEG_F | SEG_E, RADAR_GHOST_LEVEL);
     break;
   default:
     break;
@@ -154,31 +157,24 @@ static void f_radarsweep0(struct display *display, uint32_t clock) {
 
 static void f_radarsweep1(struct display *display, uint32_t clock) {
   struct radarsweep *radarsweep = (struct radarsweep*) display->userdata;
+  uint8_t full = radarsweep->dither->depth;
 
   switch (radarsweep->state) {
   case 6:
-    display->display_value.display_glyph[0] |= (SEG_G1 | SEG_G2);
-    display->display_value.display_glyph[1] |= (SEG_G1 | SEG_G2);
+    radar_segments(radarsweep, display, 1, 0, SEG_G1 | SEG_G2, full);
+    radar_segments(radarsweep, display, 1, 1, SEG_G1 | SEG_G2, full);
     break;
   case 7:
-    if (radarsweep->timer == radarsweep->delay - 2 ||
-        radarsweep->timer == radarsweep->delay - 5 ||
-        radarsweep->timer == radarsweep->delay - 9) {
-      display->display_value.display_glyph[0] |= (SEG_G1 | SEG_G2);
-      display->display_value.display_glyph[1] |= (SEG_G1 | SEG_G2);
-    }
+    radar_segments(radarsweep, display, 1, 0, SEG_G1 | SEG_G2, RADAR_GHOST_LEVEL);
+    radar_segments(radarsweep, display, 1, 1, SEG_G1 | SEG_G2, RADAR_GHOST_LEVEL);
     break;
   case 2:
-    display->display_value.display_glyph[2] |= (SEG_G1 | SEG_G2);
-    display->display_value.display_glyph[3] |= (SEG_G1 | SEG_G2);
+    radar_segments(radarsweep, display, 1, 2, SEG_G1 | SEG_G2, full);
+    radar_segments(radarsweep, display, 1, 3, SEG_G1 | SEG_G2, full);
     break;
   case 3:
-    if (radarsweep->timer == radarsweep->delay - 2 ||
-        radarsweep->timer == radarsweep->delay - 5 ||
-        radarsweep->timer == radarsweep->delay - 9) {
-      display->display_value.display_glyph[2] |= (SEG_G1 | SEG_G2);
-      display->display_value.display_glyph[3] |= (SEG_G1 | SEG_G2);
-    }
+    radar_segments(radarsweep, display, 1, 2, SEG_G1 | SEG_G2, RADAR_GHOST_LEVEL);
+    radar_segments(radarsweep, display, 1, 3, SEG_G1 | SEG_G2, RADAR_GHOST_LEVEL);
     break;
   default:
     break;
@@ -187,33 +183,22 @@ static void f_radarsweep1(struct display *display, uint32_t clock) {
 
 static void f_radarsweep2(struct display *display, uint32_t clock) {
   struct radarsweep *radarsweep = (struct radarsweep*) display->userdata;
+  uint8_t full = radarsweep->dither->depth;
 
   switch (radarsweep->state) {
   case 5:
-    display->display_value.display_glyph[0] |= (SEG_K | SEG_L);
-    if (radarsweep->timer == radarsweep->delay - 2 ||
-        radarsweep->timer == radarsweep->delay - 5 ||
-        radarsweep->timer == radarsweep->delay - 9) {
-      display->display_value.display_glyph[2] |= (SEG_F | SEG_E);
-    }
+    radar_segments(radarsweep, display, 2, 0, SEG_K | SEG_L, full);
+    radar_segments(radarsweep, display, 2, 2, SEG_F | SEG_E, RADAR_GHOST_LEVEL);
     break;
   case 4:
-    display->display_value.display_glyph[2] |= (SEG_F | SEG_E);
-    if (radarsweep->timer == radarsweep->delay - 2 ||
-        radarsweep->timer == radarsweep->delay - 5 ||
-        radarsweep->timer == radarsweep->delay - 9) {
-      display->display_value.display_glyph[3] |= (SEG_H | SEG_N);
-    }
+    radar_segments(radarsweep, display, 2, 2, SEG_F | SEG_E, full);
+    radar_segments(radarsweep, display, 2, 3, SEG_H | SEG_N, RADAR_GHOST_LEVEL);
     break;
   case 3:
-    display->display_value.display_glyph[3] |= (SEG_H | SEG_N);
+    radar_segments(radarsweep, display, 2, 3, SEG_H | SEG_N, full);
     break;
   case 6:
-    if (radarsweep->timer == radarsweep->delay - 2 ||
-        radarsweep->timer == radarsweep->delay - 5 ||
-        radarsweep->timer == radarsweep->delay - 9) {
-      display->display_value.display_glyph[0] |= (SEG_K | SEG_L);
-    }
+    radar_segments(radarsweep, display, 2, 0, SEG_K | SEG_L, RADAR_GHOST_LEVEL);
     break;
   default:
     break;
@@ -221,6 +206,17 @@ static void f_radarsweep2(struct display *display, uint32_t clock) {
 }
 
 
+/** radar_segments
+ *
+ * light segments on a digit at the given dither level.  The level sticks
+ * to those segments, so every lit segment sets its own.
+ */
+static void radar_segments(struct radarsweep *radarsweep, struct display *display, int display_index, int digit, uint16_t segments, uint8_t level) {
+  display->display_value.display_glyph[digit] |= segments;
+  set_dither_level(radarsweep->dither, display_index, digit, segments, level);
+}
+
+
 
 static void f_ledlightshow(struct display *display, uint32_t clock) {
   struct led_lightshow *leds = (struct led_lightshow*) display->userdata;
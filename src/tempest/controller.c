@@ -18,16 +18,35 @@
 
 #include "control_panel.h"
 #include "controller.h"
+#include "ut3k_gesture.h"
 #include "ut3k_pulseaudio.h"
 
 
+#define GESTURE_ZAPPER 1
+
+
 struct controller {
   struct model *model;
   struct ut3k_view *view;
 
+  struct ut3k_gestures gestures;
+  uint32_t event_cursor;
 };
 
 
+// a quick flick gets the player around the 28 slot playfield
+static const struct encoder_acceleration player_acceleration =
+  { .slow_detent_usec = 80000, .fast_detent_usec = 20000, .max_multiplier = 4 };
+
+// push the knob and hit the red button together: the super zapper,
+// same as the toggle.  Not a turn of the knob, play turns it hard
+// enough to fire that by accident.
+static const struct gesture_step zapper_chord_knob_first[] =
+  { GESTURE_PRESS(INPUT_RED_ENCODER_BUTTON), GESTURE_PRESS(INPUT_RED_BUTTON) };
+static const struct gesture_step zapper_chord_button_first[] =
+  { GESTURE_PRESS(INPUT_RED_BUTTON), GESTURE_PRESS(INPUT_RED_ENCODER_BUTTON) };
+
+
 /* start off with accurate front panel state */
 static void initialize_model_from_control_panel(struct controller *this, const struct control_panel *control_panel);
 
@@ -40,6 +59,13 @@ struct controller* create_controller(struct model *model, struct ut3k_view *view
   this->model = model;
   this->view = view;
 
+  set_encoder_acceleration(view, RED_ROTARY_ENCODER, &player_acceleration);
+
+  init_ut3k_gestures(&this->gestures, 250);
+  add_ut3k_gesture(&this->gestures, GESTURE_ZAPPER, zapper_chord_knob_first, 2);
+  add_ut3k_gesture(&this->gestures, GESTURE_ZAPPER, zapper_chord_button_first, 2);
+  this->event_cursor = 0;
+
   initialize_model_from_control_panel(this, get_control_panel(view));
 
   return this;
@@ -51,6 +77,8 @@ void free_controller(struct controller *this) {
 
 
 void controller_update(struct controller *this, uint32_t clock) {
+  // the player's knob every tick, the rest at keyscan speed
+  update_encoders(this->view, clock);
   if (clock & 0b1) {
     update_controls(this->view, clock);
   }
@@ -71,14 +99,10 @@ static void initialize_model_from_control_panel(struct controller *this, const s
  */
 void controller_callback_control_panel(const struct control_panel *control_panel, void *userdata) {
   struct controller *this = (struct controller*) userdata;
-  const struct rotary_encoder *red_rotary_encoder = get_red_rotary_encoder(control_panel);
   const struct button *blue_button = get_blue_button(control_panel);
   const struct toggles *toggles = get_toggles(control_panel);
-
-
-  if (red_rotary_encoder->encoder_delta != 0) {
-    move_player(this->model, -1 * red_rotary_encoder->encoder_delta);
-  }
+  int gestures[4];
+  int count;
 
 
   if (blue_button->button_state == 1) {
@@ -89,4 +113,25 @@ void controller_callback_control_panel(const struct control_panel *control_panel
   if (toggles->state_count == 0 && toggles->toggles_toggled == 0x01) {
     set_player_zapper(this->model);
   }
+
+  count = ut3k_gestures_read(&this->gestures, control_panel, &this->event_cursor, gestures, 4);
+  for (int i = 0; i < count; ++i) {
+    if (gestures[i] == GESTURE_ZAPPER) {
+      set_player_zapper(this->model);
+    }
+  }
+}
+
+
+/** controller encoder callback
+ *
+ * implements f_view_encoder_listener: player movement, every tick
+ */
+void controller_callback_encoders(const struct encoder_deltas *deltas, void *userdata) {
+  struct controller *this = (struct controller*) userdata;
+  int16_t delta = deltas->accelerated_delta[RED_ROTARY_ENCODER];
+
+  for (int step = 0; step < abs(delta); ++step) {
+    move_player(this->model, delta > 0 ? -1 : 1);
+  }
 }
@@ -29,6 +29,8 @@
 #include "model.h"
 #include "controller.h"
 #include "ut3k_view.h"
+#include "ut3k_config.h"
+#include "ut3k_session.h"
 
 
 /** tempest
@@ -71,6 +73,7 @@ void sig_cleanup_and_exit(int signum) {
   printf("caught sig %d.  Cleaning up and exiting.  Stats: %u clock ticks (%u overruns); total controller time %ld.%06ld\n",
 	 signum, clock_iterations, clock_overruns,
          tval_total_controller_time.tv_sec, tval_total_controller_time.tv_usec);
+  print_input_latency(view);
   ut3k_remove_all_samples();
   free_controller(controller);
   free_model(model);
@@ -102,6 +105,9 @@ static void run_mvc(config_t *cfg) {
     return;
   }
 
+  // cabinet settings from ultratroninator.config
+  load_ut3k_config(cfg);
+
   view = create_alphanum_ut3k_view();
   if (view == NULL) {
     printf("error creating game view\n");
@@ -116,6 +122,7 @@ static void run_mvc(config_t *cfg) {
   }
 
   register_control_panel_listener(view, controller_callback_control_panel, controller);
+  register_encoder_listener(view, controller_callback_encoders, controller);
 
   // init and hack:
   // start with a sleep since the view does a read from the ht16k33
@@ -129,7 +136,10 @@ static void run_mvc(config_t *cfg) {
   while (1) {
     // do the usleep first, otherwise the game launch is delayed by way too long
 
-    if (tval_sleep_time.tv_sec == 0) {
+    if (ut3k_session_is_replay()) {
+      // replaying a recorded session: run as fast as the model allows
+    }
+    else if (tval_sleep_time.tv_sec == 0) {
       // sleep for the fixed loop time minus the time for the controller
       usleep(tval_sleep_time.tv_usec);
     }
@@ -216,7 +226,8 @@ int main(int argc, char **argv, char **envp) {
 
   cfg = (config_t*)malloc(sizeof(config_t));
 
-  srand(time(NULL));
+  // a replayed session brings its own seed
+  srand(ut3k_session_init(time(NULL)));
 
   config_init(cfg);
 
@@ -245,7 +256,9 @@ int main(int argc, char **argv, char **envp) {
   ut3k_new_audio_context();
  
   /* load audio specified from config */
+  ut3k_begin_sample_loading("tempest");
   load_audio_from_config(cfg, games_directory);
+  ut3k_finish_sample_loading();
 
 
   /* everything setup, run the mvc in a loop --
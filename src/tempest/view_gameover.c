@@ -21,6 +21,7 @@
 #include "tempest.h"
 #include "model.h"
 #include "view_gameover.h"
+#include "ut3k_transition.h"
 
 
 static display_type_t get_red_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness);
@@ -30,15 +31,29 @@ static display_type_t get_leds_display(struct display_strategy *display_strategy
 
 
 
+// green display: explosions going off at random digits, a frame every
+// EXPLOSION_FRAME_TICKS of the gameover animation timer
+#define EXPLOSION_FRAME_TICKS 4
+
+struct view_data {
+  struct model *model;
+  struct ut3k_transition explosion;
+};
+
+
 /* view methods ----------------------------------------------------- */
 
 
 struct display_strategy* create_gameover_display_strategy(struct model *model) {
   struct display_strategy *display_strategy;
+  struct view_data *view_data = (struct view_data*)malloc(sizeof(struct view_data));
+  view_data->model = model;
+  init_explosion_transition(&view_data->explosion, 0, rand() % UT3K_TRANSITION_DIGITS, 0);
+
   display_strategy = (struct display_strategy*)malloc(sizeof(struct display_strategy));
   *display_strategy = (struct display_strategy const)
     {
-     .userdata = model,
+     .userdata = view_data,
      .get_green_display = get_green_display,
      .green_blink = HT16K33_BLINK_OFF,
      .green_brightness = HT16K33_BRIGHTNESS_5,
@@ -58,6 +73,7 @@ struct display_strategy* create_gameover_display_strategy(struct model *model) {
 }
 
 void free_gameover_display_strategy(struct display_strategy *display_strategy) {
+  free(display_strategy->userdata);
   free(display_strategy);
 }
 
@@ -66,7 +82,8 @@ void free_gameover_display_strategy(struct display_strategy *display_strategy) {
 
 // implements f_get_display for the red display
 static display_type_t get_red_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
-  struct model *model = (struct model*) display_strategy->userdata;
+  struct view_data *view_data = (struct view_data*) display_strategy->userdata;
+  struct model *model = view_data->model;
   const struct gameover *gameover = get_model_gameover(model);
 
   *blink = HT16K33_BLINK_OFF;
@@ -79,7 +96,8 @@ static display_type_t get_red_display(struct display_strategy *display_strategy,
 
 // implements f_get_display for the blue display
 static display_type_t get_blue_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
-  struct model *model = (struct model*) display_strategy->userdata;
+  struct view_data *view_data = (struct view_data*) display_strategy->userdata;
+  struct model *model = view_data->model;
   const struct gameover *gameover = get_model_gameover(model);
 
   *blink = HT16K33_BLINK_OFF;
@@ -93,31 +111,26 @@ static display_type_t get_blue_display(struct display_strategy *display_strategy
 
 // implements f_get_display for the green display
 static display_type_t get_green_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
-  struct model *model = (struct model*) display_strategy->userdata;
+  struct view_data *view_data = (struct view_data*) display_strategy->userdata;
+  struct model *model = view_data->model;
   const struct gameover *gameover = get_model_gameover(model);
 
   *blink = HT16K33_BLINK_OFF;
   *brightness = HT16K33_BRIGHTNESS_5;
 
-  memset((*value).display_glyph, 0, sizeof(display_value_t));
-
-  switch (gameover->animation_timer) {
-  case 1:
-    (*value).display_glyph[0] = 1 << rand() % 16;
-    break;
-  case 3:
-    (*value).display_glyph[1] = 1 << rand() % 16;
-    break;
-  case 5:
-    (*value).display_glyph[2] = 1 << rand() % 16;
-    break;
-  case 8:
-    (*value).display_glyph[3] = 1 << rand() % 16;
-    break;
-  default:
-    break;
+  if (gameover->animation_timer % EXPLOSION_FRAME_TICKS == 0) {
+    if (ut3k_transition_done(&view_data->explosion)) {
+      // set off the next one somewhere else
+      init_explosion_transition(&view_data->explosion, 0, rand() % UT3K_TRANSITION_DIGITS, 0);
+    }
+    else {
+      ut3k_transition_advance(&view_data->explosion);
+    }
   }
 
+  memset((*value).display_glyph, 0, sizeof(display_value_t));
+  ut3k_transition_apply(&view_data->explosion, 0, (*value).display_glyph);
+
   return glyph_display;
 }
 
@@ -126,7 +139,8 @@ static const int light_show[] = { 0x00, 0x81, 0xC3, 0xE7, 0xFF };
 
 // implements f_get_display for the leds display
 static display_type_t get_leds_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
-  struct model *model = (struct model*) display_strategy->userdata;
+  struct view_data *view_data = (struct view_data*) display_strategy->userdata;
+  struct model *model = view_data->model;
   const struct gameover *gameover = get_model_gameover(model);
 
   *blink = HT16K33_BLINK_OFF;
@@ -20,6 +20,7 @@
 
 #include "tempest.h"
 #include "model.h"
+#include "ut3k_transition.h"
 
 
 static display_type_t get_red_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness);
@@ -39,73 +40,38 @@ static display_type_t get_leds_display(struct display_strategy *display_strategy
 #define FLATLINE_MID 0x00C0
 #define FLATLINE_HIGH 0x0001
 
-struct display_frame {
-  uint16_t glyph_green[4];
-  uint16_t glyph_blue[4];
-};
-
-static const struct display_frame diag_rising0 =
-  {
-   .glyph_green = { 0, 0, 0, 0 },
-   .glyph_blue = { 0, DIAG_LL_UR, DIAG_LR_UL, 0 }
-  };
-static const struct display_frame diag_rising1 =
-  {
-   .glyph_green = { 0, DIAG_LL_UR, DIAG_LR_UL, 0 },
-   .glyph_blue = { DIAG_LL_UR, 0, 0, DIAG_LR_UL }
-  };
-static const struct display_frame diag_rising2 =
+// frames for green (0) and blue (1); red shows the message
+static const uint16_t diag_rising[][UT3K_TRANSITION_DISPLAYS][UT3K_TRANSITION_DIGITS] =
   {
-   .glyph_green = { DIAG_LL_UR, 0, 0, DIAG_LR_UL },
-   .glyph_blue = { 0, 0, 0, 0 }
+   { { 0, 0, 0, 0 },
+     { 0, DIAG_LL_UR, DIAG_LR_UL, 0 } },
+   { { 0, DIAG_LL_UR, DIAG_LR_UL, 0 },
+     { DIAG_LL_UR, 0, 0, DIAG_LR_UL } },
+   { { DIAG_LL_UR, 0, 0, DIAG_LR_UL },
+     { 0, 0, 0, 0 } }
   };
 
-static const struct display_frame diag_rising[] =
-  { diag_rising0, diag_rising1, diag_rising2 };
-
-
-
-static const struct display_frame flatline0 =
-  {
-   .glyph_green = { FLATLINE_LOW, FLATLINE_LOW, FLATLINE_LOW, FLATLINE_LOW },
-   .glyph_blue = { FLATLINE_LOW, FLATLINE_LOW, FLATLINE_LOW, FLATLINE_LOW }
-  };
-static const struct display_frame flatline1 =
-  {
-   .glyph_green = { FLATLINE_HIGH, FLATLINE_HIGH, FLATLINE_HIGH, FLATLINE_HIGH },
-   .glyph_blue = { FLATLINE_MID, FLATLINE_MID, FLATLINE_MID, FLATLINE_MID }
-  };
-static const struct display_frame flatline2 =
+static const uint16_t flatline[][UT3K_TRANSITION_DISPLAYS][UT3K_TRANSITION_DIGITS] =
   {
-   .glyph_green = { 0, 0, 0, 0 },
-   .glyph_blue = { FLATLINE_HIGH, FLATLINE_HIGH, FLATLINE_HIGH, FLATLINE_HIGH }
+   { { FLATLINE_LOW, FLATLINE_LOW, FLATLINE_LOW, FLATLINE_LOW },
+     { FLATLINE_LOW, FLATLINE_LOW, FLATLINE_LOW, FLATLINE_LOW } },
+   { { FLATLINE_HIGH, FLATLINE_HIGH, FLATLINE_HIGH, FLATLINE_HIGH },
+     { FLATLINE_MID, FLATLINE_MID, FLATLINE_MID, FLATLINE_MID } },
+   { { 0, 0, 0, 0 },
+     { FLATLINE_HIGH, FLATLINE_HIGH, FLATLINE_HIGH, FLATLINE_HIGH } }
   };
-static const struct display_frame flatline[] =
-  { flatline0, flatline1, flatline2 };
-
-
 
-static const struct display_frame diag_falling0 =
+static const uint16_t diag_falling[][UT3K_TRANSITION_DISPLAYS][UT3K_TRANSITION_DIGITS] =
   {
-   .glyph_green = { 0, DIAG_LR_UL, DIAG_LL_UR, 0 },
-   .glyph_blue = { 0, 0, 0, 0 }
+   { { 0, DIAG_LR_UL, DIAG_LL_UR, 0 },
+     { 0, 0, 0, 0 } },
+   { { DIAG_LR_UL, 0, 0, DIAG_LL_UR },
+     { 0, DIAG_LR_UL, DIAG_LL_UR, 0 } },
+   { { 0, 0, 0, 0 },
+     { DIAG_LR_UL, 0, 0, DIAG_LL_UR } }
   };
-static const struct display_frame diag_falling1 =
-  {
-   .glyph_green = { DIAG_LR_UL, 0, 0, DIAG_LL_UR },
-   .glyph_blue = { 0, DIAG_LR_UL, DIAG_LL_UR, 0 }
-  };
-static const struct display_frame diag_falling2 =
-  {
-   .glyph_green = { 0, 0, 0, 0 },
-   .glyph_blue = { DIAG_LR_UL, 0, 0, DIAG_LL_UR }
-  };
-
-static const struct display_frame diag_falling[] =
-  { diag_falling0, diag_falling1, diag_falling2 };
-
-
 
+#define ANIMATION_FRAMES(frames) (sizeof(frames) / sizeof(frames[0]))
 
 
 // view methods
@@ -116,19 +82,22 @@ static const struct display_frame diag_falling[] =
 
 struct view_data {
   struct model *model;
-  struct display_frame const *green_display;
-  struct display_frame const *blue_display;
+  struct ut3k_transition diag_rising;
+  struct ut3k_transition flatline;
+  struct ut3k_transition diag_falling;
+  struct ut3k_transition *animation;  // the one playing
 };
 
+static struct ut3k_transition* get_animation(struct view_data *view_data, animation_state_t animation_state);
+
 struct display_strategy* create_levelup_display_strategy(struct model *model) {
   struct display_strategy *display_strategy;
   struct view_data *view_data = (struct view_data*)malloc(sizeof(struct view_data));
-  *view_data = (struct view_data const)
-    {
-     .model = model,
-     .green_display = NULL,
-     .blue_display = NULL
-    };
+  view_data->model = model;
+  init_frames_transition(&view_data->diag_rising, diag_rising, ANIMATION_FRAMES(diag_rising), 1);
+  init_frames_transition(&view_data->flatline, flatline, ANIMATION_FRAMES(flatline), 1);
+  init_frames_transition(&view_data->diag_falling, diag_falling, ANIMATION_FRAMES(diag_falling), 1);
+  view_data->animation = &view_data->diag_rising;
 
   display_strategy = (struct display_strategy*)malloc(sizeof(struct display_strategy));
   *display_strategy = (struct display_strategy const)
@@ -179,45 +148,13 @@ static display_type_t get_red_display(struct display_strategy *display_strategy,
 // implements f_get_display for the blue display
 static display_type_t get_blue_display(struct display_strategy *display_strategy, display_value_t *value, ht16k33blink_t *blink, ht16k33brightness_t *brightness) {
   struct view_data *view_data = (struct view_data*) display_strategy->userdata;
-  struct model *model = view_data->model;
-  const struct levelup *levelup = get_model_levelup(model);
-
 
   *blink = HT16K33_BLINK_OFF;
   *brightness = HT16K33_BRIGHTNESS_5;
 
-  if (levelup->animation_timer == 1) {
-    // go to the next frame in sequence.  Rollback to first if at end of array.
-    switch (levelup->animation_state) {
-    case DIAG_RISING_SLOW:
-    case DIAG_RISING_MED:
-    case DIAG_RISING_FAST:
-      view_data->blue_display =
-        (view_data->blue_display == (struct display_frame*)(&diag_rising + 1) - 1) ?
-        &diag_rising[0] : view_data->blue_display + 1;
-      break;
-    case FLATLINE:
-      view_data->blue_display =
-        (view_data->blue_display == (struct display_frame*)(&flatline + 1) - 1) ?
-        &flatline[0] : view_data->blue_display + 1;
-      break;
-    case DIAG_FALLING_SLOW:
-    case DIAG_FALLING_MED:
-    case DIAG_FALLING_FAST:
-      view_data->blue_display =
-        (view_data->blue_display == (struct display_frame*)(&diag_falling + 1) - 1) ?
-        &diag_falling[0] : view_data->blue_display + 1;
-      break;
-    default:
-      printf("how did I get here?\n");
-    }
-  }
-
-
-  (*value).display_glyph[0] = view_data->blue_display->glyph_blue[0];
-  (*value).display_glyph[1] = view_data->blue_display->glyph_blue[1];
-  (*value).display_glyph[2] = view_data->blue_display->glyph_blue[2];
-  (*value).display_glyph[3] = view_data->blue_display->glyph_blue[3];
+  // frame was advanced with the green display
+  memset((*value).display_glyph, 0, sizeof((*value).display_glyph));
+  ut3k_transition_apply(view_data->animation, 1, (*value).display_glyph);
 
   return glyph_display;
 }
@@ -237,49 +174,27 @@ static display_type_t get_green_display(struct display_strategy *display_strateg
   // first.  Better: create some actual instance methods on the view; not
   // sure yet how to do that without a hard coupling to the model.
   if (levelup->init_levelup_display == 1) {
-    switch (levelup->animation_state) {
-    case DIAG_RISING_SLOW:
-    default:
-      view_data->green_display = &diag_rising[0];
-      view_data->blue_display = &diag_rising[0];
-      break;
-    }
+    view_data->animation = get_animation(view_data, levelup->animation_state);
+    ut3k_transition_restart(view_data->animation);
     printf("init levelup display\n");
   }
 
 
   if (levelup->animation_timer == 1) {
-    // go to the next frame in sequence.  Rollback to first if at end of array.
-    switch (levelup->animation_state) {
-    case DIAG_RISING_SLOW:
-    case DIAG_RISING_MED:
-    case DIAG_RISING_FAST:
-      view_data->green_display =
-        (view_data->green_display == (struct display_frame*)(&diag_rising + 1) - 1) ?
-        &diag_rising[0] : view_data->green_display + 1;
-      break;
-    case FLATLINE:
-      view_data->green_display =
-        (view_data->green_display == (struct display_frame*)(&flatline + 1) - 1) ?
-        &flatline[0] : view_data->green_display + 1;
-      break;
-    case DIAG_FALLING_SLOW:
-    case DIAG_FALLING_MED:
-    case DIAG_FALLING_FAST:
-      view_data->green_display =
-        (view_data->green_display == (struct display_frame*)(&diag_falling + 1) - 1) ?
-        &diag_falling[0] : view_data->green_display + 1;
-      break;
-    default:
-      printf("how did I get here?\n");
+    // go to the next frame in sequence, looping back to the first.  A
+    // new animation state starts its animation from the top.
+    if (view_data->animation != get_animation(view_data, levelup->animation_state)) {
+      view_data->animation = get_animation(view_data, levelup->animation_state);
+      ut3k_transition_restart(view_data->animation);
+    }
+    else {
+      ut3k_transition_advance(view_data->animation);
     }
   }
 
 
-  (*value).display_glyph[0] = view_data->green_display->glyph_green[0];
-  (*value).display_glyph[1] = view_data->green_display->glyph_green[1];
-  (*value).display_glyph[2] = view_data->green_display->glyph_green[2];
-  (*value).display_glyph[3] = view_data->green_display->glyph_green[3];
+  memset((*value).display_glyph, 0, sizeof((*value).display_glyph));
+  ut3k_transition_apply(view_data->animation, 0, (*value).display_glyph);
 
   return glyph_display;
 }
@@ -300,3 +215,22 @@ static display_type_t get_leds_display(struct display_strategy *display_strategy
 }
 
 
+
+/* static ----------------------------------------------------------- */
+
+
+static struct ut3k_transition* get_animation(struct view_data *view_data, animation_state_t animation_state) {
+  switch (animation_state) {
+  case FLATLINE:
+    return &view_data->flatline;
+  case DIAG_FALLING_FAST:
+  case DIAG_FALLING_MED:
+  case DIAG_FALLING_SLOW:
+    return &view_data->diag_falling;
+  case DIAG_RISING_SLOW:
+  case DIAG_RISING_MED:
+  case DIAG_RISING_FAST:
+  default:
+    return &view_data->diag_rising;
+  }
+}
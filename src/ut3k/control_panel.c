@@ -17,50 +17,129 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "control_panel.h"
 
 
-// Addresses
-// Byte is offset from zero
-// Bit is number of bits to shift right to shift it to least significant
-static const int GREEN_ROTARY_ENCODER_BYTE = 5;
-static const int GREEN_ROTARY_ENCODER_PUSHBUTTON_BIT = 3;
-
-static const int GREEN_SELECTOR_BYTE = 2;
-static const int GREEN_SELECTOR_FIRST_BIT = 4;
-
-static const int GREEN_BUTTON_BYTE = 2;
-static const int GREEN_BUTTON_BIT = 0;
-
-
-static const int BLUE_SELECTOR_BYTE = 3;
-static const int BLUE_SELECTOR_FIRST_BIT = 0;
-
-static const int BLUE_ROTARY_ENCODER_BYTE = 0;
-static const int BLUE_ROTARY_ENCODER_PUSHBUTTON_BIT = 3;
-
-static const int BLUE_BUTTON_BYTE = 2;
-static const int BLUE_BUTTON_BIT = 1;
-
-static const int RED_ROTARY_ENCODER_BYTE = 0;
-static const int RED_ROTARY_ENCODER_PUSHBUTTON_BIT = 4;
-
-static const int RED_BUTTON_BYTE = 5;
-static const int RED_BUTTON_BIT = 0;
-
-static const int JOYSTICK_BYTE0 = 0;
-static const int JOYSTICK_BYTE1 = 1;
-static const int JOYSTICK_PUSHBUTTON_BIT = 3;
-
-
-static const int TOGGLES_BYTE = 4;
+// Where everything is wired on the original cabinet.  A keyscan bit
+// is numbered byte * 8 + bit, bit 0 being least significant.
+#define KEYSCAN_BIT(byte, bit) ((byte) * 8 + (bit))
+
+static const struct keyscan_map default_keyscan_map =
+  {
+   .bits =
+   {
+    [INPUT_GREEN_BUTTON] = { KEYSCAN_BIT(2, 0) },
+    [INPUT_BLUE_BUTTON] = { KEYSCAN_BIT(2, 1) },
+    [INPUT_RED_BUTTON] = { KEYSCAN_BIT(5, 0) },
+    [INPUT_GREEN_ENCODER_BUTTON] = { KEYSCAN_BIT(5, 3) },
+    [INPUT_BLUE_ENCODER_BUTTON] = { KEYSCAN_BIT(0, 3) },
+    [INPUT_RED_ENCODER_BUTTON] = { KEYSCAN_BIT(0, 4) },
+    [INPUT_JOYSTICK_BUTTON] = { KEYSCAN_BIT(1, 3) },
+    [INPUT_GREEN_SELECTOR] = { KEYSCAN_BIT(2, 4), KEYSCAN_BIT(2, 5), KEYSCAN_BIT(2, 6), KEYSCAN_BIT(2, 7) },
+    [INPUT_BLUE_SELECTOR] = { KEYSCAN_BIT(3, 0), KEYSCAN_BIT(3, 1), KEYSCAN_BIT(3, 2), KEYSCAN_BIT(3, 3) },
+    [INPUT_TOGGLES] = { KEYSCAN_BIT(4, 0), KEYSCAN_BIT(4, 1), KEYSCAN_BIT(4, 2), KEYSCAN_BIT(4, 3),
+                        KEYSCAN_BIT(4, 4), KEYSCAN_BIT(4, 5), KEYSCAN_BIT(4, 6), KEYSCAN_BIT(4, 7) },
+    // the joystick is 4 bits across two bytes.  Probably should have
+    // thought of that before wiring everything up, but hey, here it is.
+    [INPUT_JOYSTICK_DIRECTION] = { KEYSCAN_BIT(1, 0), KEYSCAN_BIT(1, 1), KEYSCAN_BIT(1, 2), KEYSCAN_BIT(0, 7) }
+   },
+   .bit_counts =
+   {
+    [INPUT_GREEN_BUTTON] = 1,
+    [INPUT_BLUE_BUTTON] = 1,
+    [INPUT_RED_BUTTON] = 1,
+    [INPUT_GREEN_ENCODER_BUTTON] = 1,
+    [INPUT_BLUE_ENCODER_BUTTON] = 1,
+    [INPUT_RED_ENCODER_BUTTON] = 1,
+    [INPUT_JOYSTICK_BUTTON] = 1,
+    [INPUT_GREEN_SELECTOR] = 4,
+    [INPUT_BLUE_SELECTOR] = 4,
+    [INPUT_TOGGLES] = 8,
+    [INPUT_JOYSTICK_DIRECTION] = 4
+   }
+  };
+
+#define KEYSCAN_BYTES 6
+#define INPUT_BIT(input) (1 << (input))
+#define MAX_KEYSCAN_RUNS UT3K_KEYSCAN_MAX_BITS
+
+#define DEFAULT_LONG_PRESS_UPDATES 25
+#define DEFAULT_DOUBLE_PRESS_UPDATES 8
+
+#define DEFAULT_JOYSTICK_REPEAT_DELAY_MSEC 400
+#define DEFAULT_JOYSTICK_REPEAT_INTERVAL_MSEC 100
+
+// mechanical switches bounce, buttons are clean enough
+#define DEFAULT_SWITCH_DEBOUNCE_UPDATES 2
+#define DEFAULT_BUTTON_DEBOUNCE_UPDATES 1
+
+struct encoder_carry;
 
 static void update_button(struct button *button, uint8_t value, uint32_t clock);
-static void update_rotary_encoder(struct rotary_encoder *encoder, unsigned long long int bit_queue, int queue_index);
+static void update_rotary_encoder(struct rotary_encoder *encoder, struct encoder_carry *carry, const struct encoder_transition *transitions, int count);
+static void decode_rotary_encoder(struct rotary_encoder *encoder, struct encoder_carry *carry, const struct encoder_transition *transitions, int count);
+static int accelerate_detent(struct rotary_encoder *encoder, uint64_t timestamp_ns, uint16_t *velocity);
 static void update_selector(struct selector *selector, uint8_t value);
 static void update_toggles(struct toggles *toggles, uint8_t value);
 static void update_joystick(struct joystick *joystick, uint8_t value);
+static void repeat_joystick(struct control_panel *this);
+static int compile_keyscan_map(struct control_panel *this, const struct keyscan_map *map);
+static uint8_t gather_input(const struct control_panel *this, input_id_t input, const uint8_t *keyscan);
+static void init_debounce(struct control_panel *this, input_id_t input, uint8_t updates);
+static void debounce_keyscan(struct control_panel *this, ht16k33keyscan_t keyscan);
+static void decode_input(struct control_panel *this, input_id_t input, ht16k33keyscan_t keyscan, uint32_t clock);
+static void age_input(struct control_panel *this, input_id_t input);
+static void button_events(struct control_panel *this, input_id_t input, const struct button *button);
+static void emit_event(struct control_panel *this, input_event_type_t type, input_id_t input, int value, uint8_t index);
+static void rotate_event(struct control_panel *this, rotary_encoder_id_t id, input_id_t input, const struct rotary_encoder *encoder);
+
+
+// joystick contacts up, down, left, right in bits 0 - 3 to a direction:
+// every combination, opposites cancelling
+static const enum direction joystick_directions[16] =
+  {
+   [0b0000] = JOY_CENTERED,   [0b0001] = JOY_UP,
+   [0b0010] = JOY_DOWN,       [0b0011] = JOY_CENTERED,
+   [0b0100] = JOY_LEFT,       [0b0101] = JOY_UP_LEFT,
+   [0b0110] = JOY_DOWN_LEFT,  [0b0111] = JOY_LEFT,
+   [0b1000] = JOY_RIGHT,      [0b1001] = JOY_UP_RIGHT,
+   [0b1010] = JOY_DOWN_RIGHT, [0b1011] = JOY_RIGHT,
+   [0b1100] = JOY_CENTERED,   [0b1101] = JOY_UP,
+   [0b1110] = JOY_DOWN,       [0b1111] = JOY_CENTERED
+  };
+
+//                                             U   D   L   R   C  UL  UR  DL  DR
+static const int8_t joystick_x[JOY_DIRECTIONS] = { 0,  0, -1,  1,  0, -1,  1, -1,  1 };
+static const int8_t joystick_y[JOY_DIRECTIONS] = { 1, -1,  0,  0,  0,  1,  1, -1, -1 };
+
+
+// a run of neighbouring keyscan bits landing on neighbouring bits of
+// an input's value:
+//   value |= (keyscan[byte] & mask) >> shift << position
+struct keyscan_run {
+  uint8_t byte;
+  uint8_t mask;
+  uint8_t shift;
+  uint8_t position;
+};
+
+
+// detents the encoder fast path found since the last update
+struct encoder_carry {
+  int8_t encoder_delta;
+  int16_t accelerated_delta;
+  uint16_t velocity;
+};
+
+
+// per button, for long and double presses
+struct press_tracker {
+  uint32_t last_press_update;
+  int pressed_before;
+  int long_press_sent;
+};
 
 
 struct control_panel {
@@ -77,10 +156,48 @@ struct control_panel {
   struct button red_button;
 
   struct toggles toggles;
+
+  struct encoder_carry encoder_carries[3];  // by rotary_encoder_id_t
+
+  // keyscan decode, compiled from the keyscan map: the input each bit
+  // belongs to (INPUT_COUNT for none), the runs of bits making up each
+  // input, the last keyscan and, for each byte, which inputs
+  // (INPUT_BIT mask) a change to each combination of its bits touches
+  uint8_t bit_inputs[KEYSCAN_BYTES][8];
+  struct keyscan_run runs[INPUT_COUNT][MAX_KEYSCAN_RUNS];
+  uint8_t run_counts[INPUT_COUNT];
+  ht16k33keyscan_t last_keyscan;
+  uint16_t changed_inputs[KEYSCAN_BYTES][256];
+
+  // debounce: each bit shifts its raw readings into a history and the
+  // filtered keyscan only follows once the last window's worth agree.
+  // Bits that agree with the filtered keyscan all through their window
+  // are settled and skipped.
+  uint8_t debounce_updates[INPUT_COUNT];
+  uint32_t debounce_windows[KEYSCAN_BYTES][8];
+  uint32_t debounce_histories[KEYSCAN_BYTES][8];
+  ht16k33keyscan_t filtered_keyscan;
+  ht16k33keyscan_t debouncing;  // bits not yet settled
+
+  // input events
+  struct panel_input_event events[INPUT_EVENT_RING_SIZE];
+  uint32_t events_head;  // count of events ever emitted
+  struct press_tracker press_trackers[INPUT_COUNT];
+  uint32_t updates;
+  uint32_t long_press_updates;
+  uint32_t double_press_updates;
+  uint32_t clock;
+  uint64_t timestamp_ns;
+
+  // joystick auto-repeat: when it last moved and the repeats since
+  uint64_t joystick_repeat_delay_ns;
+  uint64_t joystick_repeat_interval_ns;
+  uint64_t joystick_moved_ns;
+  uint32_t joystick_repeats;
 };
 
 
-struct control_panel* create_control_panel(ht16k33keyscan_t keyscan) {
+struct control_panel* create_control_panel(ht16k33keyscan_t keyscan, const struct keyscan_map *map) {
   struct control_panel *this = (struct control_panel*) malloc(sizeof(struct control_panel));
 
   /* initialize stuff before processing keyscan that needs it,
@@ -114,18 +231,65 @@ struct control_panel* create_control_panel(ht16k33keyscan_t keyscan) {
      .direction_previous = JOY_CENTERED,
      .state_count = 0,
      .previous_bits = 0,
+     .repeat = 0,
      .button = { 0 }
     };
+  set_control_panel_joystick_repeat(this, DEFAULT_JOYSTICK_REPEAT_DELAY_MSEC, DEFAULT_JOYSTICK_REPEAT_INTERVAL_MSEC);
+  this->joystick_moved_ns = 0;
+  this->joystick_repeats = 0;
 
-  this->green_encoder = (struct rotary_encoder const) { 0 };
-  this->blue_encoder = (struct rotary_encoder const) { 0 };
-  this->red_encoder = (struct rotary_encoder const) { 0 };
+  // the pins are pulled up: at rest on a detent they read 11
+  this->green_encoder = (struct rotary_encoder const) { .previous_ab = 0b11, .acceleration = { .max_multiplier = 1 } };
+  this->blue_encoder = (struct rotary_encoder const) { .previous_ab = 0b11, .acceleration = { .max_multiplier = 1 } };
+  this->red_encoder = (struct rotary_encoder const) { .previous_ab = 0b11, .acceleration = { .max_multiplier = 1 } };
+  memset(this->encoder_carries, 0, sizeof(this->encoder_carries));
 
   this->toggles = (struct toggles const) { 0 };
 
+  memset(this->press_trackers, 0, sizeof(this->press_trackers));
+  this->events_head = 0;
+  this->updates = 0;
+  this->long_press_updates = DEFAULT_LONG_PRESS_UPDATES;
+  this->double_press_updates = DEFAULT_DOUBLE_PRESS_UPDATES;
+
+  if (map == NULL) {
+    map = &default_keyscan_map;
+  }
+  if (compile_keyscan_map(this, map) != 0) {
+    printf("create_control_panel: bad keyscan map, using the default\n");
+    compile_keyscan_map(this, &default_keyscan_map);
+  }
+
+  // every bit "changed" so the first keyscan decodes everything
+  memcpy(this->filtered_keyscan, keyscan, sizeof(ht16k33keyscan_t));
+  for (int byte = 0; byte < KEYSCAN_BYTES; ++byte) {
+    this->last_keyscan[byte] = ~keyscan[byte];
+  }
+
+  // bits not wired to anything pass straight through
+  memset(this->debouncing, 0, sizeof(ht16k33keyscan_t));
+  memset(this->debounce_histories, 0, sizeof(this->debounce_histories));
+  for (int byte = 0; byte < KEYSCAN_BYTES; ++byte) {
+    for (int bit = 0; bit < 8; ++bit) {
+      this->debounce_windows[byte][bit] = 0b1;
+    }
+  }
+  for (input_id_t input = 0; input < INPUT_COUNT; ++input) {
+    init_debounce(this, input, DEFAULT_BUTTON_DEBOUNCE_UPDATES);
+  }
+  init_debounce(this, INPUT_GREEN_SELECTOR, DEFAULT_SWITCH_DEBOUNCE_UPDATES);
+  init_debounce(this, INPUT_BLUE_SELECTOR, DEFAULT_SWITCH_DEBOUNCE_UPDATES);
+  init_debounce(this, INPUT_TOGGLES, DEFAULT_SWITCH_DEBOUNCE_UPDATES);
+
   // this is mainly for more stateful input devices:
   // toggle switches, selectors
-  update_control_panel(this, keyscan, 0, 0, 0, 0, 0, 0, 0);
+  update_control_panel(this, keyscan, NULL, 0, NULL, 0, NULL, 0, 0, 0);
+
+  // where things start isn't news.  Nor is the clock it was read at: a
+  // replay's updates bring the recorded times, so repeats are timed
+  // from the first of them.
+  this->events_head = 0;
+  this->joystick_moved_ns = 0;
 
   return this;
 }
@@ -141,50 +305,123 @@ void free_control_panel(struct control_panel *this) {
 
 int update_control_panel(struct control_panel *this,
 			 ht16k33keyscan_t keyscan,
-			 unsigned long long int green_bit_queue,
-			 int green_queue_index,
-			 unsigned long long int blue_bit_queue,
-			 int blue_queue_index,
-			 unsigned long long int red_bit_queue,
-			 int red_queue_index,
-			 uint32_t clock) {
-  // Update buttons
-  update_button(&(this->green_button), ht16k33keyscan_byte(&keyscan, GREEN_BUTTON_BYTE) >> GREEN_BUTTON_BIT & 0b1, clock);
-  update_button(&(this->blue_button), ht16k33keyscan_byte(&keyscan, BLUE_BUTTON_BYTE) >> BLUE_BUTTON_BIT & 0b1, clock);
-  update_button(&(this->red_button), ht16k33keyscan_byte(&keyscan, RED_BUTTON_BYTE) >> RED_BUTTON_BIT & 0b1, clock);
+			 const struct encoder_transition *green_transitions,
+			 int green_count,
+			 const struct encoder_transition *blue_transitions,
+			 int blue_count,
+			 const struct encoder_transition *red_transitions,
+			 int red_count,
+			 uint32_t clock,
+			 uint64_t timestamp_ns) {
+  struct timespec now;
+  uint16_t changed = 0;
+
+  if (timestamp_ns == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timestamp_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  }
+  this->timestamp_ns = timestamp_ns;
+  this->clock = clock;
+  this->updates++;
 
-  // rotary encoder buttons are treated the same
-  update_button(&(this->green_encoder.button), ht16k33keyscan_byte(&keyscan, GREEN_ROTARY_ENCODER_BYTE) >> GREEN_ROTARY_ENCODER_PUSHBUTTON_BIT & 0b1, clock);
-  update_button(&(this->blue_encoder.button), ht16k33keyscan_byte(&keyscan, BLUE_ROTARY_ENCODER_BYTE) >> BLUE_ROTARY_ENCODER_PUSHBUTTON_BIT & 0b1, clock);
-  update_button(&(this->red_encoder.button), ht16k33keyscan_byte(&keyscan, RED_ROTARY_ENCODER_BYTE) >> RED_ROTARY_ENCODER_PUSHBUTTON_BIT & 0b1, clock);
+  debounce_keyscan(this, keyscan);
 
-  // the three encoders
-  update_rotary_encoder(&(this->green_encoder), green_bit_queue, green_queue_index);
-  update_rotary_encoder(&(this->blue_encoder), blue_bit_queue, blue_queue_index);
-  update_rotary_encoder(&(this->red_encoder), red_bit_queue, red_queue_index);
+  // which inputs have bits that changed since the last keyscan.  Most
+  // keyscans are the same as the one before: nothing to decode, every
+  // input has just been in its state for one more update.
+  for (int byte = 0; byte < KEYSCAN_BYTES; ++byte) {
+    changed |= this->changed_inputs[byte][this->filtered_keyscan[byte] ^ this->last_keyscan[byte]];
+  }
+  memcpy(this->last_keyscan, this->filtered_keyscan, sizeof(ht16k33keyscan_t));
 
-  // the two selectors
-  update_selector(&(this->green_selector), ht16k33keyscan_byte(&keyscan, GREEN_SELECTOR_BYTE) >> GREEN_SELECTOR_FIRST_BIT & 0b1111);
-  update_selector(&(this->blue_selector), ht16k33keyscan_byte(&keyscan, BLUE_SELECTOR_BYTE) >> BLUE_SELECTOR_FIRST_BIT & 0b1111);
+  for (input_id_t input = 0; input < INPUT_COUNT; ++input) {
+    if (changed & INPUT_BIT(input)) {
+      decode_input(this, input, this->filtered_keyscan, clock);
+    }
+    else {
+      age_input(this, input);
+    }
+  }
 
-  // toggle switches
-  update_toggles(&(this->toggles), ht16k33keyscan_byte(&keyscan, TOGGLES_BYTE));
+  // the three encoders
+  update_rotary_encoder(&(this->green_encoder), &this->encoder_carries[GREEN_ROTARY_ENCODER], green_transitions, green_count);
+  update_rotary_encoder(&(this->blue_encoder), &this->encoder_carries[BLUE_ROTARY_ENCODER], blue_transitions, blue_count);
+  update_rotary_encoder(&(this->red_encoder), &this->encoder_carries[RED_ROTARY_ENCODER], red_transitions, red_count);
+
+  // events for whatever changed
+  rotate_event(this, GREEN_ROTARY_ENCODER, INPUT_GREEN_ENCODER_BUTTON, &this->green_encoder);
+  rotate_event(this, BLUE_ROTARY_ENCODER, INPUT_BLUE_ENCODER_BUTTON, &this->blue_encoder);
+  rotate_event(this, RED_ROTARY_ENCODER, INPUT_RED_ENCODER_BUTTON, &this->red_encoder);
+
+  button_events(this, INPUT_GREEN_BUTTON, &this->green_button);
+  button_events(this, INPUT_BLUE_BUTTON, &this->blue_button);
+  button_events(this, INPUT_RED_BUTTON, &this->red_button);
+  button_events(this, INPUT_GREEN_ENCODER_BUTTON, &this->green_encoder.button);
+  button_events(this, INPUT_BLUE_ENCODER_BUTTON, &this->blue_encoder.button);
+  button_events(this, INPUT_RED_ENCODER_BUTTON, &this->red_encoder.button);
+  button_events(this, INPUT_JOYSTICK_BUTTON, &this->red_joystick.button);
+
+  if (this->green_selector.state_count == 0) {
+    emit_event(this, INPUT_SELECTOR, INPUT_GREEN_SELECTOR, this->green_selector.selector_state, 0);
+  }
+  if (this->blue_selector.state_count == 0) {
+    emit_event(this, INPUT_SELECTOR, INPUT_BLUE_SELECTOR, this->blue_selector.selector_state, 0);
+  }
 
-  // joystick pushbutton
-  update_button(&(this->red_joystick.button), ht16k33keyscan_byte(&keyscan, JOYSTICK_BYTE1) >> JOYSTICK_PUSHBUTTON_BIT & 0b1, clock);
+  if (this->toggles.state_count == 0) {
+    for (int toggle = 0; toggle < 8; ++toggle) {
+      if (this->toggles.toggles_toggled & (1 << toggle)) {
+        emit_event(this, INPUT_TOGGLE, INPUT_TOGGLES, (this->toggles.toggles_state >> toggle) & 0b1, toggle);
+      }
+    }
+  }
 
-  // and finally the joystick
-  // the joystick is 5 bits across two bytes.  Probably should have
-  // thought of that before wiring everything up, but hey, here it is.
-  update_joystick(&(this->red_joystick),
-		  (ht16k33keyscan_byte(&keyscan, JOYSTICK_BYTE1) & 0b111) |
-		  (ht16k33keyscan_byte(&keyscan, JOYSTICK_BYTE0) & 0b10000000));
+  repeat_joystick(this);
+  if (this->red_joystick.state_count == 0) {
+    emit_event(this, INPUT_JOYSTICK, INPUT_JOYSTICK_DIRECTION, this->red_joystick.direction, 0);
+  }
+  for (int repeat = 0; repeat < this->red_joystick.repeat; ++repeat) {
+    emit_event(this, INPUT_JOYSTICK, INPUT_JOYSTICK_DIRECTION, this->red_joystick.direction, 1);
+  }
 
   return 0;
 }
 
 
 
+int update_control_panel_encoders(struct control_panel *this,
+                                  const struct encoder_transition *green_transitions,
+                                  int green_count,
+                                  const struct encoder_transition *blue_transitions,
+                                  int blue_count,
+                                  const struct encoder_transition *red_transitions,
+                                  int red_count,
+                                  struct encoder_deltas *deltas) {
+  struct rotary_encoder *encoders[3] = { &this->green_encoder, &this->blue_encoder, &this->red_encoder };
+  const struct encoder_transition *transitions[3] = { green_transitions, blue_transitions, red_transitions };
+  int counts[3] = { green_count, blue_count, red_count };
+  struct encoder_carry found;
+  int moved = 0;
+
+  for (int id = 0; id < 3; ++id) {
+    found = (struct encoder_carry const) { 0 };
+    decode_rotary_encoder(encoders[id], &found, transitions[id], counts[id]);
+
+    deltas->encoder_delta[id] = found.encoder_delta;
+    deltas->accelerated_delta[id] = found.accelerated_delta;
+    if (found.encoder_delta != 0) {
+      this->encoder_carries[id].encoder_delta += found.encoder_delta;
+      this->encoder_carries[id].accelerated_delta += found.accelerated_delta;
+      this->encoder_carries[id].velocity = found.velocity;
+      moved = 1;
+    }
+  }
+
+  return moved;
+}
+
+
+
 const struct button* get_green_button(const struct control_panel *this) {
   return (const struct button*) &(this->green_button);
 }
@@ -212,6 +449,21 @@ const struct rotary_encoder* get_red_rotary_encoder(const struct control_panel *
 }
 
 
+void set_rotary_encoder_acceleration(struct control_panel *this, rotary_encoder_id_t encoder, const struct encoder_acceleration *acceleration) {
+  switch (encoder) {
+  case GREEN_ROTARY_ENCODER:
+    this->green_encoder.acceleration = *acceleration;
+    break;
+  case BLUE_ROTARY_ENCODER:
+    this->blue_encoder.acceleration = *acceleration;
+    break;
+  case RED_ROTARY_ENCODER:
+    this->red_encoder.acceleration = *acceleration;
+    break;
+  }
+}
+
+
 const struct selector* get_green_selector(const struct control_panel *this) {
   return (const struct selector*) &(this->green_selector);
 }
@@ -228,9 +480,360 @@ const struct joystick* get_joystick(const struct control_panel *this) {
   return (const struct joystick*) &(this->red_joystick);
 }
 
+int read_input_events(const struct control_panel *this, uint32_t *cursor, struct panel_input_event events[], int max) {
+  int count = 0;
+
+  if (this->events_head - *cursor > INPUT_EVENT_RING_SIZE) {
+    *cursor = this->events_head - INPUT_EVENT_RING_SIZE;
+  }
+
+  while (*cursor != this->events_head && count < max) {
+    events[count++] = this->events[*cursor % INPUT_EVENT_RING_SIZE];
+    ++*cursor;
+  }
+
+  return count;
+}
+
+
+int joystick_direction_x(enum direction direction) {
+  return direction < JOY_DIRECTIONS ? joystick_x[direction] : 0;
+}
+
+
+int joystick_direction_y(enum direction direction) {
+  return direction < JOY_DIRECTIONS ? joystick_y[direction] : 0;
+}
+
+
+void set_control_panel_joystick_repeat(struct control_panel *this, uint32_t delay_msec, uint32_t interval_msec) {
+  this->joystick_repeat_delay_ns = (uint64_t) delay_msec * 1000000;
+  this->joystick_repeat_interval_ns = (uint64_t) (interval_msec ? interval_msec : 1) * 1000000;
+}
+
+
+void set_control_panel_event_timing(struct control_panel *this, uint32_t long_press_updates, uint32_t double_press_updates) {
+  this->long_press_updates = long_press_updates;
+  this->double_press_updates = double_press_updates;
+}
+
+
+const struct keyscan_map* get_default_keyscan_map() {
+  return &default_keyscan_map;
+}
+
+
+void set_control_panel_debounce(struct control_panel *this, input_id_t input, uint8_t updates) {
+  if (input >= INPUT_COUNT) {
+    return;
+  }
+  init_debounce(this, input, updates);
+}
+
+
 /* internal functions ***************************************************/
 
 
+/** compile_keyscan_map
+ *
+ * turn the map into the decode tables: which input owns each bit,
+ * the runs to gather each input's value from and the inputs touched
+ * by any change to a byte.  Returns -1 if the map is no good: bits out
+ * of range, wired to two inputs or the wrong count for the input.
+ */
+static int compile_keyscan_map(struct control_panel *this, const struct keyscan_map *map) {
+  struct keyscan_run *run;
+  int byte, bit;
+
+  memset(this->bit_inputs, INPUT_COUNT, sizeof(this->bit_inputs));
+
+  for (input_id_t input = 0; input < INPUT_COUNT; ++input) {
+    if (map->bit_counts[input] != default_keyscan_map.bit_counts[input]) {
+      return -1;
+    }
+
+    this->run_counts[input] = 0;
+    run = NULL;
+    for (int position = 0; position < map->bit_counts[input]; ++position) {
+      if (map->bits[input][position] >= KEYSCAN_BYTES * 8) {
+        return -1;
+      }
+      byte = map->bits[input][position] / 8;
+      bit = map->bits[input][position] % 8;
+      if (this->bit_inputs[byte][bit] != INPUT_COUNT) {
+        return -1;
+      }
+      this->bit_inputs[byte][bit] = input;
+
+      // carry on the run if this bit is next to the last one both in
+      // the keyscan and in the value
+      if (run != NULL && run->byte == byte &&
+          bit == run->shift + __builtin_popcount(run->mask) &&
+          position == run->position + __builtin_popcount(run->mask)) {
+        run->mask |= 1 << bit;
+      }
+      else {
+        run = &this->runs[input][this->run_counts[input]++];
+        *run = (struct keyscan_run const) { .byte = byte, .mask = 1 << bit, .shift = bit, .position = position };
+      }
+    }
+  }
+
+  for (byte = 0; byte < KEYSCAN_BYTES; ++byte) {
+    for (int diff = 0; diff < 256; ++diff) {
+      this->changed_inputs[byte][diff] = 0;
+      for (bit = 0; bit < 8; ++bit) {
+        if ((diff & (1 << bit)) && this->bit_inputs[byte][bit] != INPUT_COUNT) {
+          this->changed_inputs[byte][diff] |= INPUT_BIT(this->bit_inputs[byte][bit]);
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+/** gather_input
+ *
+ * an input's value out of the keyscan, first bit of its map in bit 0.
+ */
+static uint8_t gather_input(const struct control_panel *this, input_id_t input, const uint8_t *keyscan) {
+  const struct keyscan_run *run = this->runs[input];
+  uint8_t value = 0;
+
+  for (int i = 0; i < this->run_counts[input]; ++i, ++run) {
+    value |= (keyscan[run->byte] & run->mask) >> run->shift << run->position;
+  }
+  return value;
+}
+
+
+/** init_debounce
+ *
+ * window the input's bits over the last updates readings, 1 being
+ * no filtering.  Their history starts over as agreeing with the
+ * filtered keyscan.
+ */
+static void init_debounce(struct control_panel *this, input_id_t input, uint8_t updates) {
+  uint32_t window;
+
+  if (updates < 1) {
+    updates = 1;
+  }
+  else if (updates > UT3K_MAX_DEBOUNCE_UPDATES) {
+    updates = UT3K_MAX_DEBOUNCE_UPDATES;
+  }
+  this->debounce_updates[input] = updates;
+  window = updates == 32 ? 0xFFFFFFFF : (1u << updates) - 1;
+
+  for (int byte = 0; byte < KEYSCAN_BYTES; ++byte) {
+    for (int bit = 0; bit < 8; ++bit) {
+      if (this->bit_inputs[byte][bit] == input) {
+        this->debounce_windows[byte][bit] = window;
+        this->debounce_histories[byte][bit] = (this->filtered_keyscan[byte] >> bit & 0b1) ? 0xFFFFFFFF : 0;
+        this->debouncing[byte] &= ~(1 << bit);
+      }
+    }
+  }
+}
+
+
+/** debounce_keyscan
+ *
+ * update filtered_keyscan from a raw keyscan.  A bit only needs
+ * looking at if it's unsettled or reads different from its filtered
+ * value: a panel nobody is touching is six compares.
+ */
+static void debounce_keyscan(struct control_panel *this, ht16k33keyscan_t keyscan) {
+  uint8_t raw, unsettled;
+  uint32_t history, window;
+
+  for (int byte = 0; byte < KEYSCAN_BYTES; ++byte) {
+    raw = ht16k33keyscan_byte(&keyscan, byte);
+    unsettled = this->debouncing[byte] | (raw ^ this->filtered_keyscan[byte]);
+
+    for (int bit = 0; unsettled != 0; ++bit, unsettled >>= 1) {
+      if ((unsettled & 0b1) == 0) {
+        continue;
+      }
+
+      history = this->debounce_histories[byte][bit] << 1 | (raw >> bit & 0b1);
+      this->debounce_histories[byte][bit] = history;
+      window = this->debounce_windows[byte][bit];
+
+      if ((history & window) == window) {
+        this->filtered_keyscan[byte] |= 1 << bit;
+        this->debouncing[byte] &= ~(1 << bit);
+      }
+      else if ((history & window) == 0) {
+        this->filtered_keyscan[byte] &= ~(1 << bit);
+        this->debouncing[byte] &= ~(1 << bit);
+      }
+      else {
+        this->debouncing[byte] |= 1 << bit;
+      }
+    }
+  }
+}
+
+
+/** decode_input
+ *
+ * an input's keyscan bits changed: work out its new state.
+ */
+static void decode_input(struct control_panel *this, input_id_t input, ht16k33keyscan_t keyscan, uint32_t clock) {
+  uint8_t value = gather_input(this, input, keyscan);
+
+  switch (input) {
+  case INPUT_GREEN_BUTTON:
+    update_button(&(this->green_button), value, clock);
+    break;
+  case INPUT_BLUE_BUTTON:
+    update_button(&(this->blue_button), value, clock);
+    break;
+  case INPUT_RED_BUTTON:
+    update_button(&(this->red_button), value, clock);
+    break;
+
+  // rotary encoder buttons are treated the same
+  case INPUT_GREEN_ENCODER_BUTTON:
+    update_button(&(this->green_encoder.button), value, clock);
+    break;
+  case INPUT_BLUE_ENCODER_BUTTON:
+    update_button(&(this->blue_encoder.button), value, clock);
+    break;
+  case INPUT_RED_ENCODER_BUTTON:
+    update_button(&(this->red_encoder.button), value, clock);
+    break;
+
+  case INPUT_JOYSTICK_BUTTON:
+    update_button(&(this->red_joystick.button), value, clock);
+    break;
+
+  case INPUT_GREEN_SELECTOR:
+    update_selector(&(this->green_selector), value);
+    break;
+  case INPUT_BLUE_SELECTOR:
+    update_selector(&(this->blue_selector), value);
+    break;
+
+  case INPUT_TOGGLES:
+    update_toggles(&(this->toggles), value);
+    break;
+
+  case INPUT_JOYSTICK_DIRECTION:
+    update_joystick(&(this->red_joystick), value);
+    break;
+
+  default:
+    break;
+  }
+}
+
+
+/** age_input
+ *
+ * an input's keyscan bits are as they were: one more update in the
+ * same state.
+ */
+static void age_input(struct control_panel *this, input_id_t input) {
+  switch (input) {
+  case INPUT_GREEN_BUTTON:
+    this->green_button.state_count++;
+    break;
+  case INPUT_BLUE_BUTTON:
+    this->blue_button.state_count++;
+    break;
+  case INPUT_RED_BUTTON:
+    this->red_button.state_count++;
+    break;
+  case INPUT_GREEN_ENCODER_BUTTON:
+    this->green_encoder.button.state_count++;
+    break;
+  case INPUT_BLUE_ENCODER_BUTTON:
+    this->blue_encoder.button.state_count++;
+    break;
+  case INPUT_RED_ENCODER_BUTTON:
+    this->red_encoder.button.state_count++;
+    break;
+  case INPUT_JOYSTICK_BUTTON:
+    this->red_joystick.button.state_count++;
+    break;
+  case INPUT_GREEN_SELECTOR:
+    this->green_selector.state_count++;
+    break;
+  case INPUT_BLUE_SELECTOR:
+    this->blue_selector.state_count++;
+    break;
+  case INPUT_TOGGLES:
+    this->toggles.state_count++;
+    break;
+  case INPUT_JOYSTICK_DIRECTION:
+    this->red_joystick.state_count++;
+    break;
+  default:
+    break;
+  }
+}
+
+
+
+static void button_events(struct control_panel *this, input_id_t input, const struct button *button) {
+  struct press_tracker *tracker = &this->press_trackers[input];
+
+  if (button->state_count == 0) {
+    if (button->button_state) {
+      emit_event(this, INPUT_PRESS, input, 1, 0);
+      if (tracker->pressed_before &&
+          this->updates - tracker->last_press_update <= this->double_press_updates) {
+        emit_event(this, INPUT_DOUBLE_PRESS, input, 1, 0);
+        tracker->pressed_before = 0;  // a third press starts over
+      }
+      else {
+        tracker->pressed_before = 1;
+      }
+      tracker->last_press_update = this->updates;
+      tracker->long_press_sent = 0;
+    }
+    else {
+      emit_event(this, INPUT_RELEASE, input, 0, 0);
+    }
+  }
+  else if (button->button_state && !tracker->long_press_sent &&
+           button->state_count >= this->long_press_updates) {
+    emit_event(this, INPUT_LONG_PRESS, input, 1, 0);
+    tracker->long_press_sent = 1;
+  }
+}
+
+
+static void emit_event(struct control_panel *this, input_event_type_t type, input_id_t input, int value, uint8_t index) {
+  this->events[this->events_head % INPUT_EVENT_RING_SIZE] = (struct panel_input_event const)
+    {
+     .type = type,
+     .input = input,
+     .value = value,
+     .index = index,
+     .clock = this->clock,
+     .timestamp_ns = this->timestamp_ns,
+     .cause = this->events_head + 1
+    };
+  this->events_head++;
+}
+
+
+// stamped with the encoder's last detent: that's when the knob moved,
+// which can be a good while before the update that sees it
+static void rotate_event(struct control_panel *this, rotary_encoder_id_t id, input_id_t input, const struct rotary_encoder *encoder) {
+  if (encoder->encoder_delta != 0) {
+    emit_event(this, INPUT_ROTATE, input, encoder->accelerated_delta, id);
+    this->events[(this->events_head - 1) % INPUT_EVENT_RING_SIZE].timestamp_ns = encoder->last_detent_ns;
+  }
+}
+
+
+
 
 static void update_button(struct button *button, uint8_t value, uint32_t clock) {
   if (value != button->button_state) {
@@ -252,36 +855,49 @@ static void update_button(struct button *button, uint8_t value, uint32_t clock)
 // rotary encoders: out with the HT16K33, rewired the internals to use
 // the Raspberry Pi directly.  And whatdya know, 20ms between the
 // HT16K33 reads was definitely not enough.  Anyway, that changes the
-// interface here a bit.  The update call takes a queue (reference
-// ut3k_view.c update_rotary_encoder) of B,A values readings from the
-// encoder.  This function replays the history, draining the queue.
+// interface here a bit.  The update call takes the transitions
+// (reference ut3k_view.c poll_rotary_encoders) the encoder went through
+// since the last update.  This function replays the history.
 //
-// Provided the queue has at least 4 bits (two samples/reading of A/B)
-// grab the oldest 4 bits.  Do a table lookup.  Shift the 4-bit window
-// by 2 to more recent A/B samples.  Accumulate values this way, record
-// an actual delta when state of AB == 11 is reached.  The accumulation
-// is persistent in the rotary_encoder struct, so the next reading may
-// progress the accumulation value.
+// Each transition makes a 4-bit window of the previous and the new B,A
+// state.  Do a table lookup.  Accumulate values this way, record an
+// actual delta when state of AB == 11 is reached.  The accumulation and
+// the previous state are persistent in the rotary_encoder struct, so
+// the next update may progress the accumulation value.
 // 
 
 static const int lookup_table[] = {0,-1,1,0,1,0,0,-1,-1,0,0,1,0,1,-1,0};
 
 
-static void update_rotary_encoder(struct rotary_encoder *encoder, unsigned long long int bit_queue, int queue_index) {
-  uint8_t encoder_state;
+static void update_rotary_encoder(struct rotary_encoder *encoder, struct encoder_carry *carry, const struct encoder_transition *transitions, int count) {
+  // start from whatever the fast path already found
+  decode_rotary_encoder(encoder, carry, transitions, count);
 
-  encoder->encoder_delta = 0;
+  encoder->encoder_delta = carry->encoder_delta;
+  encoder->accelerated_delta = carry->accelerated_delta;
+  encoder->velocity = carry->velocity;
+  *carry = (struct encoder_carry const) { 0 };
+}
 
-  // process the queue.  Producing a delta requires getting a couple
-  // samples in the 20ms loop.
-  // loop while we have at least 4 bits
-  while (queue_index > 3) {
-    encoder_state = (bit_queue >> (queue_index - 4)) & 0b1111;
+
+// run the transitions through the encoder, adding the detents to carry
+static void decode_rotary_encoder(struct rotary_encoder *encoder, struct encoder_carry *carry, const struct encoder_transition *transitions, int count) {
+  uint8_t encoder_state;
+
+  for (int i = 0; i < count; ++i) {
+    encoder_state = (encoder->previous_ab << 2) | (transitions[i].ab & 0b11);
+    encoder->previous_ab = transitions[i].ab & 0b11;
     encoder->accumulator += lookup_table[encoder_state];
-    queue_index -= 2;
 
     if ((encoder_state & 0b11) == 0b11) {
-      encoder->encoder_delta += encoder->accumulator > 0 ? 1 : -1;
+      if (encoder->accumulator > 0) {
+        carry->encoder_delta++;
+        carry->accelerated_delta += accelerate_detent(encoder, transitions[i].timestamp_ns, &carry->velocity);
+      }
+      else {
+        carry->encoder_delta--;
+        carry->accelerated_delta -= accelerate_detent(encoder, transitions[i].timestamp_ns, &carry->velocity);
+      }
       encoder->accumulator = 0;
     }
 
@@ -290,6 +906,43 @@ static void update_rotary_encoder(struct rotary_encoder *encoder, unsigned long
 }
 
 
+/** accelerate_detent
+ *
+ * how many detents a detent at timestamp_ns counts for, going by the
+ * time since the one before.  Also works out the velocity.
+ */
+static int accelerate_detent(struct rotary_encoder *encoder, uint64_t timestamp_ns, uint16_t *velocity) {
+  const struct encoder_acceleration *curve = &encoder->acceleration;
+  uint64_t interval_usec = (timestamp_ns - encoder->last_detent_ns) / 1000;
+  uint32_t ramp;  // 0 at slow_detent_usec - 256 at fast_detent_usec
+
+  if (encoder->last_detent_ns == 0 || timestamp_ns <= encoder->last_detent_ns) {
+    interval_usec = UINT32_MAX;
+  }
+  encoder->last_detent_ns = timestamp_ns;
+  // detents pushed microseconds apart would wrap a uint16_t
+  if (interval_usec >= 1000000) {
+    *velocity = 1;
+  }
+  else if (interval_usec <= 1000000 / UINT16_MAX) {
+    *velocity = UINT16_MAX;
+  }
+  else {
+    *velocity = 1000000 / interval_usec;
+  }
+
+  if (curve->max_multiplier <= 1 || interval_usec >= curve->slow_detent_usec) {
+    return 1;
+  }
+  if (interval_usec <= curve->fast_detent_usec || curve->slow_detent_usec <= curve->fast_detent_usec) {
+    return curve->max_multiplier;
+  }
+
+  ramp = (curve->slow_detent_usec - interval_usec) * 256 / (curve->slow_detent_usec - curve->fast_detent_usec);
+  return 1 + (((curve->max_multiplier - 1) * ramp * ramp + 32768) >> 16);
+}
+
+
 /** update_selector
  * the funny thing about the selectors are they may make contact with
  * the second contact before disconnecting from the first.  make
@@ -351,33 +1004,50 @@ static void update_toggles(struct toggles *toggles, uint8_t value) {
 
 
 static void update_joystick(struct joystick *joystick, uint8_t value) {
-  if (joystick->previous_bits != value) {
-    // something changed, assume it's a single bit and
-    // that the joystick can only point one direction
+  enum direction direction = joystick_directions[value & 0b1111];
+
+  joystick->previous_bits = value;
+  // a contact that changes nothing (the third of a cancelled pair, say)
+  // doesn't count as a move
+  if (direction != joystick->direction) {
     joystick->direction_previous = joystick->direction;
+    joystick->direction = direction;
     joystick->state_count = 0;
-    joystick->previous_bits = value;
-    switch (value) {
-    case 0b0000:
-    default:
-      joystick->direction = JOY_CENTERED;
-      break;
-    case 0b0001:
-      joystick->direction = JOY_UP;
-      break;
-    case 0b0010:
-      joystick->direction = JOY_DOWN;
-      break;
-    case 0b0100:
-      joystick->direction = JOY_LEFT;
-      break;
-    case 0b10000000:
-      joystick->direction = JOY_RIGHT;
-      break;
-    }
   }
   else {
     joystick->state_count++;
   }
 
 }
+
+
+/** repeat_joystick
+ *
+ * repeats due by the update's timestamp, less those already sent.
+ * More than one if the updates are further apart than the interval.
+ */
+static void repeat_joystick(struct control_panel *this) {
+  struct joystick *joystick = &this->red_joystick;
+  uint64_t held_ns;
+  uint32_t due;
+
+  joystick->repeat = 0;
+
+  if (joystick->state_count == 0 || this->joystick_moved_ns == 0) {
+    this->joystick_moved_ns = this->timestamp_ns;
+    this->joystick_repeats = 0;
+    return;
+  }
+  if (joystick->direction == JOY_CENTERED || this->joystick_repeat_delay_ns == 0) {
+    return;
+  }
+
+  held_ns = this->timestamp_ns - this->joystick_moved_ns;
+  if (held_ns < this->joystick_repeat_delay_ns) {
+    return;
+  }
+
+  due = 1 + (held_ns - this->joystick_repeat_delay_ns) / this->joystick_repeat_interval_ns;
+  joystick->repeat = due - this->joystick_repeats > UINT8_MAX ? UINT8_MAX : due - this->joystick_repeats;
+  this->joystick_repeats = due;
+}
@@ -33,13 +33,25 @@
 struct control_panel;
 
 
+// a rotary encoder reaching a new A/B state: A in bit 0, B in bit 1.
+// timestamp_ns is CLOCK_MONOTONIC, as the GPIO line events have it.
+struct encoder_transition {
+  uint64_t timestamp_ns;
+  uint8_t ab;
+};
+
+
+struct keyscan_map;
+
 /** create_control_panel
  *
  * construct a control panel.  This object is reponsible for state of
  * all user interface gadgets on the front panel.  The keyscan
- * represent the initial state of the control panel.
+ * represent the initial state of the control panel, the map where
+ * each input is wired: NULL for the original cabinet (see
+ * get_default_keyscan_map).
  */
-struct control_panel* create_control_panel(ht16k33keyscan_t keyscan);
+struct control_panel* create_control_panel(ht16k33keyscan_t keyscan, const struct keyscan_map *map);
 
 
 /** free any resources allocated for the control panel
@@ -57,19 +69,47 @@ void free_control_panel(struct control_panel *this);
  * this function is expected to be called at regular intervals:
  * the counts that are provided in the various accessor methods
  * are based upon calls to update_panel to increment the counts.
- * queues of 64 bits from each rotary encoder are provided as well.
- * The queues are expected to be interweaved A/B values from the
- * rotary encoder pins.
+ * The transitions of each rotary encoder since the last call are
+ * provided as well, oldest first.  timestamp_ns is when the keyscan
+ * was read, CLOCK_MONOTONIC, or 0 for now: a replay passes the
+ * recorded time so timed things (joystick auto-repeat) come out the
+ * same.
  */
 int update_control_panel(struct control_panel *this,
 			 ht16k33keyscan_t keyscan,
-			 unsigned long long int green_bit_queue,
-			 int green_queue_index,
-			 unsigned long long int blue_bit_queue,
-			 int blue_queue_index,
-			 unsigned long long int red_bit_queue,
-			 int red_queue_index,
-			 uint32_t clock);
+			 const struct encoder_transition *green_transitions,
+			 int green_count,
+			 const struct encoder_transition *blue_transitions,
+			 int blue_count,
+			 const struct encoder_transition *red_transitions,
+			 int red_count,
+			 uint32_t clock,
+			 uint64_t timestamp_ns);
+
+
+// detents found by update_control_panel_encoders, by rotary_encoder_id_t
+struct encoder_deltas {
+  int8_t encoder_delta[3];
+  int16_t accelerated_delta[3];
+};
+
+/** update_control_panel_encoders
+ *
+ * encoder fast path: decode transitions between keyscans.  The detents
+ * found go into deltas and are also held for the next
+ * update_control_panel, so its encoder_delta and accelerated_delta
+ * still cover everything since the last keyscan.  The transitions
+ * handed to update_control_panel are then only the ones since.
+ * Returns non-zero if any encoder moved a detent.
+ */
+int update_control_panel_encoders(struct control_panel *this,
+                                  const struct encoder_transition *green_transitions,
+                                  int green_count,
+                                  const struct encoder_transition *blue_transitions,
+                                  int blue_count,
+                                  const struct encoder_transition *red_transitions,
+                                  int red_count,
+                                  struct encoder_deltas *deltas);
 
 
 
@@ -97,15 +137,33 @@ const struct button* get_red_button(const struct control_panel *this);
 
 
 
+typedef enum { GREEN_ROTARY_ENCODER, BLUE_ROTARY_ENCODER, RED_ROTARY_ENCODER } rotary_encoder_id_t;
+
+// acceleration curve: detents closer together than slow_detent_usec
+// count for more, up to max_multiplier at fast_detent_usec or closer.
+// The multiplier ramps up along a square curve in between, so the
+// knob stays precise until it's really spun.  max_multiplier 1 (the
+// default) turns acceleration off.
+struct encoder_acceleration {
+  uint32_t slow_detent_usec;
+  uint32_t fast_detent_usec;
+  uint8_t max_multiplier;
+};
+
 // these rotary encoders include a push button
 struct rotary_encoder {
   int8_t encoder_delta;  // -1, 0, 1: what you're probably most interested in
+  int16_t accelerated_delta;  // encoder_delta with the acceleration curve applied
+  uint16_t velocity;  // detents per second at the last detent, 0 if none this update
   struct button button;  // the press button
 
   // guru meditation: this ought to be hidden from the user, it's an
   // implementation detail.  Accumulator holds how many states the
-  // encoder passed through.
+  // encoder passed through, previous_ab the last of them.
   int8_t accumulator;
+  uint8_t previous_ab;
+  uint64_t last_detent_ns;
+  struct encoder_acceleration acceleration;
 };
 
 /** get encoders
@@ -115,6 +173,12 @@ const struct rotary_encoder* get_green_rotary_encoder(const struct control_panel
 const struct rotary_encoder* get_blue_rotary_encoder(const struct control_panel *this);
 const struct rotary_encoder* get_red_rotary_encoder(const struct control_panel *this);
 
+/** set_rotary_encoder_acceleration
+ *
+ * set the curve for accelerated_delta on one encoder.
+ */
+void set_rotary_encoder_acceleration(struct control_panel *this, rotary_encoder_id_t encoder, const struct encoder_acceleration *acceleration);
+
 
 
 
@@ -138,18 +202,35 @@ const struct selector* get_blue_selector(const struct control_panel *this);
 
 
 
-// joystick is only a single direction and includes a pushbutton
-enum direction { JOY_UP, JOY_DOWN, JOY_LEFT, JOY_RIGHT, JOY_CENTERED };
+// joystick points one of eight ways and includes a pushbutton.
+// Opposite contacts made together cancel out.
+enum direction { JOY_UP, JOY_DOWN, JOY_LEFT, JOY_RIGHT, JOY_CENTERED,
+                 JOY_UP_LEFT, JOY_UP_RIGHT, JOY_DOWN_LEFT, JOY_DOWN_RIGHT,
+                 JOY_DIRECTIONS };
 struct joystick {
   enum direction direction;
   enum direction direction_previous;
   uint32_t state_count;
   uint8_t previous_bits;
+  uint8_t repeat;  // auto-repeats due this update: treat each as another push
   struct button button;
 };
 
 const struct joystick* get_joystick(const struct control_panel *this);
 
+// the direction as steps on each axis: x -1 left, 1 right, y -1 down, 1 up
+int joystick_direction_x(enum direction direction);
+int joystick_direction_y(enum direction direction);
+
+/** set_control_panel_joystick_repeat
+ *
+ * held off center for delay_msec, the joystick repeats every
+ * interval_msec.  Timed from the updates' timestamps, so repeats keep
+ * pace however often the panel is updated.  delay_msec 0 turns
+ * repeats off.  Default 400ms, then every 100ms.
+ */
+void set_control_panel_joystick_repeat(struct control_panel *this, uint32_t delay_msec, uint32_t interval_msec);
+
 
 // toggle switches we do as a single byte
 struct toggles {
@@ -161,4 +242,113 @@ struct toggles {
 
 const struct toggles* get_toggles(const struct control_panel *this);
 
+
+
+/*** Input events ****/
+
+// update_control_panel also reports what changed as a stream of
+// events, so a game can look at only what happened instead of going
+// through every input each tick.  Events go on a ring of
+// INPUT_EVENT_RING_SIZE; each reader keeps its own cursor.
+
+#define INPUT_EVENT_RING_SIZE 64
+
+typedef enum {
+  INPUT_PRESS,         // buttons, including the encoder and joystick buttons
+  INPUT_RELEASE,
+  INPUT_LONG_PRESS,    // held long_press_updates, once per press
+  INPUT_DOUBLE_PRESS,  // pressed again within double_press_updates of the last press
+  INPUT_SELECTOR,      // value is the new selector_value
+  INPUT_TOGGLE,        // index is the switch, value its new state
+  INPUT_JOYSTICK,      // value is the new direction, index 1 for an auto-repeat
+  INPUT_ROTATE,        // input is the encoder's button, index its rotary_encoder_id_t,
+                       // value the accelerated_delta
+  INPUT_EVENT_TYPE_COUNT
+} input_event_type_t;
+
+typedef enum {
+  INPUT_GREEN_BUTTON,
+  INPUT_BLUE_BUTTON,
+  INPUT_RED_BUTTON,
+  INPUT_GREEN_ENCODER_BUTTON,
+  INPUT_BLUE_ENCODER_BUTTON,
+  INPUT_RED_ENCODER_BUTTON,
+  INPUT_JOYSTICK_BUTTON,
+  INPUT_GREEN_SELECTOR,
+  INPUT_BLUE_SELECTOR,
+  INPUT_TOGGLES,
+  INPUT_JOYSTICK_DIRECTION,
+  INPUT_COUNT
+} input_id_t;
+
+struct panel_input_event {
+  input_event_type_t type;
+  input_id_t input;
+  int value;
+  uint8_t index;
+  uint32_t clock;         // game clock of the update that saw it
+  uint64_t timestamp_ns;  // CLOCK_MONOTONIC at that update, of the last detent for INPUT_ROTATE
+  uint32_t cause;         // causal ID for latency tracking, never 0 (see ut3k_latency.h)
+};
+
+/** read_input_events
+ *
+ * copy out up to max events that came in since *cursor and move the
+ * cursor past them.  Start the cursor at 0.  A reader that falls more
+ * than a ring behind loses the oldest events.  Returns the count.
+ */
+int read_input_events(const struct control_panel *this, uint32_t *cursor, struct panel_input_event events[], int max);
+
+/** set_control_panel_event_timing
+ *
+ * counted in calls to update_control_panel, like state_count.
+ * Defaults: long press 25, double press 8 (about 1s and 320ms when
+ * updating every other 20ms tick).
+ */
+void set_control_panel_event_timing(struct control_panel *this, uint32_t long_press_updates, uint32_t double_press_updates);
+
+
+/*** Keyscan map ****/
+
+// Which keyscan bits make up each input, numbered byte * 8 + bit with
+// bit 0 least significant.  The first bit listed becomes bit 0 of the
+// input's value:
+//   buttons: 1 bit
+//   selectors: 4 bits, positions zero to three
+//   toggles: 8 bits, switch 0 first
+//   joystick direction: 4 bits, up, down, left, right
+// The map is compiled into decode tables when the control panel is
+// created, so any wiring decodes as fast as any other.
+
+#define UT3K_KEYSCAN_MAX_BITS 8
+
+struct keyscan_map {
+  uint8_t bits[INPUT_COUNT][UT3K_KEYSCAN_MAX_BITS];
+  uint8_t bit_counts[INPUT_COUNT];
+};
+
+/** get_default_keyscan_map
+ *
+ * how the original cabinet is wired.  Copy it as a starting point for
+ * a rewired one.
+ */
+const struct keyscan_map* get_default_keyscan_map();
+
+
+/*** Debounce ****/
+
+// Keyscan bits are filtered before they're decoded: an input only
+// changes once it has read the same for its debounce window, counted
+// in calls to update_control_panel.  1 is no filtering and the
+// quickest response.  Defaults: 2 for the selectors and toggles, 1 for
+// everything else.
+
+#define UT3K_MAX_DEBOUNCE_UPDATES 32
+
+/** set_control_panel_debounce
+ *
+ * set the debounce window of one input, 1 - UT3K_MAX_DEBOUNCE_UPDATES.
+ */
+void set_control_panel_debounce(struct control_panel *this, input_id_t input, uint8_t updates);
+
 #endif // CONTROL_PANEL_H
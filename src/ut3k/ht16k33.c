@@ -502,6 +502,26 @@ int HT16K33_COMMIT(HT16K33 *backpack) {
 }
 
 
+/**
+ * Write length bytes of values straight to display RAM, starting at
+ * address (0x00 - 0x0F).  The display buffer isn't touched, so this is
+ * for callers keeping their own idea of what's on the chip, e.g. to
+ * only send the few bytes that changed.
+ */
+int HT16K33_WRITE_RAM(HT16K33 *backpack, uint8_t address, uint8_t length, const uint8_t *values) {
+  if(backpack->adapter_fd == -1) {
+    backpack->lasterr = -1;
+    return -1;
+  }
+
+  if (address + length > 16) {
+    return -1;
+  }
+
+  return i2c_smbus_write_i2c_block_data(backpack->adapter_fd, address, length, values);
+}
+
+
 
 /**
  * Read the key data from the HT16K33.
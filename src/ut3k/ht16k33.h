@@ -239,6 +239,11 @@ int HT16K33_CLEAN_DIGIT(HT16K33 *backpack, unsigned short digit);
  * Data must be saved to the buffer calling HT16K33_UPDATE_DIGIT() before calling this one.
  */
 int HT16K33_COMMIT(HT16K33 *backpack);
+/**
+ * Write a run of bytes directly to display RAM, bypassing the display
+ * buffer.  address + length must not exceed 16.
+ */
+int HT16K33_WRITE_RAM(HT16K33 *backpack, uint8_t address, uint8_t length, const uint8_t *values);
 
 
 /**
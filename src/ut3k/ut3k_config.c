@@ -0,0 +1,284 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ut3k_config.h"
+
+
+#define CONFIG_DEBOUNCE_GROUP "debounce"
+#define CONFIG_HARDWARE_GROUP "hardware"
+#define CONFIG_KEYSCAN_GROUP CONFIG_HARDWARE_GROUP ".keyscan"
+#define CONFIG_VIRTUAL_PANEL_GROUP "virtual_panel"
+
+static const char *input_names[INPUT_COUNT] =
+  {
+   "green_button",
+   "blue_button",
+   "red_button",
+   "green_encoder_button",
+   "blue_encoder_button",
+   "red_encoder_button",
+   "joystick_button",
+   "green_selector",
+   "blue_selector",
+   "toggles",
+   "joystick_direction"
+  };
+
+static const char *display_address_names[UT3K_CONFIG_DISPLAYS] =
+  {
+   "green_display_address",
+   "blue_display_address",
+   "red_display_address",
+   "inputs_and_leds_address"
+  };
+
+static const char *virtual_action_names[VIRTUAL_ACTION_COUNT] =
+  {
+   "green_button", "blue_button", "red_button",
+   "green_encoder_button", "blue_encoder_button", "red_encoder_button",
+   "joystick_button",
+   "green_selector_0", "green_selector_1", "green_selector_2", "green_selector_3",
+   "blue_selector_0", "blue_selector_1", "blue_selector_2", "blue_selector_3",
+   "toggle_0", "toggle_1", "toggle_2", "toggle_3",
+   "toggle_4", "toggle_5", "toggle_6", "toggle_7",
+   "joystick_up", "joystick_down", "joystick_left", "joystick_right",
+   "green_encoder_cw", "green_encoder_ccw",
+   "blue_encoder_cw", "blue_encoder_ccw",
+   "red_encoder_cw", "red_encoder_ccw"
+  };
+
+// buttons down the left hand, selectors on the number row, toggles
+// along the top row, joystick on hjkl and the encoders in pairs
+static const char default_virtual_keys[VIRTUAL_ACTION_COUNT] =
+  {
+   'a', 's', 'd',
+   'z', 'x', 'c',
+   ' ',
+   '1', '2', '3', '4',
+   '5', '6', '7', '8',
+   'q', 'w', 'e', 'r', 't', 'y', 'u', 'i',
+   'k', 'j', 'h', 'l',
+   'g', 'f',
+   'b', 'v',
+   'm', 'n'
+  };
+
+// the original cabinet, less the keyscan map which comes from the
+// control panel
+static const struct ut3k_hardware_map default_hardware =
+  {
+   .i2c_adapter = 1,
+   .display_addresses = { HT16K33_ADDR_07, HT16K33_ADDR_06, HT16K33_ADDR_05, HT16K33_ADDR_04 },
+   .gpio_chip = "/dev/gpiochip0",
+   .encoder_lines = { 16, 26, 6, 13, 12, 25 },
+   .reset_button_line = 23
+  };
+
+static struct ut3k_config ut3k_config;
+static int loaded = 0;
+
+static int load_debounce(const config_t *cfg);
+static int load_hardware(const config_t *cfg);
+static int load_keyscan_map(const config_t *cfg);
+static int load_virtual_keys(const config_t *cfg);
+
+
+
+int load_ut3k_config(const config_t *cfg) {
+  memset(&ut3k_config, 0, sizeof(ut3k_config));
+  ut3k_config.hardware = default_hardware;
+  memcpy(&ut3k_config.hardware.keyscan, get_default_keyscan_map(), sizeof(struct keyscan_map));
+  memcpy(ut3k_config.virtual_keys, default_virtual_keys, sizeof(default_virtual_keys));
+  loaded = 1;
+
+  if (cfg == NULL) {
+    return 0;
+  }
+
+  return load_debounce(cfg) + load_hardware(cfg) + load_keyscan_map(cfg) + load_virtual_keys(cfg);
+}
+
+
+const struct ut3k_config* get_ut3k_config() {
+  if (!loaded) {
+    load_ut3k_config(NULL);
+  }
+  return &ut3k_config;
+}
+
+
+const char* ut3k_config_input_name(input_id_t input) {
+  return input < INPUT_COUNT ? input_names[input] : NULL;
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+static int load_debounce(const config_t *cfg) {
+  char path[64];
+  int value, found = 0;
+
+  for (input_id_t input = 0; input < INPUT_COUNT; ++input) {
+    snprintf(path, sizeof(path), "%s.%s", CONFIG_DEBOUNCE_GROUP, input_names[input]);
+    if (config_lookup_int(cfg, path, &value) == CONFIG_TRUE) {
+      if (value < 1 || value > UT3K_MAX_DEBOUNCE_UPDATES) {
+        printf("load_ut3k_config: %s out of range 1 - %d, ignored\n", path, UT3K_MAX_DEBOUNCE_UPDATES);
+        continue;
+      }
+      ut3k_config.debounce_updates[input] = value;
+      found++;
+    }
+  }
+
+  return found;
+}
+
+
+static int load_hardware(const config_t *cfg) {
+  struct ut3k_hardware_map *hardware = &ut3k_config.hardware;
+  config_setting_t *setting;
+  char path[64];
+  const char *string;
+  int value, found = 0;
+
+  if (config_lookup_int(cfg, CONFIG_HARDWARE_GROUP ".i2c_adapter", &value) == CONFIG_TRUE) {
+    hardware->i2c_adapter = value;
+    found++;
+  }
+
+  for (int display = 0; display < UT3K_CONFIG_DISPLAYS; ++display) {
+    snprintf(path, sizeof(path), "%s.%s", CONFIG_HARDWARE_GROUP, display_address_names[display]);
+    if (config_lookup_int(cfg, path, &value) == CONFIG_TRUE) {
+      if (value < HT16K33_ADDR_01 || value > HT16K33_ADDR_08) {
+        printf("load_ut3k_config: %s 0x%x isn't an HT16K33 address, ignored\n", path, value);
+        continue;
+      }
+      hardware->display_addresses[display] = value;
+      found++;
+    }
+  }
+
+  if (config_lookup_string(cfg, CONFIG_HARDWARE_GROUP ".gpio_chip", &string) == CONFIG_TRUE) {
+    snprintf(hardware->gpio_chip, sizeof(hardware->gpio_chip), "%s", string);
+    found++;
+  }
+
+  setting = config_lookup(cfg, CONFIG_HARDWARE_GROUP ".encoder_lines");
+  if (setting != NULL) {
+    if (config_setting_length(setting) != UT3K_CONFIG_ENCODER_LINES) {
+      printf("load_ut3k_config: encoder_lines needs %d lines, ignored\n", UT3K_CONFIG_ENCODER_LINES);
+    }
+    else {
+      for (int line = 0; line < UT3K_CONFIG_ENCODER_LINES; ++line) {
+        hardware->encoder_lines[line] = config_setting_get_int_elem(setting, line);
+      }
+      found++;
+    }
+  }
+
+  setting = config_lookup(cfg, CONFIG_HARDWARE_GROUP ".encoder_devices");
+  if (setting != NULL) {
+    if (config_setting_length(setting) != UT3K_CONFIG_ENCODERS) {
+      printf("load_ut3k_config: encoder_devices needs %d devices, ignored\n", UT3K_CONFIG_ENCODERS);
+    }
+    else {
+      for (int encoder = 0; encoder < UT3K_CONFIG_ENCODERS; ++encoder) {
+        string = config_setting_get_string_elem(setting, encoder);
+        snprintf(hardware->encoder_devices[encoder], sizeof(hardware->encoder_devices[encoder]),
+                 "%s", string != NULL ? string : "");
+      }
+      found++;
+    }
+  }
+
+  if (config_lookup_int(cfg, CONFIG_HARDWARE_GROUP ".reset_button_line", &value) == CONFIG_TRUE) {
+    hardware->reset_button_line = value;
+    found++;
+  }
+
+  return found;
+}
+
+
+/** load_keyscan_map
+ *
+ * inputs are checked for their bit count and range here.  Bits wired
+ * to two inputs are caught when the control panel compiles the map.
+ */
+static int load_keyscan_map(const config_t *cfg) {
+  struct keyscan_map *map = &ut3k_config.hardware.keyscan;
+  config_setting_t *setting;
+  char path[64];
+  int bit, length, found = 0;
+
+  for (input_id_t input = 0; input < INPUT_COUNT; ++input) {
+    snprintf(path, sizeof(path), "%s.%s", CONFIG_KEYSCAN_GROUP, input_names[input]);
+    setting = config_lookup(cfg, path);
+    if (setting == NULL) {
+      continue;
+    }
+
+    length = config_setting_length(setting);
+    if (length != map->bit_counts[input]) {
+      printf("load_ut3k_config: %s needs %d bits, ignored\n", path, map->bit_counts[input]);
+      continue;
+    }
+
+    for (bit = 0; bit < length; ++bit) {
+      if (config_setting_get_int_elem(setting, bit) < 0 ||
+          config_setting_get_int_elem(setting, bit) >= (int) sizeof(ht16k33keyscan_t) * 8) {
+        break;
+      }
+    }
+    if (bit < length) {
+      printf("load_ut3k_config: %s has a bit outside the keyscan, ignored\n", path);
+      continue;
+    }
+
+    for (bit = 0; bit < length; ++bit) {
+      map->bits[input][bit] = config_setting_get_int_elem(setting, bit);
+    }
+    found++;
+  }
+
+  return found;
+}
+
+
+static int load_virtual_keys(const config_t *cfg) {
+  char path[64];
+  const char *key;
+  int found = 0;
+
+  for (virtual_action_t action = 0; action < VIRTUAL_ACTION_COUNT; ++action) {
+    snprintf(path, sizeof(path), "%s.%s", CONFIG_VIRTUAL_PANEL_GROUP, virtual_action_names[action]);
+    if (config_lookup_string(cfg, path, &key) == CONFIG_TRUE) {
+      if (strlen(key) != 1) {
+        printf("load_ut3k_config: %s should be one character, ignored\n", path);
+        continue;
+      }
+      ut3k_config.virtual_keys[action] = key[0];
+      found++;
+    }
+  }
+
+  return found;
+}
@@ -0,0 +1,106 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/* ut3k_config.h
+ *
+ * Cabinet settings out of ultratroninator.config, the config file
+ * every game includes.  These are about the machine rather than the
+ * game: each cabinet's switches are a bit different.
+ *
+ * Load them before creating the view, which picks them up:
+ *   load_ut3k_config(cfg);
+ *   view = create_alphanum_ut3k_view();
+ *
+ * Settings:
+ *   debounce = { green_selector = 2; toggles = 3; ... };
+ *     debounce window per input, counted in control panel updates.
+ *     Inputs are named as input_id_t without the INPUT_ prefix, in
+ *     lower case.  Anything not set keeps the control panel default.
+ *
+ *   hardware = { ... };
+ *     how the cabinet is wired, so a rewired or second revision
+ *     cabinet doesn't need every game rebuilt:
+ *       i2c_adapter = 1;               the N in /dev/i2c-N
+ *       green_display_address = 0x76;  and blue_, red_, inputs_and_leds_
+ *       gpio_chip = "/dev/gpiochip0";
+ *       encoder_lines = [ 16, 26, 6, 13, 12, 25 ];
+ *                                      green A, B, blue A, B, red A, B
+ *       encoder_devices = [ "/dev/input/event1", ... ];
+ *                                      green, blue, red: read the encoders
+ *                                      through the kernel driver instead of
+ *                                      encoder_lines, see ut3k_encoder_evdev.h
+ *       reset_button_line = 23;        the mcp's reset button
+ *       keyscan = { green_button = [ 16 ]; green_selector = [ 20, 21, 22, 23 ]; ... };
+ *                                      see struct keyscan_map
+ *     Anything not set is as the original cabinet.
+ *
+ *   virtual_panel = { green_button = "a"; toggle_0 = "q"; ... };
+ *     keys for the virtual control panel (ut3k_virtual_panel.h), one
+ *     character each, " " for the space bar.  Names are as
+ *     virtual_action_t without the VIRTUAL_ prefix, in lower case.
+ */
+
+#ifndef UT3K_CONFIG_H
+#define UT3K_CONFIG_H
+
+#include <stdint.h>
+#include <libconfig.h>
+
+#include "control_panel.h"
+#include "ut3k_virtual_panel.h"
+
+
+#define UT3K_CONFIG_DISPLAYS 4
+#define UT3K_CONFIG_ENCODER_LINES 6
+#define UT3K_CONFIG_ENCODERS 3
+
+
+struct ut3k_hardware_map {
+  int i2c_adapter;
+  // green, blue, red displays then the inputs and LEDs chip
+  uint8_t display_addresses[UT3K_CONFIG_DISPLAYS];
+  char gpio_chip[64];
+  // green A, green B, blue A, blue B, red A, red B
+  uint32_t encoder_lines[UT3K_CONFIG_ENCODER_LINES];
+  // evdev devices for green, blue, red: empty to use encoder_lines
+  char encoder_devices[UT3K_CONFIG_ENCODERS][64];
+  uint32_t reset_button_line;
+  struct keyscan_map keyscan;
+};
+
+struct ut3k_config {
+  uint8_t debounce_updates[INPUT_COUNT];  // 0: not set
+  struct ut3k_hardware_map hardware;
+  char virtual_keys[VIRTUAL_ACTION_COUNT];
+};
+
+
+/** load_ut3k_config
+ *
+ * read the cabinet settings.  A NULL config (no config file) leaves
+ * everything at the defaults.  Returns the count of settings found.
+ */
+int load_ut3k_config(const config_t *cfg);
+
+// the settings last loaded, the defaults if none have been
+const struct ut3k_config* get_ut3k_config();
+
+// name of an input as used in the config, NULL if out of range
+const char* ut3k_config_input_name(input_id_t input);
+
+
+#endif
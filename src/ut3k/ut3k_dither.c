@@ -0,0 +1,172 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "ut3k_dither.h"
+
+
+// LEDs sit on COM4 - COM6 of their chip, the displays start at COM0
+#define LEDS_DISPLAY 3
+#define LEDS_FIRST_COM 4
+
+static void update_masks(struct ut3k_dither *this, int display, int digit);
+static int write_run(HT16K33 *chip, uint8_t shown[16], const uint8_t target[16], int start, int end, struct ut3k_dither_cost *cost);
+static inline uint32_t write_bus_usec(int bytes);
+
+
+
+void init_ut3k_dither(struct ut3k_dither *this, int depth, uint32_t frame_usec) {
+  if (depth < 1) {
+    depth = 1;
+  }
+  else if (depth > UT3K_DITHER_MAX_DEPTH) {
+    depth = UT3K_DITHER_MAX_DEPTH;
+  }
+
+  this->depth = depth;
+  this->frame_usec = frame_usec;
+
+  // everything full on.  Masks for RAM not covered by a digit (unused
+  // COM lines) stay all ones so whatever is in the buffer goes through.
+  memset(this->levels, depth, sizeof(this->levels));
+  memset(this->masks, 0xFF, sizeof(this->masks));
+
+  this->last_cost = (struct ut3k_dither_cost const) { 0 };
+  this->total_cost = (struct ut3k_dither_cost const) { 0 };
+  this->ticks = 0;
+}
+
+
+void set_dither_level(struct ut3k_dither *this, int display, int digit, uint16_t segments, uint8_t level) {
+  if (display < 0 || display >= UT3K_DITHER_DISPLAYS ||
+      digit < 0 || digit >= (display == LEDS_DISPLAY ? UT3K_DITHER_LEDS : 4)) {
+    return;
+  }
+
+  if (level > this->depth) {
+    level = this->depth;
+  }
+
+  for (int bit = 0; bit < 16; ++bit) {
+    if (segments & (1 << bit)) {
+      this->levels[display][digit][bit] = level;
+    }
+  }
+
+  update_masks(this, display, digit);
+}
+
+
+void set_dither_display_level(struct ut3k_dither *this, int display, uint8_t level) {
+  int digits = display == LEDS_DISPLAY ? UT3K_DITHER_LEDS : 4;
+
+  for (int digit = 0; digit < digits; ++digit) {
+    set_dither_level(this, display, digit, 0xFFFF, level);
+  }
+}
+
+
+/** ut3k_dither_write_subframe
+ *
+ * find runs of changed bytes.  A run keeps going over unchanged bytes
+ * while resending them costs fewer bus bits than the overhead of
+ * another write; costs are independent per gap so deciding each gap on
+ * its own gives the cheapest set of writes.
+ */
+int ut3k_dither_write_subframe(HT16K33 *chip, uint8_t shown[16], const uint8_t target[16], int full, struct ut3k_dither_cost *cost) {
+  int rc = 0;
+  int start, end;
+  int i = 0;
+
+  if (full) {
+    return write_run(chip, shown, target, 0, 16, cost);
+  }
+
+  while (i < 16) {
+    while (i < 16 && shown[i] == target[i]) {
+      ++i;
+    }
+    if (i == 16) {
+      break;
+    }
+
+    start = i;
+    end = i + 1;  // one past the last changed byte in the run
+    for (i = end; i < 16; ++i) {
+      if ((i - end) * UT3K_I2C_BYTE_BITS > UT3K_I2C_WRITE_OVERHEAD_BITS) {
+        break;
+      }
+      if (shown[i] != target[i]) {
+        end = i + 1;
+      }
+    }
+
+    rc |= write_run(chip, shown, target, start, end, cost);
+    i = end;
+  }
+
+  return rc;
+}
+
+
+uint32_t ut3k_dither_worst_case_usec(const struct ut3k_dither *this) {
+  return this->depth * UT3K_DITHER_DISPLAYS * write_bus_usec(16);
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+/** update_masks
+ *
+ * rebuild the subframe masks for one digit: a segment is lit in
+ * subframe k while its level is greater than k.
+ */
+static void update_masks(struct ut3k_dither *this, int display, int digit) {
+  int com = display == LEDS_DISPLAY ? LEDS_FIRST_COM + digit : digit;
+  uint16_t mask;
+
+  for (int subframe = 0; subframe < this->depth; ++subframe) {
+    mask = 0;
+    for (int bit = 0; bit < 16; ++bit) {
+      if (this->levels[display][digit][bit] > subframe) {
+        mask |= 1 << bit;
+      }
+    }
+    this->masks[display][subframe][2 * com] = (uint8_t) mask;
+    this->masks[display][subframe][2 * com + 1] = (uint8_t) (mask >> 8);
+  }
+}
+
+
+static int write_run(HT16K33 *chip, uint8_t shown[16], const uint8_t target[16], int start, int end, struct ut3k_dither_cost *cost) {
+  int length = end - start;
+
+  memcpy(&shown[start], &target[start], length);
+
+  cost->writes++;
+  cost->bytes += length;
+  cost->bus_usec += write_bus_usec(length);
+
+  return HT16K33_WRITE_RAM(chip, start, length, &target[start]);
+}
+
+
+static inline uint32_t write_bus_usec(int bytes) {
+  uint32_t bits = UT3K_I2C_WRITE_OVERHEAD_BITS + bytes * UT3K_I2C_BYTE_BITS;
+  return (bits * 1000000 + UT3K_I2C_BUS_HZ - 1) / UT3K_I2C_BUS_HZ;
+}
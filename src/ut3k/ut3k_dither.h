@@ -0,0 +1,124 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* ut3k_dither.h
+ *
+ * Temporal dithering for per-segment and per-LED brightness.
+ * HT16K33 dimming is one setting for the whole chip, so to get a dim
+ * digit next to a bright one the tick is cut into depth subframes and
+ * each segment is lit for level of them:
+ *   level 0      : off
+ *   level depth  : on for the whole tick (the default)
+ *   in between   : on for the first level subframes
+ *
+ * Subframes are written with HT16K33_WRITE_RAM, only sending the bytes
+ * that differ from what's already on the chip.  Runs of changed bytes
+ * separated by a short gap are merged into one write when resending the
+ * gap is cheaper than starting another i2c transaction.  The cost of
+ * each tick is kept so a game can decide how much depth it can afford
+ * at its loop time.
+ *
+ * Use with commit_ut3k_view_dithered in ut3k_view.h.
+ */
+
+#ifndef UT3K_DITHER_H
+#define UT3K_DITHER_H
+
+#include <stdint.h>
+
+#include "ht16k33.h"
+
+#define UT3K_DITHER_MAX_DEPTH 8
+
+// green, blue, red displays then the LEDs: same order as ut3k_display
+#define UT3K_DITHER_DISPLAYS 4
+#define UT3K_DITHER_LEDS 3
+
+// raspberry pi default i2c baudrate.  Bump this if the bus has been
+// set to 400kHz in config.txt, the estimates follow.
+#define UT3K_I2C_BUS_HZ 100000
+
+// bits per i2c write transaction not counting the data bytes:
+// start + address byte + register byte (each with ack) + stop
+#define UT3K_I2C_WRITE_OVERHEAD_BITS (1 + 9 + 9 + 1)
+#define UT3K_I2C_BYTE_BITS 9
+
+
+struct ut3k_dither_cost {
+  uint32_t writes;    // i2c write transactions
+  uint32_t bytes;     // data bytes written
+  uint32_t bus_usec;  // estimated time on the bus
+};
+
+
+struct ut3k_dither {
+  int depth;            // subframes per tick, 1 - UT3K_DITHER_MAX_DEPTH
+  uint32_t frame_usec;  // subframes are spread over this much time
+
+  // per-segment level, indexed as the ut3k_display glyphs:
+  // [display][digit][segment bit]
+  uint8_t levels[UT3K_DITHER_DISPLAYS][4][16];
+
+  // derived from levels: display RAM mask for each subframe
+  uint8_t masks[UT3K_DITHER_DISPLAYS][UT3K_DITHER_MAX_DEPTH][16];
+
+  struct ut3k_dither_cost last_cost;   // cost of the most recent tick
+  struct ut3k_dither_cost total_cost;  // since init
+  uint32_t ticks;
+};
+
+
+/** init_ut3k_dither
+ *
+ * depth subframes each tick, spread over frame_usec which should be
+ * about the game's loop time.  All segments start at full brightness.
+ */
+void init_ut3k_dither(struct ut3k_dither *this, int depth, uint32_t frame_usec);
+
+
+/** set_dither_level
+ *
+ * set the level (0 - depth) for the segments in the mask on one digit of
+ * a display.  display is 0-2 for green, blue, red, 3 for the LEDs.  For
+ * the LEDs digit is the glyph set_red_leds (0), set_blue_leds (1) and
+ * set_green_leds (2) write to.
+ * Levels are positional: they stick to the segment until changed,
+ * whatever is drawn there.
+ */
+void set_dither_level(struct ut3k_dither *this, int display, int digit, uint16_t segments, uint8_t level);
+
+// all segments on all digits of a display
+void set_dither_display_level(struct ut3k_dither *this, int display, uint8_t level);
+
+
+/** ut3k_dither_write_subframe
+ *
+ * write target to chip, sending only the bytes that differ from shown
+ * (or all of them if full is set).  shown is updated to match and the
+ * writes are added to cost.
+ */
+int ut3k_dither_write_subframe(HT16K33 *chip, uint8_t shown[16], const uint8_t target[16], int full, struct ut3k_dither_cost *cost);
+
+
+/** ut3k_dither_worst_case_usec
+ *
+ * bus time for a tick where every byte of every chip changes on every
+ * subframe.  Keep this comfortably under the loop time.
+ */
+uint32_t ut3k_dither_worst_case_usec(const struct ut3k_dither *this);
+
+
+#endif
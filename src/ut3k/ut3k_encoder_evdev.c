@@ -0,0 +1,224 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ut3k_encoder_evdev.h"
+#include "ut3k_config.h"
+
+
+#define EVENT_READ 64
+
+
+struct encoder_evdev {
+  int fds[UT3K_ENCODER_EVDEV_ENCODERS];
+  int monotonic[UT3K_ENCODER_EVDEV_ENCODERS];  // event times are CLOCK_MONOTONIC
+  int wake_fd;
+  int thread_started;
+  atomic_int stop;                             // set by the game thread
+  pthread_t thread;
+  struct encoder_ring *rings;
+};
+
+static struct encoder_evdev evdev = { .fds = { -1, -1, -1 }, .wake_fd = -1 };
+
+
+static void* read_encoders(void *userdata);
+static int read_encoder(int encoder);
+static void close_devices();
+static inline uint64_t monotonic_ns();
+
+
+
+int ut3k_encoder_evdev_configured() {
+  return get_ut3k_config()->hardware.encoder_devices[0][0] != '\0';
+}
+
+
+int start_ut3k_encoder_evdev(struct encoder_ring rings[UT3K_ENCODER_EVDEV_ENCODERS]) {
+  const struct ut3k_hardware_map *hardware = &get_ut3k_config()->hardware;
+  int clock_id = CLOCK_MONOTONIC;
+  int rc;
+
+  evdev.rings = rings;
+  atomic_store(&evdev.stop, 0);
+
+  for (int encoder = 0; encoder < UT3K_ENCODER_EVDEV_ENCODERS; ++encoder) {
+    evdev.fds[encoder] = open(hardware->encoder_devices[encoder], O_RDONLY | O_CLOEXEC);
+    if (evdev.fds[encoder] == -1) {
+      printf("start_ut3k_encoder_evdev: can't open %s: %s\n", hardware->encoder_devices[encoder], strerror(errno));
+      close_devices();
+      return -1;
+    }
+    // same clock as the GPIO line events.  Not a device (a recording
+    // piped in, say): stamp events as they're read instead.
+    evdev.monotonic[encoder] = ioctl(evdev.fds[encoder], EVIOCSCLOCKID, &clock_id) == 0;
+  }
+
+  evdev.wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (evdev.wake_fd == -1) {
+    printf("start_ut3k_encoder_evdev: eventfd failed: %s\n", strerror(errno));
+  }
+
+  rc = pthread_create(&evdev.thread, NULL, read_encoders, NULL);
+  if (rc != 0) {
+    printf("start_ut3k_encoder_evdev: failed to start encoder reader %d\n", rc);
+    close_devices();
+    return -1;
+  }
+  evdev.thread_started = 1;
+
+  printf("rotary encoders from %s, %s, %s\n", hardware->encoder_devices[0],
+         hardware->encoder_devices[1], hardware->encoder_devices[2]);
+  return 0;
+}
+
+
+void stop_ut3k_encoder_evdev() {
+  uint64_t wake = 1;
+
+  atomic_store(&evdev.stop, 1);
+  if (evdev.wake_fd != -1) {
+    if (write(evdev.wake_fd, &wake, sizeof(wake)) != sizeof(wake)) {
+      printf("stop_ut3k_encoder_evdev: unable to wake encoder reader: %s\n", strerror(errno));
+    }
+  }
+  if (evdev.thread_started) {
+    pthread_join(evdev.thread, NULL);
+    evdev.thread_started = 0;
+  }
+  close_devices();
+
+  for (int encoder = 0; encoder < UT3K_ENCODER_EVDEV_ENCODERS; ++encoder) {
+    if (evdev.rings != NULL && evdev.rings[encoder].dropped) {
+      printf("encoder %d ring overflowed, dropped %u transitions\n",
+             encoder, evdev.rings[encoder].dropped);
+    }
+  }
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+/** read_encoders
+ *
+ * thread: wait for counts from any of the encoders or the wake up to
+ * stop.  Without the eventfd, check for the stop every 100ms.
+ */
+static void* read_encoders(void *userdata) {
+  struct pollfd poll_fds[UT3K_ENCODER_EVDEV_ENCODERS + 1];
+  int fd_count = UT3K_ENCODER_EVDEV_ENCODERS;
+
+  for (int encoder = 0; encoder < UT3K_ENCODER_EVDEV_ENCODERS; ++encoder) {
+    poll_fds[encoder] = (struct pollfd const) { .fd = evdev.fds[encoder], .events = POLLIN };
+  }
+  if (evdev.wake_fd != -1) {
+    poll_fds[fd_count++] = (struct pollfd const) { .fd = evdev.wake_fd, .events = POLLIN };
+  }
+
+  while (!atomic_load(&evdev.stop)) {
+    if (poll(poll_fds, fd_count, evdev.wake_fd == -1 ? 100 : -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printf("encoder evdev: poll failed: %s\n", strerror(errno));
+      break;
+    }
+
+    for (int encoder = 0; encoder < UT3K_ENCODER_EVDEV_ENCODERS && !atomic_load(&evdev.stop); ++encoder) {
+      if (poll_fds[encoder].revents == 0) {
+        continue;
+      }
+      if ((poll_fds[encoder].revents & POLLIN) == 0 || read_encoder(encoder) != 0) {
+        // unplugged, or the end of a recording: stop watching it
+        printf("encoder evdev: lost encoder %d\n", encoder);
+        poll_fds[encoder].fd = -1;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+/** read_encoder
+ *
+ * every EV_REL count is a detent, whatever the axis: the driver's
+ * linux,axis is REL_X unless the overlay says otherwise.  Returns
+ * non-zero once the device has nothing more to give.
+ */
+static int read_encoder(int encoder) {
+  struct input_event events[EVENT_READ];
+  ssize_t bytes_read;
+  uint64_t timestamp_ns;
+
+  bytes_read = read(evdev.fds[encoder], events, sizeof(events));
+  if (bytes_read <= 0) {
+    return bytes_read == -1 && errno == EINTR ? 0 : -1;
+  }
+
+  for (int i = 0; i < bytes_read / (ssize_t) sizeof(struct input_event); ++i) {
+    if (events[i].type != EV_REL || events[i].value == 0) {
+      continue;
+    }
+
+    timestamp_ns = evdev.monotonic[encoder] ?
+      (uint64_t) events[i].input_event_sec * 1000000000 + events[i].input_event_usec * 1000 :
+      monotonic_ns();
+    // the driver sends a count per detent, more only if it fell behind
+    for (int count = 0; count < abs(events[i].value); ++count) {
+      encoder_ring_push_detent(&evdev.rings[encoder], events[i].value, timestamp_ns + count * 4000);
+    }
+  }
+
+  return 0;
+}
+
+
+static void close_devices() {
+  for (int encoder = 0; encoder < UT3K_ENCODER_EVDEV_ENCODERS; ++encoder) {
+    if (evdev.fds[encoder] != -1) {
+      close(evdev.fds[encoder]);
+      evdev.fds[encoder] = -1;
+    }
+  }
+  if (evdev.wake_fd != -1) {
+    close(evdev.wake_fd);
+    evdev.wake_fd = -1;
+  }
+}
+
+
+static inline uint64_t monotonic_ns() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,64 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/* ut3k_encoder_evdev.h
+ *
+ * Rotary encoders through the kernel's rotary-encoder driver instead
+ * of the view's GPIO polling thread.  The driver decodes the quadrature
+ * off the line interrupts and reports each encoder as an input device
+ * sending EV_REL counts; here a thread reads those and pushes whole
+ * detents onto the encoder rings.  Everything past the rings (the
+ * control panel's rotary_encoder, acceleration, the session recorder)
+ * works as with the GPIO thread.
+ *
+ * Turned on by naming the three devices in ultratroninator.config:
+ *   hardware = { encoder_devices = [ "/dev/input/by-path/platform-rotary@10-event",
+ *                                    "...", "..." ]; };
+ * green, blue then red.  The overlay for each encoder wants
+ * rotary-encoder,relative-axis and the default steps-per-period of 1,
+ * so each count is a detent:
+ *   dtoverlay=rotary-encoder,pin_a=16,pin_b=26,relative_axis=1
+ * Swap pin_a and pin_b if a knob runs backwards.
+ *
+ * Any device sending EV_REL will do, so uinput devices stand in for
+ * the encoders on a box without the cabinet: src/encoder_feeder makes
+ * three, prints the encoder_devices line for them and turns them as
+ * told on stdin (see encoder_feeder.h).
+ */
+
+#ifndef UT3K_ENCODER_EVDEV_H
+#define UT3K_ENCODER_EVDEV_H
+
+#include "ut3k_encoder_ring.h"
+
+#define UT3K_ENCODER_EVDEV_ENCODERS 3
+
+
+// true if the config names encoder devices
+int ut3k_encoder_evdev_configured();
+
+/** start_ut3k_encoder_evdev
+ *
+ * open the configured devices and start the thread pushing onto rings,
+ * green, blue, red.  Returns 0, or -1 if a device can't be opened.
+ */
+int start_ut3k_encoder_evdev(struct encoder_ring rings[UT3K_ENCODER_EVDEV_ENCODERS]);
+
+void stop_ut3k_encoder_evdev();
+
+
+#endif
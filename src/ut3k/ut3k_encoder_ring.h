@@ -0,0 +1,123 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* ut3k_encoder_ring.h
+ *
+ * Wait-free single producer, single consumer ring of rotary encoder
+ * transitions.  The encoder thread pushes, update_controls drains;
+ * neither ever waits on the other.
+ *
+ * head and tail only ever count up, each written by one side only.  The
+ * producer publishes a transition by storing head with release order
+ * after writing the slot, the consumer frees slots by storing tail the
+ * same way.  head - tail is the fill level even across wrap around.
+ *
+ * Sizing: a 24 detent encoder gives 96 transitions a turn, so a very
+ * hard spin of 10 turns a second is about 1000 a second.  1024 slots
+ * cover a second of that between drains: far more than the 40ms between
+ * keyscans, with room for a stalled game loop (a sample load, say).
+ * Should it fill anyway, new transitions are dropped and counted.
+ */
+
+#ifndef UT3K_ENCODER_RING_H
+#define UT3K_ENCODER_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "control_panel.h"
+
+// power of two
+#define UT3K_ENCODER_RING_SIZE 1024
+
+
+struct encoder_ring {
+  // own cache lines so the two sides don't bounce one between them
+  _Alignas(64) _Atomic uint32_t head;  // producer
+  _Alignas(64) _Atomic uint32_t tail;  // consumer
+  uint32_t dropped;                    // producer, for diagnostics
+  struct encoder_transition transitions[UT3K_ENCODER_RING_SIZE];
+};
+
+
+static inline void init_encoder_ring(struct encoder_ring *this) {
+  atomic_init(&this->head, 0);
+  atomic_init(&this->tail, 0);
+  this->dropped = 0;
+}
+
+
+/** encoder_ring_push
+ *
+ * producer side.  Returns 0, or -1 if the ring is full and the
+ * transition was dropped.
+ */
+static inline int encoder_ring_push(struct encoder_ring *this, uint64_t timestamp_ns, uint8_t ab) {
+  uint32_t head = atomic_load_explicit(&this->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&this->tail, memory_order_acquire);
+
+  if (head - tail == UT3K_ENCODER_RING_SIZE) {
+    this->dropped++;
+    return -1;
+  }
+
+  this->transitions[head & (UT3K_ENCODER_RING_SIZE - 1)] =
+    (struct encoder_transition const) { .timestamp_ns = timestamp_ns, .ab = ab };
+  atomic_store_explicit(&this->head, head + 1, memory_order_release);
+  return 0;
+}
+
+
+/** encoder_ring_push_detent
+ *
+ * producer side, for sources that only know whole detents (the virtual
+ * panel, the kernel's rotary-encoder driver): push the four transitions
+ * of one detent from rest, clockwise for a positive direction, a usec
+ * apart starting at timestamp_ns.
+ */
+static inline void encoder_ring_push_detent(struct encoder_ring *this, int direction, uint64_t timestamp_ns) {
+  // A in bit 0 and B in bit 1.  Counter clockwise goes backwards.
+  static const uint8_t detent_cw[4] = { 0b01, 0b00, 0b10, 0b11 };
+  static const uint8_t detent_ccw[4] = { 0b10, 0b00, 0b01, 0b11 };
+  const uint8_t *detent = direction > 0 ? detent_cw : detent_ccw;
+
+  for (int i = 0; i < 4; ++i) {
+    encoder_ring_push(this, timestamp_ns + i * 1000, detent[i]);
+  }
+}
+
+
+/** encoder_ring_drain
+ *
+ * consumer side.  Copy out up to max transitions, oldest first, and
+ * return how many.
+ */
+static inline int encoder_ring_drain(struct encoder_ring *this, struct encoder_transition *transitions, int max) {
+  uint32_t tail = atomic_load_explicit(&this->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&this->head, memory_order_acquire);
+  int count = 0;
+
+  while (tail != head && count < max) {
+    transitions[count++] = this->transitions[tail & (UT3K_ENCODER_RING_SIZE - 1)];
+    ++tail;
+  }
+
+  atomic_store_explicit(&this->tail, tail, memory_order_release);
+  return count;
+}
+
+
+#endif
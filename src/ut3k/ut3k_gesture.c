@@ -0,0 +1,312 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ut3k_gesture.h"
+
+
+// one bit per step of every gesture, gesture * UT3K_GESTURE_MAX_STEPS + step
+#define STEP_WORDS ((UT3K_GESTURE_MAX_GESTURES * UT3K_GESTURE_MAX_STEPS + 63) / 64)
+
+typedef uint64_t steps_t[STEP_WORDS];
+
+// a state of the automaton while compiling: the steps the gestures
+// partly matched so far are waiting on, and the gestures just completed
+struct compile_state {
+  steps_t waiting;
+  uint32_t accepts;
+};
+
+static int compile(struct ut3k_gestures *this);
+static int add_symbols(struct ut3k_gestures *this, steps_t symbol_steps[]);
+static int find_state(struct compile_state states[], int count, const struct compile_state *state);
+static int value_slot(input_event_type_t type, int value, uint8_t index);
+static int step_matches(const struct gesture_step *step, input_event_type_t type, input_id_t input, int slot);
+
+static inline void set_step(steps_t steps, int bit) {
+  steps[bit / 64] |= (uint64_t) 1 << (bit % 64);
+}
+
+static inline int has_step(const steps_t steps, int bit) {
+  return (steps[bit / 64] >> (bit % 64)) & 1;
+}
+
+
+
+void init_ut3k_gestures(struct ut3k_gestures *this, uint32_t timeout_msec) {
+  this->gesture_count = 0;
+  this->timeout_ns = (uint64_t) timeout_msec * 1000000;
+  compile(this);
+}
+
+
+int add_ut3k_gesture(struct ut3k_gestures *this, int id, const struct gesture_step steps[], int step_count) {
+  struct ut3k_gesture *gesture;
+
+  if (this->gesture_count == UT3K_GESTURE_MAX_GESTURES ||
+      step_count < 1 || step_count > UT3K_GESTURE_MAX_STEPS) {
+    printf("gesture %d: too many gestures or a bad step count (%d)\n", id, step_count);
+    return -1;
+  }
+
+  gesture = &this->gestures[this->gesture_count++];
+  gesture->id = id;
+  gesture->step_count = step_count;
+  memcpy(gesture->steps, steps, sizeof(struct gesture_step) * step_count);
+
+  if (compile(this) != 0) {
+    printf("gesture %d: automaton too big, left out\n", id);
+    this->gesture_count--;
+    compile(this);
+    return -1;
+  }
+  return 0;
+}
+
+
+int ut3k_gestures_feed(struct ut3k_gestures *this, const struct panel_input_event *event) {
+  int slot = value_slot(event->type, event->value, event->index);
+  uint8_t symbol;
+  uint32_t accepts;
+
+  if (slot < 0 || event->type >= INPUT_EVENT_TYPE_COUNT || event->input >= INPUT_COUNT) {
+    return -1;
+  }
+  symbol = this->symbols[event->type][event->input][slot];
+  if (symbol == 0) {
+    return -1;
+  }
+
+  if (this->state != 0 && event->timestamp_ns - this->last_ns > this->timeout_ns) {
+    this->state = 0;
+  }
+  this->last_ns = event->timestamp_ns;
+
+  this->state = this->next[this->state][symbol];
+  accepts = this->accepts[this->state];
+
+  return accepts ? this->gestures[__builtin_ctz(accepts)].id : -1;
+}
+
+
+int ut3k_gestures_read(struct ut3k_gestures *this, const struct control_panel *control_panel, uint32_t *cursor, int ids[], int max) {
+  struct panel_input_event events[INPUT_EVENT_RING_SIZE];
+  int count, found = 0, id;
+
+  count = read_input_events(control_panel, cursor, events, INPUT_EVENT_RING_SIZE);
+  for (int i = 0; i < count; ++i) {
+    id = ut3k_gestures_feed(this, &events[i]);
+    if (id >= 0 && found < max) {
+      ids[found++] = id;
+    }
+  }
+  return found;
+}
+
+
+void ut3k_gestures_reset(struct ut3k_gestures *this) {
+  this->state = 0;
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+/** compile
+ *
+ * subset construction over the gestures' steps.  A state is the set of
+ * steps partly matched gestures are waiting on; the first step of every
+ * gesture is always waited on, so matches start anywhere.  States are
+ * numbered as they're found, state 0 being nothing waiting.
+ */
+static int compile(struct ut3k_gestures *this) {
+  struct compile_state states[UT3K_GESTURE_MAX_STATES];
+  struct compile_state to;
+  steps_t symbol_steps[UT3K_GESTURE_MAX_SYMBOLS];
+  const struct ut3k_gesture *gesture;
+  int step, bit, found;
+
+  this->state = 0;
+  this->last_ns = 0;
+
+  if (add_symbols(this, symbol_steps) != 0) {
+    return -1;
+  }
+
+  memset(&states[0], 0, sizeof(struct compile_state));
+  this->accepts[0] = 0;
+  this->state_count = 1;
+
+  for (int from = 0; from < this->state_count; ++from) {
+    this->next[from][0] = from;  // not ours, stay put
+
+    for (int symbol = 1; symbol < this->symbol_count; ++symbol) {
+      memset(&to, 0, sizeof(to));
+
+      for (int g = 0; g < this->gesture_count; ++g) {
+        gesture = &this->gestures[g];
+        for (step = 0; step < gesture->step_count; ++step) {
+          bit = g * UT3K_GESTURE_MAX_STEPS + step;
+          if (!has_step(symbol_steps[symbol], bit) ||
+              (step > 0 && !has_step(states[from].waiting, bit))) {
+            continue;
+          }
+          if (step + 1 == gesture->step_count) {
+            to.accepts |= (uint32_t) 1 << g;
+          }
+          else {
+            set_step(to.waiting, bit + 1);
+          }
+        }
+      }
+
+      found = find_state(states, this->state_count, &to);
+      if (found < 0) {
+        if (this->state_count == UT3K_GESTURE_MAX_STATES) {
+          return -1;
+        }
+        found = this->state_count++;
+        states[found] = to;
+        this->accepts[found] = to.accepts;
+      }
+      this->next[from][symbol] = found;
+    }
+  }
+
+  return 0;
+}
+
+
+/** add_symbols
+ *
+ * kinds of events matching the same steps share a symbol.  Symbol 0 is
+ * the events no step matches, which the automaton skips.
+ */
+static int add_symbols(struct ut3k_gestures *this, steps_t symbol_steps[]) {
+  steps_t steps;
+  const struct ut3k_gesture *gesture;
+  int symbol, empty;
+
+  memset(symbol_steps[0], 0, sizeof(steps_t));
+  this->symbol_count = 1;
+
+  for (int type = 0; type < INPUT_EVENT_TYPE_COUNT; ++type) {
+    for (int input = 0; input < INPUT_COUNT; ++input) {
+      for (int slot = 0; slot < UT3K_GESTURE_VALUES; ++slot) {
+        memset(steps, 0, sizeof(steps));
+        empty = 1;
+        for (int g = 0; g < this->gesture_count; ++g) {
+          gesture = &this->gestures[g];
+          for (int step = 0; step < gesture->step_count; ++step) {
+            if (step_matches(&gesture->steps[step], type, input, slot)) {
+              set_step(steps, g * UT3K_GESTURE_MAX_STEPS + step);
+              empty = 0;
+            }
+          }
+        }
+
+        symbol = 0;
+        if (!empty) {
+          for (symbol = 1; symbol < this->symbol_count; ++symbol) {
+            if (memcmp(symbol_steps[symbol], steps, sizeof(steps_t)) == 0) {
+              break;
+            }
+          }
+          if (symbol == this->symbol_count) {
+            if (symbol == UT3K_GESTURE_MAX_SYMBOLS) {
+              return -1;
+            }
+            memcpy(symbol_steps[symbol], steps, sizeof(steps_t));
+            this->symbol_count++;
+          }
+        }
+        this->symbols[type][input][slot] = symbol;
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+static int find_state(struct compile_state states[], int count, const struct compile_state *state) {
+  for (int i = 0; i < count; ++i) {
+    if (states[i].accepts == state->accepts &&
+        memcmp(states[i].waiting, state->waiting, sizeof(steps_t)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+/** value_slot
+ *
+ * the part of an event's value (and index) steps can match on, 0 to
+ * UT3K_GESTURE_VALUES - 1.  -1 for events never matched.
+ */
+static int value_slot(input_event_type_t type, int value, uint8_t index) {
+  switch (type) {
+  case INPUT_SELECTOR:
+    return value >= 0 && value < UT3K_GESTURE_VALUES ? value : -1;
+  case INPUT_TOGGLE:
+    return index * 2 + 1 < UT3K_GESTURE_VALUES ? index * 2 + (value != 0) : -1;
+  case INPUT_JOYSTICK:
+    // auto-repeats would make a held stick look like a combo
+    return index == 0 && value >= 0 && value < UT3K_GESTURE_VALUES ? value : -1;
+  case INPUT_ROTATE:
+    if (value > UT3K_GESTURE_MAX_DELTA) {
+      value = UT3K_GESTURE_MAX_DELTA;
+    }
+    else if (value < -UT3K_GESTURE_MAX_DELTA) {
+      value = -UT3K_GESTURE_MAX_DELTA;
+    }
+    return value + UT3K_GESTURE_MAX_DELTA;
+  default:
+    return 0;
+  }
+}
+
+
+static int step_matches(const struct gesture_step *step, input_event_type_t type, input_id_t input, int slot) {
+  int delta;
+
+  if (step->type != type || step->input != input) {
+    return 0;
+  }
+
+  switch (type) {
+  case INPUT_SELECTOR:
+    return step->value == GESTURE_ANY_VALUE || step->value == slot;
+  case INPUT_TOGGLE:
+    return slot == step->index * 2 + (step->value != 0);
+  case INPUT_JOYSTICK:
+    return slot == step->value;
+  case INPUT_ROTATE:
+    delta = slot - UT3K_GESTURE_MAX_DELTA;
+    if (step->value > 0) {
+      return delta >= step->value;
+    }
+    else if (step->value < 0) {
+      return delta <= step->value;
+    }
+    return delta != 0;
+  default:
+    return slot == 0;
+  }
+}
@@ -0,0 +1,149 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* ut3k_gesture.h
+ *
+ * Combos and gestures matched against the control panel's input
+ * events: a service menu sequence, a chord, a flick of an encoder.
+ *
+ * A gesture is a sequence of steps, each matching one kind of event.
+ * All the gestures are compiled together into one deterministic
+ * automaton whenever one is added, so matching an event is a lookup
+ * of its symbol and a lookup of the next state however many gestures
+ * there are.  Gestures can start at any event and can overlap.
+ *
+ * Events that no gesture has a step for are skipped over: with only
+ * presses in the gestures, releases and joystick moves in between
+ * don't break a combo.  Events that some gesture wants but that don't
+ * continue a match do.  A combo is also dropped when more than the
+ * timeout goes by between its events.
+ *
+ * A chord is two presses close together, add one gesture per order
+ * with the same id to take either.
+ */
+
+#ifndef UT3K_GESTURE_H
+#define UT3K_GESTURE_H
+
+#include <stdint.h>
+
+#include "control_panel.h"
+
+#define UT3K_GESTURE_MAX_GESTURES 32
+#define UT3K_GESTURE_MAX_STEPS 8
+#define UT3K_GESTURE_MAX_STATES 128
+#define UT3K_GESTURE_MAX_SYMBOLS 32
+
+// rotate deltas are clamped to this either way before matching
+#define UT3K_GESTURE_MAX_DELTA 16
+
+// event value slots: the widest is a clamped rotate delta
+#define UT3K_GESTURE_VALUES (2 * UT3K_GESTURE_MAX_DELTA + 1)
+
+#define GESTURE_ANY_VALUE -1
+
+
+/** struct gesture_step
+ *
+ * matches events of type from input.  What value means goes by type:
+ *   INPUT_PRESS, INPUT_RELEASE, INPUT_LONG_PRESS, INPUT_DOUBLE_PRESS:
+ *     not used
+ *   INPUT_SELECTOR: the position, or GESTURE_ANY_VALUE
+ *   INPUT_TOGGLE: the switch's new state, index is the switch
+ *   INPUT_JOYSTICK: the direction.  Auto-repeats never match.
+ *   INPUT_ROTATE: input is the encoder's button.  The smallest
+ *     accelerated_delta to match, turning the way of its sign; 0 for
+ *     any turn.
+ */
+struct gesture_step {
+  input_event_type_t type;
+  input_id_t input;
+  int value;
+  uint8_t index;
+};
+
+// for static tables of steps
+#define GESTURE_PRESS(input) { INPUT_PRESS, (input), 0, 0 }
+#define GESTURE_RELEASE(input) { INPUT_RELEASE, (input), 0, 0 }
+#define GESTURE_LONG_PRESS(input) { INPUT_LONG_PRESS, (input), 0, 0 }
+#define GESTURE_DOUBLE_PRESS(input) { INPUT_DOUBLE_PRESS, (input), 0, 0 }
+#define GESTURE_SELECTOR(input, position) { INPUT_SELECTOR, (input), (position), 0 }
+#define GESTURE_TOGGLE(toggle, state) { INPUT_TOGGLE, INPUT_TOGGLES, (state), (toggle) }
+#define GESTURE_JOYSTICK(direction) { INPUT_JOYSTICK, INPUT_JOYSTICK_DIRECTION, (direction), 0 }
+#define GESTURE_ROTATE(encoder_button, min_delta) { INPUT_ROTATE, (encoder_button), (min_delta), 0 }
+
+
+struct ut3k_gesture {
+  int id;
+  int step_count;
+  struct gesture_step steps[UT3K_GESTURE_MAX_STEPS];
+};
+
+struct ut3k_gestures {
+  int gesture_count;
+  struct ut3k_gesture gestures[UT3K_GESTURE_MAX_GESTURES];
+  uint64_t timeout_ns;
+
+  // compiled from the gestures: the symbol of each kind of event (0
+  // for those no gesture wants), the automaton's transitions and the
+  // gestures completed on getting to each state.  State 0 is nothing
+  // matched so far.
+  uint8_t symbols[INPUT_EVENT_TYPE_COUNT][INPUT_COUNT][UT3K_GESTURE_VALUES];
+  uint8_t next[UT3K_GESTURE_MAX_STATES][UT3K_GESTURE_MAX_SYMBOLS];
+  uint32_t accepts[UT3K_GESTURE_MAX_STATES];
+  int state_count;
+  int symbol_count;
+
+  uint8_t state;
+  uint64_t last_ns;
+};
+
+
+/** init_ut3k_gestures
+ *
+ * no gestures yet.  timeout_msec is the longest gap allowed between
+ * the events of a gesture.
+ */
+void init_ut3k_gestures(struct ut3k_gestures *this, uint32_t timeout_msec);
+
+/** add_ut3k_gesture
+ *
+ * id is reported when the steps are matched, it needn't be unique.
+ * Returns 0, or -1 if the gesture doesn't fit (too many steps or
+ * gestures, or an automaton too big) in which case it's left out.
+ * Matching starts over.
+ */
+int add_ut3k_gesture(struct ut3k_gestures *this, int id, const struct gesture_step steps[], int step_count);
+
+/** ut3k_gestures_feed
+ *
+ * the next input event.  Returns the id of the gesture it completes,
+ * or -1.  If it completes more than one the first added wins.
+ */
+int ut3k_gestures_feed(struct ut3k_gestures *this, const struct panel_input_event *event);
+
+/** ut3k_gestures_read
+ *
+ * feed the events since *cursor (see read_input_events) and put the
+ * ids of up to max completed gestures in ids.  Returns the count.
+ */
+int ut3k_gestures_read(struct ut3k_gestures *this, const struct control_panel *control_panel, uint32_t *cursor, int ids[], int max);
+
+// forget any partly matched gestures
+void ut3k_gestures_reset(struct ut3k_gestures *this);
+
+
+#endif
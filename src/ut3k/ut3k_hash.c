@@ -0,0 +1,62 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ut3k_hash.h"
+
+
+#define FNV_PRIME 0x100000001B3ULL
+#define HASH_BUFFER_SIZE 65536
+
+
+
+uint64_t ut3k_hash_bytes(uint64_t hash, const void *data, size_t size) {
+  const uint8_t *bytes = (const uint8_t*) data;
+
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+
+int ut3k_hash_file(const char *filename, uint64_t *hash) {
+  uint8_t *buffer;
+  size_t bytes;
+  FILE *file;
+  int rc = 0;
+
+  if ((file = fopen(filename, "rb")) == NULL) {
+    return -1;
+  }
+
+  if ((buffer = (uint8_t*) malloc(HASH_BUFFER_SIZE)) == NULL) {
+    fclose(file);
+    return -1;
+  }
+  *hash = UT3K_HASH_INIT;
+  while ((bytes = fread(buffer, 1, HASH_BUFFER_SIZE, file)) > 0) {
+    *hash = ut3k_hash_bytes(*hash, buffer, bytes);
+  }
+  if (ferror(file)) {
+    rc = -1;
+  }
+
+  free(buffer);
+  fclose(file);
+  return rc;
+}
@@ -0,0 +1,42 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/* ut3k_hash.h
+ *
+ * Content hashes for telling sample files apart: the same audio under
+ * different names or paths gets the same hash.  64 bit FNV-1a, quick
+ * and nothing adversarial about it: reading a file costs far less than
+ * decoding or uploading it.
+ */
+
+#ifndef UT3K_HASH_H
+#define UT3K_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UT3K_HASH_INIT 0xCBF29CE484222325ULL
+
+
+// continue hash over size bytes; start from UT3K_HASH_INIT
+uint64_t ut3k_hash_bytes(uint64_t hash, const void *data, size_t size);
+
+// hash of a file's bytes, 0 on success
+int ut3k_hash_file(const char *filename, uint64_t *hash);
+
+
+#endif
@@ -0,0 +1,111 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ut3k_latency.h"
+
+
+static void record_latency(struct ut3k_latency *this, int type, uint64_t latency_ns);
+
+
+
+void init_ut3k_latency(struct ut3k_latency *this, int types) {
+  memset(this, 0, sizeof(struct ut3k_latency));
+  this->types = types < UT3K_LATENCY_MAX_TYPES ? types : UT3K_LATENCY_MAX_TYPES;
+}
+
+
+void ut3k_latency_input(struct ut3k_latency *this, uint32_t cause, int type, uint64_t timestamp_ns) {
+  if (type < 0 || type >= this->types) {
+    return;
+  }
+
+  if (this->pending_head - this->pending_tail == UT3K_LATENCY_PENDING) {
+    this->pending_tail++;
+    this->dropped++;
+  }
+
+  this->pending[this->pending_head % UT3K_LATENCY_PENDING].cause = cause;
+  this->pending[this->pending_head % UT3K_LATENCY_PENDING].type = type;
+  this->pending[this->pending_head % UT3K_LATENCY_PENDING].timestamp_ns = timestamp_ns;
+  this->pending_head++;
+}
+
+
+void ut3k_latency_commit(struct ut3k_latency *this, uint32_t cause, uint64_t commit_ns) {
+  uint32_t slot;
+
+  // causes go on in order, so settling stops at the first later one
+  while (this->pending_tail != this->pending_head) {
+    slot = this->pending_tail % UT3K_LATENCY_PENDING;
+    if (cause != 0 && (int32_t) (this->pending[slot].cause - cause) > 0) {
+      break;
+    }
+    if (commit_ns > this->pending[slot].timestamp_ns) {
+      record_latency(this, this->pending[slot].type, commit_ns - this->pending[slot].timestamp_ns);
+    }
+    this->pending_tail++;
+  }
+}
+
+
+void print_ut3k_latency(const struct ut3k_latency *this, const char *const type_names[]) {
+  const struct ut3k_latency_histogram *histogram;
+
+  printf("input to display latency:\n");
+  for (int type = 0; type < this->types; ++type) {
+    histogram = &this->histograms[type];
+    if (histogram->samples == 0) {
+      continue;
+    }
+
+    printf("  %-12s %6u inputs, mean %7llu usec, max %7u usec\n",
+           type_names[type], histogram->samples,
+           (unsigned long long) (histogram->total_usec / histogram->samples), histogram->max_usec);
+    for (int bucket = 0; bucket < UT3K_LATENCY_BUCKETS; ++bucket) {
+      if (histogram->buckets[bucket] != 0) {
+        printf("    %8u - %8u usec: %6u\n", bucket == 0 ? 0 : 1u << bucket, (2u << bucket) - 1, histogram->buckets[bucket]);
+      }
+    }
+  }
+  if (this->dropped != 0) {
+    printf("  %u inputs never made it to a frame\n", this->dropped);
+  }
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+static void record_latency(struct ut3k_latency *this, int type, uint64_t latency_ns) {
+  struct ut3k_latency_histogram *histogram = &this->histograms[type];
+  uint32_t usec = latency_ns / 1000 > UINT32_MAX ? UINT32_MAX : latency_ns / 1000;
+  int bucket = 0;
+
+  while (bucket < UT3K_LATENCY_BUCKETS - 1 && (usec >> (bucket + 1)) != 0) {
+    bucket++;
+  }
+
+  histogram->buckets[bucket]++;
+  histogram->samples++;
+  histogram->total_usec += usec;
+  if (usec > histogram->max_usec) {
+    histogram->max_usec = usec;
+  }
+}
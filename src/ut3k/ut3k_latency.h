@@ -0,0 +1,84 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/* ut3k_latency.h
+ *
+ * Input to display latency: how long from a knob turn or button press
+ * to the changed segments going out to the HT16K33s.
+ *
+ * Every control panel event carries a causal ID, its cause.  The view
+ * notes each cause with its input's timestamp as update_controls sees
+ * it, then settles them at commit time:
+ *   - a game that knows which input a frame shows can say so with
+ *     set_ut3k_display_cause: the commit settles that cause and any
+ *     before it.
+ *   - otherwise the first commit that changes anything on the chips
+ *     settles everything waiting.
+ * Latencies go in a histogram per event type with power of two
+ * buckets: bucket n counts latencies of 2^n to 2^(n+1) - 1 usec.
+ */
+
+#ifndef UT3K_LATENCY_H
+#define UT3K_LATENCY_H
+
+#include <stdint.h>
+
+#define UT3K_LATENCY_BUCKETS 24  // up to 16s
+#define UT3K_LATENCY_PENDING 64  // causes waiting for a frame
+#define UT3K_LATENCY_MAX_TYPES 16
+
+
+struct ut3k_latency_histogram {
+  uint32_t buckets[UT3K_LATENCY_BUCKETS];
+  uint32_t samples;
+  uint64_t total_usec;
+  uint32_t max_usec;
+};
+
+struct ut3k_latency {
+  int types;
+  struct ut3k_latency_histogram histograms[UT3K_LATENCY_MAX_TYPES];
+
+  // ring of causes waiting for a frame, oldest at tail
+  struct {
+    uint32_t cause;
+    uint8_t type;
+    uint64_t timestamp_ns;
+  } pending[UT3K_LATENCY_PENDING];
+  uint32_t pending_head;
+  uint32_t pending_tail;
+  uint32_t dropped;  // pushed out of a full ring before a frame came
+};
+
+
+void init_ut3k_latency(struct ut3k_latency *this, int types);
+
+// an input of type happened at timestamp_ns
+void ut3k_latency_input(struct ut3k_latency *this, uint32_t cause, int type, uint64_t timestamp_ns);
+
+/** ut3k_latency_commit
+ *
+ * a frame went out at commit_ns.  Settle cause and those before it, or
+ * everything waiting for a cause of 0.
+ */
+void ut3k_latency_commit(struct ut3k_latency *this, uint32_t cause, uint64_t commit_ns);
+
+// print the histograms, type_names has one name per type
+void print_ut3k_latency(const struct ut3k_latency *this, const char *const type_names[]);
+
+
+#endif
@@ -0,0 +1,295 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ut3k_levels.h"
+
+
+struct voice {
+  const char *sample_name;
+  const struct ut3k_envelope *envelope;  // NULL when the slot is free
+  uint32_t gain;
+  struct timespec start;
+};
+
+static struct voice voices[UT3K_LEVEL_VOICES];
+static int next_voice = 0;
+
+static inline void add_magnitude(struct ut3k_envelope *this, uint32_t magnitude);
+static void close_block(struct ut3k_envelope *this);
+static int voice_level(struct voice *voice, const struct timespec *now, struct ut3k_level *level);
+static inline uint16_t clip_level(uint64_t value);
+static uint32_t isqrt(uint64_t value);
+
+
+
+struct ut3k_envelope* new_ut3k_envelope(uint32_t rate, int channels, uint64_t frames) {
+  struct ut3k_envelope *this;
+  uint32_t block_frames;
+
+  if (rate == 0 || channels < 1) {
+    return NULL;
+  }
+
+  block_frames = (uint64_t) rate * UT3K_LEVEL_PERIOD_USEC / 1000000;
+  if (block_frames == 0) {
+    block_frames = 1;
+  }
+
+  this = (struct ut3k_envelope*) malloc(sizeof(struct ut3k_envelope));
+  *this = (struct ut3k_envelope const)
+    {
+     .blocks = (frames + block_frames - 1) / block_frames,
+     .block = 0,
+     .block_samples = block_frames * channels,
+     .block_count = 0,
+     .sum_squares = 0,
+     .peak = 0
+    };
+  this->levels = (struct ut3k_level*) calloc(this->blocks ? this->blocks : 1, sizeof(struct ut3k_level));
+
+  return this;
+}
+
+
+void free_ut3k_envelope(struct ut3k_envelope *this) {
+  if (this) {
+    free(this->levels);
+    free(this);
+  }
+}
+
+
+void ut3k_envelope_add_s16(struct ut3k_envelope *this, const int16_t *samples, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    add_magnitude(this, (uint32_t) abs(samples[i]) << 1);
+  }
+}
+
+
+void ut3k_envelope_add_s32(struct ut3k_envelope *this, const int32_t *samples, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    add_magnitude(this, (uint32_t) (llabs(samples[i]) >> 15));
+  }
+}
+
+
+void ut3k_envelope_add_u8(struct ut3k_envelope *this, const uint8_t *samples, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    add_magnitude(this, (uint32_t) abs(samples[i] - 128) << 9);
+  }
+}
+
+
+void ut3k_envelope_finish(struct ut3k_envelope *this) {
+  if (this->block_count > 0) {
+    close_block(this);
+  }
+  this->blocks = this->block;
+}
+
+
+void ut3k_levels_start_voice(const char *sample_name, const struct ut3k_envelope *envelope, uint32_t gain) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ut3k_levels_start_voice_at(sample_name, envelope, gain, (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec);
+}
+
+
+void ut3k_levels_start_voice_at(const char *sample_name, const struct ut3k_envelope *envelope, uint32_t gain, uint64_t start_ns) {
+  struct voice *voice;
+
+  if (envelope == NULL) {
+    return;
+  }
+
+  // round robin: the slot after the newest voice holds the oldest
+  voice = &voices[next_voice];
+  next_voice = (next_voice + 1) % UT3K_LEVEL_VOICES;
+
+  voice->sample_name = sample_name;
+  voice->envelope = envelope;
+  voice->gain = gain;
+  voice->start.tv_sec = start_ns / 1000000000;
+  voice->start.tv_nsec = start_ns % 1000000000;
+}
+
+
+void ut3k_levels_stop_voices(const struct ut3k_envelope *envelope) {
+  for (int i = 0; i < UT3K_LEVEL_VOICES; ++i) {
+    if (voices[i].envelope == envelope) {
+      voices[i].envelope = NULL;
+    }
+  }
+}
+
+
+void ut3k_get_master_level(struct ut3k_level *level) {
+  struct timespec now;
+  struct ut3k_level voice;
+  uint64_t sum_squares = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  level->peak = 0;
+
+  for (int i = 0; i < UT3K_LEVEL_VOICES; ++i) {
+    if (voice_level(&voices[i], &now, &voice)) {
+      sum_squares += (uint64_t) voice.rms * voice.rms;
+      if (voice.peak > level->peak) {
+        level->peak = voice.peak;
+      }
+    }
+  }
+
+  level->rms = clip_level(isqrt(sum_squares));
+}
+
+
+int ut3k_get_voice_levels(struct ut3k_voice_level levels[], int max) {
+  struct timespec now;
+  int count = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (int i = 0; i < UT3K_LEVEL_VOICES && count < max; ++i) {
+    if (voice_level(&voices[i], &now, &levels[count].level)) {
+      levels[count].sample_name = voices[i].sample_name;
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+
+void ut3k_get_sample_level(const char *sample_name, struct ut3k_level *level) {
+  struct timespec now;
+  struct ut3k_level voice;
+  uint64_t sum_squares = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  level->peak = 0;
+
+  for (int i = 0; i < UT3K_LEVEL_VOICES; ++i) {
+    if (voices[i].envelope && strcmp(voices[i].sample_name, sample_name) == 0 &&
+        voice_level(&voices[i], &now, &voice)) {
+      sum_squares += (uint64_t) voice.rms * voice.rms;
+      if (voice.peak > level->peak) {
+        level->peak = voice.peak;
+      }
+    }
+  }
+
+  level->rms = clip_level(isqrt(sum_squares));
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+static inline void add_magnitude(struct ut3k_envelope *this, uint32_t magnitude) {
+  if (magnitude > UT3K_LEVEL_FULL_SCALE) {
+    magnitude = UT3K_LEVEL_FULL_SCALE;
+  }
+
+  this->sum_squares += (uint64_t) magnitude * magnitude;
+  if (magnitude > this->peak) {
+    this->peak = magnitude;
+  }
+
+  if (++this->block_count == this->block_samples) {
+    close_block(this);
+  }
+}
+
+
+static void close_block(struct ut3k_envelope *this) {
+  // the file can run a little longer than it claimed: drop the extra
+  if (this->block < this->blocks) {
+    this->levels[this->block].rms = clip_level(isqrt(this->sum_squares / this->block_count));
+    this->levels[this->block].peak = this->peak;
+    ++this->block;
+  }
+
+  this->block_count = 0;
+  this->sum_squares = 0;
+  this->peak = 0;
+}
+
+
+/** voice_level
+ *
+ * the level of a voice at now, 0 if it's done playing.  Finished voices
+ * free up their slot.
+ */
+static int voice_level(struct voice *voice, const struct timespec *now, struct ut3k_level *level) {
+  int64_t elapsed_usec;
+  uint64_t block;
+
+  if (voice->envelope == NULL) {
+    return 0;
+  }
+
+  elapsed_usec = (now->tv_sec - voice->start.tv_sec) * 1000000LL +
+    (now->tv_nsec - voice->start.tv_nsec) / 1000;
+  if (elapsed_usec < 0) {
+    return 0;  // scheduled, not started yet
+  }
+  block = elapsed_usec / UT3K_LEVEL_PERIOD_USEC;
+
+  if (block >= voice->envelope->blocks) {
+    voice->envelope = NULL;
+    return 0;
+  }
+
+  level->rms = clip_level(((uint64_t) voice->envelope->levels[block].rms * voice->gain) >> 16);
+  level->peak = clip_level(((uint64_t) voice->envelope->levels[block].peak * voice->gain) >> 16);
+  return 1;
+}
+
+
+static inline uint16_t clip_level(uint64_t value) {
+  return value > UT3K_LEVEL_FULL_SCALE ? UT3K_LEVEL_FULL_SCALE : value;
+}
+
+
+// integer square root, bit by bit
+static uint32_t isqrt(uint64_t value) {
+  uint64_t root = 0;
+  uint64_t bit = 1ULL << 62;
+
+  while (bit > value) {
+    bit >>= 2;
+  }
+
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+
+  return root;
+}
@@ -0,0 +1,119 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* ut3k_levels.h
+ *
+ * RMS and peak levels of what's playing, for VU meters on the LEDs.
+ *
+ * Samples are played from the PulseAudio server's sample cache, so the
+ * audio never comes back through here.  Instead each sample gets an
+ * envelope when it's uploaded: RMS and peak over every
+ * UT3K_LEVEL_PERIOD_USEC of audio.  Playing a sample starts a voice
+ * against its envelope and the level of a voice is then the envelope
+ * block for how long ago it started, scaled by its volume.  Working out
+ * the levels is a clock read and a lookup per voice, cheap enough to do
+ * every audio period or every game tick.
+ *
+ * Levels are linear, 0 - UT3K_LEVEL_FULL_SCALE.  Voices are mixed as
+ * uncorrelated: the master RMS is the root of the sum of the squares,
+ * the master peak the largest voice peak.
+ */
+
+#ifndef UT3K_LEVELS_H
+#define UT3K_LEVELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UT3K_LEVEL_FULL_SCALE 0xFFFF
+
+// one envelope block per audio period
+#define UT3K_LEVEL_PERIOD_USEC 10000
+
+// voices tracked at once, the oldest is dropped to make room
+#define UT3K_LEVEL_VOICES 16
+
+// unity gain for ut3k_levels_start_voice
+#define UT3K_LEVEL_UNITY_GAIN 0x10000
+
+
+struct ut3k_level {
+  uint16_t rms;
+  uint16_t peak;
+};
+
+
+struct ut3k_envelope {
+  uint32_t blocks;
+  struct ut3k_level *levels;  // one per UT3K_LEVEL_PERIOD_USEC
+
+  // while it's being built
+  uint32_t block;          // block being filled
+  uint32_t block_samples;  // samples per block, all channels
+  uint32_t block_count;
+  uint64_t sum_squares;
+  uint16_t peak;
+};
+
+
+struct ut3k_voice_level {
+  const char *sample_name;
+  struct ut3k_level level;
+};
+
+
+/** new_ut3k_envelope
+ *
+ * an empty envelope for frames of audio at rate with channels
+ * interleaved.  Feed it the audio with the ut3k_envelope_add_*
+ * functions then ut3k_envelope_finish.  NULL on a bad format.
+ */
+struct ut3k_envelope* new_ut3k_envelope(uint32_t rate, int channels, uint64_t frames);
+void free_ut3k_envelope(struct ut3k_envelope *this);
+
+// count interleaved samples, in the order they play
+void ut3k_envelope_add_s16(struct ut3k_envelope *this, const int16_t *samples, size_t count);
+void ut3k_envelope_add_s32(struct ut3k_envelope *this, const int32_t *samples, size_t count);
+void ut3k_envelope_add_u8(struct ut3k_envelope *this, const uint8_t *samples, size_t count);
+
+// close off a partial last block
+void ut3k_envelope_finish(struct ut3k_envelope *this);
+
+
+/** ut3k_levels_start_voice
+ *
+ * sample_name started playing now.  gain is 16.16 fixed point, see
+ * UT3K_LEVEL_UNITY_GAIN.  The name and envelope are held by pointer, so
+ * drop any voices with ut3k_levels_stop_voices before freeing them.
+ */
+void ut3k_levels_start_voice(const char *sample_name, const struct ut3k_envelope *envelope, uint32_t gain);
+// as above, starting at start_ns on CLOCK_MONOTONIC
+void ut3k_levels_start_voice_at(const char *sample_name, const struct ut3k_envelope *envelope, uint32_t gain, uint64_t start_ns);
+void ut3k_levels_stop_voices(const struct ut3k_envelope *envelope);
+
+
+/** levels right now
+ *
+ * ut3k_get_voice_levels fills in up to max voices still playing and
+ * returns how many.  ut3k_get_sample_level adds up every voice of one
+ * sample: handy for a meter per instrument.
+ */
+void ut3k_get_master_level(struct ut3k_level *level);
+int ut3k_get_voice_levels(struct ut3k_voice_level levels[], int max);
+void ut3k_get_sample_level(const char *sample_name, struct ut3k_level *level);
+
+
+#endif
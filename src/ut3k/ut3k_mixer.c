@@ -0,0 +1,329 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ut3k_mixer.h"
+
+
+// frames mixed at a time into the accumulator
+#define MIX_CHUNK 512
+
+// how far each render's start time may pull the frame to time mapping
+#define CLOCK_SMOOTHING 16
+
+static void track_clock(struct ut3k_mixer *this, uint64_t start_ns);
+static uint64_t time_to_frame(struct ut3k_mixer *this, uint64_t when_ns);
+static void take_triggers(struct ut3k_mixer *this);
+static void start_voice(struct ut3k_mixer *this, const struct ut3k_pcm *pcm, uint32_t gain, uint64_t start_frame);
+static void mix_voice(struct ut3k_mixer_voice *voice, int32_t *accumulator, uint64_t chunk_frame, uint32_t frames);
+static inline int16_t clip(int32_t sample);
+
+
+
+void init_ut3k_mixer(struct ut3k_mixer *this, uint32_t period_frames) {
+  if (period_frames < UT3K_MIXER_MIN_PERIOD) {
+    period_frames = UT3K_MIXER_MIN_PERIOD;
+  }
+  else if (period_frames > UT3K_MIXER_MAX_PERIOD) {
+    period_frames = UT3K_MIXER_MAX_PERIOD;
+  }
+
+  atomic_init(&this->head, 0);
+  atomic_init(&this->tail, 0);
+  this->dropped = 0;
+  this->period_frames = period_frames;
+  this->voice_count = 0;
+  this->frames_rendered = 0;
+  this->stolen = 0;
+  this->anchor_frame = 0;
+  this->anchor_ns = 0;
+  this->late = 0;
+}
+
+
+/** new_ut3k_pcm
+ *
+ * linear interpolation between source frames when the rate differs,
+ * stepping through the source in 16.16 fixed point.
+ */
+struct ut3k_pcm* new_ut3k_pcm(const int16_t *samples, uint32_t frames, int channels, int rate) {
+  struct ut3k_pcm *this;
+  uint64_t position = 0, step;
+  uint32_t index, fraction;
+  int32_t left, right, next_left, next_right;
+
+  if (channels < 1 || rate < 1) {
+    return NULL;
+  }
+
+  this = (struct ut3k_pcm*) malloc(sizeof(struct ut3k_pcm));
+  if (this == NULL) {
+    return NULL;
+  }
+
+  this->mapped = 0;
+  this->frames = (uint64_t) frames * UT3K_MIXER_RATE / rate;
+  this->data = (int16_t*) malloc(this->frames * UT3K_MIXER_FRAME_BYTES + 1);
+  if (this->data == NULL) {
+    free(this);
+    return NULL;
+  }
+
+  step = ((uint64_t) rate << 16) / UT3K_MIXER_RATE;
+  for (uint32_t frame = 0; frame < this->frames; ++frame, position += step) {
+    index = position >> 16;
+    fraction = position & 0xFFFF;
+
+    left = samples[index * channels];
+    right = samples[index * channels + (channels > 1)];
+    if (fraction != 0 && index + 1 < frames) {
+      next_left = samples[(index + 1) * channels];
+      next_right = samples[(index + 1) * channels + (channels > 1)];
+      left += ((int64_t) (next_left - left) * fraction) >> 16;
+      right += ((int64_t) (next_right - right) * fraction) >> 16;
+    }
+
+    this->data[2 * frame] = left;
+    this->data[2 * frame + 1] = right;
+  }
+
+  return this;
+}
+
+
+void free_ut3k_pcm(struct ut3k_pcm *this) {
+  if (this) {
+    if (!this->mapped) {
+      free(this->data);
+    }
+    free(this);
+  }
+}
+
+
+int ut3k_mixer_trigger(struct ut3k_mixer *this, const struct ut3k_pcm *pcm, uint32_t gain, uint64_t when_ns) {
+  uint32_t head = atomic_load_explicit(&this->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&this->tail, memory_order_acquire);
+
+  if (head - tail == UT3K_MIXER_TRIGGERS) {
+    this->dropped++;
+    return -1;
+  }
+
+  this->triggers[head & (UT3K_MIXER_TRIGGERS - 1)] =
+    (struct ut3k_mixer_trigger const) { .pcm = pcm, .gain = gain, .when_ns = when_ns };
+  atomic_store_explicit(&this->head, head + 1, memory_order_release);
+  return 0;
+}
+
+
+void ut3k_mixer_render(struct ut3k_mixer *this, int16_t *out, uint32_t frames, uint64_t start_ns) {
+  int32_t accumulator[MIX_CHUNK * UT3K_MIXER_CHANNELS];
+  uint32_t chunk;
+  int voice;
+
+  track_clock(this, start_ns);
+  take_triggers(this);
+
+  while (frames > 0) {
+    chunk = frames < MIX_CHUNK ? frames : MIX_CHUNK;
+    memset(accumulator, 0, chunk * UT3K_MIXER_CHANNELS * sizeof(int32_t));
+
+    for (voice = 0; voice < this->voice_count; ) {
+      mix_voice(&this->voices[voice], accumulator, this->frames_rendered, chunk);
+      if (this->voices[voice].position >= this->voices[voice].pcm->frames) {
+        // done: the last voice takes its place
+        this->voices[voice] = this->voices[--this->voice_count];
+      }
+      else {
+        ++voice;
+      }
+    }
+
+    for (uint32_t i = 0; i < chunk * UT3K_MIXER_CHANNELS; ++i) {
+      out[i] = clip(accumulator[i]);
+    }
+
+    out += chunk * UT3K_MIXER_CHANNELS;
+    frames -= chunk;
+    this->frames_rendered += chunk;
+  }
+}
+
+
+void ut3k_mixer_forget(struct ut3k_mixer *this, const struct ut3k_pcm *pcm) {
+  take_triggers(this);
+
+  for (int voice = 0; voice < this->voice_count; ) {
+    if (this->voices[voice].pcm == pcm) {
+      this->voices[voice] = this->voices[--this->voice_count];
+    }
+    else {
+      ++voice;
+    }
+  }
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+/** track_clock
+ *
+ * move the anchor up to the frame about to be rendered, easing the
+ * time it's expected at toward start_ns.
+ */
+static void track_clock(struct ut3k_mixer *this, uint64_t start_ns) {
+  uint64_t expected_ns;
+  int64_t error;
+
+  if (start_ns == 0) {
+    return;
+  }
+
+  if (this->anchor_ns == 0) {
+    this->anchor_frame = this->frames_rendered;
+    this->anchor_ns = start_ns;
+    return;
+  }
+
+  expected_ns = this->anchor_ns +
+    (this->frames_rendered - this->anchor_frame) * 1000000000ULL / UT3K_MIXER_RATE;
+  error = (int64_t) (start_ns - expected_ns);
+
+  this->anchor_frame = this->frames_rendered;
+  if (error > UT3K_MIXER_RESYNC_NS || error < -UT3K_MIXER_RESYNC_NS) {
+    this->anchor_ns = start_ns;
+  }
+  else {
+    this->anchor_ns = expected_ns + error / CLOCK_SMOOTHING;
+  }
+}
+
+
+/** time_to_frame
+ *
+ * the output frame heard at when_ns, the next one rendered if that's
+ * already gone (or not known).
+ */
+static uint64_t time_to_frame(struct ut3k_mixer *this, uint64_t when_ns) {
+  int64_t offset;
+
+  if (when_ns == 0 || this->anchor_ns == 0) {
+    return this->frames_rendered;
+  }
+
+  // nearest frame, either side of the anchor
+  offset = (int64_t) (when_ns - this->anchor_ns);
+  offset = (offset * UT3K_MIXER_RATE + (offset < 0 ? -500000000LL : 500000000LL)) / 1000000000LL;
+
+  if ((int64_t) this->anchor_frame + offset < (int64_t) this->frames_rendered) {
+    this->late++;
+    return this->frames_rendered;
+  }
+  return this->anchor_frame + offset;
+}
+
+
+static void take_triggers(struct ut3k_mixer *this) {
+  uint32_t tail = atomic_load_explicit(&this->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&this->head, memory_order_acquire);
+  const struct ut3k_mixer_trigger *trigger;
+
+  while (tail != head) {
+    trigger = &this->triggers[tail & (UT3K_MIXER_TRIGGERS - 1)];
+    start_voice(this, trigger->pcm, trigger->gain, time_to_frame(this, trigger->when_ns));
+    ++tail;
+  }
+
+  atomic_store_explicit(&this->tail, tail, memory_order_release);
+}
+
+
+/** start_voice
+ *
+ * with every voice busy the one furthest along gives way: it's the
+ * one most likely nearly done, or a long tail nobody will miss.
+ */
+static void start_voice(struct ut3k_mixer *this, const struct ut3k_pcm *pcm, uint32_t gain, uint64_t start_frame) {
+  int voice, furthest = 0;
+
+  if (pcm->frames == 0) {
+    return;
+  }
+
+  if (this->voice_count < UT3K_MIXER_VOICES) {
+    voice = this->voice_count++;
+  }
+  else {
+    for (voice = 1; voice < UT3K_MIXER_VOICES; ++voice) {
+      if (this->voices[voice].position > this->voices[furthest].position) {
+        furthest = voice;
+      }
+    }
+    voice = furthest;
+    this->stolen++;
+  }
+
+  this->voices[voice] = (struct ut3k_mixer_voice const)
+    { .pcm = pcm, .start_frame = start_frame, .position = 0, .gain = gain };
+}
+
+
+/** mix_voice
+ *
+ * frames of output from chunk_frame on.  A voice waiting to start
+ * comes in partway through the chunk that holds its start frame.
+ */
+static void mix_voice(struct ut3k_mixer_voice *voice, int32_t *accumulator, uint64_t chunk_frame, uint32_t frames) {
+  uint32_t remaining = voice->pcm->frames - voice->position;
+  const int16_t *data = voice->pcm->data + voice->position * UT3K_MIXER_CHANNELS;
+  int64_t gain = voice->gain;
+  uint32_t wait;
+
+  if (voice->start_frame >= chunk_frame + frames) {
+    return;
+  }
+  if (voice->start_frame > chunk_frame) {
+    wait = voice->start_frame - chunk_frame;
+    accumulator += wait * UT3K_MIXER_CHANNELS;
+    frames -= wait;
+  }
+
+  if (frames > remaining) {
+    frames = remaining;
+  }
+
+  if (gain == UT3K_MIXER_UNITY_GAIN) {
+    for (uint32_t i = 0; i < frames * UT3K_MIXER_CHANNELS; ++i) {
+      accumulator[i] += data[i];
+    }
+  }
+  else {
+    for (uint32_t i = 0; i < frames * UT3K_MIXER_CHANNELS; ++i) {
+      accumulator[i] += (data[i] * gain) >> 16;
+    }
+  }
+
+  voice->position += frames;
+}
+
+
+static inline int16_t clip(int32_t sample) {
+  return sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample;
+}
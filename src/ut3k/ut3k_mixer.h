@@ -0,0 +1,154 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* ut3k_mixer.h
+ *
+ * In-process mixing of sound effects.  Samples are decoded once, at
+ * load, into memory as 16 bit stereo at UT3K_MIXER_RATE.  Playing one
+ * starts a voice; the audio thread adds up the voices a period at a
+ * time into a single playback stream.  Against playing each effect on
+ * the sound server that's no round trip per effect, and a period can
+ * be a few milliseconds.
+ *
+ * The game thread starts voices by pushing triggers on a wait-free
+ * single producer, single consumer ring (like ut3k_encoder_ring.h),
+ * the audio thread takes them off at the start of each render.
+ * Everything else in the mixer belongs to the audio thread.
+ *
+ * A trigger can be for a CLOCK_MONOTONIC time rather than right away.
+ * Each render is told when its first frame will come out of the
+ * speaker, which pins output frames to the monotonic clock; the voice
+ * then starts on the frame for its time.  The estimates jitter with
+ * the server's latency reports, so they're only let pull the mapping
+ * a sixteenth of the way each render: steady, but following a sound
+ * card clock that drifts from the system's.  Scheduled a little ahead,
+ * a voice starts on the frame asked for however late the game loop
+ * got round to asking.
+ *
+ * Nothing here knows about PulseAudio: ut3k_pulseaudio.c runs the
+ * stream and calls ut3k_mixer_render from its write callback.
+ */
+
+#ifndef UT3K_MIXER_H
+#define UT3K_MIXER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define UT3K_MIXER_RATE 44100
+#define UT3K_MIXER_CHANNELS 2
+#define UT3K_MIXER_FRAME_BYTES (UT3K_MIXER_CHANNELS * sizeof(int16_t))
+
+// playing or waiting to start at once.  Past this the voice furthest
+// along is cut short.  Scheduled voices hold a slot from the trigger
+// until they've played out, so a sequencer playing ahead needs room for
+// the next step's hits on top of the tails still ringing.  Renders only
+// go through the voices in use.
+#define UT3K_MIXER_VOICES 64
+
+// power of two
+#define UT3K_MIXER_TRIGGERS 64
+
+// frames the server asks for at a time: 256 is under 6ms
+#define UT3K_MIXER_DEFAULT_PERIOD 256
+#define UT3K_MIXER_MIN_PERIOD 64
+#define UT3K_MIXER_MAX_PERIOD 8192
+
+// unity gain for voices, 16.16 like UT3K_LEVEL_UNITY_GAIN
+#define UT3K_MIXER_UNITY_GAIN 0x10000
+
+
+// a decoded sample: interleaved stereo frames at UT3K_MIXER_RATE
+struct ut3k_pcm {
+  uint32_t frames;
+  int16_t *data;
+  uint8_t mapped;  // data belongs to a sample bank mapping, not ours to free
+};
+
+// mixing ahead of time further off than this is taken as the stream
+// having stopped and started (an underrun, say): the frame to time
+// mapping starts over instead of easing across
+#define UT3K_MIXER_RESYNC_NS 50000000
+
+struct ut3k_mixer_trigger {
+  const struct ut3k_pcm *pcm;
+  uint32_t gain;
+  uint64_t when_ns;  // 0: right away
+};
+
+struct ut3k_mixer_voice {
+  const struct ut3k_pcm *pcm;
+  uint64_t start_frame;  // output frame it starts on
+  uint32_t position;     // next frame of pcm
+  uint32_t gain;
+};
+
+struct ut3k_mixer {
+  _Alignas(64) _Atomic uint32_t head;  // game thread
+  _Alignas(64) _Atomic uint32_t tail;  // audio thread
+  uint32_t dropped;                    // game thread, ring full
+  struct ut3k_mixer_trigger triggers[UT3K_MIXER_TRIGGERS];
+
+  uint32_t period_frames;
+  int voice_count;
+  struct ut3k_mixer_voice voices[UT3K_MIXER_VOICES];
+  uint64_t frames_rendered;
+  uint32_t stolen;  // voices cut short for a new one
+
+  // output frame anchor_frame comes out at anchor_ns, 0 until known
+  uint64_t anchor_frame;
+  uint64_t anchor_ns;
+  uint32_t late;  // triggers for a time already rendered
+};
+
+
+void init_ut3k_mixer(struct ut3k_mixer *this, uint32_t period_frames);
+
+/** new_ut3k_pcm
+ *
+ * convert frames of interleaved 16 bit samples with channels channels
+ * at rate to the mixer's format.  Mono goes to both sides, past two
+ * channels only the first two are kept.  NULL if out of memory.
+ */
+struct ut3k_pcm* new_ut3k_pcm(const int16_t *samples, uint32_t frames, int channels, int rate);
+
+void free_ut3k_pcm(struct ut3k_pcm *this);
+
+/** ut3k_mixer_trigger
+ *
+ * game thread: start pcm playing at when_ns on CLOCK_MONOTONIC, or at
+ * the next render for 0 (or a time already past).  Returns 0, or -1 if
+ * the ring is full and the trigger was dropped.
+ */
+int ut3k_mixer_trigger(struct ut3k_mixer *this, const struct ut3k_pcm *pcm, uint32_t gain, uint64_t when_ns);
+
+/** ut3k_mixer_render
+ *
+ * audio thread: mix the next frames of every voice into out,
+ * interleaved stereo.  start_ns is when out's first frame will be
+ * heard, 0 if not known.  Voices that finish are let go.
+ */
+void ut3k_mixer_render(struct ut3k_mixer *this, int16_t *out, uint32_t frames, uint64_t start_ns);
+
+/** ut3k_mixer_forget
+ *
+ * stop every voice of pcm, including triggers not yet rendered, before
+ * it's freed.  Call with the audio thread kept out of ut3k_mixer_render.
+ */
+void ut3k_mixer_forget(struct ut3k_mixer *this, const struct ut3k_pcm *pcm);
+
+
+#endif
@@ -1,33 +1,144 @@
 #include <assert.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <sndfile.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/queue.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <pulse/pulseaudio.h>
 
+#include "ut3k_hash.h"
+#include "ut3k_levels.h"
+#include "ut3k_mixer.h"
 #include "ut3k_pulseaudio.h"
+#include "ut3k_sample_bank.h"
+#include "ut3k_sample_cache.h"
+#include "ut3k_session.h"
 
 char *context_name = "Ultratroninator 3000 audio";
 
+// batch loading: decoder threads, at most one a core, and upload
+// streams in flight at once
+#define UT3K_LOAD_MAX_DECODERS 4
+#define UT3K_LOAD_UPLOAD_STREAMS 4
+
+
+// audio as it's held, once for every key whose file has the same content
+struct sample_buffer {
+    uint64_t hash;                   // of the file's content
+    int hashed;                      // unless it couldn't be read
+    int references;                  // keys on it
+    struct ut3k_envelope *envelope;  // levels for VU meters
+    struct ut3k_pcm *pcm;            // decoded for the mixer, NULL if on the server
+    char *server_name;               // first key's name, or its name in the sample cache
+    uint8_t cached;                  // resident: left on the server at exit
+    LIST_ENTRY(sample_buffer) nodes;
+};
 
 struct sample {
     char *name;
+    struct sample_buffer *buffer;
     LIST_ENTRY(sample) nodes;
 };
 
 LIST_HEAD(sample_list, sample) sample_list;
+LIST_HEAD(sample_buffer_list, sample_buffer) sample_buffer_list;
 
 static pa_mainloop *mainloop = NULL;
 static pa_mainloop_api *mainloop_api = NULL;
 static pa_context *context = NULL;
 static pa_operation *pa_operation_most_recent = NULL;
 
+// the mixer gets its own context on a threaded mainloop: the game
+// loop's mainloop only gets iterated every tick or so, far too seldom
+// to keep a low latency stream fed
+static struct ut3k_mixer mixer;
+static uint32_t mixer_period_frames = UT3K_MIXER_DEFAULT_PERIOD;
+static pa_threaded_mainloop *mixer_mainloop = NULL;
+static pa_context *mixer_context = NULL;
+static pa_stream *mixer_stream = NULL;
+
+// files queued by ut3k_upload_wavfile, loaded together by
+// ut3k_finish_sample_loading
+struct sample_load {
+    char *filename;
+    char *name;
+    int decoded;                     // 0 pending, 1 decoded, -1 failed
+    pa_sample_spec ss;
+    void *data;                      // decoded for the server
+    size_t bytes;
+    struct ut3k_pcm *pcm;            // or for the mixer
+    struct ut3k_envelope *envelope;
+    pa_stream *stream;
+    size_t written;
+    int cached;                      // goes through the sample cache
+    int resident;                    // found there, nothing to upload
+    struct stat source;
+    char server_name[UT3K_SAMPLE_CACHE_NAME_SIZE];
+    uint64_t hash;
+    int hashed;
+    int shares;                      // same content as another, nothing to load
+    int same_as;                     // that load, or -1 for a buffer held already
+    struct sample_buffer *buffer;    // the buffer held, or once loaded
+};
+
+// content claimed in a batch: by a load, or a buffer held already
+struct content {
+    uint64_t hash;
+    int load;
+    struct sample_buffer *buffer;
+};
+
+static struct {
+    int active;
+    const char *label;
+    struct timespec start;
+    struct sample_load *loads;
+    int count;
+    int capacity;
+    int banked;                      // found in the sample bank instead
+    int next_decode;                 // under the mutex, as are decoded flags
+    struct content *contents;        // and contents
+    int content_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t decoded;
+} loading = { .mutex = PTHREAD_MUTEX_INITIALIZER, .decoded = PTHREAD_COND_INITIALIZER };
+
+// what's resident on the server, listed at each batch
+static struct ut3k_sample_cache sample_cache;
+
+// samples packed ahead of time for the mixer, looked for once
+static struct ut3k_sample_bank *sample_bank = NULL;
+static int sample_bank_tried = 0;
+
 static enum pa_sample_format sndfile_format_to_pa_sample_format(int sfinfo);
 static char* filename_to_samplename(char *filename);
-static int ut3k_write_stream(pa_stream *stream, pa_sample_spec *ss, size_t file_stream_bytes, SNDFILE *f_sndfile);
+static struct sample* find_sample(const char *sample_name);
+static uint32_t volume_to_gain(pa_volume_t volume);
+static int start_mixer();
+static void stop_mixer();
+static void mixer_context_state_cb(pa_context *c, void *userdata);
+static void mixer_stream_state_cb(pa_stream *s, void *userdata);
+static void mixer_write_cb(pa_stream *s, size_t nbytes, void *userdata);
+static struct ut3k_pcm* decode_wavfile(SNDFILE *f_sndfile, SF_INFO *info, struct ut3k_envelope *envelope);
+static void forget_pcm(struct ut3k_pcm *pcm);
+static struct sample_buffer* new_sample_buffer(const char *server_name, struct ut3k_envelope *envelope, struct ut3k_pcm *pcm, uint8_t cached);
+static struct sample_buffer* find_sample_buffer(uint64_t hash);
+static void add_sample(char *name, struct sample_buffer *buffer);
+static pa_operation* release_sample_buffer(struct sample_buffer *buffer);
+static int sample_from_bank(char *filename, char *sample_name);
+static void* decode_loads(void *unused);
+static void use_sample_cache(struct sample_load *load);
+static int claim_content(struct sample_load *load, int index);
+static int decode_load(struct sample_load *load, int index);
+static int start_upload(struct sample_load *load);
+static int continue_upload(struct sample_load *load);
+static int finish_load(struct sample_load *load);
+static int share_load(struct sample_load *load);
 static void pa_sinklist_cb(pa_context *c, const pa_sink_info *l, int eol, void *userdata);
 
 /** ut3k_new_audio_context
@@ -56,10 +167,15 @@ void ut3k_new_audio_context() {
         ut3k_pa_mainloop_iterate();
     } while (context_state != PA_CONTEXT_READY);
 
-    // init the linked list
+    // init the linked lists
     LIST_INIT(&sample_list);
+    LIST_INIT(&sample_buffer_list);
     printf("pulseaudio connection ready\n");
 
+    if (start_mixer() == 0) {
+        printf("mixer running, %u frame period\n", mixer.period_frames);
+    }
+
     return;
 }
 
@@ -75,6 +191,14 @@ void ut3k_pa_mainloop_iterate() {
  */
 void ut3k_disconnect_audio_context() {
 
+    stop_mixer();
+
+    // after the mixer: its samples may still point into the bank
+    close_ut3k_sample_bank(sample_bank);
+    sample_bank = NULL;
+    sample_bank_tried = 0;
+    ut3k_sample_cache_clear(&sample_cache);
+
     if (context) {
         pa_context_disconnect(context);
         context = NULL;
@@ -95,89 +219,199 @@ void ut3k_disconnect_audio_context() {
  * ut3k_remove_sample call.
  * The returned string is memory managed by this library and gets
  * free'd as part of the ut3k_remove_sample call.
+ *
+ * Between ut3k_begin_sample_loading and ut3k_finish_sample_loading the
+ * file is only queued; on its own it's a batch of one.
  */
 
 char* ut3k_upload_wavfile(char *filename, char *sample_name) {
-    SNDFILE *f_sndfile;
-    SF_INFO info;
-    pa_stream *stream;
-    pa_sample_spec ss;
-    size_t file_stream_bytes;
-    struct sample *new_sample;
-    char *pulse_audio_stream_name;
+    struct sample_load *load;
+    int batch_of_one = !loading.active;
 
     assert(filename != NULL);
-    f_sndfile = sf_open(filename, SFM_READ, &info);
 
-    printf("sndfile opened %s\n", filename);
+    // the mixer can play straight out of a sample bank
+    if (mixer_stream != NULL && sample_from_bank(filename, sample_name) == 0) {
+        loading.banked++;
+        return sample_name;
+    }
 
-    if (sf_error(f_sndfile) != 0) {
-        printf("File error: %s\n", sf_strerror(f_sndfile));
-        return 0;
+    if (batch_of_one) {
+        ut3k_begin_sample_loading(NULL);
+    }
+
+    if (loading.count == loading.capacity) {
+        loading.capacity = loading.capacity ? 2 * loading.capacity : 32;
+        loading.loads = (struct sample_load*)realloc(loading.loads, loading.capacity * sizeof(struct sample_load));
+    }
+    load = &loading.loads[loading.count++];
+    memset(load, 0, sizeof(struct sample_load));
+    load->filename = strdup(filename);
+    load->name = sample_name ? strndup(sample_name, 128) : filename_to_samplename(filename);
+    load->same_as = -1;
+
+    if (batch_of_one) {
+        ut3k_finish_sample_loading();
     }
 
+    return sample_name;
+}
 
-    ss.format = sndfile_format_to_pa_sample_format(info.format);
-    ss.channels = info.channels;
-    ss.rate = info.samplerate;
 
-    switch(ss.format) {
-    case PA_SAMPLE_S16LE:
-        file_stream_bytes = 2 * info.channels * info.frames;
-        break;
-    case PA_SAMPLE_S24LE: // this isn't likely right for 24 bit...
-    case PA_SAMPLE_S32LE:
-    case PA_SAMPLE_FLOAT32LE:
-        file_stream_bytes = 4 * info.channels * info.frames;
-        break;
-    case PA_SAMPLE_U8:
-    default:
-        file_stream_bytes = 1 * info.channels * info.frames;
-        break;
+void ut3k_begin_sample_loading(const char *label) {
+    loading.active = 1;
+    loading.label = label;
+    loading.count = 0;
+    loading.banked = 0;
+    clock_gettime(CLOCK_MONOTONIC, &loading.start);
+}
+
+
+/** ut3k_finish_sample_loading
+ *
+ * decoders take the queued files in order.  The main thread starts an
+ * upload stream for each file as its decode comes in, in queue order,
+ * with up to UT3K_LOAD_UPLOAD_STREAMS in flight, and iterates the
+ * mainloop only while waiting on the server.
+ */
+int ut3k_finish_sample_loading() {
+    pthread_t decoders[UT3K_LOAD_MAX_DECODERS];
+    int decoder_count, next_upload = 0, in_flight = 0, finished = 0, loaded = 0, resident = 0, shared = 0;
+    int progress, buffers = 0;
+    struct sample_load *load;
+    struct sample_buffer *buffer;
+    struct timespec now;
+    long elapsed_usec;
+
+    if (!loading.active) {
+        return 0;
     }
 
-    // established the file characteristic, create a stream and write
-    // it to the server.  Use the basename of the filename for the
-    // uploaded stream.  Track this internally too in the linked list.
-    new_sample = (struct sample*)malloc(sizeof(struct sample));
-    LIST_INSERT_HEAD(&sample_list, new_sample, nodes);
-    
-    if (sample_name) { // caller supplied a name to use
-      pulse_audio_stream_name = sample_name;
-      new_sample->name = strndup(sample_name, 128);  // copy since it's incoming data
+    decoder_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (decoder_count > UT3K_LOAD_MAX_DECODERS) {
+        decoder_count = UT3K_LOAD_MAX_DECODERS;
     }
-    else {
-      pulse_audio_stream_name = filename_to_samplename(filename);
-      new_sample->name = pulse_audio_stream_name;  // mem already copied
+    if (decoder_count > loading.count) {
+        decoder_count = loading.count;
+    }
+    if (decoder_count < 1) {
+        decoder_count = 1;
+    }
+
+    // keys share what's held already, then what's loaded first
+    LIST_FOREACH(buffer, &sample_buffer_list, nodes) {
+        ++buffers;
+    }
+    loading.contents = (struct content*)realloc(loading.contents, (loading.count + buffers + 1) * sizeof(struct content));
+    loading.content_count = 0;
+    LIST_FOREACH(buffer, &sample_buffer_list, nodes) {
+        if (buffer->hashed) {
+            loading.contents[loading.content_count++] = (struct content const) { buffer->hash, -1, buffer };
+        }
     }
 
-    stream = pa_stream_new(context, pulse_audio_stream_name, &ss, NULL);
-    pa_stream_ref(stream);
-    assert(pa_stream_connect_upload(stream, file_stream_bytes) == 0);
+    // on the server, take whatever earlier games left there
+    if (mixer_stream == NULL && ut3k_sample_cache_enabled()) {
+        ut3k_sample_cache_refresh(&sample_cache, context, mainloop);
+        for (int i = 0; i < loading.count; ++i) {
+            use_sample_cache(&loading.loads[i]);
+        }
+    }
 
-    // wait for it to be ready
-    pa_stream_state_t stream_state;
-    do {
-        stream_state = pa_stream_get_state(stream);
-        assert(PA_STREAM_IS_GOOD(stream_state));
-        ut3k_pa_mainloop_iterate();
-    } while (stream_state != PA_STREAM_READY);
+    loading.next_decode = 0;
+    for (int i = 0; i < decoder_count; ++i) {
+        if (pthread_create(&decoders[i], NULL, decode_loads, NULL) != 0) {
+            decoder_count = i;
+        }
+    }
+    if (decoder_count == 0) {
+        // no threads to be had, decode here
+        decode_loads(NULL);
+    }
 
+    while (finished < loading.count) {
+        progress = 0;
+
+        // start uploads for decoded files, keeping to queue order
+        pthread_mutex_lock(&loading.mutex);
+        while (next_upload < loading.count && in_flight < UT3K_LOAD_UPLOAD_STREAMS &&
+               loading.loads[next_upload].decoded != 0) {
+            load = &loading.loads[next_upload++];
+            pthread_mutex_unlock(&loading.mutex);
+
+            if (load->decoded > 0 && load->shares) {
+                // once what it shares is loaded
+                ++finished;
+            }
+            else if (load->decoded < 0 || load->data == NULL) {
+                // failed, resident, or decoded for the mixer: nothing to upload
+                loaded += finish_load(load);
+                ++finished;
+            }
+            else if (start_upload(load) == 0) {
+                ++in_flight;
+            }
+            else {
+                finish_load(load);
+                ++finished;
+            }
+            progress = 1;
+
+            pthread_mutex_lock(&loading.mutex);
+        }
 
-    // stream is ready to write
-    ut3k_write_stream(stream, &ss, file_stream_bytes, f_sndfile);
+        // nothing to do until a decoder finishes
+        if (!progress && in_flight == 0 && finished < loading.count) {
+            pthread_cond_wait(&loading.decoded, &loading.mutex);
+            pthread_mutex_unlock(&loading.mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&loading.mutex);
+
+        for (int i = 0; i < next_upload; ++i) {
+            load = &loading.loads[i];
+            if (load->stream != NULL && continue_upload(load) != 0) {
+                loaded += finish_load(load);
+                ++finished;
+                --in_flight;
+                progress = 1;
+            }
+        }
 
+        if (!progress && in_flight > 0) {
+            // block on the server
+            assert(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+        }
+    }
 
-    // throwing an iterate between finish & disconnect cause an
-    // assertion on 12.2.  took out the iterate and things seem to
-    // work.  Guess the server doesn't need cycles between these
-    // calls.
-    assert(pa_stream_finish_upload(stream) == 0);
-    assert(pa_stream_disconnect(stream) == 0);
-    pa_stream_unref(stream);
+    for (int i = 0; i < decoder_count; ++i) {
+        pthread_join(decoders[i], NULL);
+    }
+    for (int i = 0; i < loading.count; ++i) {
+        if (loading.loads[i].shares) {
+            loaded += share_load(&loading.loads[i]);
+            ++shared;
+        }
+    }
+    // let the last of the uploads through
     ut3k_pa_mainloop_iterate();
+    loaded += loading.banked;
+    for (int i = 0; i < loading.count; ++i) {
+        resident += loading.loads[i].resident;
+    }
 
-    return sample_name;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_usec = (now.tv_sec - loading.start.tv_sec) * 1000000 + (now.tv_nsec - loading.start.tv_nsec) / 1000;
+    if (loading.label) {
+        printf("%s: loaded %d of %d samples in %ld.%03ld ms (%d decoders, %s, %d resident, %d shared)\n",
+               loading.label, loaded, loading.count + loading.banked, elapsed_usec / 1000, elapsed_usec % 1000,
+               decoder_count, mixer_stream != NULL ? "mixer" : "server", resident, shared);
+    }
+
+    loading.active = 0;
+    loading.count = 0;
+
+    return loaded;
 }
 
 
@@ -187,11 +421,51 @@ void ut3k_play_sample(const char *sample_name) {
 
 
 void ut3k_play_sample_at_volume(const char *sample_name, int32_t volume) {
+    ut3k_play_sample_at(sample_name, volume, 0);
+}
+
+
+/** ut3k_play_sample_at
+ *
+ * through the mixer the sample starts on the output frame for
+ * when_ns.  Samples on the server can only be played right away.
+ * A sample that failed to load for the mixer is skipped quietly.
+ */
+void ut3k_play_sample_at(const char *sample_name, int32_t volume, uint64_t when_ns) {
+    struct sample *sample;
+    struct sample_buffer *buffer;
+
+    // a replay runs faster than real time: keep it quiet
+    if (ut3k_session_is_replay()) {
+        return;
+    }
+
+    sample = find_sample(sample_name);
+    if (sample != NULL) {
+        buffer = sample->buffer;
+        if (when_ns != 0 && buffer->pcm != NULL) {
+            ut3k_levels_start_voice_at(sample->name, buffer->envelope, volume_to_gain(volume), when_ns);
+        }
+        else {
+            ut3k_levels_start_voice(sample->name, buffer->envelope, volume_to_gain(volume));
+        }
+        if (buffer->pcm != NULL) {
+            ut3k_mixer_trigger(&mixer, buffer->pcm, volume_to_gain(volume), when_ns);
+            return;
+        }
+    }
+
+    // with the mixer nothing is uploaded: the server doesn't have it.
+    // Failed loads were reported as they failed.
+    if (mixer_stream != NULL) {
+        return;
+    }
+
     if (pa_operation_most_recent != NULL) {
         pa_operation_unref(pa_operation_most_recent);
     }
 
-    pa_operation_most_recent = pa_context_play_sample(context, sample_name, NULL, volume, NULL, NULL);
+    pa_operation_most_recent = pa_context_play_sample(context, sample ? sample->buffer->server_name : sample_name, NULL, volume, NULL, NULL);
     pa_operation_ref(pa_operation_most_recent);
 }
 
@@ -230,17 +504,17 @@ void ut3k_list_samples() {
 
 void ut3k_remove_sample(char *sample_name) {
     struct sample *sample_to_remove;
-    pa_operation *op;
-    op = pa_context_remove_sample(context, sample_name, NULL, NULL);
-    LIST_FOREACH(sample_to_remove, &sample_list, nodes) {
-        if (strncmp(sample_to_remove->name, sample_name, 128) == 0) {
-            break;
-        }
+    pa_operation *op = NULL;
+
+    sample_to_remove = find_sample(sample_name);
+    if (sample_to_remove == NULL) {
+        return;
     }
     LIST_REMOVE(sample_to_remove, nodes);
+    op = release_sample_buffer(sample_to_remove->buffer);
     free(sample_to_remove->name);
     free(sample_to_remove);
-    while (pa_operation_get_state(op) == PA_OPERATION_RUNNING) {
+    while (op != NULL && pa_operation_get_state(op) == PA_OPERATION_RUNNING) {
         ut3k_pa_mainloop_iterate();
     }
 
@@ -252,12 +526,17 @@ void ut3k_remove_sample(char *sample_name) {
 
 void ut3k_remove_all_samples() {
     struct sample *sample;
-    pa_operation *op = NULL;
+    pa_operation *op = NULL, *removed;
 
     while (!LIST_EMPTY(&sample_list)) {
       sample = LIST_FIRST(&sample_list);
-      op = pa_context_remove_sample(context, sample->name, NULL, NULL);
       LIST_REMOVE(sample, nodes);
+      if ((removed = release_sample_buffer(sample->buffer)) != NULL) {
+          if (op != NULL) {
+              pa_operation_unref(op);
+          }
+          op = removed;
+      }
       free(sample->name);
       free(sample);
     }
@@ -312,6 +591,11 @@ void ut3k_set_default_sink(uint32_t index) {
 }
 
 
+void ut3k_set_mixer_period(uint32_t frames) {
+    mixer_period_frames = frames;
+}
+
+
 
 static enum pa_sample_format sndfile_format_to_pa_sample_format(int sfinfo) {
     switch (sfinfo & SF_FORMAT_SUBMASK) {
@@ -335,58 +619,627 @@ static enum pa_sample_format sndfile_format_to_pa_sample_format(int sfinfo) {
 }
 
 
-/** ut3k_write_stream
- * assumes the stream is ready to write
- * use the sample format provided,
- * write file_stream_bytes from f_sndfile to the stream
+static struct sample* find_sample(const char *sample_name) {
+    struct sample *sample;
+
+    LIST_FOREACH(sample, &sample_list, nodes) {
+        if (strncmp(sample->name, sample_name, 128) == 0) {
+            return sample;
+        }
+    }
+    return NULL;
+}
+
+
+/** volume_to_gain
+ *
+ * PulseAudio software volumes are cubic: linear gain is
+ * (volume / PA_VOLUME_NORM)^3.  Returned as 16.16 fixed point.
+ */
+static uint32_t volume_to_gain(pa_volume_t volume) {
+    uint64_t gain = volume;
+
+    gain = (gain * volume) / PA_VOLUME_NORM;
+    gain = (gain * volume) / PA_VOLUME_NORM;
+    return gain * UT3K_LEVEL_UNITY_GAIN / PA_VOLUME_NORM;
+}
+
+
+/** start_mixer
+ *
+ * connect a second context on its own thread and open the playback
+ * stream the mixer renders into: two periods buffered, the server
+ * asking for one at a time.  Returns 0, or -1 to leave samples to the
+ * server (turned off, or no stream).
+ */
+static int start_mixer() {
+    pa_sample_spec ss = { .format = PA_SAMPLE_S16LE, .rate = UT3K_MIXER_RATE, .channels = UT3K_MIXER_CHANNELS };
+    pa_buffer_attr attr;
+    pa_context_state_t context_state;
+    pa_stream_state_t stream_state;
+    char *setting;
+
+    setting = getenv(UT3K_MIXER_ENV_VAR);
+    if (setting != NULL && strcmp(setting, "off") == 0) {
+        printf("mixer off, samples play on the server\n");
+        return -1;
+    }
+    if (setting != NULL && atoi(setting) > 0) {
+        mixer_period_frames = atoi(setting);
+    }
+
+    init_ut3k_mixer(&mixer, mixer_period_frames);
+
+    mixer_mainloop = pa_threaded_mainloop_new();
+    assert(mixer_mainloop);
+    mixer_context = pa_context_new(pa_threaded_mainloop_get_api(mixer_mainloop), context_name);
+    assert(mixer_context);
+    pa_context_set_state_callback(mixer_context, mixer_context_state_cb, NULL);
+
+    pa_threaded_mainloop_lock(mixer_mainloop);
+    if (pa_threaded_mainloop_start(mixer_mainloop) < 0 ||
+        pa_context_connect(mixer_context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+        printf("mixer connect failed: %s\n", pa_strerror(pa_context_errno(mixer_context)));
+        pa_threaded_mainloop_unlock(mixer_mainloop);
+        stop_mixer();
+        return -1;
+    }
+
+    while ((context_state = pa_context_get_state(mixer_context)) != PA_CONTEXT_READY) {
+        if (!PA_CONTEXT_IS_GOOD(context_state)) {
+            printf("mixer context failed: %s\n", pa_strerror(pa_context_errno(mixer_context)));
+            pa_threaded_mainloop_unlock(mixer_mainloop);
+            stop_mixer();
+            return -1;
+        }
+        pa_threaded_mainloop_wait(mixer_mainloop);
+    }
+
+    attr.maxlength = (uint32_t) -1;
+    attr.tlength = 2 * mixer.period_frames * UT3K_MIXER_FRAME_BYTES;
+    attr.prebuf = (uint32_t) -1;
+    attr.minreq = mixer.period_frames * UT3K_MIXER_FRAME_BYTES;
+    attr.fragsize = (uint32_t) -1;
+
+    mixer_stream = pa_stream_new(mixer_context, "ut3k mixer", &ss, NULL);
+    assert(mixer_stream);
+    pa_stream_set_state_callback(mixer_stream, mixer_stream_state_cb, NULL);
+    pa_stream_set_write_callback(mixer_stream, mixer_write_cb, NULL);
+
+    // timing updates so the write callback knows when what it writes
+    // will be heard
+    if (pa_stream_connect_playback(mixer_stream, NULL, &attr,
+                                   PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE,
+                                   NULL, NULL) < 0) {
+        stream_state = PA_STREAM_FAILED;
+    }
+    else {
+        while ((stream_state = pa_stream_get_state(mixer_stream)) != PA_STREAM_READY &&
+               PA_STREAM_IS_GOOD(stream_state)) {
+            pa_threaded_mainloop_wait(mixer_mainloop);
+        }
+    }
+    pa_threaded_mainloop_unlock(mixer_mainloop);
+
+    if (stream_state != PA_STREAM_READY) {
+        printf("mixer stream failed: %s\n", pa_strerror(pa_context_errno(mixer_context)));
+        stop_mixer();
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void stop_mixer() {
+    if (mixer_mainloop == NULL) {
+        return;
+    }
+
+    pa_threaded_mainloop_stop(mixer_mainloop);
+    if (mixer_stream) {
+        pa_stream_disconnect(mixer_stream);
+        pa_stream_unref(mixer_stream);
+        mixer_stream = NULL;
+    }
+    if (mixer_context) {
+        pa_context_disconnect(mixer_context);
+        pa_context_unref(mixer_context);
+        mixer_context = NULL;
+    }
+    pa_threaded_mainloop_free(mixer_mainloop);
+    mixer_mainloop = NULL;
+}
+
+
+static void mixer_context_state_cb(pa_context *c, void *userdata) {
+    pa_threaded_mainloop_signal(mixer_mainloop, 0);
+}
+
+
+static void mixer_stream_state_cb(pa_stream *s, void *userdata) {
+    pa_threaded_mainloop_signal(mixer_mainloop, 0);
+}
+
+
+/** mixer_write_cb
+ *
+ * on the mixer's thread: the server wants nbytes more.  Render
+ * straight into the stream's own buffer.  What's written now is heard
+ * after the stream's latency, which places scheduled voices; further
+ * writes in the same callback carry on from the mixer's own count.
+ */
+static void mixer_write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    void *buffer;
+    size_t bytes;
+    pa_usec_t latency;
+    int negative;
+    struct timespec now;
+    uint64_t start_ns = 0;
+
+    if (pa_stream_get_latency(s, &latency, &negative) == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        start_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec + (negative ? 0 : latency * 1000);
+    }
+
+    while (nbytes > 0) {
+        bytes = nbytes;
+        if (pa_stream_begin_write(s, &buffer, &bytes) < 0 || bytes < UT3K_MIXER_FRAME_BYTES) {
+            return;
+        }
+        bytes -= bytes % UT3K_MIXER_FRAME_BYTES;
+
+        ut3k_mixer_render(&mixer, (int16_t*) buffer, bytes / UT3K_MIXER_FRAME_BYTES, start_ns);
+        start_ns = 0;
+        pa_stream_write(s, buffer, bytes, NULL, 0LL, PA_SEEK_RELATIVE);
+
+        nbytes = bytes >= nbytes ? 0 : nbytes - bytes;
+    }
+}
+
+
+/** decode_wavfile
+ *
+ * the whole file as 16 bit (libsndfile converts whatever it is), on
+ * through the envelope and into the mixer's format.
  */
-static int ut3k_write_stream(pa_stream *stream, pa_sample_spec *ss, size_t file_stream_bytes, SNDFILE *f_sndfile) {
-    uint8_t *buffer = NULL;
-    size_t file_bytes_remaining = file_stream_bytes, sf_frames_read, pa_bytes_allowed;
-
-    while (file_bytes_remaining > 0) {
-        // we've got file_bytes_remaining to write to PA.
-        // Request PA to upload this -- PA may respond with a smaller size,
-        // tracked in pa_bytes_allowed
-        pa_bytes_allowed = file_bytes_remaining;
-        assert(pa_stream_begin_write(stream, (void**)&buffer, &pa_bytes_allowed) == 0);
-
-        switch (ss->format) {
+static struct ut3k_pcm* decode_wavfile(SNDFILE *f_sndfile, SF_INFO *info, struct ut3k_envelope *envelope) {
+    int16_t *samples;
+    sf_count_t frames_read;
+    struct ut3k_pcm *pcm;
+
+    samples = (int16_t*) malloc(info->frames * info->channels * sizeof(int16_t) + 1);
+    if (samples == NULL) {
+        return NULL;
+    }
+
+    frames_read = sf_readf_short(f_sndfile, samples, info->frames);
+    if (frames_read < 0) {
+        frames_read = 0;
+    }
+    if (envelope) {
+        ut3k_envelope_add_s16(envelope, samples, frames_read * info->channels);
+    }
+
+    pcm = new_ut3k_pcm(samples, frames_read, info->channels, info->samplerate);
+    free(samples);
+
+    return pcm;
+}
+
+
+// stop its voices with the mixer's thread held off, then free it
+static void forget_pcm(struct ut3k_pcm *pcm) {
+    if (pcm == NULL) {
+        return;
+    }
+
+    if (mixer_mainloop) {
+        pa_threaded_mainloop_lock(mixer_mainloop);
+        ut3k_mixer_forget(&mixer, pcm);
+        pa_threaded_mainloop_unlock(mixer_mainloop);
+    }
+    free_ut3k_pcm(pcm);
+}
+
+
+static struct sample_buffer* new_sample_buffer(const char *server_name, struct ut3k_envelope *envelope, struct ut3k_pcm *pcm, uint8_t cached) {
+    struct sample_buffer *buffer;
+
+    buffer = (struct sample_buffer*)calloc(1, sizeof(struct sample_buffer));
+    buffer->envelope = envelope;
+    buffer->pcm = pcm;
+    buffer->server_name = strdup(server_name);
+    buffer->cached = cached;
+    LIST_INSERT_HEAD(&sample_buffer_list, buffer, nodes);
+
+    return buffer;
+}
+
+
+static struct sample_buffer* find_sample_buffer(uint64_t hash) {
+    struct sample_buffer *buffer;
+
+    LIST_FOREACH(buffer, &sample_buffer_list, nodes) {
+        if (buffer->hashed && buffer->hash == hash) {
+            return buffer;
+        }
+    }
+    return NULL;
+}
+
+
+// name is taken over
+static void add_sample(char *name, struct sample_buffer *buffer) {
+    struct sample *new_sample;
+
+    new_sample = (struct sample*)malloc(sizeof(struct sample));
+    new_sample->name = name;
+    new_sample->buffer = buffer;
+    buffer->references++;
+    LIST_INSERT_HEAD(&sample_list, new_sample, nodes);
+}
+
+
+/** release_sample_buffer
+ *
+ * a key's gone.  Voices only hold the key's name, so they're stopped
+ * whichever key started them.  With the last key the buffer goes too:
+ * the pending removal from the server, if any, is returned.
+ */
+static pa_operation* release_sample_buffer(struct sample_buffer *buffer) {
+    pa_operation *op = NULL;
+
+    ut3k_levels_stop_voices(buffer->envelope);
+    if (--buffer->references > 0) {
+        return NULL;
+    }
+
+    if (buffer->pcm == NULL && !buffer->cached) {
+        op = pa_context_remove_sample(context, buffer->server_name, NULL, NULL);
+    }
+    LIST_REMOVE(buffer, nodes);
+    forget_pcm(buffer->pcm);
+    free_ut3k_envelope(buffer->envelope);
+    free(buffer->server_name);
+    free(buffer);
+
+    return op;
+}
+
+
+/** sample_from_bank
+ *
+ * load a sample for the mixer from the sample bank, if there is one
+ * and it has an up to date copy of filename.  Named as
+ * ut3k_upload_wavfile would.  Returns 0 if loaded.
+ */
+static int sample_from_bank(char *filename, char *sample_name) {
+    const struct ut3k_bank_entry *entry;
+    struct sample_buffer *buffer;
+    struct ut3k_pcm *pcm;
+    struct ut3k_envelope *envelope;
+    char *name;
+
+    if (!sample_bank_tried) {
+        sample_bank = ut3k_sample_bank_locate(filename);
+        sample_bank_tried = 1;
+    }
+    if (sample_bank == NULL || (entry = ut3k_sample_bank_find(sample_bank, filename)) == NULL) {
+        return -1;
+    }
+
+    name = sample_name ? strndup(sample_name, 128) : filename_to_samplename(filename);
+    if ((buffer = find_sample_buffer(entry->content_hash)) == NULL) {
+        if (ut3k_sample_bank_load(sample_bank, entry, &pcm, &envelope) != 0) {
+            free(name);
+            return -1;
+        }
+        buffer = new_sample_buffer(name, envelope, pcm, 0);
+        buffer->hash = entry->content_hash;
+        buffer->hashed = 1;
+    }
+    add_sample(name, buffer);
+
+    return 0;
+}
+
+
+// decoder threads: take the next queued file until there are none
+static void* decode_loads(void *unused) {
+    int index, decoded;
+
+    while (1) {
+        pthread_mutex_lock(&loading.mutex);
+        index = loading.next_decode++;
+        pthread_mutex_unlock(&loading.mutex);
+        if (index >= loading.count) {
+            return NULL;
+        }
+
+        decoded = decode_load(&loading.loads[index], index);
+
+        pthread_mutex_lock(&loading.mutex);
+        loading.loads[index].decoded = decoded;
+        pthread_cond_broadcast(&loading.decoded);
+        pthread_mutex_unlock(&loading.mutex);
+    }
+}
+
+
+/** use_sample_cache
+ *
+ * files go by their real path in the cache, so games agree on them.
+ * One resident as it is now needn't be read to be hashed.
+ */
+static void use_sample_cache(struct sample_load *load) {
+    const struct ut3k_cached_sample *cached;
+    char *path;
+
+    if ((path = realpath(load->filename, NULL)) == NULL || stat(path, &load->source) != 0) {
+        free(path);
+        return;
+    }
+    free(load->filename);
+    load->filename = path;
+    load->cached = 1;
+
+    if ((cached = ut3k_sample_cache_find_source(&sample_cache, load->filename, &load->source)) != NULL) {
+        strcpy(load->server_name, cached->name);
+        load->hash = cached->hash;
+        load->hashed = 1;
+        load->resident = 1;
+    }
+}
+
+
+/** claim_content
+ *
+ * the first load of some content loads it, later ones share.  Returns
+ * 1 if the load shares.
+ */
+static int claim_content(struct sample_load *load, int index) {
+    struct content *content;
+
+    pthread_mutex_lock(&loading.mutex);
+    for (int i = 0; i < loading.content_count; ++i) {
+        content = &loading.contents[i];
+        if (content->hash == load->hash) {
+            load->same_as = content->load;
+            load->buffer = content->buffer;
+            load->shares = 1;
+            load->resident = 0;
+            pthread_mutex_unlock(&loading.mutex);
+            return 1;
+        }
+    }
+    loading.contents[loading.content_count++] = (struct content const) { load->hash, index, NULL };
+    pthread_mutex_unlock(&loading.mutex);
+
+    return 0;
+}
+
+
+/** decode_load
+ *
+ * the whole file, through its envelope: for the mixer in the mixer's
+ * format, for the server as it is in the file.  Anything wider than
+ * 16 bits goes up as 32 bit integers, which libsndfile converts to.
+ * Returns 1, or -1 if it can't be read.
+ */
+static int decode_load(struct sample_load *load, int index) {
+    SNDFILE *f_sndfile;
+    SF_INFO info;
+    sf_count_t samples, samples_read;
+
+    if (!load->hashed && ut3k_hash_file(load->filename, &load->hash) == 0) {
+        load->hashed = 1;
+    }
+    if (load->hashed && claim_content(load, index) != 0) {
+        return 1;
+    }
+
+    // on the server already, maybe under another path
+    if (load->cached) {
+        const struct ut3k_cached_sample *cached;
+
+        if (!load->hashed) {
+            load->cached = 0;
+        }
+        else {
+            ut3k_sample_cache_name(load->hash, load->server_name);
+            if ((cached = ut3k_sample_cache_find_content(&sample_cache, load->hash)) != NULL) {
+                load->envelope = new_ut3k_cached_envelope(cached);
+                load->resident = 1;
+                return 1;
+            }
+        }
+    }
+
+    memset(&info, 0, sizeof(info));
+    f_sndfile = sf_open(load->filename, SFM_READ, &info);
+    if (f_sndfile == NULL) {
+        printf("File error: %s: %s\n", load->filename, sf_strerror(NULL));
+        return -1;
+    }
+
+    load->envelope = new_ut3k_envelope(info.samplerate, info.channels, info.frames);
+
+    if (mixer_stream != NULL) {
+        load->pcm = decode_wavfile(f_sndfile, &info, load->envelope);
+    }
+    else {
+        load->ss.format = sndfile_format_to_pa_sample_format(info.format);
+        load->ss.channels = info.channels;
+        load->ss.rate = info.samplerate;
+        samples = info.frames * info.channels;
+
+        switch (load->ss.format) {
         case PA_SAMPLE_S16LE:
-            sf_frames_read = sf_read_short(f_sndfile, (short*)buffer, pa_bytes_allowed / 2);
-            // compute what sndfile returned as bytes- it ought to match
-            // I'd think the assertion should be
-            // sf_frames_read * ss->channels * 2 == pa_bytes_allowed
-            // but channels doesn't seem to work
-            assert(sf_frames_read * 2 == pa_bytes_allowed);
+            load->data = malloc(samples * 2 + 1);
+            samples_read = sf_read_short(f_sndfile, (short*)load->data, samples);
+            load->bytes = samples_read > 0 ? samples_read * 2 : 0;
+            if (load->envelope) {
+                ut3k_envelope_add_s16(load->envelope, (int16_t*)load->data, load->bytes / 2);
+            }
             break;
+        case PA_SAMPLE_S24LE:
         case PA_SAMPLE_S32LE:
         case PA_SAMPLE_FLOAT32LE:
-        case PA_SAMPLE_S24LE:  // not sure if this is correct for 24 bit...
-            sf_frames_read = sf_readf_int(f_sndfile, (int*)buffer, pa_bytes_allowed / 4);
-            assert(sf_frames_read * 4 == pa_bytes_allowed);
-          break;
+            load->ss.format = PA_SAMPLE_S32LE;
+            load->data = malloc(samples * 4 + 1);
+            samples_read = sf_read_int(f_sndfile, (int*)load->data, samples);
+            load->bytes = samples_read > 0 ? samples_read * 4 : 0;
+            if (load->envelope) {
+                ut3k_envelope_add_s32(load->envelope, (int32_t*)load->data, load->bytes / 4);
+            }
+            break;
         case PA_SAMPLE_U8:
         default:
-            sf_frames_read = sf_read_raw(f_sndfile, (void*)buffer, pa_bytes_allowed);
-            assert(sf_frames_read == pa_bytes_allowed);
-
+            load->data = malloc(samples + 1);
+            samples_read = sf_read_raw(f_sndfile, load->data, samples);
+            load->bytes = samples_read > 0 ? samples_read : 0;
+            if (load->envelope) {
+                ut3k_envelope_add_u8(load->envelope, (uint8_t*)load->data, load->bytes);
+            }
+            break;
         }
+    }
 
-        file_bytes_remaining -= pa_bytes_allowed;
+    if (load->envelope) {
+        ut3k_envelope_finish(load->envelope);
+    }
+    sf_close(f_sndfile);
 
-	assert(pa_stream_write(stream, buffer, pa_bytes_allowed, NULL, 0LL, PA_SEEK_RELATIVE) == 0);
-        // I don't know how necessary this is... I'm assuming we've got
-        // to give PA some cycle
-        ut3k_pa_mainloop_iterate();
+    return (load->pcm != NULL || load->bytes > 0) ? 1 : -1;
+}
+
+
+static int start_upload(struct sample_load *load) {
+    pa_proplist *proplist;
+
+    if (load->cached) {
+        proplist = new_ut3k_sample_cache_proplist(load->filename, &load->source, load->envelope);
+        load->stream = pa_stream_new_with_proplist(context, load->server_name, &load->ss, NULL, proplist);
+        pa_proplist_free(proplist);
+    }
+    else {
+        load->stream = pa_stream_new(context, load->name, &load->ss, NULL);
+    }
+    if (load->stream == NULL) {
+        printf("can't upload %s: %s\n", load->name, pa_strerror(pa_context_errno(context)));
+        load->decoded = -1;
+        return -1;
     }
 
-    //printf("finished stream write with file_bytes_remaining = %d\n", file_bytes_remaining);
+    if (pa_stream_connect_upload(load->stream, load->bytes) < 0) {
+        printf("can't upload %s: %s\n", load->name, pa_strerror(pa_context_errno(context)));
+        pa_stream_unref(load->stream);
+        load->stream = NULL;
+        load->decoded = -1;
+        return -1;
+    }
 
+    load->written = 0;
     return 0;
 }
 
 
+/** continue_upload
+ *
+ * once the stream is ready write it all.  Buffers from
+ * pa_stream_begin_write come out of the context's memory pool, shared
+ * with the server (memfd or POSIX shm) where it allows it, so the data
+ * is copied once, into the pool, and handed over by reference.
+ * Returns 0 while waiting on the stream, 1 once uploaded, -1 if it
+ * failed.
+ */
+static int continue_upload(struct sample_load *load) {
+    pa_stream_state_t stream_state;
+    void *buffer;
+    size_t bytes;
+    int rc = 1;
+
+    stream_state = pa_stream_get_state(load->stream);
+    if (stream_state != PA_STREAM_READY && PA_STREAM_IS_GOOD(stream_state)) {
+        return 0;
+    }
+
+    if (stream_state != PA_STREAM_READY) {
+        rc = -1;
+    }
+
+    while (rc > 0 && load->written < load->bytes) {
+        bytes = load->bytes - load->written;
+        if (pa_stream_begin_write(load->stream, &buffer, &bytes) < 0 || bytes == 0) {
+            rc = -1;
+            break;
+        }
+        memcpy(buffer, (uint8_t*)load->data + load->written, bytes);
+        if (pa_stream_write(load->stream, buffer, bytes, NULL, 0LL, PA_SEEK_RELATIVE) < 0) {
+            rc = -1;
+            break;
+        }
+        load->written += bytes;
+    }
+
+    if (rc > 0) {
+        pa_stream_finish_upload(load->stream);
+    }
+    else {
+        printf("upload of %s failed: %s\n", load->name, pa_strerror(pa_context_errno(context)));
+        load->decoded = -1;
+    }
+    pa_stream_disconnect(load->stream);
+    pa_stream_unref(load->stream);
+    load->stream = NULL;
+
+    return rc;
+}
+
+
+// the loaded sample goes on the list, a failed one is dropped
+static int finish_load(struct sample_load *load) {
+    free(load->data);
+    load->data = NULL;
+
+    if (load->decoded < 0) {
+        printf("failed to load %s, %s won't play\n", load->filename, load->name);
+        free_ut3k_envelope(load->envelope);
+        free_ut3k_pcm(load->pcm);
+        free(load->name);
+        free(load->filename);
+        return 0;
+    }
+
+    load->buffer = new_sample_buffer(load->cached ? load->server_name : load->name,
+                                     load->envelope, load->pcm, load->cached);
+    load->buffer->hash = load->hash;
+    load->buffer->hashed = load->hashed;
+    add_sample(load->name, load->buffer);
+
+    free(load->filename);
+    return 1;
+}
+
+
+// a key on what another load or an earlier batch loaded
+static int share_load(struct sample_load *load) {
+    struct sample_buffer *buffer = load->same_as >= 0 ? loading.loads[load->same_as].buffer : load->buffer;
+
+    if (buffer == NULL) {
+        printf("failed to load %s\n", load->filename);
+        free(load->name);
+        free(load->filename);
+        return 0;
+    }
+
+    add_sample(load->name, buffer);
+    free(load->filename);
+    return 1;
+}
+
+
 /** filename_to_samplename
  * use the basename of the passed in filename, minux any suffix.
  * the return char* is caller owned and should be free()'d when done
@@ -447,3 +1300,4 @@ static void pa_sinklist_cb(pa_context *c, const pa_sink_info *l, int eol, void *
     }
   }
 }
+
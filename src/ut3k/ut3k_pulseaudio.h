@@ -3,14 +3,33 @@
 
 #include <stdint.h>
 
+// "off" to play samples on the server instead of mixing them here, or
+// the mixer's period in frames
+#define UT3K_MIXER_ENV_VAR "UT3K_MIXER"
+
 void ut3k_new_audio_context();
 void ut3k_pa_mainloop_iterate();
 void ut3k_disconnect_audio_context();
 
+// keys whose files have the same content share one sample
 char* ut3k_upload_wavfile(char *filename, char *sample_name);
+
+// load a game's samples as a batch: ut3k_upload_wavfile calls in
+// between only queue their files.  Finishing decodes them on a pool of
+// threads while uploading several at a time, and reports the load wall
+// time under label (NULL for quiet).  Returns the count loaded.
+void ut3k_begin_sample_loading(const char *label);
+int ut3k_finish_sample_loading();
 void ut3k_play_sample(const char *sample_name);
 void ut3k_play_sample_at_volume(const char *sample_name, int32_t volume);
+
+// start the sample at when_ns on CLOCK_MONOTONIC, to the frame when
+// it's going through the mixer.  Ask a little ahead: a time already
+// past plays right away.
+void ut3k_play_sample_at(const char *sample_name, int32_t volume, uint64_t when_ns);
 int32_t ut3k_get_default_volume();
+// samples in the sample cache (ut3k_sample_cache.h) stay resident on
+// the server for the next game, only the name goes
 void ut3k_remove_sample(char *sample_name);
 void ut3k_remove_all_samples();
 void ut3k_wait_last_operation();
@@ -23,4 +42,8 @@ void ut3k_get_sink_list(uint32_t sink_list[], int *num); // pa_context_get_sink_
 void ut3k_set_default_sink(uint32_t index);
 void ut3k_set_sink_volume(uint32_t index);
 
+// frames the mixer renders at a time, see ut3k_mixer.h.  Call before
+// ut3k_new_audio_context.
+void ut3k_set_mixer_period(uint32_t frames);
+
 #endif
@@ -0,0 +1,429 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <sndfile.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ut3k_hash.h"
+#include "ut3k_sample_bank.h"
+
+
+struct ut3k_sample_bank_writer {
+  char bank_filename[256];
+  char temp_filename[260];
+  char samples_directory[256];
+  FILE *file;
+  uint64_t offset;
+  int entry_count;
+  int entry_capacity;
+  struct ut3k_bank_entry *entries;
+};
+
+struct ut3k_sample_bank {
+  int fd;
+  size_t size;
+  const uint8_t *map;
+  const struct ut3k_bank_header *header;
+  const struct ut3k_bank_entry *entries;
+};
+
+static struct ut3k_bank_entry* new_entry(struct ut3k_sample_bank_writer *this);
+static int write_aligned(struct ut3k_sample_bank_writer *this, const void *data, size_t size, uint64_t *offset);
+static int compare_entries(const void *a, const void *b);
+static const struct ut3k_bank_entry* find_entry(const struct ut3k_sample_bank *this, const char *name);
+static void prefault(const struct ut3k_sample_bank *this, uint64_t offset, size_t size);
+
+
+
+struct ut3k_sample_bank_writer* new_ut3k_sample_bank_writer(const char *bank_filename, const char *samples_directory) {
+  struct ut3k_sample_bank_writer *this;
+  struct ut3k_bank_header header = { 0 };
+
+  this = (struct ut3k_sample_bank_writer*) calloc(1, sizeof(struct ut3k_sample_bank_writer));
+  if (this == NULL) {
+    return NULL;
+  }
+  snprintf(this->bank_filename, sizeof(this->bank_filename), "%s", bank_filename);
+  snprintf(this->temp_filename, sizeof(this->temp_filename), "%s.tmp", bank_filename);
+  snprintf(this->samples_directory, sizeof(this->samples_directory), "%s", samples_directory);
+
+  // the header goes in last, once the index is where it's going
+  this->file = fopen(this->temp_filename, "wb");
+  if (this->file == NULL || fwrite(&header, sizeof(header), 1, this->file) != 1) {
+    printf("can't write sample bank %s\n", this->temp_filename);
+    if (this->file) {
+      fclose(this->file);
+    }
+    free(this);
+    return NULL;
+  }
+  this->offset = sizeof(header);
+
+  return this;
+}
+
+
+int ut3k_sample_bank_add(struct ut3k_sample_bank_writer *this, const char *name) {
+  char filename[512];
+  struct stat source;
+  SNDFILE *f_sndfile;
+  SF_INFO info;
+  int16_t *samples;
+  sf_count_t frames;
+  struct ut3k_envelope *envelope;
+  struct ut3k_pcm *pcm;
+  struct ut3k_bank_entry *entry;
+  uint64_t content_hash;
+  int rc = -1;
+
+  if (strlen(name) >= UT3K_BANK_NAME_SIZE) {
+    printf("sample name too long for the bank: %s\n", name);
+    return -1;
+  }
+  for (int i = 0; i < this->entry_count; ++i) {
+    if (strcmp(this->entries[i].name, name) == 0) {
+      return 0;
+    }
+  }
+
+  snprintf(filename, sizeof(filename), "%s/%s", this->samples_directory, name);
+  if (stat(filename, &source) != 0 || ut3k_hash_file(filename, &content_hash) != 0) {
+    printf("can't open %s\n", filename);
+    return -1;
+  }
+
+  // the same audio under another name: share its data
+  for (int i = 0; i < this->entry_count; ++i) {
+    if (this->entries[i].content_hash == content_hash) {
+      if ((entry = new_entry(this)) == NULL) {
+        return -1;
+      }
+      *entry = this->entries[i];
+      snprintf(entry->name, UT3K_BANK_NAME_SIZE, "%s", name);
+      entry->source_mtime = source.st_mtime;
+      entry->source_size = source.st_size;
+      this->entry_count++;
+      return 0;
+    }
+  }
+
+  memset(&info, 0, sizeof(info));
+  if ((f_sndfile = sf_open(filename, SFM_READ, &info)) == NULL) {
+    printf("can't open %s\n", filename);
+    return -1;
+  }
+
+  samples = (int16_t*) malloc(info.frames * info.channels * sizeof(int16_t) + 1);
+  if (samples == NULL) {
+    printf("can't convert %s\n", filename);
+    sf_close(f_sndfile);
+    return -1;
+  }
+  frames = sf_readf_short(f_sndfile, samples, info.frames);
+  sf_close(f_sndfile);
+  if (frames < 0) {
+    frames = 0;
+  }
+
+  // levels as ut3k_upload_wavfile would work them out
+  envelope = new_ut3k_envelope(info.samplerate, info.channels, frames);
+  pcm = new_ut3k_pcm(samples, frames, info.channels, info.samplerate);
+
+  if (envelope != NULL && pcm != NULL && (entry = new_entry(this)) != NULL) {
+    ut3k_envelope_add_s16(envelope, samples, frames * info.channels);
+    ut3k_envelope_finish(envelope);
+
+    memset(entry, 0, sizeof(struct ut3k_bank_entry));
+    snprintf(entry->name, UT3K_BANK_NAME_SIZE, "%s", name);
+    entry->frames = pcm->frames;
+    entry->level_blocks = envelope->blocks;
+    entry->source_mtime = source.st_mtime;
+    entry->source_size = source.st_size;
+    entry->content_hash = content_hash;
+
+    if (write_aligned(this, pcm->data, (size_t) pcm->frames * UT3K_MIXER_FRAME_BYTES, &entry->data_offset) == 0 &&
+        write_aligned(this, envelope->levels, envelope->blocks * sizeof(struct ut3k_level), &entry->levels_offset) == 0) {
+      this->entry_count++;
+      rc = 0;
+    }
+  }
+  else {
+    printf("can't convert %s\n", filename);
+  }
+
+  free_ut3k_envelope(envelope);
+  free_ut3k_pcm(pcm);
+  free(samples);
+
+  return rc;
+}
+
+
+int finish_ut3k_sample_bank_writer(struct ut3k_sample_bank_writer *this) {
+  struct ut3k_bank_header header = { 0 };
+  int rc = -1;
+
+  qsort(this->entries, this->entry_count, sizeof(struct ut3k_bank_entry), compare_entries);
+
+  memcpy(header.magic, UT3K_BANK_MAGIC, sizeof(header.magic));
+  header.version = UT3K_BANK_VERSION;
+  header.rate = UT3K_MIXER_RATE;
+  header.channels = UT3K_MIXER_CHANNELS;
+  header.entry_count = this->entry_count;
+
+  if (write_aligned(this, this->entries, this->entry_count * sizeof(struct ut3k_bank_entry), &header.entries_offset) == 0) {
+    header.file_size = this->offset;
+    if (fseek(this->file, 0, SEEK_SET) == 0 &&
+        fwrite(&header, sizeof(header), 1, this->file) == 1 &&
+        fflush(this->file) == 0 && fsync(fileno(this->file)) == 0) {
+      rc = this->entry_count;
+    }
+  }
+
+  if (fclose(this->file) != 0) {
+    rc = -1;
+  }
+  // games may have the old bank mapped: rename leaves them theirs
+  if (rc >= 0 && rename(this->temp_filename, this->bank_filename) != 0) {
+    rc = -1;
+  }
+  if (rc < 0) {
+    printf("failed writing sample bank %s\n", this->bank_filename);
+    unlink(this->temp_filename);
+  }
+
+  free(this->entries);
+  free(this);
+
+  return rc;
+}
+
+
+struct ut3k_sample_bank* open_ut3k_sample_bank(const char *bank_filename) {
+  struct ut3k_sample_bank *this;
+  struct stat bank;
+  const struct ut3k_bank_header *header;
+  void *map;
+  int fd;
+
+  fd = open(bank_filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &bank) != 0 || bank.st_size < sizeof(struct ut3k_bank_header) ||
+      (map = mmap(NULL, bank.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  header = (const struct ut3k_bank_header*) map;
+  if (memcmp(header->magic, UT3K_BANK_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != UT3K_BANK_VERSION ||
+      header->rate != UT3K_MIXER_RATE || header->channels != UT3K_MIXER_CHANNELS ||
+      header->file_size != bank.st_size ||
+      header->entries_offset + (uint64_t) header->entry_count * sizeof(struct ut3k_bank_entry) > bank.st_size) {
+    printf("%s isn't a sample bank for this mixer, repack it\n", bank_filename);
+    munmap(map, bank.st_size);
+    close(fd);
+    return NULL;
+  }
+
+  this = (struct ut3k_sample_bank*) malloc(sizeof(struct ut3k_sample_bank));
+  if (this == NULL) {
+    munmap(map, bank.st_size);
+    close(fd);
+    return NULL;
+  }
+  this->fd = fd;
+  this->size = bank.st_size;
+  this->map = (const uint8_t*) map;
+  this->header = header;
+  this->entries = (const struct ut3k_bank_entry*) (this->map + header->entries_offset);
+
+  printf("sample bank %s: %u samples\n", bank_filename, header->entry_count);
+  return this;
+}
+
+
+void close_ut3k_sample_bank(struct ut3k_sample_bank *this) {
+  if (this) {
+    munmap((void*) this->map, this->size);
+    close(this->fd);
+    free(this);
+  }
+}
+
+
+struct ut3k_sample_bank* ut3k_sample_bank_locate(const char *filename) {
+  char directory[512], bank_filename[600];
+  const char *named;
+  char *slash;
+  struct ut3k_sample_bank *bank;
+
+  if ((named = getenv(UT3K_BANK_ENV_VAR)) != NULL) {
+    return open_ut3k_sample_bank(named);
+  }
+
+  snprintf(directory, sizeof(directory), "%s", filename);
+  while ((slash = strrchr(directory, '/')) != NULL) {
+    *slash = '\0';
+    snprintf(bank_filename, sizeof(bank_filename), "%s/%s", directory, UT3K_BANK_FILENAME);
+    if ((bank = open_ut3k_sample_bank(bank_filename)) != NULL) {
+      return bank;
+    }
+  }
+  return NULL;
+}
+
+
+const struct ut3k_bank_entry* ut3k_sample_bank_find(const struct ut3k_sample_bank *this, const char *filename) {
+  const struct ut3k_bank_entry *entry = NULL;
+  const char *tail = filename;
+  struct stat source;
+
+  while (tail != NULL && entry == NULL) {
+    entry = find_entry(this, tail);
+    tail = strchr(tail, '/');
+    if (tail != NULL) {
+      ++tail;
+    }
+  }
+
+  if (entry != NULL && stat(filename, &source) == 0 &&
+      (source.st_mtime != entry->source_mtime || source.st_size != entry->source_size)) {
+    printf("%s changed since the sample bank was packed\n", filename);
+    return NULL;
+  }
+
+  return entry;
+}
+
+
+int ut3k_sample_bank_load(const struct ut3k_sample_bank *this, const struct ut3k_bank_entry *entry, struct ut3k_pcm **pcm, struct ut3k_envelope **envelope) {
+  size_t levels_size = entry->level_blocks * sizeof(struct ut3k_level);
+
+  if (entry->data_offset + (uint64_t) entry->frames * UT3K_MIXER_FRAME_BYTES > this->size ||
+      entry->levels_offset + levels_size > this->size) {
+    return -1;
+  }
+
+  *pcm = (struct ut3k_pcm*) malloc(sizeof(struct ut3k_pcm));
+  *envelope = (struct ut3k_envelope*) calloc(1, sizeof(struct ut3k_envelope));
+  if (*pcm == NULL || *envelope == NULL ||
+      ((*envelope)->levels = (struct ut3k_level*) malloc(levels_size ? levels_size : 1)) == NULL) {
+    // the bank stays mapped, other samples play out of it
+    free(*pcm);
+    free(*envelope);
+    *pcm = NULL;
+    *envelope = NULL;
+    return -1;
+  }
+
+  prefault(this, entry->data_offset, (size_t) entry->frames * UT3K_MIXER_FRAME_BYTES);
+  (*pcm)->frames = entry->frames;
+  (*pcm)->data = (int16_t*) (this->map + entry->data_offset);
+  (*pcm)->mapped = 1;
+
+  (*envelope)->blocks = entry->level_blocks;
+  (*envelope)->block = entry->level_blocks;
+  memcpy((*envelope)->levels, this->map + entry->levels_offset, levels_size);
+
+  return 0;
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+// room for one more, counted once it's filled in.  NULL if there's no memory
+static struct ut3k_bank_entry* new_entry(struct ut3k_sample_bank_writer *this) {
+  struct ut3k_bank_entry *entries;
+  int capacity;
+
+  if (this->entry_count == this->entry_capacity) {
+    capacity = this->entry_capacity ? 2 * this->entry_capacity : 64;
+    entries = (struct ut3k_bank_entry*) realloc(this->entries, capacity * sizeof(struct ut3k_bank_entry));
+    if (entries == NULL) {
+      return NULL;
+    }
+    this->entries = entries;
+    this->entry_capacity = capacity;
+  }
+  return &this->entries[this->entry_count];
+}
+
+
+static int write_aligned(struct ut3k_sample_bank_writer *this, const void *data, size_t size, uint64_t *offset) {
+  static const uint8_t padding[UT3K_BANK_ALIGN] = { 0 };
+  size_t pad = (UT3K_BANK_ALIGN - this->offset % UT3K_BANK_ALIGN) % UT3K_BANK_ALIGN;
+
+  if (pad > 0 && fwrite(padding, 1, pad, this->file) != pad) {
+    return -1;
+  }
+  this->offset += pad;
+  *offset = this->offset;
+
+  if (size > 0 && fwrite(data, 1, size, this->file) != size) {
+    return -1;
+  }
+  this->offset += size;
+  return 0;
+}
+
+
+static int compare_entries(const void *a, const void *b) {
+  return strcmp(((const struct ut3k_bank_entry*) a)->name, ((const struct ut3k_bank_entry*) b)->name);
+}
+
+
+static const struct ut3k_bank_entry* find_entry(const struct ut3k_sample_bank *this, const char *name) {
+  struct ut3k_bank_entry key;
+
+  if (strlen(name) >= UT3K_BANK_NAME_SIZE) {
+    return NULL;
+  }
+  strcpy(key.name, name);
+  return (const struct ut3k_bank_entry*) bsearch(&key, this->entries, this->header->entry_count,
+                                                 sizeof(struct ut3k_bank_entry), compare_entries);
+}
+
+
+/** prefault
+ *
+ * read a sample's pages in now, while the game's loading.  Left to the
+ * first play they'd fault in from the SD card on the mixer's thread,
+ * well past a period.
+ */
+static void prefault(const struct ut3k_sample_bank *this, uint64_t offset, size_t size) {
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  uint64_t start = offset & ~(page - 1);
+  volatile uint8_t touch;
+
+  if (size == 0) {
+    return;
+  }
+  madvise((void*) (this->map + start), offset + size - start, MADV_WILLNEED);
+  for (uint64_t at = start; at < offset + size; at += page) {
+    touch = this->map[at];
+  }
+  (void) touch;
+}
@@ -0,0 +1,143 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* ut3k_sample_bank.h
+ *
+ * Samples packed ahead of time into one file, already in the mixer's
+ * format (ut3k_mixer.h) with their VU envelopes (ut3k_levels.h).  At
+ * start a game maps the bank instead of opening, decoding and
+ * converting every WAV: loading a sample is a lookup in the index.
+ * The bank is mapped shared and read only, so its pages are shared by
+ * every game using it.  A sample's pages are read in as it's loaded,
+ * not on the mixer's thread when it first plays.
+ *
+ * Samples are named by their path under the samples directory, as in
+ * sounds.config.  Each entry keeps the size and modification time of
+ * its WAV; an entry whose WAV has changed since is passed over and the
+ * WAV loaded as before.  Repack with the ut3k_sample_bank tool after
+ * adding or changing samples.
+ *
+ * Files with the same content (ut3k_hash.h) share one copy of the
+ * sample data and levels.
+ *
+ * Layout, native byte order (the Pi's little endian):
+ *   struct ut3k_bank_header
+ *   sample data and levels, each UT3K_BANK_ALIGN aligned
+ *   struct ut3k_bank_entry[entry_count], sorted by name
+ */
+
+#ifndef UT3K_SAMPLE_BANK_H
+#define UT3K_SAMPLE_BANK_H
+
+#include <stdint.h>
+
+#include "ut3k_levels.h"
+#include "ut3k_mixer.h"
+
+#define UT3K_BANK_MAGIC "UT3KBANK"
+#define UT3K_BANK_VERSION 2
+#define UT3K_BANK_NAME_SIZE 128
+#define UT3K_BANK_ALIGN 64
+
+// looked for next to the samples, see ut3k_sample_bank_locate
+#define UT3K_BANK_FILENAME "ut3k_samples.bank"
+// or named outright
+#define UT3K_BANK_ENV_VAR "UT3K_SAMPLE_BANK"
+
+
+struct ut3k_bank_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t rate;      // UT3K_MIXER_RATE when packed
+  uint32_t channels;  // UT3K_MIXER_CHANNELS
+  uint32_t entry_count;
+  uint64_t entries_offset;
+  uint64_t file_size;
+};
+
+struct ut3k_bank_entry {
+  char name[UT3K_BANK_NAME_SIZE];
+  uint64_t data_offset;    // interleaved frames
+  uint64_t levels_offset;  // struct ut3k_level[level_blocks]
+  uint32_t frames;
+  uint32_t level_blocks;
+  int64_t source_mtime;
+  int64_t source_size;
+  uint64_t content_hash;
+};
+
+
+/*** Packing ****/
+
+struct ut3k_sample_bank_writer;
+
+/** new_ut3k_sample_bank_writer
+ *
+ * start a bank of samples from samples_directory, written to
+ * bank_filename once finished.  NULL if it can't be created.
+ */
+struct ut3k_sample_bank_writer* new_ut3k_sample_bank_writer(const char *bank_filename, const char *samples_directory);
+
+/** ut3k_sample_bank_add
+ *
+ * decode, convert and add one sample, named by its path under the
+ * samples directory.  Adding a name twice adds it once, a file with the
+ * same content as one already in points at its data.  Returns 0, or -1
+ * if it couldn't be read.
+ */
+int ut3k_sample_bank_add(struct ut3k_sample_bank_writer *this, const char *name);
+
+/** finish_ut3k_sample_bank_writer
+ *
+ * write the index and put the bank in place of any old one.  Frees the
+ * writer.  Returns the count of samples, or -1 on failure.
+ */
+int finish_ut3k_sample_bank_writer(struct ut3k_sample_bank_writer *this);
+
+
+/*** Loading ****/
+
+struct ut3k_sample_bank;
+
+// map a bank, NULL if it's missing or not a bank for this mixer
+struct ut3k_sample_bank* open_ut3k_sample_bank(const char *bank_filename);
+void close_ut3k_sample_bank(struct ut3k_sample_bank *this);
+
+/** ut3k_sample_bank_locate
+ *
+ * open the bank for a sample file: the one named by UT3K_BANK_ENV_VAR,
+ * else the first UT3K_BANK_FILENAME in the file's directory or one
+ * above it.  NULL if there's none.
+ */
+struct ut3k_sample_bank* ut3k_sample_bank_locate(const char *filename);
+
+/** ut3k_sample_bank_find
+ *
+ * the entry for the sample at filename: the one named by the longest
+ * tail of filename after a '/'.  NULL if it's not in the bank or its
+ * WAV has changed.
+ */
+const struct ut3k_bank_entry* ut3k_sample_bank_find(const struct ut3k_sample_bank *this, const char *filename);
+
+/** ut3k_sample_bank_load
+ *
+ * fills in a pcm playing straight from the mapping and a copy of the
+ * envelope for an entry.  Returns 0, or -1 if the entry is damaged.
+ */
+int ut3k_sample_bank_load(const struct ut3k_sample_bank *this, const struct ut3k_bank_entry *entry, struct ut3k_pcm **pcm, struct ut3k_envelope **envelope);
+
+
+#endif
@@ -0,0 +1,205 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ut3k_sample_cache.h"
+
+
+static void sample_info_cb(pa_context *c, const pa_sample_info *info, int eol, void *userdata);
+static int64_t proplist_number(const pa_proplist *proplist, const char *key);
+static void free_cached_sample(struct ut3k_cached_sample *sample);
+
+
+
+int ut3k_sample_cache_enabled() {
+  const char *setting = getenv(UT3K_SAMPLE_CACHE_ENV_VAR);
+
+  return setting == NULL || strcmp(setting, "off") != 0;
+}
+
+
+void ut3k_sample_cache_refresh(struct ut3k_sample_cache *this, pa_context *context, pa_mainloop *mainloop) {
+  pa_operation *op;
+  struct ut3k_cached_sample *sample;
+  struct stat source;
+  int kept = 0, changed, gone;
+
+  ut3k_sample_cache_clear(this);
+
+  op = pa_context_get_sample_info_list(context, sample_info_cb, this);
+  if (op == NULL) {
+    return;
+  }
+  while (pa_operation_get_state(op) == PA_OPERATION_RUNNING) {
+    if (pa_mainloop_iterate(mainloop, 1, NULL) < 0) {
+      break;
+    }
+  }
+  pa_operation_unref(op);
+
+  // the file's changed since, and a fresh upload takes over, or it's
+  // gone and nothing will: either way it goes.  Other stat failures
+  // (permissions, say) may pass, so keep the sample.
+  for (int i = 0; i < this->count; ++i) {
+    sample = &this->samples[i];
+    if (stat(sample->source, &source) == 0) {
+      changed = source.st_size != sample->source_size || source.st_mtime != sample->source_mtime;
+      gone = 0;
+    }
+    else {
+      changed = 0;
+      gone = errno == ENOENT || errno == ENOTDIR;
+    }
+    if (changed || gone) {
+      printf("evicting %s, %s has %s\n", sample->name, sample->source, gone ? "gone" : "changed");
+      if ((op = pa_context_remove_sample(context, sample->name, NULL, NULL)) != NULL) {
+        pa_operation_unref(op);
+      }
+      free_cached_sample(sample);
+    }
+    else {
+      this->samples[kept++] = *sample;
+    }
+  }
+  this->count = kept;
+
+  printf("sample cache: %d samples resident\n", this->count);
+}
+
+
+void ut3k_sample_cache_clear(struct ut3k_sample_cache *this) {
+  for (int i = 0; i < this->count; ++i) {
+    free_cached_sample(&this->samples[i]);
+  }
+  free(this->samples);
+  *this = (struct ut3k_sample_cache const) { 0 };
+}
+
+
+const struct ut3k_cached_sample* ut3k_sample_cache_find_source(const struct ut3k_sample_cache *this, const char *filename, const struct stat *source) {
+  const struct ut3k_cached_sample *sample;
+
+  for (int i = 0; i < this->count; ++i) {
+    sample = &this->samples[i];
+    if (sample->source_size == source->st_size && sample->source_mtime == source->st_mtime &&
+        strcmp(sample->source, filename) == 0) {
+      return sample;
+    }
+  }
+  return NULL;
+}
+
+
+const struct ut3k_cached_sample* ut3k_sample_cache_find_content(const struct ut3k_sample_cache *this, uint64_t hash) {
+  for (int i = 0; i < this->count; ++i) {
+    if (this->samples[i].hash == hash) {
+      return &this->samples[i];
+    }
+  }
+  return NULL;
+}
+
+
+void ut3k_sample_cache_name(uint64_t hash, char name[UT3K_SAMPLE_CACHE_NAME_SIZE]) {
+  snprintf(name, UT3K_SAMPLE_CACHE_NAME_SIZE, "%s%016" PRIx64, UT3K_SAMPLE_CACHE_PREFIX, hash);
+}
+
+
+pa_proplist* new_ut3k_sample_cache_proplist(const char *filename, const struct stat *source, const struct ut3k_envelope *envelope) {
+  pa_proplist *proplist = pa_proplist_new();
+  char number[24];
+
+  pa_proplist_sets(proplist, UT3K_SAMPLE_CACHE_PROP_SOURCE, filename);
+  snprintf(number, sizeof(number), "%" PRId64, (int64_t) source->st_size);
+  pa_proplist_sets(proplist, UT3K_SAMPLE_CACHE_PROP_SIZE, number);
+  snprintf(number, sizeof(number), "%" PRId64, (int64_t) source->st_mtime);
+  pa_proplist_sets(proplist, UT3K_SAMPLE_CACHE_PROP_MTIME, number);
+  if (envelope != NULL && envelope->blocks > 0) {
+    pa_proplist_set(proplist, UT3K_SAMPLE_CACHE_PROP_LEVELS, envelope->levels, envelope->blocks * sizeof(struct ut3k_level));
+  }
+
+  return proplist;
+}
+
+
+struct ut3k_envelope* new_ut3k_cached_envelope(const struct ut3k_cached_sample *sample) {
+  struct ut3k_envelope *envelope;
+
+  envelope = (struct ut3k_envelope*) calloc(1, sizeof(struct ut3k_envelope));
+  envelope->blocks = sample->level_blocks;
+  envelope->block = sample->level_blocks;
+  envelope->levels = (struct ut3k_level*) malloc(sample->level_blocks * sizeof(struct ut3k_level) + 1);
+  memcpy(envelope->levels, sample->levels, sample->level_blocks * sizeof(struct ut3k_level));
+
+  return envelope;
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+// one of ours if it has our prefix and a source
+static void sample_info_cb(pa_context *c, const pa_sample_info *info, int eol, void *userdata) {
+  struct ut3k_sample_cache *this = (struct ut3k_sample_cache*) userdata;
+  struct ut3k_cached_sample *sample;
+  const char *source;
+  const void *levels = NULL;
+  size_t levels_size = 0;
+
+  if (eol != 0 || info == NULL || info->name == NULL || info->proplist == NULL ||
+      strncmp(info->name, UT3K_SAMPLE_CACHE_PREFIX, strlen(UT3K_SAMPLE_CACHE_PREFIX)) != 0 ||
+      strlen(info->name) >= UT3K_SAMPLE_CACHE_NAME_SIZE ||
+      (source = pa_proplist_gets(info->proplist, UT3K_SAMPLE_CACHE_PROP_SOURCE)) == NULL) {
+    return;
+  }
+
+  if (this->count == this->capacity) {
+    this->capacity = this->capacity ? 2 * this->capacity : 64;
+    this->samples = (struct ut3k_cached_sample*) realloc(this->samples, this->capacity * sizeof(struct ut3k_cached_sample));
+  }
+  sample = &this->samples[this->count++];
+
+  strcpy(sample->name, info->name);
+  sample->hash = strtoull(info->name + strlen(UT3K_SAMPLE_CACHE_PREFIX), NULL, 16);
+  sample->source = strdup(source);
+  sample->source_size = proplist_number(info->proplist, UT3K_SAMPLE_CACHE_PROP_SIZE);
+  sample->source_mtime = proplist_number(info->proplist, UT3K_SAMPLE_CACHE_PROP_MTIME);
+
+  pa_proplist_get(info->proplist, UT3K_SAMPLE_CACHE_PROP_LEVELS, &levels, &levels_size);
+  sample->level_blocks = levels ? levels_size / sizeof(struct ut3k_level) : 0;
+  sample->levels = (struct ut3k_level*) malloc(sample->level_blocks * sizeof(struct ut3k_level) + 1);
+  if (sample->level_blocks > 0) {
+    memcpy(sample->levels, levels, sample->level_blocks * sizeof(struct ut3k_level));
+  }
+}
+
+
+static int64_t proplist_number(const pa_proplist *proplist, const char *key) {
+  const char *value = pa_proplist_gets(proplist, key);
+
+  return value ? strtoll(value, NULL, 10) : -1;
+}
+
+
+static void free_cached_sample(struct ut3k_cached_sample *sample) {
+  free(sample->source);
+  free(sample->levels);
+}
@@ -0,0 +1,103 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/* ut3k_sample_cache.h
+ *
+ * Samples left resident in the PulseAudio server's sample cache from
+ * one game to the next.  The server already outlives the games, so it
+ * is the sample service: a sample is uploaded under a name made from a
+ * hash of its file's content, with the file's path, size, modification
+ * time and VU envelope in its property list.  A game starting later
+ * lists the server's samples and takes any of its files already there
+ * as they are: no decode, no upload, only the envelope read back.
+ *
+ * A file that matches by path, size and time isn't read at all.  One
+ * that doesn't is hashed, and a sample with the same content under
+ * another path still saves the upload.  Samples whose files have
+ * changed or gone since are evicted when the cache is listed.
+ *
+ * Set UT3K_SAMPLE_CACHE_ENV_VAR to "off" to upload under the game's own
+ * names and remove them at exit, as before.
+ */
+
+#ifndef UT3K_SAMPLE_CACHE_H
+#define UT3K_SAMPLE_CACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "ut3k_levels.h"
+
+#define UT3K_SAMPLE_CACHE_ENV_VAR "UT3K_SAMPLE_CACHE"
+
+// "ut3k-" and 16 hex digits of the content hash
+#define UT3K_SAMPLE_CACHE_PREFIX "ut3k-"
+#define UT3K_SAMPLE_CACHE_NAME_SIZE 24
+
+#define UT3K_SAMPLE_CACHE_PROP_SOURCE "ut3k.source"
+#define UT3K_SAMPLE_CACHE_PROP_SIZE "ut3k.source.size"
+#define UT3K_SAMPLE_CACHE_PROP_MTIME "ut3k.source.mtime"
+#define UT3K_SAMPLE_CACHE_PROP_LEVELS "ut3k.levels"
+
+
+struct ut3k_cached_sample {
+  char name[UT3K_SAMPLE_CACHE_NAME_SIZE];
+  uint64_t hash;
+  char *source;
+  int64_t source_size;
+  int64_t source_mtime;
+  uint32_t level_blocks;
+  struct ut3k_level *levels;
+};
+
+struct ut3k_sample_cache {
+  int count;
+  int capacity;
+  struct ut3k_cached_sample *samples;
+};
+
+
+// unless turned off by UT3K_SAMPLE_CACHE_ENV_VAR
+int ut3k_sample_cache_enabled();
+
+/** ut3k_sample_cache_refresh
+ *
+ * list the samples resident on the server, iterating mainloop until
+ * the server has answered, and evict those whose files have changed
+ * or been deleted.
+ */
+void ut3k_sample_cache_refresh(struct ut3k_sample_cache *this, pa_context *context, pa_mainloop *mainloop);
+void ut3k_sample_cache_clear(struct ut3k_sample_cache *this);
+
+// the resident sample for filename as it is now (source from stat), or NULL
+const struct ut3k_cached_sample* ut3k_sample_cache_find_source(const struct ut3k_sample_cache *this, const char *filename, const struct stat *source);
+// the resident sample with this content, or NULL
+const struct ut3k_cached_sample* ut3k_sample_cache_find_content(const struct ut3k_sample_cache *this, uint64_t hash);
+
+// named for a content hash, see ut3k_hash.h
+void ut3k_sample_cache_name(uint64_t hash, char name[UT3K_SAMPLE_CACHE_NAME_SIZE]);
+
+// properties to upload a sample with, pa_proplist_free when done
+pa_proplist* new_ut3k_sample_cache_proplist(const char *filename, const struct stat *source, const struct ut3k_envelope *envelope);
+
+// a copy of a resident sample's envelope
+struct ut3k_envelope* new_ut3k_cached_envelope(const struct ut3k_cached_sample *sample);
+
+
+#endif
@@ -0,0 +1,671 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ut3k_session.h"
+
+
+/* On disk format.  Everything little endian.
+ *
+ * header:
+ *   char[8]  magic "UT3KSESS"
+ *   uint16   version
+ *   uint16   reserved
+ *   uint32   rand() seed
+ *
+ * then records, each with a 9 byte record header:
+ *   uint8    record type
+ *   uint32   game clock
+ *   uint32   microseconds since the previous record
+ *
+ * INITIAL_KEYSCAN / INPUT payload:
+ *   uint8[6] keyscan
+ *   uint64   timestamp_ns of the keyscan
+ *   transitions
+ *
+ * ENCODERS payload:
+ *   transitions
+ *
+ * where transitions are:
+ *   uint8    encoder mask: bit n set if encoder n has transitions
+ *   for each encoder in the mask:
+ *     uint16 count
+ *     count times:
+ *       uint8   A/B state
+ *       uint64  timestamp_ns
+ *
+ * FRAME payload:
+ *   uint8    chip mask: bit n set if chip n changed since the last frame
+ *   for each chip in the mask:
+ *     uint8[16] display buffer
+ *
+ * Unchanged frames cost 10 bytes, an idle keyscan 16 bytes.  Good enough
+ * for hours of play.
+ */
+
+#define SESSION_MAGIC "UT3KSESS"
+#define SESSION_VERSION 1
+#define SESSION_HEADER_SIZE 16
+#define SESSION_RECORD_HEADER_SIZE 9
+#define SESSION_CHIP_BYTES 16
+// largest possible record: header + frame with all chips changed
+#define SESSION_MAX_RECORD_SIZE (SESSION_RECORD_HEADER_SIZE + 1 + UT3K_SESSION_CHIPS * SESSION_CHIP_BYTES)
+#define SESSION_TRANSITION_BYTES 9
+// largest possible input: every encoder ring drained full
+#define SESSION_MAX_CONTROLS_SIZE (sizeof(ht16k33keyscan_t) + 8 + 1 + \
+                                   UT3K_SESSION_ENCODERS * (2 + UT3K_SESSION_MAX_TRANSITIONS * SESSION_TRANSITION_BYTES))
+
+typedef enum {
+  RECORD_INITIAL_KEYSCAN = 1,
+  RECORD_INPUT = 2,
+  RECORD_FRAME = 3,
+  RECORD_ENCODERS = 4
+} record_type_t;
+
+
+struct session_record {
+  record_type_t type;
+  uint32_t clock;
+  uint32_t delta_usec;
+  ht16k33keyscan_t keyscan;
+  uint64_t timestamp_ns;
+  struct encoder_transition transitions[UT3K_SESSION_ENCODERS][UT3K_SESSION_MAX_TRANSITIONS];
+  int counts[UT3K_SESSION_ENCODERS];
+  uint8_t chip_mask;
+  uint8_t chips[UT3K_SESSION_CHIPS][SESSION_CHIP_BYTES];
+};
+
+
+struct session {
+  ut3k_session_mode_t mode;
+  FILE *file;
+  char *filename;
+  uint32_t seed;
+  uint64_t start_usec;
+  uint64_t last_record_usec;
+
+  // last recorded frame, or while replaying the reference frame
+  uint8_t frame[UT3K_SESSION_CHIPS][SESSION_CHIP_BYTES];
+
+  // replay: single record lookahead
+  struct session_record peeked;
+  int have_peeked;
+  int exhausted;
+  uint64_t recorded_usec;
+
+  // stats
+  uint32_t inputs;
+  uint32_t frames;
+  uint32_t frames_mismatched;
+  uint32_t first_mismatch_clock;
+  uint32_t clock_mismatches;
+  uint32_t desyncs;
+  uint64_t bytes;
+};
+
+static struct session session = { .mode = UT3K_SESSION_OFF, .file = NULL };
+
+
+static uint64_t monotonic_usec();
+static void session_close();
+static int open_record(const char *filename, uint32_t seed);
+static int open_replay(const char *filename);
+static void write_record(record_type_t type, uint32_t clock, const uint8_t *payload, size_t payload_length);
+static size_t encode_controls(uint8_t *buffer, ht16k33keyscan_t keyscan, uint64_t timestamp_ns, const struct encoder_transition transitions[][UT3K_SESSION_MAX_TRANSITIONS], const int counts[]);
+static size_t encode_transitions(uint8_t *buffer, const struct encoder_transition transitions[][UT3K_SESSION_MAX_TRANSITIONS], const int counts[]);
+static int read_record(struct session_record *record);
+static int read_transitions(struct session_record *record);
+static struct session_record* peek_record();
+static void consume_record();
+static void end_of_replay();
+
+
+uint32_t ut3k_session_init(uint32_t seed) {
+  char *filename;
+
+  if ((filename = getenv(UT3K_SESSION_REPLAY_ENV_VAR)) != NULL) {
+    if (open_replay(filename) == 0) {
+      seed = session.seed;
+    }
+  }
+  else if ((filename = getenv(UT3K_SESSION_RECORD_ENV_VAR)) != NULL) {
+    open_record(filename, seed);
+  }
+
+  // don't let games launched from here (mcp) write over or replay the
+  // same session
+  unsetenv(UT3K_SESSION_REPLAY_ENV_VAR);
+  unsetenv(UT3K_SESSION_RECORD_ENV_VAR);
+
+  if (session.mode != UT3K_SESSION_OFF) {
+    atexit(session_close);
+  }
+
+  return seed;
+}
+
+
+ut3k_session_mode_t ut3k_session_mode() {
+  return session.mode;
+}
+
+
+int ut3k_session_is_replay() {
+  return session.mode == UT3K_SESSION_REPLAYING;
+}
+
+
+
+/* recording ------------------------------------------------------- */
+
+
+void ut3k_session_record_initial_keyscan(ht16k33keyscan_t keyscan) {
+  uint8_t payload[SESSION_MAX_RECORD_SIZE];
+  const int no_counts[UT3K_SESSION_ENCODERS] = { 0 };
+
+  if (session.mode != UT3K_SESSION_RECORDING) {
+    return;
+  }
+
+  write_record(RECORD_INITIAL_KEYSCAN, 0, payload,
+               encode_controls(payload, keyscan, 0, NULL, no_counts));
+}
+
+
+void ut3k_session_record_controls(uint32_t clock,
+                                  ht16k33keyscan_t keyscan,
+                                  uint64_t timestamp_ns,
+                                  const struct encoder_transition transitions[UT3K_SESSION_ENCODERS][UT3K_SESSION_MAX_TRANSITIONS],
+                                  const int counts[UT3K_SESSION_ENCODERS]) {
+  // too big for the stack of the game loop
+  static uint8_t payload[SESSION_MAX_CONTROLS_SIZE];
+
+  if (session.mode != UT3K_SESSION_RECORDING) {
+    return;
+  }
+
+  session.inputs++;
+  write_record(RECORD_INPUT, clock, payload,
+               encode_controls(payload, keyscan, timestamp_ns, transitions, counts));
+}
+
+
+void ut3k_session_record_encoders(uint32_t clock,
+                                  const struct encoder_transition transitions[UT3K_SESSION_ENCODERS][UT3K_SESSION_MAX_TRANSITIONS],
+                                  const int counts[UT3K_SESSION_ENCODERS]) {
+  static uint8_t payload[SESSION_MAX_CONTROLS_SIZE];
+
+  if (session.mode != UT3K_SESSION_RECORDING ||
+      counts[0] + counts[1] + counts[2] == 0) {
+    return;
+  }
+
+  write_record(RECORD_ENCODERS, clock, payload,
+               encode_transitions(payload, transitions, counts));
+}
+
+
+
+/* replaying ------------------------------------------------------- */
+
+
+int ut3k_session_replay_initial_keyscan(ht16k33keyscan_t keyscan) {
+  struct session_record *record = peek_record();
+
+  if (record == NULL || record->type != RECORD_INITIAL_KEYSCAN) {
+    printf("ut3k_session: replay log doesn't start with a keyscan\n");
+    memset(keyscan, 0, sizeof(ht16k33keyscan_t));
+    return 1;
+  }
+
+  memcpy(keyscan, record->keyscan, sizeof(ht16k33keyscan_t));
+  consume_record();
+  return 0;
+}
+
+
+int ut3k_session_replay_controls(uint32_t clock,
+                                 ht16k33keyscan_t keyscan,
+                                 uint64_t *timestamp_ns,
+                                 struct encoder_transition transitions[UT3K_SESSION_ENCODERS][UT3K_SESSION_MAX_TRANSITIONS],
+                                 int counts[UT3K_SESSION_ENCODERS]) {
+  struct session_record *record;
+
+  // skip past any frames the game didn't commit this time around.
+  // Keep the reference frame current while doing so.
+  while ((record = peek_record()) != NULL && record->type != RECORD_INPUT) {
+    if (record->type == RECORD_FRAME) {
+      for (int chip = 0; chip < UT3K_SESSION_CHIPS; ++chip) {
+        if (record->chip_mask & (1 << chip)) {
+          memcpy(session.frame[chip], record->chips[chip], SESSION_CHIP_BYTES);
+        }
+      }
+    }
+    session.desyncs++;
+    consume_record();
+  }
+
+  if (record == NULL) {
+    memset(keyscan, 0, sizeof(ht16k33keyscan_t));
+    for (int encoder = 0; encoder < UT3K_SESSION_ENCODERS; ++encoder) {
+      counts[encoder] = 0;
+    }
+    end_of_replay();
+    return 1;
+  }
+
+  if (record->clock != clock) {
+    session.clock_mismatches++;
+  }
+
+  memcpy(keyscan, record->keyscan, sizeof(ht16k33keyscan_t));
+  *timestamp_ns = record->timestamp_ns;
+  for (int encoder = 0; encoder < UT3K_SESSION_ENCODERS; ++encoder) {
+    counts[encoder] = record->counts[encoder];
+    memcpy(transitions[encoder], record->transitions[encoder],
+           record->counts[encoder] * sizeof(struct encoder_transition));
+  }
+
+  session.inputs++;
+  consume_record();
+  return 0;
+}
+
+
+int ut3k_session_replay_encoders(uint32_t clock,
+                                 struct encoder_transition transitions[UT3K_SESSION_ENCODERS][UT3K_SESSION_MAX_TRANSITIONS],
+                                 int counts[UT3K_SESSION_ENCODERS]) {
+  struct session_record *record = peek_record();
+
+  for (int encoder = 0; encoder < UT3K_SESSION_ENCODERS; ++encoder) {
+    counts[encoder] = 0;
+  }
+
+  // nothing turned on this tick.  Anything else is for another hook.
+  if (record == NULL || record->type != RECORD_ENCODERS) {
+    return record == NULL;
+  }
+
+  if (record->clock != clock) {
+    session.clock_mismatches++;
+  }
+
+  for (int encoder = 0; encoder < UT3K_SESSION_ENCODERS; ++encoder) {
+    counts[encoder] = record->counts[encoder];
+    memcpy(transitions[encoder], record->transitions[encoder],
+           record->counts[encoder] * sizeof(struct encoder_transition));
+  }
+
+  consume_record();
+  return 0;
+}
+
+
+
+/* frames ---------------------------------------------------------- */
+
+
+void ut3k_session_frame(uint32_t clock, HT16K33 *const chips[UT3K_SESSION_CHIPS]) {
+  uint8_t payload[SESSION_MAX_RECORD_SIZE];
+  size_t length = 1;
+  struct session_record *record;
+  int mismatch = 0;
+
+  switch (session.mode) {
+  case UT3K_SESSION_RECORDING:
+    payload[0] = 0;
+    for (int chip = 0; chip < UT3K_SESSION_CHIPS; ++chip) {
+      if (memcmp(session.frame[chip], chips[chip]->display_buffer.com, SESSION_CHIP_BYTES) != 0) {
+        payload[0] |= 1 << chip;
+        memcpy(session.frame[chip], chips[chip]->display_buffer.com, SESSION_CHIP_BYTES);
+        memcpy(payload + length, session.frame[chip], SESSION_CHIP_BYTES);
+        length += SESSION_CHIP_BYTES;
+      }
+    }
+    session.frames++;
+    write_record(RECORD_FRAME, clock, payload, length);
+    break;
+
+  case UT3K_SESSION_REPLAYING:
+    record = peek_record();
+    if (record != NULL && record->type == RECORD_FRAME) {
+      for (int chip = 0; chip < UT3K_SESSION_CHIPS; ++chip) {
+        if (record->chip_mask & (1 << chip)) {
+          memcpy(session.frame[chip], record->chips[chip], SESSION_CHIP_BYTES);
+        }
+      }
+      if (record->clock != clock) {
+        session.clock_mismatches++;
+      }
+      consume_record();
+    }
+    else {
+      // game committed a frame that wasn't in the recording
+      session.desyncs++;
+    }
+
+    for (int chip = 0; chip < UT3K_SESSION_CHIPS; ++chip) {
+      mismatch |= memcmp(session.frame[chip], chips[chip]->display_buffer.com, SESSION_CHIP_BYTES);
+    }
+    if (mismatch) {
+      if (session.frames_mismatched++ == 0) {
+        session.first_mismatch_clock = clock;
+      }
+    }
+    session.frames++;
+    break;
+
+  case UT3K_SESSION_OFF:
+  default:
+    break;
+  }
+}
+
+
+
+/* static ---------------------------------------------------------- */
+
+
+static uint64_t monotonic_usec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+static inline void put_u32(uint8_t *buffer, uint32_t value) {
+  buffer[0] = value;
+  buffer[1] = value >> 8;
+  buffer[2] = value >> 16;
+  buffer[3] = value >> 24;
+}
+
+static inline uint32_t get_u32(const uint8_t *buffer) {
+  return buffer[0] | buffer[1] << 8 | buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+}
+
+static inline void put_u64(uint8_t *buffer, uint64_t value) {
+  put_u32(buffer, value);
+  put_u32(buffer + 4, value >> 32);
+}
+
+static inline uint64_t get_u64(const uint8_t *buffer) {
+  return get_u32(buffer) | (uint64_t)get_u32(buffer + 4) << 32;
+}
+
+
+static int open_record(const char *filename, uint32_t seed) {
+  uint8_t header[SESSION_HEADER_SIZE] = { 0 };
+
+  session.file = fopen(filename, "wb");
+  if (session.file == NULL) {
+    printf("ut3k_session: can't open %s for recording\n", filename);
+    return 1;
+  }
+
+  memcpy(header, SESSION_MAGIC, 8);
+  header[8] = SESSION_VERSION;
+  put_u32(header + 12, seed);
+  fwrite(header, 1, SESSION_HEADER_SIZE, session.file);
+
+  session.mode = UT3K_SESSION_RECORDING;
+  session.filename = strdup(filename);
+  session.seed = seed;
+  session.bytes = SESSION_HEADER_SIZE;
+  session.start_usec = session.last_record_usec = monotonic_usec();
+  printf("ut3k_session: recording to %s\n", filename);
+
+  return 0;
+}
+
+
+static int open_replay(const char *filename) {
+  uint8_t header[SESSION_HEADER_SIZE];
+
+  session.file = fopen(filename, "rb");
+  if (session.file == NULL) {
+    printf("ut3k_session: can't open %s for replay\n", filename);
+    return 1;
+  }
+
+  if (fread(header, 1, SESSION_HEADER_SIZE, session.file) != SESSION_HEADER_SIZE ||
+      memcmp(header, SESSION_MAGIC, 8) != 0 ||
+      header[8] != SESSION_VERSION) {
+    printf("ut3k_session: %s isn't a version %d session log\n", filename, SESSION_VERSION);
+    fclose(session.file);
+    session.file = NULL;
+    return 1;
+  }
+
+  session.mode = UT3K_SESSION_REPLAYING;
+  session.filename = strdup(filename);
+  session.seed = get_u32(header + 12);
+  session.start_usec = monotonic_usec();
+  printf("ut3k_session: replaying %s\n", filename);
+
+  return 0;
+}
+
+
+static void write_record(record_type_t type, uint32_t clock, const uint8_t *payload, size_t payload_length) {
+  uint8_t header[SESSION_RECORD_HEADER_SIZE];
+  uint64_t now = monotonic_usec();
+
+  header[0] = type;
+  put_u32(header + 1, clock);
+  put_u32(header + 5, now - session.last_record_usec);
+  session.last_record_usec = now;
+
+  fwrite(header, 1, SESSION_RECORD_HEADER_SIZE, session.file);
+  fwrite(payload, 1, payload_length, session.file);
+  session.bytes += SESSION_RECORD_HEADER_SIZE + payload_length;
+}
+
+
+static size_t encode_controls(uint8_t *buffer, ht16k33keyscan_t keyscan, uint64_t timestamp_ns, const struct encoder_transition transitions[][UT3K_SESSION_MAX_TRANSITIONS], const int counts[]) {
+  memcpy(buffer, keyscan, sizeof(ht16k33keyscan_t));
+  put_u64(buffer + sizeof(ht16k33keyscan_t), timestamp_ns);
+  return sizeof(ht16k33keyscan_t) + 8 + encode_transitions(buffer + sizeof(ht16k33keyscan_t) + 8, transitions, counts);
+}
+
+
+static size_t encode_transitions(uint8_t *buffer, const struct encoder_transition transitions[][UT3K_SESSION_MAX_TRANSITIONS], const int counts[]) {
+  size_t length = 0;
+  uint8_t *encoder_mask;
+
+  encoder_mask = &buffer[length++];
+  *encoder_mask = 0;
+
+  for (int encoder = 0; encoder < UT3K_SESSION_ENCODERS; ++encoder) {
+    if (counts[encoder] > 0) {
+      *encoder_mask |= 1 << encoder;
+      buffer[length++] = counts[encoder];
+      buffer[length++] = counts[encoder] >> 8;
+      for (int i = 0; i < counts[encoder]; ++i) {
+        buffer[length] = transitions[encoder][i].ab;
+        put_u64(buffer + length + 1, transitions[encoder][i].timestamp_ns);
+        length += SESSION_TRANSITION_BYTES;
+      }
+    }
+  }
+
+  return length;
+}
+
+
+/** read_record
+ * read the next record from the replay log.  Return 0 on success.
+ */
+static int read_record(struct session_record *record) {
+  uint8_t header[SESSION_RECORD_HEADER_SIZE], timestamp_bytes[8];
+
+  if (fread(header, 1, SESSION_RECORD_HEADER_SIZE, session.file) != SESSION_RECORD_HEADER_SIZE) {
+    return 1;
+  }
+
+  record->type = header[0];
+  record->clock = get_u32(header + 1);
+  record->delta_usec = get_u32(header + 5);
+
+  switch (record->type) {
+  case RECORD_INITIAL_KEYSCAN:
+  case RECORD_INPUT:
+    if (fread(record->keyscan, 1, sizeof(ht16k33keyscan_t), session.file) != sizeof(ht16k33keyscan_t)) {
+      return 1;
+    }
+    if (fread(timestamp_bytes, 1, 8, session.file) != 8) {
+      return 1;
+    }
+    record->timestamp_ns = get_u64(timestamp_bytes);
+    if (read_transitions(record) != 0) {
+      return 1;
+    }
+    break;
+  case RECORD_ENCODERS:
+    if (read_transitions(record) != 0) {
+      return 1;
+    }
+    break;
+  case RECORD_FRAME:
+    if (fread(&record->chip_mask, 1, 1, session.file) != 1) {
+      return 1;
+    }
+    for (int chip = 0; chip < UT3K_SESSION_CHIPS; ++chip) {
+      if ((record->chip_mask & (1 << chip)) &&
+          fread(record->chips[chip], 1, SESSION_CHIP_BYTES, session.file) != SESSION_CHIP_BYTES) {
+        return 1;
+      }
+    }
+    break;
+  default:
+    printf("ut3k_session: corrupt record type %d\n", record->type);
+    return 1;
+  }
+
+  session.recorded_usec += record->delta_usec;
+  return 0;
+}
+
+
+static int read_transitions(struct session_record *record) {
+  uint8_t encoder_mask;
+  uint8_t count_bytes[2], transition_bytes[SESSION_TRANSITION_BYTES];
+  int count;
+
+  if (fread(&encoder_mask, 1, 1, session.file) != 1) {
+    return 1;
+  }
+  for (int encoder = 0; encoder < UT3K_SESSION_ENCODERS; ++encoder) {
+    record->counts[encoder] = 0;
+    if (encoder_mask & (1 << encoder)) {
+      if (fread(count_bytes, 1, 2, session.file) != 2) {
+        return 1;
+      }
+      count = count_bytes[0] | count_bytes[1] << 8;
+      if (count > UT3K_SESSION_MAX_TRANSITIONS) {
+        return 1;
+      }
+      for (int i = 0; i < count; ++i) {
+        if (fread(transition_bytes, 1, SESSION_TRANSITION_BYTES, session.file) != SESSION_TRANSITION_BYTES) {
+          return 1;
+        }
+        record->transitions[encoder][i].ab = transition_bytes[0];
+        record->transitions[encoder][i].timestamp_ns = get_u64(transition_bytes + 1);
+      }
+      record->counts[encoder] = count;
+    }
+  }
+
+  return 0;
+}
+
+
+static struct session_record* peek_record() {
+  if (session.mode != UT3K_SESSION_REPLAYING || session.exhausted) {
+    return NULL;
+  }
+
+  if (!session.have_peeked) {
+    if (read_record(&session.peeked) != 0) {
+      session.exhausted = 1;
+      return NULL;
+    }
+    session.have_peeked = 1;
+  }
+
+  return &session.peeked;
+}
+
+
+static void consume_record() {
+  session.have_peeked = 0;
+}
+
+
+/** end_of_replay
+ * out of recorded input.  Stop the game the same way the cabinet would.
+ */
+static void end_of_replay() {
+  static int signalled = 0;
+
+  if (!signalled) {
+    signalled = 1;
+    printf("ut3k_session: end of replay\n");
+    raise(SIGTERM);
+  }
+}
+
+
+static void session_close() {
+  uint64_t elapsed_usec;
+
+  if (session.file == NULL) {
+    return;
+  }
+
+  elapsed_usec = monotonic_usec() - session.start_usec;
+
+  switch (session.mode) {
+  case UT3K_SESSION_RECORDING:
+    printf("ut3k_session: recorded %u inputs and %u frames (%llu bytes) to %s over %llu.%06llu s\n",
+           session.inputs, session.frames, (unsigned long long)session.bytes, session.filename,
+           (unsigned long long)elapsed_usec / 1000000, (unsigned long long)elapsed_usec % 1000000);
+    break;
+  case UT3K_SESSION_REPLAYING:
+    printf("ut3k_session: replayed %u inputs and %u frames from %s: %u frames mismatched",
+           session.inputs, session.frames, session.filename, session.frames_mismatched);
+    if (session.frames_mismatched) {
+      printf(" (first at clock %u)", session.first_mismatch_clock);
+    }
+    printf("; %u clock mismatches; %u desyncs\n", session.clock_mismatches, session.desyncs);
+    printf("ut3k_session: %llu.%06llu s of play replayed in %llu.%06llu s (%.1fx real time)\n",
+           (unsigned long long)session.recorded_usec / 1000000, (unsigned long long)session.recorded_usec % 1000000,
+           (unsigned long long)elapsed_usec / 1000000, (unsigned long long)elapsed_usec % 1000000,
+           elapsed_usec ? (double)session.recorded_usec / elapsed_usec : 0.0);
+    break;
+  default:
+    break;
+  }
+
+  fclose(session.file);
+  session.file = NULL;
+  free(session.filename);
+  session.mode = UT3K_SESSION_OFF;
+}
@@ -0,0 +1,111 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* ut3k_session.h
+ *
+ * Session recorder and replayer.  Record every keyscan, every batch of
+ * rotary encoder transitions handed to update_control_panel (or to
+ * update_control_panel_encoders) and every committed frame to a compact
+ * binary log.  Later, feed that log back
+ * through the control panel and game model and verify the frames come
+ * out the same.
+ *
+ * The session is driven by environment variables so no game needs a
+ * special build:
+ *   UT3K_SESSION_RECORD=<file>  record the session to file
+ *   UT3K_SESSION_REPLAY=<file>  replay the session from file
+ *
+ * During a replay the view doesn't touch the HT16K33s or GPIO and the
+ * game loop should skip its sleep (see ut3k_session_is_replay), so the
+ * replay runs as fast as the model allows.  When the recorded inputs run
+ * out the session raises SIGTERM so the game exits through its usual
+ * cleanup path.  Replay stats are printed at exit.
+ */
+
+#ifndef UT3K_SESSION_H
+#define UT3K_SESSION_H
+
+#include <stdint.h>
+
+#include "ht16k33.h"
+#include "ut3k_encoder_ring.h"
+
+#define UT3K_SESSION_RECORD_ENV_VAR "UT3K_SESSION_RECORD"
+#define UT3K_SESSION_REPLAY_ENV_VAR "UT3K_SESSION_REPLAY"
+
+// number of rotary encoders / HT16K33s captured in a session
+#define UT3K_SESSION_ENCODERS 3
+#define UT3K_SESSION_CHIPS 4
+// transitions per encoder per input: a full ring's worth
+#define UT3K_SESSION_MAX_TRANSITIONS UT3K_ENCODER_RING_SIZE
+
+typedef enum { UT3K_SESSION_OFF, UT3K_SESSION_RECORDING, UT3K_SESSION_REPLAYING } ut3k_session_mode_t;
+
+
+/** ut3k_session_init
+ *
+ * check the environment and open a session for recording or replay.
+ * Call this first thing in main, before anything draws on rand():
+ *   srand(ut3k_session_init(time(NULL)));
+ * Returns the seed to use: the passed in seed when recording (it's
+ * saved in the log) or when no session is active, the recorded seed
+ * when replaying.
+ * The session is closed and stats printed via atexit.
+ */
+uint32_t ut3k_session_init(uint32_t seed);
+
+ut3k_session_mode_t ut3k_session_mode();
+int ut3k_session_is_replay();
+
+
+/** record hooks: called by ut3k_view.  No-op unless recording.
+ */
+void ut3k_session_record_initial_keyscan(ht16k33keyscan_t keyscan);
+void ut3k_session_record_controls(uint32_t clock,
+                                  ht16k33keyscan_t keyscan,
+                                  uint64_t timestamp_ns,
+                                  const struct encoder_transition transitions[UT3K_SESSION_ENCODERS][UT3K_SESSION_MAX_TRANSITIONS],
+                                  const int counts[UT3K_SESSION_ENCODERS]);
+// encoder fast path: transitions only, nothing recorded if there are none
+void ut3k_session_record_encoders(uint32_t clock,
+                                  const struct encoder_transition transitions[UT3K_SESSION_ENCODERS][UT3K_SESSION_MAX_TRANSITIONS],
+                                  const int counts[UT3K_SESSION_ENCODERS]);
+
+/** replay hooks: called by ut3k_view in place of reading hardware.
+ * Return 0 on success, non-zero if the log has nothing more to offer.
+ */
+int ut3k_session_replay_initial_keyscan(ht16k33keyscan_t keyscan);
+int ut3k_session_replay_controls(uint32_t clock,
+                                 ht16k33keyscan_t keyscan,
+                                 uint64_t *timestamp_ns,
+                                 struct encoder_transition transitions[UT3K_SESSION_ENCODERS][UT3K_SESSION_MAX_TRANSITIONS],
+                                 int counts[UT3K_SESSION_ENCODERS]);
+// counts are all 0 unless the next record is from the encoder fast path
+int ut3k_session_replay_encoders(uint32_t clock,
+                                 struct encoder_transition transitions[UT3K_SESSION_ENCODERS][UT3K_SESSION_MAX_TRANSITIONS],
+                                 int counts[UT3K_SESSION_ENCODERS]);
+
+
+/** ut3k_session_frame
+ *
+ * a frame has been committed to the four HT16K33 display buffers.
+ * Recording: write out any chips that changed since the last frame.
+ * Replaying: compare against the recorded frame and count mismatches.
+ */
+void ut3k_session_frame(uint32_t clock, HT16K33 *const chips[UT3K_SESSION_CHIPS]);
+
+
+#endif
@@ -0,0 +1,276 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ut3k_transition.h"
+
+
+#define SEGMENTS 15  // A - N plus DP
+#define SEGMENT_COLUMNS 5
+#define SEGMENT_ROWS 5
+
+#define EXPLOSION_FLASH 0x3FFF
+#define EXPLOSION_SPARKS (SEG_H | SEG_J | SEG_K | SEG_L | SEG_M | SEG_N)
+
+
+// where each segment bit sits in its digit, for wipes:
+//  A  B  C  D  E  F  G1 G2 H  J  K  L  M  N  DP
+static const uint8_t segment_column[SEGMENTS] =
+  { 2, 4, 4, 2, 0, 0, 1, 3, 1, 2, 3, 1, 2, 3, 4 };
+static const uint8_t segment_row[SEGMENTS] =
+  { 0, 1, 3, 4, 3, 1, 2, 2, 1, 1, 1, 3, 3, 3, 4 };
+
+
+// frame from which a segment shows (TRANSITION_IN) or stops showing (TRANSITION_OUT)
+typedef uint8_t thresholds_t[UT3K_TRANSITION_DISPLAYS][UT3K_TRANSITION_DIGITS][SEGMENTS];
+
+static void compile_fade(struct ut3k_transition *this, thresholds_t thresholds, int steps, transition_fade_t fade, int loop);
+static void link_frames(struct ut3k_transition *this, int loop);
+static uint16_t random_segments(int count);
+
+
+
+void init_wipe_transition(struct ut3k_transition *this, wipe_direction_t direction, transition_fade_t fade, int loop) {
+  thresholds_t thresholds;
+  int steps, position;
+
+  steps = (direction == WIPE_LEFT_TO_RIGHT || direction == WIPE_RIGHT_TO_LEFT) ?
+    UT3K_TRANSITION_DIGITS * SEGMENT_COLUMNS : UT3K_TRANSITION_DISPLAYS * SEGMENT_ROWS;
+
+  for (int display = 0; display < UT3K_TRANSITION_DISPLAYS; ++display) {
+    for (int digit = 0; digit < UT3K_TRANSITION_DIGITS; ++digit) {
+      for (int bit = 0; bit < SEGMENTS; ++bit) {
+        switch (direction) {
+        case WIPE_LEFT_TO_RIGHT:
+          position = digit * SEGMENT_COLUMNS + segment_column[bit];
+          break;
+        case WIPE_RIGHT_TO_LEFT:
+          position = steps - 1 - (digit * SEGMENT_COLUMNS + segment_column[bit]);
+          break;
+        case WIPE_TOP_TO_BOTTOM:
+          position = display * SEGMENT_ROWS + segment_row[bit];
+          break;
+        case WIPE_BOTTOM_TO_TOP:
+        default:
+          position = steps - 1 - (display * SEGMENT_ROWS + segment_row[bit]);
+          break;
+        }
+        thresholds[display][digit][bit] = position + 1;
+      }
+    }
+  }
+
+  compile_fade(this, thresholds, steps, fade, loop);
+}
+
+
+void init_dissolve_transition(struct ut3k_transition *this, int steps, transition_fade_t fade, int loop) {
+  thresholds_t thresholds;
+
+  if (steps < 1) {
+    steps = 1;
+  }
+  else if (steps > UT3K_TRANSITION_MAX_FRAMES - 1) {
+    steps = UT3K_TRANSITION_MAX_FRAMES - 1;
+  }
+
+  for (int display = 0; display < UT3K_TRANSITION_DISPLAYS; ++display) {
+    for (int digit = 0; digit < UT3K_TRANSITION_DIGITS; ++digit) {
+      for (int bit = 0; bit < SEGMENTS; ++bit) {
+        thresholds[display][digit][bit] = 1 + rand() % steps;
+      }
+    }
+  }
+
+  compile_fade(this, thresholds, steps, fade, loop);
+}
+
+
+void init_buildup_transition(struct ut3k_transition *this, transition_fade_t fade, int loop) {
+  thresholds_t thresholds;
+
+  for (int display = 0; display < UT3K_TRANSITION_DISPLAYS; ++display) {
+    for (int digit = 0; digit < UT3K_TRANSITION_DIGITS; ++digit) {
+      // bit order already goes outline (A-F), middle bar (G1, G2),
+      // insides (H-N), then the DP
+      for (int bit = 0; bit < SEGMENTS; ++bit) {
+        thresholds[display][digit][bit] = bit + 1;
+      }
+    }
+  }
+
+  compile_fade(this, thresholds, SEGMENTS, fade, loop);
+}
+
+
+/** init_explosion_transition
+ *
+ * rings of digits (chessboard distance from the center digit) go
+ * through flash, sparks and embers one frame apart.  The final frame is
+ * blank.
+ */
+void init_explosion_transition(struct ut3k_transition *this, int display, int digit, int loop) {
+  int max_distance = 0, distance, age;
+  int row_distance, column_distance;
+  int distances[UT3K_TRANSITION_DISPLAYS][UT3K_TRANSITION_DIGITS];
+
+  for (int d = 0; d < UT3K_TRANSITION_DISPLAYS; ++d) {
+    for (int g = 0; g < UT3K_TRANSITION_DIGITS; ++g) {
+      row_distance = abs(d - display);
+      column_distance = abs(g - digit);
+      distances[d][g] = row_distance > column_distance ? row_distance : column_distance;
+      if (distances[d][g] > max_distance) {
+        max_distance = distances[d][g];
+      }
+    }
+  }
+
+  this->frames = max_distance + 4;
+  memset(this->table, 0, sizeof(struct ut3k_transition_frame) * this->frames);
+
+  for (int frame = 0; frame < this->frames - 1; ++frame) {
+    for (int d = 0; d < UT3K_TRANSITION_DISPLAYS; ++d) {
+      for (int g = 0; g < UT3K_TRANSITION_DIGITS; ++g) {
+        distance = distances[d][g];
+        age = frame - distance;
+        if (age == 0) {
+          this->table[frame].or_mask[d][g] = EXPLOSION_FLASH;
+        }
+        else if (age == 1) {
+          this->table[frame].or_mask[d][g] = EXPLOSION_SPARKS;
+        }
+        else if (age == 2) {
+          this->table[frame].or_mask[d][g] = random_segments(2);
+        }
+      }
+    }
+  }
+
+  link_frames(this, loop);
+}
+
+
+void init_frames_transition(struct ut3k_transition *this, const uint16_t frames[][UT3K_TRANSITION_DISPLAYS][UT3K_TRANSITION_DIGITS], int num_frames, int loop) {
+  if (num_frames < 1) {
+    // nothing to show: hold blank
+    this->frames = 1;
+    memset(&this->table[0], 0, sizeof(struct ut3k_transition_frame));
+    link_frames(this, loop);
+    return;
+  }
+  if (num_frames > UT3K_TRANSITION_MAX_FRAMES) {
+    num_frames = UT3K_TRANSITION_MAX_FRAMES;
+  }
+
+  this->frames = num_frames;
+  for (int frame = 0; frame < num_frames; ++frame) {
+    memset(this->table[frame].and_mask, 0, sizeof(this->table[frame].and_mask));
+    memcpy(this->table[frame].or_mask, frames[frame], sizeof(this->table[frame].or_mask));
+  }
+
+  link_frames(this, loop);
+}
+
+
+void ut3k_transition_restart(struct ut3k_transition *this) {
+  this->frame = 0;
+}
+
+
+void ut3k_transition_advance(struct ut3k_transition *this) {
+  this->frame = this->next[this->frame];
+}
+
+
+int ut3k_transition_done(const struct ut3k_transition *this) {
+  return this->next[this->frame] == this->frame;
+}
+
+
+void ut3k_transition_apply(const struct ut3k_transition *this, int display, uint16_t glyph[4]) {
+  const struct ut3k_transition_frame *frame = &this->table[this->frame];
+
+  glyph[0] = (glyph[0] & frame->and_mask[display][0]) | frame->or_mask[display][0];
+  glyph[1] = (glyph[1] & frame->and_mask[display][1]) | frame->or_mask[display][1];
+  glyph[2] = (glyph[2] & frame->and_mask[display][2]) | frame->or_mask[display][2];
+  glyph[3] = (glyph[3] & frame->and_mask[display][3]) | frame->or_mask[display][3];
+}
+
+
+void ut3k_transition_apply_display(const struct ut3k_transition *this, struct ut3k_display *ut3k_display) {
+  struct display *display;
+
+  for (int i = 0; i < UT3K_TRANSITION_DISPLAYS; ++i) {
+    display = &ut3k_display->displays[i];
+    if (display->display_type == glyph_display) {
+      ut3k_transition_apply(this, i, display->display_value.display_glyph);
+      mark_display_dirty(display);
+    }
+  }
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+/** compile_fade
+ *
+ * steps + 1 frames.  TRANSITION_IN: a segment is let through from
+ * the frame matching its threshold on.  TRANSITION_OUT: until then.
+ */
+static void compile_fade(struct ut3k_transition *this, thresholds_t thresholds, int steps, transition_fade_t fade, int loop) {
+  uint16_t mask;
+
+  this->frames = steps + 1;
+
+  for (int frame = 0; frame < this->frames; ++frame) {
+    for (int display = 0; display < UT3K_TRANSITION_DISPLAYS; ++display) {
+      for (int digit = 0; digit < UT3K_TRANSITION_DIGITS; ++digit) {
+        mask = 0;
+        for (int bit = 0; bit < SEGMENTS; ++bit) {
+          if ((thresholds[display][digit][bit] <= frame) == (fade == TRANSITION_IN)) {
+            mask |= 1 << bit;
+          }
+        }
+        this->table[frame].and_mask[display][digit] = mask;
+        this->table[frame].or_mask[display][digit] = 0;
+      }
+    }
+  }
+
+  link_frames(this, loop);
+}
+
+
+static void link_frames(struct ut3k_transition *this, int loop) {
+  for (int frame = 0; frame < this->frames - 1; ++frame) {
+    this->next[frame] = frame + 1;
+  }
+  this->next[this->frames - 1] = loop ? 0 : this->frames - 1;
+  this->frame = 0;
+}
+
+
+static uint16_t random_segments(int count) {
+  uint16_t segments = 0;
+
+  while (count-- > 0) {
+    segments |= 1 << (rand() % (SEGMENTS - 1));
+  }
+  return segments;
+}
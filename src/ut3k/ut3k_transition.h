@@ -0,0 +1,108 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* ut3k_transition.h
+ *
+ * Glyph transitions across the three alphanum displays: wipes,
+ * dissolves, segment-by-segment build-ups and explosions.
+ *
+ * A transition is worked out once, at init, into a table of frames.
+ * Each frame is an AND and an OR mask for every digit:
+ *   glyph = (glyph & and_mask) | or_mask
+ * AND masks take away (or reveal) whatever the game drew, OR masks draw
+ * the effect itself.  Running a transition is then a table lookup to
+ * get to the next frame and the AND/OR on each digit.
+ *
+ * The displays are treated as a 3 x 4 grid of digits, display 0 (green)
+ * on top through display 2 (red) on the bottom.  Each digit is 5 segment
+ * columns wide and 5 segment rows high for wipes.
+ */
+
+#ifndef UT3K_TRANSITION_H
+#define UT3K_TRANSITION_H
+
+#include <stdint.h>
+
+#include "ut3k_view.h"
+
+#define UT3K_TRANSITION_DISPLAYS 3
+#define UT3K_TRANSITION_DIGITS 4
+#define UT3K_TRANSITION_MAX_FRAMES 32
+
+
+typedef enum { TRANSITION_IN, TRANSITION_OUT } transition_fade_t;
+
+typedef enum { WIPE_LEFT_TO_RIGHT, WIPE_RIGHT_TO_LEFT,
+               WIPE_TOP_TO_BOTTOM, WIPE_BOTTOM_TO_TOP } wipe_direction_t;
+
+
+struct ut3k_transition_frame {
+  uint16_t and_mask[UT3K_TRANSITION_DISPLAYS][UT3K_TRANSITION_DIGITS];
+  uint16_t or_mask[UT3K_TRANSITION_DISPLAYS][UT3K_TRANSITION_DIGITS];
+};
+
+struct ut3k_transition {
+  int frames;
+  int frame;
+  // frame to go to after each frame: the last frame points at itself
+  // to hold, or back to the first to loop
+  uint8_t next[UT3K_TRANSITION_MAX_FRAMES];
+  struct ut3k_transition_frame table[UT3K_TRANSITION_MAX_FRAMES];
+};
+
+
+/** transitions
+ *
+ * TRANSITION_IN starts blank and reveals what's drawn, TRANSITION_OUT
+ * takes it away.  With loop set the transition starts over after the
+ * last frame, otherwise it holds there.
+ */
+
+// one segment column (or row) per frame
+void init_wipe_transition(struct ut3k_transition *this, wipe_direction_t direction, transition_fade_t fade, int loop);
+
+// segments come or go in random order over steps frames
+void init_dissolve_transition(struct ut3k_transition *this, int steps, transition_fade_t fade, int loop);
+
+// every digit draws (or erases) itself a segment at a time, outline first
+void init_buildup_transition(struct ut3k_transition *this, transition_fade_t fade, int loop);
+
+// blanks what's drawn and blows up from a digit: a flash followed by
+// sparks and embers rippling out across the displays
+void init_explosion_transition(struct ut3k_transition *this, int display, int digit, int loop);
+
+// canned frames, drawn over blank displays.  No frames is one blank frame.
+void init_frames_transition(struct ut3k_transition *this, const uint16_t frames[][UT3K_TRANSITION_DISPLAYS][UT3K_TRANSITION_DIGITS], int num_frames, int loop);
+
+
+// back to the first frame
+void ut3k_transition_restart(struct ut3k_transition *this);
+
+// go to the next frame
+void ut3k_transition_advance(struct ut3k_transition *this);
+
+// true if holding on the last frame
+int ut3k_transition_done(const struct ut3k_transition *this);
+
+// apply the current frame to the glyph of one display
+void ut3k_transition_apply(const struct ut3k_transition *this, int display, uint16_t glyph[4]);
+
+// apply the current frame to the glyph displays of a ut3k_display and
+// mark them dirty.  Integer and string displays are left alone.
+void ut3k_transition_apply_display(const struct ut3k_transition *this, struct ut3k_display *ut3k_display);
+
+
+#endif
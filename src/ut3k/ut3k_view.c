@@ -17,37 +17,46 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/gpio.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "ut3k_view.h"
+#include "ut3k_session.h"
+#include "ut3k_config.h"
+#include "ut3k_virtual_panel.h"
+#include "ut3k_encoder_evdev.h"
+#include "ut3k_latency.h"
+#include "ut3k_encoder_ring.h"
 #include "display_strategy.h"
 
-#define GREEN_DISPLAY_ADDRESS HT16K33_ADDR_07
-#define BLUE_DISPLAY_ADDRESS HT16K33_ADDR_06
-#define RED_DISPLAY_ADDRESS HT16K33_ADDR_05
-#define INPUTS_AND_LEDS_ADDRESS HT16K33_ADDR_04
-#define I2C_ADAPTER_1 1
-
 #define DISPLAY_GREEN 0
 #define DISPLAY_BLUE 1
 #define DISPLAY_RED 2
 #define DISPLAY_LEDS 3
 #define DISPLAY_ROWS 3
 
+#define ENCODER_GREEN 0
+#define ENCODER_BLUE 1
+#define ENCODER_RED 2
+
+// i2c addresses, gpio lines and the keyscan map are in the cabinet's
+// config, see ut3k_config.h
 
-static const int gpio_rotary_green_a_bcm = 16;
-static const int gpio_rotary_green_b_bcm = 26;
-static const int gpio_rotary_blue_a_bcm = 6;
-static const int gpio_rotary_blue_b_bcm = 13;
-static const int gpio_rotary_red_a_bcm = 12;
-static const int gpio_rotary_red_b_bcm = 25;
-static const char *gpio_devfile = "/dev/gpiochip0";
+// the kernel holds back an edge until the line has been steady this
+// long.  Well under the ~2ms between edges of a fast spin.
+#define ENCODER_DEBOUNCE_USEC 500
+#define ENCODER_LINES 6
+// events the kernel buffers for us, and that we read at once
+#define ENCODER_EVENT_BUFFER 256
+#define ENCODER_EVENT_READ 32
 
 
 
@@ -56,25 +65,29 @@ typedef void (*f_show_displays)(struct ut3k_view*, struct display_strategy*);
 
 // implements f_show_displays
 static void ht16k33_alphanum_display_game(struct ut3k_view *this, struct display_strategy *display);
-static void commit_string(HT16K33 *display, char *string);
-static void commit_glyph(HT16K33 *display, uint16_t glyph[]);
-static void commit_integer(HT16K33 *display, int16_t value);
+static int render_ut3k_display(struct ut3k_view *this, struct ut3k_display *ut3k_display, uint32_t clock);
+static void pull_display(struct display *display, display_type_t type, display_value_t *value, char *retained_string);
+static void encode_string(HT16K33 *display, char *string);
+static void encode_glyph(HT16K33 *display, uint16_t glyph[]);
+static void encode_integer(HT16K33 *display, int16_t value);
+static void note_input_causes(struct ut3k_view *this);
+static void settle_input_causes(struct ut3k_view *this, struct ut3k_display *ut3k_display, int rendered);
+
+static const char *const latency_type_names[INPUT_EVENT_TYPE_COUNT] =
+  { "press", "release", "long press", "double press", "selector", "toggle", "joystick", "rotate" };
 
 
 /** rotary encoder stuff
  *
- * runs in own thread, reading the rotary encoders at a faster
- * interval than the HT16K33 can provide.
- * Use a long long int (64 bits) as a queue for each encoder.
- * Each read push two bits onto the end.
+ * runs in own thread, blocked on edge events from the encoder GPIO
+ * lines and woken by the kernel for each transition.  Each new A/B
+ * state goes on the encoder's ring (ut3k_encoder_ring.h) with the
+ * kernel's timestamp, for update_controls to drain.
+ * With encoder_devices configured ut3k_encoder_evdev fills the rings
+ * instead.
  */
-struct rotary_encoder_bits_queue {
-  unsigned long long int bit_queue;
-  int queue_index;
-  int previous_a;
-  int previous_b;
-};
 static void* poll_rotary_encoders(void *userdata);
+static int read_encoder_lines(int line_fd, uint64_t *line_bits);
 
 
 struct ut3k_view {
@@ -89,21 +102,39 @@ struct ut3k_view {
 
   // aliases for the above
   HT16K33 *display_array[3];
+  HT16K33 *chip_array[4];  // displays plus inputs_and_leds, for session capture
+
+  // what's actually in display RAM when dithering; the display
+  // buffers hold the undithered frame
+  uint8_t dither_shadow[4][16];
+  int dither_shadow_valid;
+
+  // update_displays pulls into this and commits it like any other
+  // retained display, so unchanged values cost nothing.  Strings are
+  // copied: the strategies hand out pointers to buffers they reuse.
+  struct ut3k_display pulled_display;
+  char pulled_strings[3][5];
 
 
   struct control_panel *control_panel;
+  uint32_t latency_cursor;  // events read for latency
+  struct ut3k_latency latency;
   void *control_panel_listener_userdata;  // for callback
   f_view_control_panel_listener control_panel_listener;  // the callback
+  void *encoder_listener_userdata;
+  f_view_encoder_listener encoder_listener;
 
   // rotary encoder baggage
   pthread_t thread_poll_rotary_encoders;
-  pthread_mutex_t rotary_bits_queue_mutex;
-  // the data below should only be accessed by the rotary_bits_queue_mutex
-  struct rotary_encoder_bits_queue green_rotary_queue;
-  struct rotary_encoder_bits_queue blue_rotary_queue;
-  struct rotary_encoder_bits_queue red_rotary_queue;
-// end mutex protected data
+  // written by the encoder thread, drained by update_controls and
+  // update_encoders
+  struct encoder_ring encoder_rings[3];
+  // what was drained, handed on to the control panel
+  struct encoder_transition encoder_transitions[3][UT3K_ENCODER_RING_SIZE];
   int cleanup_and_exit; // signal to thread to exit
+  int encoder_wake_fd;   // eventfd: wakes the thread to see the above
+  int encoder_thread_started;
+  int encoder_evdev_started;  // ut3k_encoder_evdev instead of the thread
 };
 
 
@@ -125,6 +156,7 @@ struct ut3k_view* create_alphanum_ut3k_view() {
   struct ut3k_view *this;
   int rc = 0;
   ht16k33keyscan_t keyscan;
+  const struct ut3k_hardware_map *hardware;
 
 
   this = (struct ut3k_view*) malloc(sizeof(struct ut3k_view));
@@ -142,61 +174,121 @@ struct ut3k_view* create_alphanum_ut3k_view() {
     return NULL;
   }
 
-  HT16K33_init(this->green_display, I2C_ADAPTER_1, GREEN_DISPLAY_ADDRESS);
-  HT16K33_init(this->blue_display, I2C_ADAPTER_1, BLUE_DISPLAY_ADDRESS);
-  HT16K33_init(this->red_display, I2C_ADAPTER_1, RED_DISPLAY_ADDRESS);
-  HT16K33_init(this->inputs_and_leds, I2C_ADAPTER_1, INPUTS_AND_LEDS_ADDRESS);
+  hardware = &get_ut3k_config()->hardware;
+  HT16K33_init(this->green_display, hardware->i2c_adapter, hardware->display_addresses[DISPLAY_GREEN]);
+  HT16K33_init(this->blue_display, hardware->i2c_adapter, hardware->display_addresses[DISPLAY_BLUE]);
+  HT16K33_init(this->red_display, hardware->i2c_adapter, hardware->display_addresses[DISPLAY_RED]);
+  HT16K33_init(this->inputs_and_leds, hardware->i2c_adapter, hardware->display_addresses[DISPLAY_LEDS]);
   
   // alias in array
   this->display_array[DISPLAY_GREEN] = this->green_display;
   this->display_array[DISPLAY_BLUE] = this->blue_display;
   this->display_array[DISPLAY_RED] = this->red_display;
+  memcpy(this->chip_array, this->display_array, sizeof(this->display_array));
+  this->chip_array[DISPLAY_LEDS] = this->inputs_and_leds;
+  this->dither_shadow_valid = 0;
+  reset_ut3k_display(&this->pulled_display);
 
+  init_encoder_ring(&this->encoder_rings[ENCODER_GREEN]);
+  init_encoder_ring(&this->encoder_rings[ENCODER_BLUE]);
+  init_encoder_ring(&this->encoder_rings[ENCODER_RED]);
 
-  // error codes positive...just sum them up
-
-  rc += initialize_backpack(this->green_display);
-  rc += initialize_backpack(this->blue_display);
-  rc += initialize_backpack(this->red_display);
-  rc += initialize_backpack(this->inputs_and_leds);
 
-  if (rc) {
-    free(this);
-    return NULL;
+  if (ut3k_session_is_replay()) {
+    // no hardware: the displays are only buffers to compare against
+    // the recording and the keyscans come from the session log
+    ut3k_session_replay_initial_keyscan(keyscan);
   }
-  
-  // error codes negative
-  rc = HT16K33_COMMIT(this->green_display);
-  rc -= HT16K33_COMMIT(this->blue_display);
-  rc -= HT16K33_COMMIT(this->red_display);
-  rc -= HT16K33_COMMIT(this->inputs_and_leds);
-
-  if (rc) {
-    free(this);
-    return NULL;
+  else if (ut3k_virtual_panel_is_active()) {
+    // no hardware either: keys stand in for the control panel.  The
+    // displays aren't opened, commits to them quietly go nowhere.
+    if (start_ut3k_virtual_panel(this->encoder_rings) != 0) {
+      free(this);
+      return NULL;
+    }
+    ut3k_virtual_panel_keyscan(keyscan);
+    ut3k_session_record_initial_keyscan(keyscan);
   }
+  else {
+    // error codes positive...just sum them up
+
+    rc += initialize_backpack(this->green_display);
+    rc += initialize_backpack(this->blue_display);
+    rc += initialize_backpack(this->red_display);
+    rc += initialize_backpack(this->inputs_and_leds);
+
+    if (rc) {
+      free(this);
+      return NULL;
+    }
+  
+    // error codes negative
+    rc = HT16K33_COMMIT(this->green_display);
+    rc -= HT16K33_COMMIT(this->blue_display);
+    rc -= HT16K33_COMMIT(this->red_display);
+    rc -= HT16K33_COMMIT(this->inputs_and_leds);
+
+    if (rc) {
+      free(this);
+      return NULL;
+    }
 
 
 
-  // get current state of control panel.  Some switches may
-  // be set, so start off with the state reflecting that.
-  rc = HT16K33_READ(this->inputs_and_leds, keyscan);
-  if (rc != 0) {
-    printf("keyscan failed with code %d\n", rc);
+    // get current state of control panel.  Some switches may
+    // be set, so start off with the state reflecting that.
+    rc = HT16K33_READ(this->inputs_and_leds, keyscan);
+    if (rc != 0) {
+      printf("keyscan failed with code %d\n", rc);
+    }
+    ut3k_session_record_initial_keyscan(keyscan);
   }
 
-  this->control_panel = create_control_panel(keyscan);
+  this->control_panel = create_control_panel(keyscan, &hardware->keyscan);
+  this->latency_cursor = 0;
+  init_ut3k_latency(&this->latency, INPUT_EVENT_TYPE_COUNT);
+  this->control_panel_listener = NULL;
+  this->encoder_listener = NULL;
 
-  // init and start polling the rotary encoders
-  this->green_rotary_queue = (struct rotary_encoder_bits_queue const) { .bit_queue = 0, .queue_index = 0, .previous_a = 1, .previous_b = 1 };
-  this->blue_rotary_queue = (struct rotary_encoder_bits_queue const) { .bit_queue = 0, .queue_index = 0, .previous_a = 1, .previous_b = 1 };
-  this->red_rotary_queue = (struct rotary_encoder_bits_queue const) { .bit_queue = 0, .queue_index = 0, .previous_a = 1, .previous_b = 1 };
-  pthread_mutex_init(&this->rotary_bits_queue_mutex, NULL);
+  // the cabinet's own debounce, if it has any
+  for (input_id_t input = 0; input < INPUT_COUNT; ++input) {
+    if (get_ut3k_config()->debounce_updates[input] != 0) {
+      set_control_panel_debounce(this->control_panel, input, get_ut3k_config()->debounce_updates[input]);
+    }
+  }
+
+  // start polling the rotary encoders
   this->cleanup_and_exit = 0;
+  this->encoder_wake_fd = -1;
 
-  rc = pthread_create(&this->thread_poll_rotary_encoders, NULL, poll_rotary_encoders, this);
-  if (rc != 0) {
-    printf("create_alphanum_ut3k_view: failed to start rotary encoder listener %d\n", rc);
+  this->encoder_thread_started = 0;
+  this->encoder_evdev_started = 0;
+
+  if (ut3k_session_is_replay() || ut3k_virtual_panel_is_active()) {
+    // replays and the virtual panel bring their own transitions
+  }
+  else if (ut3k_encoder_evdev_configured()) {
+    // the kernel decodes them
+    if (start_ut3k_encoder_evdev(this->encoder_rings) != 0) {
+      printf("create_alphanum_ut3k_view: no rotary encoders\n");
+    }
+    else {
+      this->encoder_evdev_started = 1;
+    }
+  }
+  else {
+    this->encoder_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (this->encoder_wake_fd == -1) {
+      printf("create_alphanum_ut3k_view: eventfd failed: %s\n", strerror(errno));
+    }
+
+    rc = pthread_create(&this->thread_poll_rotary_encoders, NULL, poll_rotary_encoders, this);
+    if (rc != 0) {
+      printf("create_alphanum_ut3k_view: failed to start rotary encoder listener %d\n", rc);
+    }
+    else {
+      this->encoder_thread_started = 1;
+    }
   }
 
   return this;
@@ -213,6 +305,16 @@ int free_ut3k_view(struct ut3k_view *this) {
 
   // signal thread to exit
   this->cleanup_and_exit = 1;
+  if (this->encoder_wake_fd != -1) {
+    uint64_t wake = 1;
+    if (write(this->encoder_wake_fd, &wake, sizeof(wake)) != sizeof(wake)) {
+      printf("free_ut3k_view: unable to wake encoder thread: %s\n", strerror(errno));
+    }
+  }
+
+  if (ut3k_virtual_panel_is_active() && !ut3k_session_is_replay()) {
+    stop_ut3k_virtual_panel();
+  }
 
   free_control_panel(this->control_panel);
 
@@ -226,7 +328,15 @@ int free_ut3k_view(struct ut3k_view *this) {
   free(this->red_display);
   free(this->inputs_and_leds);
 
-  pthread_join(this->thread_poll_rotary_encoders, NULL);
+  if (this->encoder_thread_started) {
+    pthread_join(this->thread_poll_rotary_encoders, NULL);
+  }
+  if (this->encoder_evdev_started) {
+    stop_ut3k_encoder_evdev();
+  }
+  if (this->encoder_wake_fd != -1) {
+    close(this->encoder_wake_fd);
+  }
 
   free(this);
 
@@ -242,66 +352,46 @@ int free_ut3k_view(struct ut3k_view *this) {
 void update_controls(struct ut3k_view *this, uint32_t clock) {
   ht16k33keyscan_t keyscan;
   int keyscan_rc;
-  unsigned long long int green_bit_queue, blue_bit_queue, red_bit_queue;
-  int green_queue_index, blue_queue_index, red_queue_index;
+  int counts[3];
+  struct timespec now;
+  uint64_t timestamp_ns;
 
-  keyscan_rc = HT16K33_READ(this->inputs_and_leds, keyscan);
-  if (keyscan_rc != 0) {
-    printf("keyscan failed with code %d\n", keyscan_rc);
+  if (ut3k_session_is_replay()) {
+    ut3k_session_replay_controls(clock, keyscan, &timestamp_ns, this->encoder_transitions, counts);
   }
+  else {
+    if (ut3k_virtual_panel_is_active()) {
+      ut3k_virtual_panel_keyscan(keyscan);
+    }
+    else {
+      keyscan_rc = HT16K33_READ(this->inputs_and_leds, keyscan);
+      if (keyscan_rc != 0) {
+        printf("keyscan failed with code %d\n", keyscan_rc);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timestamp_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
 
-  //  printf("keyscan: 0x%X 0x%X 0x%X 0x%X 0x%X 0x%X\n",
-  //  	 keyscan[0], keyscan[1], keyscan[2], keyscan[3], keyscan[4], keyscan[5]);
-
-  // drain the queue: read any rotary encoder data
-  // treat this as a critical section- just copy the data
-  // out and release the lock.  Minimize losing any reads
-  // from the gpio pins.  Maybe I'm just paranoid.
-  pthread_mutex_lock(&this->rotary_bits_queue_mutex);
-  if (this->green_rotary_queue.queue_index > 3) {
-    green_bit_queue = this->green_rotary_queue.bit_queue;
-    green_queue_index = this->green_rotary_queue.queue_index;
-    // leave the last two
-    this->green_rotary_queue.bit_queue = this->green_rotary_queue.bit_queue & 0b11;
-    this->green_rotary_queue.queue_index = 2;
-  }
-  else {  // no change-- queue size zero for no processing
-    green_bit_queue = 0;
-    green_queue_index = 0;
-  }
+    //  printf("keyscan: 0x%X 0x%X 0x%X 0x%X 0x%X 0x%X\n",
+    //  	 keyscan[0], keyscan[1], keyscan[2], keyscan[3], keyscan[4], keyscan[5]);
 
-  if (this->blue_rotary_queue.queue_index > 3) {
-    blue_bit_queue = this->blue_rotary_queue.bit_queue;
-    blue_queue_index = this->blue_rotary_queue.queue_index;
-    // leave the last two
-    this->blue_rotary_queue.bit_queue = this->blue_rotary_queue.bit_queue & 0b11;
-    this->blue_rotary_queue.queue_index = 2;
-  }
-  else {
-    blue_bit_queue = 0;
-    blue_queue_index = 0;
-  }
+    // drain the rings: whatever the encoder thread has pushed since
+    // last time.  No lock, the thread keeps on pushing meanwhile.
+    for (int encoder = 0; encoder < 3; ++encoder) {
+      counts[encoder] = encoder_ring_drain(&this->encoder_rings[encoder],
+                                           this->encoder_transitions[encoder], UT3K_ENCODER_RING_SIZE);
+    }
 
-  if (this->red_rotary_queue.queue_index > 3) {
-    red_bit_queue = this->red_rotary_queue.bit_queue;
-    red_queue_index = this->red_rotary_queue.queue_index;
-    // leave the last two
-    this->red_rotary_queue.bit_queue = this->red_rotary_queue.bit_queue & 0b11;
-    this->red_rotary_queue.queue_index = 2;
-  }
-  else {
-    red_bit_queue = 0;
-    red_queue_index = 0;
+    ut3k_session_record_controls(clock, keyscan, timestamp_ns, this->encoder_transitions, counts);
   }
 
-  pthread_mutex_unlock(&this->rotary_bits_queue_mutex);
-
   // update control panel here...
   update_control_panel(this->control_panel, keyscan,
-                       green_bit_queue, green_queue_index,
-                       blue_bit_queue, blue_queue_index,
-                       red_bit_queue, red_queue_index,
-                       clock);
+                       this->encoder_transitions[ENCODER_GREEN], counts[ENCODER_GREEN],
+                       this->encoder_transitions[ENCODER_BLUE], counts[ENCODER_BLUE],
+                       this->encoder_transitions[ENCODER_RED], counts[ENCODER_RED],
+                       clock, timestamp_ns);
+  note_input_causes(this);
 
   if (this->control_panel_listener) {
     (*this->control_panel_listener)((const struct control_panel*)this->control_panel, this->control_panel_listener_userdata);
@@ -310,6 +400,36 @@ void update_controls(struct ut3k_view *this, uint32_t clock) {
 }
 
 
+/** update_encoders
+ *
+ * same drain as update_controls, minus the keyscan.  Recorded in a
+ * session as its own batch so the replay hands the listener the same
+ * detents on the same tick.
+ */
+void update_encoders(struct ut3k_view *this, uint32_t clock) {
+  struct encoder_deltas deltas;
+  int counts[3];
+
+  if (ut3k_session_is_replay()) {
+    ut3k_session_replay_encoders(clock, this->encoder_transitions, counts);
+  }
+  else {
+    for (int encoder = 0; encoder < 3; ++encoder) {
+      counts[encoder] = encoder_ring_drain(&this->encoder_rings[encoder],
+                                           this->encoder_transitions[encoder], UT3K_ENCODER_RING_SIZE);
+    }
+    ut3k_session_record_encoders(clock, this->encoder_transitions, counts);
+  }
+
+  if (update_control_panel_encoders(this->control_panel,
+                                    this->encoder_transitions[ENCODER_GREEN], counts[ENCODER_GREEN],
+                                    this->encoder_transitions[ENCODER_BLUE], counts[ENCODER_BLUE],
+                                    this->encoder_transitions[ENCODER_RED], counts[ENCODER_RED],
+                                    &deltas) &&
+      this->encoder_listener) {
+    (*this->encoder_listener)(&deltas, this->encoder_listener_userdata);
+  }
+}
 
 
 
@@ -321,25 +441,94 @@ void update_controls(struct ut3k_view *this, uint32_t clock) {
  */
 
 void commit_ut3k_view(struct ut3k_view *this, struct ut3k_display *ut3k_display, uint32_t clock) {
+  int rendered;
+
+  if (this->dither_shadow_valid) {
+    // the chips are showing a dithered subframe: send everything
+    for (int i = 0; i < 3; ++i) {
+      ut3k_display->displays[i].dirty = 1;
+    }
+    ut3k_display->leds.dirty = 1;
+    this->dither_shadow_valid = 0;
+  }
+
+  rendered = render_ut3k_display(this, ut3k_display, clock);
+
+  for (int i = 0; i < 4; ++i) {
+    if (rendered & (1 << i)) {
+      HT16K33_COMMIT(this->chip_array[i]);
+    }
+  }
+  settle_input_causes(this, ut3k_display, rendered);
+
+  ut3k_session_frame(clock, this->chip_array);
+}
+
+
+/** commit_ut3k_view_dithered
+ *
+ * render as commit_ut3k_view, then write dither->depth masked
+ * subframes, sleeping between them so each gets an even share of
+ * dither->frame_usec.  The last subframe stays up until the next call.
+ */
+void commit_ut3k_view_dithered(struct ut3k_view *this, struct ut3k_display *ut3k_display, struct ut3k_dither *dither, uint32_t clock) {
+  struct timespec start, wakeup;
+  uint64_t offset_nsec;
+  uint8_t target[16];
+  int full, rendered;
+
+  rendered = render_ut3k_display(this, ut3k_display, clock);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  dither->last_cost = (struct ut3k_dither_cost const) { 0 };
+
+  for (int subframe = 0; subframe < dither->depth; ++subframe) {
+    // no idea what's on the chips after a plain commit: send it all
+    full = subframe == 0 && !this->dither_shadow_valid;
+
+    for (int i = 0; i < 4; ++i) {
+      for (int byte = 0; byte < 16; ++byte) {
+        target[byte] = this->chip_array[i]->display_buffer.com[byte] & dither->masks[i][subframe][byte];
+      }
+      ut3k_dither_write_subframe(this->chip_array[i], this->dither_shadow[i], target, full, &dither->last_cost);
+    }
+
+    if (subframe + 1 < dither->depth && !ut3k_session_is_replay()) {
+      offset_nsec = start.tv_nsec + (uint64_t)dither->frame_usec * 1000 * (subframe + 1) / dither->depth;
+      wakeup.tv_sec = start.tv_sec + offset_nsec / 1000000000;
+      wakeup.tv_nsec = offset_nsec % 1000000000;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+    }
+  }
+  this->dither_shadow_valid = 1;
+  settle_input_causes(this, ut3k_display, rendered);
+
+  dither->total_cost.writes += dither->last_cost.writes;
+  dither->total_cost.bytes += dither->last_cost.bytes;
+  dither->total_cost.bus_usec += dither->last_cost.bus_usec;
+  dither->ticks++;
+
+  ut3k_session_frame(clock, this->chip_array);
+}
+
+
+/** render_ut3k_display
+ *
+ * run the animators and encode the dirty displays of the ut3k_display
+ * into the HT16K33 display buffers.  Brightness and blink are sent if
+ * changed; the display buffers are left for the caller to commit.
+ * Returns a bitmask of the chip_array entries that were encoded.
+ */
+static int render_ut3k_display(struct ut3k_view *this, struct ut3k_display *ut3k_display, uint32_t clock) {
   struct display *display;  
+  int rendered = 0;
 
   for (int i = 0; i < 3; ++i) {
     display = &ut3k_display->displays[i];
 
     if (display->f_animate != NULL) {
       display->f_animate(display, clock);
-    }
-
-    switch (display->display_type) {
-    case integer_display:
-      commit_integer(this->display_array[i], display->display_value.display_int);
-      break;
-    case glyph_display:
-      commit_glyph(this->display_array[i], display->display_value.display_glyph);
-      break;
-    case string_display:
-      commit_string(this->display_array[i], display->display_value.display_string);
-      break;
+      display->dirty = 1;
     }
 
     if (this->display_array[i]->brightness != display->brightness) {
@@ -350,6 +539,23 @@ void commit_ut3k_view(struct ut3k_view *this, struct ut3k_display *ut3k_display,
       HT16K33_BLINK(this->display_array[i], display->blink);
     }
 
+    if (!display->dirty) {
+      continue;
+    }
+    display->dirty = 0;
+    rendered |= 1 << i;
+
+    switch (display->display_type) {
+    case integer_display:
+      encode_integer(this->display_array[i], display->display_value.display_int);
+      break;
+    case glyph_display:
+      encode_glyph(this->display_array[i], display->display_value.display_glyph);
+      break;
+    case string_display:
+      encode_string(this->display_array[i], display->display_value.display_string);
+      break;
+    }
   }
 
 
@@ -358,22 +564,9 @@ void commit_ut3k_view(struct ut3k_view *this, struct ut3k_display *ut3k_display,
 
   if (display->f_animate != NULL) {
     display->f_animate(display, clock);
+    display->dirty = 1;
   }
 
-  switch (display->display_type) {
-  case glyph_display:
-    HT16K33_UPDATE_RAW_BYDIGIT(this->inputs_and_leds, 4, display->display_value.display_glyph[0]);
-    HT16K33_UPDATE_RAW_BYDIGIT(this->inputs_and_leds, 5, display->display_value.display_glyph[1]);
-    HT16K33_UPDATE_RAW_BYDIGIT(this->inputs_and_leds, 6, display->display_value.display_glyph[2]);
-    HT16K33_COMMIT(this->inputs_and_leds);
-    break;
-  case integer_display:
-  case string_display:
-  default:
-    printf("ut3k_view:commit_ut3k_view: unsupported display mode set for LED display\n");
-    break;
-  }
-  
   if (this->inputs_and_leds->brightness != display->brightness) {
     HT16K33_BRIGHTNESS(this->inputs_and_leds, display->brightness);
   }
@@ -382,6 +575,25 @@ void commit_ut3k_view(struct ut3k_view *this, struct ut3k_display *ut3k_display,
     HT16K33_BLINK(this->inputs_and_leds, display->blink);
   }
 
+  if (display->dirty) {
+    display->dirty = 0;
+
+    switch (display->display_type) {
+    case glyph_display:
+      HT16K33_UPDATE_RAW_BYDIGIT(this->inputs_and_leds, 4, display->display_value.display_glyph[0]);
+      HT16K33_UPDATE_RAW_BYDIGIT(this->inputs_and_leds, 5, display->display_value.display_glyph[1]);
+      HT16K33_UPDATE_RAW_BYDIGIT(this->inputs_and_leds, 6, display->display_value.display_glyph[2]);
+      rendered |= 1 << DISPLAY_LEDS;
+      break;
+    case integer_display:
+    case string_display:
+    default:
+      printf("ut3k_view:commit_ut3k_view: unsupported display mode set for LED display\n");
+      break;
+    }
+  }
+
+  return rendered;
 }
 
 
@@ -390,9 +602,11 @@ void clear_ut3k_display(struct ut3k_display *this) {
   for (int i = 0; i < 3; ++i) {
     this->displays[i].display_type = glyph_display;
     memset(this->displays[i].display_value.display_glyph, 0, 8);
+    this->displays[i].dirty = 1;
   }
   this->leds.display_type = glyph_display;
   memset(this->leds.display_value.display_glyph, 0, 8);
+  this->leds.dirty = 1;
 }
 
 
@@ -409,40 +623,114 @@ void reset_ut3k_display(struct ut3k_display *this) {
      .displays[0].brightness = HT16K33_BRIGHTNESS_7,
      .displays[0].f_animate = NULL,
      .displays[0].userdata = NULL,
+     .displays[0].dirty = 1,
      .displays[1].display_type = glyph_display,
      .displays[1].display_value.display_glyph = { 0 },
      .displays[1].blink = HT16K33_BLINK_OFF,
      .displays[1].brightness = HT16K33_BRIGHTNESS_7,
      .displays[1].f_animate = NULL,
      .displays[1].userdata = NULL,
+     .displays[1].dirty = 1,
      .displays[2].display_type = glyph_display,
      .displays[2].display_value.display_glyph = { 0 },
      .displays[2].blink = HT16K33_BLINK_OFF,
      .displays[2].brightness = HT16K33_BRIGHTNESS_7,
      .displays[2].f_animate = NULL,
      .displays[2].userdata = NULL,
+     .displays[2].dirty = 1,
      .leds.display_type = glyph_display,
      .leds.display_value.display_glyph = { 0 },
      .leds.blink = HT16K33_BLINK_OFF,
      .leds.brightness = HT16K33_BRIGHTNESS_7,
      .leds.f_animate = NULL,
-     .leds.userdata = NULL
+     .leds.userdata = NULL,
+     .leds.dirty = 1
     };
 }
 
 
 
 void set_green_leds(struct display *this, uint16_t value) {
+  this->dirty |= this->display_value.display_glyph[2] != value;
   this->display_value.display_glyph[2] = value;
 }
 void set_blue_leds(struct display *this, uint16_t value) {
+  this->dirty |= this->display_value.display_glyph[1] != value;
   this->display_value.display_glyph[1] = value;
 }
 void set_red_leds(struct display *this, uint16_t value) {
+  this->dirty |= this->display_value.display_glyph[0] != value;
   this->display_value.display_glyph[0] = value;
 }
 
 
+// linear level at which each LED of a bar graph lights, first LED first:
+// 0xFFFF * 10^(dB/20) for -45, -39 ... -3dB
+static const uint16_t bar_graph_thresholds[8] =
+  { 369, 735, 1467, 2927, 5841, 11654, 23253, 46395 };
+
+uint8_t leds_bar_graph(uint16_t level, uint16_t peak) {
+  uint8_t leds = 0;
+
+  for (int led = 0; led < 8; ++led) {
+    if (level >= bar_graph_thresholds[led]) {
+      leds |= 0x80 >> led;
+    }
+    else if (peak >= bar_graph_thresholds[led] &&
+             (led == 7 || peak < bar_graph_thresholds[led + 1])) {
+      leds |= 0x80 >> led;
+    }
+  }
+
+  return leds;
+}
+
+void set_leds_bar_graph(struct display *this, leds_row_t row, uint16_t level, uint16_t peak) {
+  uint16_t value = leds_bar_graph(level, peak);
+
+  this->dirty |= this->display_value.display_glyph[row] != value;
+  this->display_value.display_glyph[row] = value;
+}
+
+
+void set_display_integer(struct display *this, int32_t value) {
+  if (this->display_type != integer_display || this->display_value.display_int != value) {
+    this->display_type = integer_display;
+    this->display_value.display_int = value;
+    this->dirty = 1;
+  }
+}
+
+void set_display_string(struct display *this, char *string) {
+  this->display_type = string_display;
+  this->display_value.display_string = string;
+  this->dirty = 1;
+}
+
+void set_display_glyph(struct display *this, const uint16_t glyph[4]) {
+  if (this->display_type != glyph_display ||
+      memcmp(this->display_value.display_glyph, glyph, sizeof(this->display_value.display_glyph)) != 0) {
+    this->display_type = glyph_display;
+    memcpy(this->display_value.display_glyph, glyph, sizeof(this->display_value.display_glyph));
+    this->dirty = 1;
+  }
+}
+
+// blink and brightness are compared against the chip at commit, no
+// need to dirty the display for them
+void set_display_blink(struct display *this, ht16k33blink_t blink) {
+  this->blink = blink;
+}
+
+void set_display_brightness(struct display *this, ht16k33brightness_t brightness) {
+  this->brightness = brightness;
+}
+
+void mark_display_dirty(struct display *this) {
+  this->dirty = 1;
+}
+
+
 
 // f_animator functions and related
 // this is all looking a bit too wanna be OO.
@@ -560,107 +848,75 @@ void update_displays(struct ut3k_view *this, struct display_strategy *display_st
   // maybe I should switch to an OO language?
   // show_displays is expected to update all visual info on the HT16K33s
   ht16k33_alphanum_display_game(this, display_strategy);
-
+  commit_ut3k_view(this, &this->pulled_display, clock);
 }
 
 
 /** ht16k33_alphanum_display_game: implements f_show_displays
- * specific implementation for the Adafruit alphanum display
+ * specific implementation for the Adafruit alphanum display.
+ * Pull each display from the strategy into the retained pulled_display;
+ * only the values that changed get re-encoded and sent on commit.
  */
 
 static void ht16k33_alphanum_display_game(struct ut3k_view *this, struct display_strategy *display_strategy) {
   display_value_t union_result;
-  ht16k33blink_t blink;
-  ht16k33brightness_t brightness;
-  uint32_t led_display_value = 0;
-  
+  display_type_t type;
+  struct display *display;
+  f_get_display get_display[3] = { display_strategy->get_green_display,
+                                   display_strategy->get_blue_display,
+                                   display_strategy->get_red_display };
 
-  switch(display_strategy->get_green_display(display_strategy, &union_result, &blink, &brightness)) {
-  case integer_display:
-    commit_integer(this->display_array[0], union_result.display_int);
-    break;
-  case glyph_display:
-    commit_glyph(this->display_array[0], union_result.display_glyph);
-    break;
-  case string_display:
-    commit_string(this->display_array[0], union_result.display_string);
-    break;
-  }
-
-  if (brightness != this->green_display->brightness) {
-    HT16K33_BRIGHTNESS(this->green_display, brightness);
-  }
-  if (blink != this->green_display->blink_state) {
-    HT16K33_BLINK(this->green_display, blink);
+  for (int i = 0; i < 3; ++i) {
+    display = &this->pulled_display.displays[i];
+    type = get_display[i](display_strategy, &union_result, &display->blink, &display->brightness);
+    pull_display(display, type, &union_result, this->pulled_strings[i]);
   }
 
 
-
-  switch(display_strategy->get_blue_display(display_strategy, &union_result, &blink, &brightness)) {
+  display = &this->pulled_display.leds;
+  switch(display_strategy->get_leds_display(display_strategy, &union_result, &display->blink, &display->brightness)) {
   case integer_display:
-    commit_integer(this->display_array[1], union_result.display_int);
+    set_red_leds(display, (uint16_t)(union_result.display_int & 0x00FF));
+    set_blue_leds(display, (uint16_t)((union_result.display_int >> 8) & 0x00FF));
+    set_green_leds(display, (uint16_t)((union_result.display_int >> 16) & 0x00FF));
     break;
   case glyph_display:
-    commit_glyph(this->display_array[1], union_result.display_glyph);
-    break;
   case string_display:
-    commit_string(this->display_array[1], union_result.display_string);
+    printf("only integer supported\n");
     break;
   }
-
-  if (brightness != this->blue_display->brightness) {
-    HT16K33_BRIGHTNESS(this->blue_display, brightness);
-  }
-  if (blink != this->blue_display->blink_state) {
-    HT16K33_BLINK(this->blue_display, blink);
-  }
-
+}
 
 
-  switch(display_strategy->get_red_display(display_strategy, &union_result, &blink, &brightness)) {
+/** pull_display
+ *
+ * retain a value handed back by an f_get_display, marking the display
+ * dirty only if it differs from the last one.  Strings are copied into
+ * retained_string (5 chars) to compare against next time.
+ */
+static void pull_display(struct display *display, display_type_t type, display_value_t *value, char *retained_string) {
+  switch (type) {
   case integer_display:
-    commit_integer(this->display_array[2], union_result.display_int);
+    set_display_integer(display, value->display_int);
     break;
   case glyph_display:
-    commit_glyph(this->display_array[2], union_result.display_glyph);
+    set_display_glyph(display, value->display_glyph);
     break;
   case string_display:
-    commit_string(this->display_array[2], union_result.display_string);
-    break;
-  }
-
-
-  if (brightness != this->red_display->brightness) {
-    HT16K33_BRIGHTNESS(this->red_display, brightness);
-  }
-  if (blink != this->red_display->blink_state) {
-    HT16K33_BLINK(this->red_display, blink);
-  }
-
-
-
-  switch(display_strategy->get_leds_display(display_strategy, &union_result, &blink, &brightness)) {
-  case integer_display:
-    led_display_value = union_result.display_int;
+    if (value->display_string == NULL) {
+      if (display->display_type != string_display || retained_string[0] != '\0') {
+        retained_string[0] = '\0';
+        set_display_string(display, retained_string);
+      }
+    }
+    else if (display->display_type != string_display ||
+             strncmp(retained_string, value->display_string, 4) != 0) {
+      strncpy(retained_string, value->display_string, 4);
+      retained_string[4] = '\0';
+      set_display_string(display, retained_string);
+    }
     break;
-  case glyph_display:
-  case string_display:
-    printf("only integer supported\n");
-    return;
-  }
-
-  if (brightness != this->inputs_and_leds->brightness) {
-    HT16K33_BRIGHTNESS(this->inputs_and_leds, brightness);
   }
-  if (blink != this->inputs_and_leds->blink_state) {
-    HT16K33_BLINK(this->inputs_and_leds, blink);
-  }
-
-  HT16K33_UPDATE_RAW_BYDIGIT(this->inputs_and_leds, 4, (uint16_t)(led_display_value & 0x00FF));
-  HT16K33_UPDATE_RAW_BYDIGIT(this->inputs_and_leds, 5, (uint16_t)((led_display_value >> 8) & 0x00FF));
-  HT16K33_UPDATE_RAW_BYDIGIT(this->inputs_and_leds, 6, (uint16_t)((led_display_value >> 16) & 0x00FF));
-  HT16K33_COMMIT(this->inputs_and_leds);
-
 }
 
 
@@ -678,23 +934,88 @@ void register_control_panel_listener(struct ut3k_view *view, f_view_control_pane
 }
 
 
+void register_encoder_listener(struct ut3k_view *view, f_view_encoder_listener f, void *userdata) {
+  view->encoder_listener = f;
+  view->encoder_listener_userdata = userdata;
+}
+
+
 /* Accessors ---------------------------------------------------------- */
 
 const struct control_panel* get_control_panel(struct ut3k_view *this) {
   return (const struct control_panel*) this->control_panel;
 }
 
+void set_encoder_acceleration(struct ut3k_view *this, rotary_encoder_id_t encoder, const struct encoder_acceleration *acceleration) {
+  set_rotary_encoder_acceleration(this->control_panel, encoder, acceleration);
+}
+
+void set_input_event_timing(struct ut3k_view *this, uint32_t long_press_updates, uint32_t double_press_updates) {
+  set_control_panel_event_timing(this->control_panel, long_press_updates, double_press_updates);
+}
+
+void set_joystick_repeat(struct ut3k_view *this, uint32_t delay_msec, uint32_t interval_msec) {
+  set_control_panel_joystick_repeat(this->control_panel, delay_msec, interval_msec);
+}
+
+void set_input_debounce(struct ut3k_view *this, input_id_t input, uint8_t updates) {
+  set_control_panel_debounce(this->control_panel, input, updates);
+}
+
+void set_ut3k_display_cause(struct ut3k_display *this, uint32_t cause) {
+  this->cause = cause;
+}
+
+void print_input_latency(const struct ut3k_view *this) {
+  print_ut3k_latency(&this->latency, latency_type_names);
+}
+
 
 
 /* Static ------------------------------------------------------------- */
 
 
-/** commit_string
+/** note_input_causes
+ *
+ * every event since last time goes on the latency tracker's waiting
+ * list, with the time of its input.
+ */
+static void note_input_causes(struct ut3k_view *this) {
+  struct panel_input_event events[INPUT_EVENT_RING_SIZE];
+  int count;
+
+  count = read_input_events(this->control_panel, &this->latency_cursor, events, INPUT_EVENT_RING_SIZE);
+  for (int i = 0; i < count; ++i) {
+    ut3k_latency_input(&this->latency, events[i].cause, events[i].type, events[i].timestamp_ns);
+  }
+}
+
+
+/** settle_input_causes
+ *
+ * a frame is out: the cause the game says it shows, or failing that
+ * everything waiting if the frame changed anything.
+ */
+static void settle_input_causes(struct ut3k_view *this, struct ut3k_display *ut3k_display, int rendered) {
+  struct timespec now;
+
+  if (ut3k_display->cause == 0 && rendered == 0) {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ut3k_latency_commit(&this->latency, ut3k_display->cause, (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec);
+  ut3k_display->cause = 0;
+}
+
+
+
+/** encode_string
  * 
- * write a string to a specific HT16K33 display.  Only the first 4
- * chars are written.  Commit is called.
+ * write a string to a specific HT16K33 display buffer.  Only the first
+ * 4 chars are written.
  */
-static void commit_string(HT16K33 *display, char *string) {
+static void encode_string(HT16K33 *display, char *string) {
   int digit;
 
   for (digit = 0; digit < 4; ++digit) { // digit
@@ -708,30 +1029,27 @@ static void commit_string(HT16K33 *display, char *string) {
     // clear any remaining digits
     HT16K33_CLEAN_DIGIT(display, digit);
   }
-
-  HT16K33_COMMIT(display);
 }
 
 
 
-/** commit_glyph
+/** encode_glyph
  *
  * raw read of four 16 bit ints sent straight to the update raw method.
  * more than enough rope to hang yourself with this.
  */
-static void commit_glyph(HT16K33 *display, uint16_t glyph[]) {
+static void encode_glyph(HT16K33 *display, uint16_t glyph[]) {
   HT16K33_UPDATE_RAW(display, glyph);
-  HT16K33_COMMIT(display);
 }
 
 
 
-/** commit_integer
+/** encode_integer
  * 
- * write a string to a specific HT16K33 display.  Only the first 4
- * chars are written.  Commit is called.
+ * write an integer to a specific HT16K33 display buffer, right
+ * aligned in the 4 digits.
  */
-static void commit_integer(HT16K33 *display, int16_t value) {
+static void encode_integer(HT16K33 *display, int16_t value) {
 
   if (value >= 0 && value < 256) {
     HT16K33_DISPLAY_INTEGER(display, (uint8_t)value);
@@ -744,16 +1062,9 @@ static void commit_integer(HT16K33 *display, int16_t value) {
       HT16K33_UPDATE_ALPHANUM(display, digit, buffer[digit], 0);
     }
   }
-
-  HT16K33_COMMIT(display);
 }
 
 
-
-
-
-
-
 static int initialize_backpack(HT16K33 *backpack) {
   int rc;
   // prepare the backpack driver
@@ -802,67 +1113,54 @@ static int initialize_backpack(HT16K33 *backpack) {
 }
 
 
-/** push encoder queue
+/** poll_rotary_encoders
  *
- * maybe push might be a better name: push both a &b if one of a || b values
- * is different from what was previously seen.
- * The queue is a 64 bit int.
- * "front" of the queue has the most recent two bits read, with older
- * pairs of bits following.  Pairs of bits are a single read state.
- * Two states (four bits) are required to infer the change in the
- * encoder.
- *
- *                   queue_index = 6                  
- * ------------- ... ---------------------------------------
- * |    |    |   ...    |    | B2 | A2 | B1 | A1 | B0 | A0 |
- * ------------- ... ---------------------------------------
- *   63   62              6    5    4    3    2    1    0
- *
- * queue_index = 0 :: nothing in the queue
- * queue_index = 1 :: one bit in the queue: illegal; any odd index is illegal
- * queue_index > 3 :: four or more bits in queue (two states): these
- *                     can be processed via lookup table
+ * request the six encoder lines with both-edge detection and kernel
+ * debounce, then sleep in poll until there are edge events (or the
+ * wake fd says it's time to go).  Every edge arrives as an event, in
+ * order, so nothing is missed however fast a knob spins and nothing
+ * runs while the knobs are still.
+ * Events only say which edge: rising is the line going to 1.  The
+ * line_seqno of each event shows if the kernel had to drop any, in
+ * which case the line values are read again.
  */
-static inline void push_encoder_queue(struct rotary_encoder_bits_queue *queue, int a, int b) {
-
-  assert(queue->queue_index < (sizeof(long long int) * 8));
-  if (queue->previous_a != a || queue->previous_b != b) {
-    queue->bit_queue = (queue->bit_queue << 2) | (a) | (b << 1);
-    queue->queue_index += 2;
-    queue->previous_a = a;
-    queue->previous_b = b;
-  }
-  
-}
-
-
 static void* poll_rotary_encoders(void *userdata) {
   struct ut3k_view *this = (struct ut3k_view*) userdata;
   int gpio_fd = -1; // set to an invalid fd
-  int ret;
-  struct gpiohandle_request gpio_request;
-  struct gpiohandle_data gpio_data;
-
-  
-  gpio_fd = open(gpio_devfile, O_RDONLY);
+  int ret, line, value, encoder;
+  ssize_t bytes_read;
+  struct gpio_v2_line_request gpio_request;
+  struct gpio_v2_line_event events[ENCODER_EVENT_READ];
+  struct pollfd poll_fds[2];
+  uint64_t line_bits;
+  uint32_t line_seqnos[ENCODER_LINES] = { 0 };
+  uint8_t ab[3] = { 0b11, 0b11, 0b11 };  // as the control panel starts out
+  struct timespec now;
+
+  gpio_fd = open(get_ut3k_config()->hardware.gpio_chip, O_RDONLY);
   if (gpio_fd == -1) {
     printf("can't open gpio devfile, %s\n", strerror(errno));
     return NULL;
   }
 
-  // setup to read 2 bits from 3 encoders.  Pullup resistors required.
-  gpio_request.lineoffsets[0] = gpio_rotary_green_a_bcm;
-  gpio_request.lineoffsets[1] = gpio_rotary_green_b_bcm;
-  gpio_request.lineoffsets[2] = gpio_rotary_blue_a_bcm;
-  gpio_request.lineoffsets[3] = gpio_rotary_blue_b_bcm;
-  gpio_request.lineoffsets[4] = gpio_rotary_red_a_bcm;
-  gpio_request.lineoffsets[5] = gpio_rotary_red_b_bcm;
-  gpio_request.lines = 6;
-  gpio_request.flags = GPIOHANDLE_REQUEST_INPUT | GPIOHANDLE_REQUEST_BIAS_PULL_UP;
-  strcpy(gpio_request.consumer_label, "ut3k_view");
-  
-  if (ioctl(gpio_fd, GPIO_GET_LINEHANDLE_IOCTL, &gpio_request) == -1) {
-    printf("unable to get line handle via ioctl: %s (%d)\n", strerror(errno), errno);
+  // setup to watch 2 lines from 3 encoders.  Pullup resistors required.
+  memset(&gpio_request, 0, sizeof(gpio_request));
+  for (line = 0; line < ENCODER_LINES; ++line) {
+    gpio_request.offsets[line] = get_ut3k_config()->hardware.encoder_lines[line];
+  }
+  gpio_request.num_lines = ENCODER_LINES;
+  gpio_request.event_buffer_size = ENCODER_EVENT_BUFFER;
+  gpio_request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_UP |
+    GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+  gpio_request.config.num_attrs = 1;
+  gpio_request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+  gpio_request.config.attrs[0].attr.debounce_period_us = ENCODER_DEBOUNCE_USEC;
+  gpio_request.config.attrs[0].mask = (1 << ENCODER_LINES) - 1;
+  strcpy(gpio_request.consumer, "ut3k_view");
+
+  if (ioctl(gpio_fd, GPIO_V2_GET_LINE_IOCTL, &gpio_request) == -1) {
+    printf("unable to get encoder lines via ioctl: %s (%d)\n", strerror(errno), errno);
+    close(gpio_fd);
     return NULL;
   }
 
@@ -870,31 +1168,109 @@ static void* poll_rotary_encoders(void *userdata) {
   ret = close(gpio_fd);
   assert(ret == 0);
 
+  // where the lines are now: the first edge is a change from here.
+  // Let the control panel know about any encoder off its detent.
+  if (read_encoder_lines(gpio_request.fd, &line_bits) == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (encoder = 0; encoder < 3; ++encoder) {
+      value = (line_bits >> (2 * encoder)) & 0b11;
+      if (value != ab[encoder]) {
+        ab[encoder] = value;
+        encoder_ring_push(&this->encoder_rings[encoder],
+                          (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec, value);
+      }
+    }
+  }
+
+  poll_fds[0] = (struct pollfd const) { .fd = gpio_request.fd, .events = POLLIN };
+  poll_fds[1] = (struct pollfd const) { .fd = this->encoder_wake_fd, .events = POLLIN };
+
   printf("starting thread rotary encoder loop\n");
 
-  // start read loop for encoder pins
-  do {
-    ret = ioctl(gpio_request.fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &gpio_data);
+  // start event loop for encoder pins
+  while (this->cleanup_and_exit == 0) {
+    ret = poll(poll_fds, this->encoder_wake_fd == -1 ? 1 : 2,
+               this->encoder_wake_fd == -1 ? 100 : -1);
     if (ret == -1) {
-	printf("Unable to get line value using ioctl : %s\n", strerror(errno));
+      if (errno != EINTR) {
+        printf("poll on encoder lines failed: %s\n", strerror(errno));
+        break;
+      }
+      continue;
     }
-    else {
-      ret = pthread_mutex_lock(&this->rotary_bits_queue_mutex);
-
-      // mutex locked, have access to the encoder queues
-      push_encoder_queue(&this->green_rotary_queue, gpio_data.values[0], gpio_data.values[1]);
-      push_encoder_queue(&this->blue_rotary_queue, gpio_data.values[2], gpio_data.values[3]);
-      push_encoder_queue(&this->red_rotary_queue, gpio_data.values[4], gpio_data.values[5]);
-
-      pthread_mutex_unlock(&this->rotary_bits_queue_mutex);
+    if (!(poll_fds[0].revents & POLLIN)) {
+      continue;
     }
 
-    usleep(2500);
+    bytes_read = read(gpio_request.fd, events, sizeof(events));
+    if (bytes_read < (ssize_t) sizeof(struct gpio_v2_line_event)) {
+      printf("unable to read encoder events: %s\n", strerror(errno));
+      continue;
+    }
 
-  } while (this->cleanup_and_exit == 0);
+    for (int i = 0; i < bytes_read / sizeof(struct gpio_v2_line_event); ++i) {
+      for (line = 0; line < ENCODER_LINES; ++line) {
+        if (gpio_request.offsets[line] == events[i].offset) {
+          break;
+        }
+      }
+      if (line == ENCODER_LINES) {
+        continue;
+      }
+
+      if (line_seqnos[line] != 0 && events[i].line_seqno != line_seqnos[line] + 1) {
+        // the kernel buffer overflowed: take the line as it is now
+        printf("encoder line %d dropped %u events\n", events[i].offset,
+               events[i].line_seqno - line_seqnos[line] - 1);
+        if (read_encoder_lines(gpio_request.fd, &line_bits) == 0) {
+          value = (line_bits >> line) & 1;
+        }
+        else {
+          value = events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+        }
+      }
+      else {
+        value = events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+      }
+      line_seqnos[line] = events[i].line_seqno;
+
+      // line pairs are A then B for each encoder: A is bit 0
+      encoder = line >> 1;
+      value = (ab[encoder] & ~(1 << (line & 1))) | (value << (line & 1));
+      if (value != ab[encoder]) {
+        ab[encoder] = value;
+        encoder_ring_push(&this->encoder_rings[encoder], events[i].timestamp_ns, value);
+      }
+    }
+  }
 
 
   close(gpio_request.fd);
 
+  for (encoder = 0; encoder < 3; ++encoder) {
+    if (this->encoder_rings[encoder].dropped) {
+      printf("encoder %d ring overflowed, dropped %u transitions\n",
+             encoder, this->encoder_rings[encoder].dropped);
+    }
+  }
+
   return NULL;
 }
+
+
+/** read_encoder_lines
+ *
+ * current value of all the encoder lines, bit n for line n of the
+ * request.
+ */
+static int read_encoder_lines(int line_fd, uint64_t *line_bits) {
+  struct gpio_v2_line_values values = { .bits = 0, .mask = (1 << ENCODER_LINES) - 1 };
+
+  if (ioctl(line_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) == -1) {
+    printf("Unable to get line value using ioctl : %s\n", strerror(errno));
+    return -1;
+  }
+
+  *line_bits = values.bits;
+  return 0;
+}
@@ -19,6 +19,7 @@
 #include "ut3k_defs.h"
 #include "ht16k33.h"
 #include "control_panel.h"
+#include "ut3k_dither.h"
 
 
 struct ut3k_view;
@@ -53,6 +54,18 @@ int free_ut3k_view(struct ut3k_view *this);
 void update_controls(struct ut3k_view*, uint32_t clock);
 
 
+/** update_encoders
+ *
+ * encoder fast path.  The encoders are on GPIO, not the HT16K33, so
+ * they can be read every tick: call this on every clock, even the ones
+ * that skip update_controls, and any detents since the last call go to
+ * the encoder listener straight away.  update_controls still reports
+ * everything since the last keyscan in the control panel's encoders,
+ * the fast path just hears about it sooner.
+ */
+void update_encoders(struct ut3k_view*, uint32_t clock);
+
+
  /**
   * Register event handlers with the appropriate components.
   * The control_panel_listener will be called during update_view.
@@ -60,12 +73,51 @@ void update_controls(struct ut3k_view*, uint32_t clock);
 typedef void (*f_view_control_panel_listener)(const struct control_panel *control_panel, void *userdata);
 void register_control_panel_listener(struct ut3k_view *view, f_view_control_panel_listener f, void *userdata);
 
+// called by update_encoders when an encoder moved a detent
+typedef void (*f_view_encoder_listener)(const struct encoder_deltas *deltas, void *userdata);
+void register_encoder_listener(struct ut3k_view *view, f_view_encoder_listener f, void *userdata);
+
 
 /** get the control panel.  Useful for initialization or if you really
  *   want to avoid the callback model.
  */
 const struct control_panel* get_control_panel(struct ut3k_view*);
 
+/** set_encoder_acceleration
+ *
+ * turn on (or tune) acceleration for one rotary encoder.  See struct
+ * encoder_acceleration in control_panel.h.
+ */
+void set_encoder_acceleration(struct ut3k_view*, rotary_encoder_id_t encoder, const struct encoder_acceleration *acceleration);
+
+/** set_input_event_timing
+ *
+ * when the control panel reports long and double presses.  See
+ * read_input_events in control_panel.h.
+ */
+void set_input_event_timing(struct ut3k_view*, uint32_t long_press_updates, uint32_t double_press_updates);
+
+/** set_joystick_repeat
+ *
+ * how long the joystick is held before it auto-repeats and how often
+ * after that.  See struct joystick in control_panel.h.
+ */
+void set_joystick_repeat(struct ut3k_view*, uint32_t delay_msec, uint32_t interval_msec);
+
+/** set_input_debounce
+ *
+ * debounce window for one input.  Normally comes from the cabinet's
+ * config, see ut3k_config.h and set_control_panel_debounce.
+ */
+void set_input_debounce(struct ut3k_view*, input_id_t input, uint8_t updates);
+
+/** print_input_latency
+ *
+ * input to display latency histograms since the view was created, see
+ * ut3k_latency.h.  For the stats at exit.
+ */
+void print_input_latency(const struct ut3k_view*);
+
 
 typedef void (*f_animator)(struct display*, uint32_t clock);
 
@@ -76,6 +128,14 @@ typedef void (*f_animator)(struct display*, uint32_t clock);
  * commit_ut3k_display will write the buffer to the display and, between
  * cycles, clear_ut3k_display to get a clean slate.
  * How this is better than the previous way I had I dunno.
+ *
+ * Retained mode: the display is only re-encoded and sent to its HT16K33
+ * when marked dirty.  The set_display_* and set_*_leds functions mark it
+ * dirty if the value actually changed, so a model can hold on to a
+ * ut3k_display, call them when its state changes and commit every tick
+ * for next to nothing.  Writing the fields directly is fine too; call
+ * mark_display_dirty after.  clear/reset mark everything dirty and a
+ * display with an animator is dirty every tick.
  */
 
 struct display {
@@ -94,6 +154,7 @@ struct display {
   ht16k33brightness_t brightness;
   f_animator f_animate;
   void *userdata;  // may be a struct text_scroller, but that's not enforced...
+  int dirty;  // display_type/display_value changed since the last commit
 };
 
 
@@ -101,8 +162,12 @@ struct display {
 struct ut3k_display {
   struct display displays[3];
   struct display leds;
+  uint32_t cause;  // input this frame shows, 0 if not known: see ut3k_latency.h
 };
 
+// the frame shows the result of an input event's cause.  Cleared by the commit.
+void set_ut3k_display_cause(struct ut3k_display *this, uint32_t cause);
+
 
 /** commit_ut3k_view
  *
@@ -112,6 +177,16 @@ struct ut3k_display {
  */
 void commit_ut3k_view(struct ut3k_view *this, struct ut3k_display *ut3k_display, uint32_t clock);
 
+/** commit_ut3k_view_dithered
+ *
+ * as commit_ut3k_view, but give segments their own brightness with the
+ * levels set in dither (see ut3k_dither.h).  Blocks for most of
+ * dither->frame_usec while it steps through the subframes, so the game
+ * loop's own sleep gets shorter by as much.  The bus cost of the tick
+ * is left in dither->last_cost.
+ */
+void commit_ut3k_view_dithered(struct ut3k_view *this, struct ut3k_display *ut3k_display, struct ut3k_dither *dither, uint32_t clock);
+
 // convenience function - clears the display buffer only, no
 // write/commit is involved.  so one can start a display cycle with a
 // clean slate.
@@ -126,6 +201,29 @@ void set_green_leds(struct display*, uint16_t);
 void set_blue_leds(struct display*, uint16_t);
 void set_red_leds(struct display*, uint16_t);
 
+// the LED rows by the glyph set_*_leds writes to
+typedef enum { LEDS_RED = 0, LEDS_BLUE = 1, LEDS_GREEN = 2 } leds_row_t;
+
+/** leds_bar_graph
+ *
+ * VU meter on an 8 LED row.  level and peak are linear, 0 - 0xFFFF as
+ * ut3k_levels.h hands them out.  The bar fills from the first LED
+ * (0x80), 6dB per LED, from -45dB up to -3dB on the last.  The peak
+ * lights the one LED it reaches so it shows past the end of the bar.
+ */
+uint8_t leds_bar_graph(uint16_t level, uint16_t peak);
+void set_leds_bar_graph(struct display*, leds_row_t row, uint16_t level, uint16_t peak);
+
+// retained mode setters: mark the display dirty only on a change.
+// Strings are held by pointer, so set_display_string always marks dirty
+// (the text behind a pointer may have changed).
+void set_display_integer(struct display*, int32_t value);
+void set_display_string(struct display*, char *string);
+void set_display_glyph(struct display*, const uint16_t glyph[4]);
+void set_display_blink(struct display*, ht16k33blink_t blink);
+void set_display_brightness(struct display*, ht16k33brightness_t brightness);
+void mark_display_dirty(struct display*);
+
 
 ///// f_animator functionality
 
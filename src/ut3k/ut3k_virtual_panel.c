@@ -0,0 +1,330 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ut3k_virtual_panel.h"
+#include "ut3k_config.h"
+
+
+#define KEY_READ 32
+
+// evdev key codes to the characters the key map is written in
+static const char evdev_keys[KEY_SPACE + 1] =
+  {
+   [KEY_1] = '1', [KEY_2] = '2', [KEY_3] = '3', [KEY_4] = '4', [KEY_5] = '5',
+   [KEY_6] = '6', [KEY_7] = '7', [KEY_8] = '8', [KEY_9] = '9', [KEY_0] = '0',
+   [KEY_MINUS] = '-', [KEY_EQUAL] = '=',
+   [KEY_Q] = 'q', [KEY_W] = 'w', [KEY_E] = 'e', [KEY_R] = 'r', [KEY_T] = 't',
+   [KEY_Y] = 'y', [KEY_U] = 'u', [KEY_I] = 'i', [KEY_O] = 'o', [KEY_P] = 'p',
+   [KEY_LEFTBRACE] = '[', [KEY_RIGHTBRACE] = ']',
+   [KEY_A] = 'a', [KEY_S] = 's', [KEY_D] = 'd', [KEY_F] = 'f', [KEY_G] = 'g',
+   [KEY_H] = 'h', [KEY_J] = 'j', [KEY_K] = 'k', [KEY_L] = 'l',
+   [KEY_SEMICOLON] = ';', [KEY_APOSTROPHE] = '\'', [KEY_GRAVE] = '`',
+   [KEY_BACKSLASH] = '\\',
+   [KEY_Z] = 'z', [KEY_X] = 'x', [KEY_C] = 'c', [KEY_V] = 'v', [KEY_B] = 'b',
+   [KEY_N] = 'n', [KEY_M] = 'm',
+   [KEY_COMMA] = ',', [KEY_DOT] = '.', [KEY_SLASH] = '/',
+   [KEY_SPACE] = ' '
+  };
+
+
+struct virtual_panel {
+  int active;  // -1 until the environment has been checked
+  int is_stdin;
+  int fd;
+  int wake_fd;
+  int thread_started;
+  atomic_int stop;  // set by the game thread
+  pthread_t thread;
+  struct encoder_ring *rings;
+  struct termios saved_termios;
+  int termios_saved;
+
+  // the keyscan as the game sees it, and when tapped bits let go
+  pthread_mutex_t mutex;
+  ht16k33keyscan_t keyscan;
+  uint64_t release_ns[sizeof(ht16k33keyscan_t) * 8];
+};
+
+static struct virtual_panel panel = { .active = -1, .fd = -1, .wake_fd = -1,
+                                      .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static void* read_keys(void *userdata);
+static void key_changed(char key, int down, uint64_t now_ns);
+static void set_bit(int bit, int on, uint64_t release_ns);
+static void restore_terminal();
+static inline uint64_t monotonic_ns();
+
+
+
+int ut3k_virtual_panel_is_active() {
+  if (panel.active == -1) {
+    panel.active = getenv(UT3K_VIRTUAL_PANEL_ENV_VAR) != NULL;
+  }
+  return panel.active;
+}
+
+
+int start_ut3k_virtual_panel(struct encoder_ring rings[UT3K_VIRTUAL_ENCODERS]) {
+  const struct keyscan_map *map = &get_ut3k_config()->hardware.keyscan;
+  const char *source = getenv(UT3K_VIRTUAL_PANEL_ENV_VAR);
+  struct termios raw;
+  int rc;
+
+  if (source == NULL) {
+    return -1;
+  }
+
+  panel.rings = rings;
+  atomic_store(&panel.stop, 0);
+
+  // at rest: selectors at their first position, everything else off
+  memset(panel.keyscan, 0, sizeof(ht16k33keyscan_t));
+  memset(panel.release_ns, 0, sizeof(panel.release_ns));
+  set_bit(map->bits[INPUT_GREEN_SELECTOR][0], 1, 0);
+  set_bit(map->bits[INPUT_BLUE_SELECTOR][0], 1, 0);
+
+  panel.is_stdin = strcmp(source, UT3K_VIRTUAL_PANEL_STDIN) == 0;
+  if (panel.is_stdin) {
+    panel.fd = STDIN_FILENO;
+    // keys as they're typed, without echo
+    if (isatty(panel.fd) && tcgetattr(panel.fd, &panel.saved_termios) == 0) {
+      panel.termios_saved = 1;
+      atexit(restore_terminal);
+      raw = panel.saved_termios;
+      raw.c_lflag &= ~(ICANON | ECHO);
+      raw.c_cc[VMIN] = 1;
+      raw.c_cc[VTIME] = 0;
+      tcsetattr(panel.fd, TCSANOW, &raw);
+    }
+  }
+  else {
+    panel.fd = open(source, O_RDONLY | O_CLOEXEC);
+    if (panel.fd == -1) {
+      printf("start_ut3k_virtual_panel: can't open %s: %s\n", source, strerror(errno));
+      return -1;
+    }
+  }
+
+  panel.wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (panel.wake_fd == -1) {
+    printf("start_ut3k_virtual_panel: eventfd failed: %s\n", strerror(errno));
+  }
+
+  rc = pthread_create(&panel.thread, NULL, read_keys, NULL);
+  if (rc != 0) {
+    printf("start_ut3k_virtual_panel: failed to start key reader %d\n", rc);
+    return -1;
+  }
+  panel.thread_started = 1;
+
+  printf("virtual control panel reading %s\n", source);
+  return 0;
+}
+
+
+void ut3k_virtual_panel_keyscan(ht16k33keyscan_t keyscan) {
+  uint64_t now = monotonic_ns();
+
+  pthread_mutex_lock(&panel.mutex);
+  for (int bit = 0; bit < (int) sizeof(ht16k33keyscan_t) * 8; ++bit) {
+    if (panel.release_ns[bit] != 0 && panel.release_ns[bit] <= now) {
+      panel.keyscan[bit / 8] &= ~(1 << bit % 8);
+      panel.release_ns[bit] = 0;
+    }
+  }
+  memcpy(keyscan, panel.keyscan, sizeof(ht16k33keyscan_t));
+  pthread_mutex_unlock(&panel.mutex);
+}
+
+
+void stop_ut3k_virtual_panel() {
+  uint64_t wake = 1;
+
+  atomic_store(&panel.stop, 1);
+  if (panel.wake_fd != -1) {
+    if (write(panel.wake_fd, &wake, sizeof(wake)) != sizeof(wake)) {
+      printf("stop_ut3k_virtual_panel: unable to wake key reader: %s\n", strerror(errno));
+    }
+  }
+  if (panel.thread_started) {
+    pthread_join(panel.thread, NULL);
+    panel.thread_started = 0;
+  }
+  if (panel.wake_fd != -1) {
+    close(panel.wake_fd);
+    panel.wake_fd = -1;
+  }
+  if (!panel.is_stdin && panel.fd != -1) {
+    close(panel.fd);
+  }
+  panel.fd = -1;
+  restore_terminal();
+}
+
+
+
+/* Static ------------------------------------------------------------- */
+
+
+/** read_keys
+ *
+ * thread: wait for keys or the wake up to stop.
+ */
+static void* read_keys(void *userdata) {
+  struct pollfd poll_fds[2];
+  struct input_event events[KEY_READ];
+  char keys[KEY_READ];
+  ssize_t bytes_read;
+
+  poll_fds[0] = (struct pollfd const) { .fd = panel.fd, .events = POLLIN };
+  poll_fds[1] = (struct pollfd const) { .fd = panel.wake_fd, .events = POLLIN };
+
+  while (!atomic_load(&panel.stop)) {
+    if (poll(poll_fds, panel.wake_fd == -1 ? 1 : 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printf("virtual panel: poll failed: %s\n", strerror(errno));
+      break;
+    }
+    if (atomic_load(&panel.stop)) {
+      break;
+    }
+    // a closed pipe can still have keys to read: leave it to the read
+    // to find the end
+    if ((poll_fds[0].revents & POLLIN) == 0) {
+      if (poll_fds[0].revents & (POLLERR | POLLHUP)) {
+        break;
+      }
+      continue;
+    }
+
+    if (panel.is_stdin) {
+      bytes_read = read(panel.fd, keys, sizeof(keys));
+      for (int i = 0; i < bytes_read; ++i) {
+        key_changed(keys[i], 1, monotonic_ns());
+      }
+    }
+    else {
+      bytes_read = read(panel.fd, events, sizeof(events));
+      for (int i = 0; i < bytes_read / (ssize_t) sizeof(struct input_event); ++i) {
+        // 0 up, 1 down, 2 auto repeat
+        if (events[i].type == EV_KEY && events[i].code <= KEY_SPACE && evdev_keys[events[i].code] != '\0') {
+          key_changed(evdev_keys[events[i].code], events[i].value, monotonic_ns());
+        }
+      }
+    }
+
+    if (bytes_read <= 0) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+
+/** key_changed
+ *
+ * down is 1 for a key going down, 2 for it repeating and 0 for it
+ * coming up.  Terminal keys only ever go down.
+ */
+static void key_changed(char key, int down, uint64_t now_ns) {
+  const struct keyscan_map *map = &get_ut3k_config()->hardware.keyscan;
+  const char *keys = get_ut3k_config()->virtual_keys;
+  uint64_t release_ns = panel.is_stdin ? now_ns + UT3K_VIRTUAL_TAP_MSEC * 1000000ull : 0;
+  int bit;
+
+  for (virtual_action_t action = 0; action < VIRTUAL_ACTION_COUNT; ++action) {
+    if (keys[action] != key) {
+      continue;
+    }
+
+    if (action <= VIRTUAL_JOYSTICK_BUTTON) {
+      if (down != 2) {
+        set_bit(map->bits[action][0], down, release_ns);
+      }
+    }
+    else if (action <= VIRTUAL_BLUE_SELECTOR_3) {
+      input_id_t selector = action <= VIRTUAL_GREEN_SELECTOR_3 ? INPUT_GREEN_SELECTOR : INPUT_BLUE_SELECTOR;
+      int position = (action - VIRTUAL_GREEN_SELECTOR_0) % 4;
+      if (down == 1) {
+        for (int i = 0; i < 4; ++i) {
+          set_bit(map->bits[selector][i], i == position, 0);
+        }
+      }
+    }
+    else if (action <= VIRTUAL_TOGGLE_7) {
+      if (down == 1) {
+        bit = map->bits[INPUT_TOGGLES][action - VIRTUAL_TOGGLE_0];
+        set_bit(bit, !(panel.keyscan[bit / 8] >> bit % 8 & 0b1), 0);
+      }
+    }
+    else if (action <= VIRTUAL_JOYSTICK_RIGHT) {
+      if (down != 2) {
+        set_bit(map->bits[INPUT_JOYSTICK_DIRECTION][action - VIRTUAL_JOYSTICK_UP], down, release_ns);
+      }
+    }
+    else if (down != 0) {
+      encoder_ring_push_detent(&panel.rings[(action - VIRTUAL_GREEN_ENCODER_CW) / 2],
+                               (action - VIRTUAL_GREEN_ENCODER_CW) % 2 ? -1 : 1, now_ns);
+    }
+  }
+}
+
+
+// release_ns: when a tapped bit lets go, 0 to stay as set
+static void set_bit(int bit, int on, uint64_t release_ns) {
+  pthread_mutex_lock(&panel.mutex);
+  if (on) {
+    panel.keyscan[bit / 8] |= 1 << bit % 8;
+  }
+  else {
+    panel.keyscan[bit / 8] &= ~(1 << bit % 8);
+  }
+  panel.release_ns[bit] = on ? release_ns : 0;
+  pthread_mutex_unlock(&panel.mutex);
+}
+
+
+static void restore_terminal() {
+  if (panel.termios_saved) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &panel.saved_termios);
+    panel.termios_saved = 0;
+  }
+}
+
+
+static inline uint64_t monotonic_ns() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
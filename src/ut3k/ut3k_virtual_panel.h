@@ -0,0 +1,114 @@
+/* Copyright 2021 Kyle Farrell
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License.  You may
+ * obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/* ut3k_virtual_panel.h
+ *
+ * A stand-in for the control panel hardware, to run games on a box
+ * without the cabinet.  Keys from a Linux evdev keyboard, or typed on
+ * stdin, are made into keyscan bits and rotary encoder transitions and
+ * go through update_control_panel like the real thing: events, the
+ * session recorder and the rest all work as on the cabinet.
+ *
+ * Driven by an environment variable, like the session:
+ *   UT3K_VIRTUAL_PANEL=stdin              keys typed on the terminal
+ *   UT3K_VIRTUAL_PANEL=/dev/input/eventN  a keyboard
+ * The view then leaves the HT16K33s and GPIO alone.
+ *
+ * A keyboard has key up: buttons and the joystick are held as long as
+ * their key, and holding an encoder key spins it at the key repeat
+ * rate.  A terminal only has key down, so there buttons are tapped
+ * for UT3K_VIRTUAL_TAP_MSEC.  Toggle keys flip their switch, selector
+ * keys turn the selector to that position.
+ *
+ * Keys come from the virtual_panel group in ultratroninator.config,
+ * see ut3k_config.h.  Bits land where the cabinet's keyscan map says.
+ */
+
+#ifndef UT3K_VIRTUAL_PANEL_H
+#define UT3K_VIRTUAL_PANEL_H
+
+#include "ht16k33.h"
+#include "ut3k_encoder_ring.h"
+
+#define UT3K_VIRTUAL_PANEL_ENV_VAR "UT3K_VIRTUAL_PANEL"
+#define UT3K_VIRTUAL_PANEL_STDIN "stdin"
+
+#define UT3K_VIRTUAL_TAP_MSEC 100
+#define UT3K_VIRTUAL_ENCODERS 3
+
+
+typedef enum {
+  // the buttons, in input_id_t order
+  VIRTUAL_GREEN_BUTTON,
+  VIRTUAL_BLUE_BUTTON,
+  VIRTUAL_RED_BUTTON,
+  VIRTUAL_GREEN_ENCODER_BUTTON,
+  VIRTUAL_BLUE_ENCODER_BUTTON,
+  VIRTUAL_RED_ENCODER_BUTTON,
+  VIRTUAL_JOYSTICK_BUTTON,
+  VIRTUAL_GREEN_SELECTOR_0,
+  VIRTUAL_GREEN_SELECTOR_1,
+  VIRTUAL_GREEN_SELECTOR_2,
+  VIRTUAL_GREEN_SELECTOR_3,
+  VIRTUAL_BLUE_SELECTOR_0,
+  VIRTUAL_BLUE_SELECTOR_1,
+  VIRTUAL_BLUE_SELECTOR_2,
+  VIRTUAL_BLUE_SELECTOR_3,
+  VIRTUAL_TOGGLE_0,
+  VIRTUAL_TOGGLE_1,
+  VIRTUAL_TOGGLE_2,
+  VIRTUAL_TOGGLE_3,
+  VIRTUAL_TOGGLE_4,
+  VIRTUAL_TOGGLE_5,
+  VIRTUAL_TOGGLE_6,
+  VIRTUAL_TOGGLE_7,
+  VIRTUAL_JOYSTICK_UP,
+  VIRTUAL_JOYSTICK_DOWN,
+  VIRTUAL_JOYSTICK_LEFT,
+  VIRTUAL_JOYSTICK_RIGHT,
+  VIRTUAL_GREEN_ENCODER_CW,
+  VIRTUAL_GREEN_ENCODER_CCW,
+  VIRTUAL_BLUE_ENCODER_CW,
+  VIRTUAL_BLUE_ENCODER_CCW,
+  VIRTUAL_RED_ENCODER_CW,
+  VIRTUAL_RED_ENCODER_CCW,
+  VIRTUAL_ACTION_COUNT
+} virtual_action_t;
+
+
+// true if UT3K_VIRTUAL_PANEL is set
+int ut3k_virtual_panel_is_active();
+
+
+/** start_ut3k_virtual_panel
+ *
+ * open the key source and start a thread reading it.  Encoder keys
+ * push transitions onto rings: green, blue, red.  Returns 0 if
+ * started.
+ */
+int start_ut3k_virtual_panel(struct encoder_ring rings[UT3K_VIRTUAL_ENCODERS]);
+
+
+// the current keyscan, as HT16K33_READ would have it
+void ut3k_virtual_panel_keyscan(ht16k33keyscan_t keyscan);
+
+
+// stop the thread, put the terminal back
+void stop_ut3k_virtual_panel();
+
+
+#endif